@@ -0,0 +1,113 @@
+/* Benchmark of how compile time grows with the size of a single function. It generates a function
+ * with the given number of statements, made of chains of constants, arithmetic and copies like the
+ * ones a frontend emits, then times parsing it, each optimisation pass and code generation. Build
+ * with -DUYB_BENCHMARKS=ON and run:
+ *     bench_bigfn [num_statements]
+ * The function has 50000 statements by default.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#include <api.h>
+#include <lexer.h>
+#include <parser.h>
+#include <optimisation.h>
+#include <vector.h>
+#include <time.h>
+
+_Thread_local Arena arena;
+int is_position_independent = 1;
+
+#define ITERATIONS 4
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate_function(size_t num_statements, size_t *len_buf) {
+    char *buf;
+    FILE *f = open_memstream(&buf, len_buf);
+    fprintf(f, "export function w $main(w %%a) {\n@start\n\t%%v0 =w copy 1\n");
+    for (size_t i = 1; i < num_statements; i++) {
+        switch (i % 4) {
+            case 0: fprintf(f, "\t%%v%zu =w copy %zu\n", i, i); break;
+            case 1: fprintf(f, "\t%%v%zu =w add %%a, %%v%zu\n", i, i - 1); break;
+            case 2: fprintf(f, "\t%%v%zu =w copy %%v%zu\n", i, i - 1); break;
+            case 3: fprintf(f, "\t%%v%zu =w xor %%v%zu, %%v%zu\n", i, i - 1, i - 3); break;
+        }
+    }
+    fprintf(f, "\tret %%v%zu\n}\n", num_statements - 1);
+    fclose(f);
+    return buf;
+}
+
+typedef struct {
+    char *name;
+    double best;
+} Phase;
+
+static void time_phase(Phase *phase, double start) {
+    double taken = now() - start;
+    if (taken < phase->best) phase->best = taken;
+}
+
+static void run_on_all(Function *fns, size_t num_fns, char *pass) {
+    Pipeline pipeline;
+    pipeline_parse("", &pipeline);
+    for (size_t fn = 0; fn < num_fns; fn++)
+        run_pass(&fns[fn], find_pass(pass), &pipeline);
+    pipeline_free(&pipeline);
+}
+
+int main(int argc, char **argv) {
+    size_t num_statements = (argc > 1) ? strtoull(argv[1], NULL, 10) : 50000;
+    if (num_statements < 4) num_statements = 4;
+    size_t len;
+    char *text = generate_function(num_statements, &len);
+    Phase phases[] = {
+        {"parse", 1e9}, {"fold", 1e9}, {"copyelim", 1e9}, {"dce", 1e9}, {"x86_64", 1e9},
+    };
+    FILE *null = fopen("/dev/null", "w");
+    for (size_t it = 0; it < ITERATIONS; it++) {
+        SourceBuf src;
+        source_from_buffer(text, len, &src);
+        Global **globals;
+        AggregateType **aggtypes;
+        FileDbg **filesdbg;
+        double start = now();
+        Token **toks = lex_file(&src, 1);
+        Function **fns = parse_program(toks, &globals, &aggtypes, &filesdbg);
+        time_phase(&phases[0], start);
+        start = now();
+        run_on_all(*fns, vec_size(fns), "fold");
+        time_phase(&phases[1], start);
+        start = now();
+        run_on_all(*fns, vec_size(fns), "copyelim");
+        time_phase(&phases[2], start);
+        start = now();
+        run_on_all(*fns, vec_size(fns), "dce");
+        time_phase(&phases[3], start);
+        start = now();
+        build_program_x86_64(*fns, vec_size(fns), *globals, vec_size(globals), *aggtypes, vec_size(aggtypes),
+                             *filesdbg, vec_size(filesdbg), null);
+        time_phase(&phases[4], start);
+        vec_free(toks);
+        vec_free(fns);
+        vec_free(globals);
+        vec_free(aggtypes);
+        vec_free(filesdbg);
+        reset_x86_64();
+        arena_reset(&arena);
+    }
+    printf("One function of %zu statements, best of %d runs\n", num_statements, ITERATIONS);
+    double total = 0;
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        printf("%-18s %9.2f ms\n", phases[i].name, phases[i].best * 1000);
+        total += phases[i].best;
+    }
+    printf("%-18s %9.2f ms\n", "total", total * 1000);
+    fclose(null);
+    free(text);
+    return 0;
+}
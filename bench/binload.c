@@ -0,0 +1,93 @@
+/* Benchmark comparing how long it takes to get a program into memory from the textual IR, through
+ * lex_file and parse_program, and from the binary IR written by --emit-bin, through
+ * load_program_bin. Build with -DUYB_BENCHMARKS=ON and run:
+ *     bench_binload [file.ssa]
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#include <api.h>
+#include <lexer.h>
+#include <parser.h>
+#include <vector.h>
+#include <target/IR/binary.h>
+#include <time.h>
+
+_Thread_local Arena arena;
+int is_position_independent = 1;
+
+#define ITERATIONS 8
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void open_source(char *fname, SourceBuf *src) {
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        printf("Failed to open %s\n", fname);
+        exit(1);
+    }
+    source_open(f, src);
+    fclose(f);
+}
+
+static size_t count_statements(Function **fns) {
+    size_t num = 0;
+    for (size_t i = 0; i < vec_size(fns); i++)
+        num += (*fns)[i].num_statements;
+    return num;
+}
+
+int main(int argc, char **argv) {
+    char *fname = (argc > 1) ? argv[1] : "examples/rule110.ssa";
+    SourceBuf text;
+    open_source(fname, &text);
+    double text_mb = text.len / (1024.0 * 1024.0);
+    Global **globals;
+    AggregateType **aggtypes;
+    FileDbg **filesdbg;
+    Function **text_fns = NULL;
+    double best_text = 1e9;
+    for (size_t it = 0; it < ITERATIONS; it++) {
+        double start = now();
+        Token **toks = lex_file(&text, 1);
+        text_fns = parse_program(toks, &globals, &aggtypes, &filesdbg);
+        double end = now();
+        vec_free(toks);
+        if (end - start < best_text) best_text = end - start;
+    }
+
+    FILE *binf = tmpfile();
+    if (!binf) {
+        printf("Failed to create a temporary file for the binary IR.\n");
+        exit(1);
+    }
+    build_program_IR_bin(*text_fns, vec_size(text_fns), *globals, vec_size(globals), *aggtypes, vec_size(aggtypes),
+                         *filesdbg, vec_size(filesdbg), binf);
+    fflush(binf);
+    rewind(binf);
+    SourceBuf bin;
+    source_open(binf, &bin);
+    fclose(binf);
+    double bin_mb = bin.len / (1024.0 * 1024.0);
+    Function **bin_fns = NULL;
+    double best_bin = 1e9;
+    for (size_t it = 0; it < ITERATIONS; it++) {
+        double start = now();
+        bin_fns = load_program_bin(bin.data, bin.len, &globals, &aggtypes, &filesdbg);
+        double end = now();
+        if (end - start < best_bin) best_bin = end - start;
+    }
+
+    printf("Input: %s, best of %d runs\n", fname, ITERATIONS);
+    printf("%-8s %9.1f MB %9.2f ms %9.1f MB/s\n", "text", text_mb, best_text * 1000, text_mb / best_text);
+    printf("%-8s %9.1f MB %9.2f ms %9.1f MB/s\n", "binary", bin_mb, best_bin * 1000, bin_mb / best_bin);
+    bool match = vec_size(text_fns) == vec_size(bin_fns) && count_statements(text_fns) == count_statements(bin_fns);
+    printf("Binary loads %.2fx faster, %zu functions and %zu statements %s\n", best_text / best_bin,
+           vec_size(text_fns), count_statements(text_fns), (match) ? "match" : "DO NOT MATCH");
+    source_close(&bin);
+    source_close(&text);
+    return !match;
+}
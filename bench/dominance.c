@@ -0,0 +1,99 @@
+/* Benchmark of building the control flow graph, dominator tree and liveness of functions with
+ * thousands of blocks. It generates functions made of nested while loops with an if statement in
+ * each body, in the same shape cproc emits (see examples/rule110.ssa), then times cfg_build(),
+ * dom_tree() and liveness() on them. Build with -DUYB_BENCHMARKS=ON and run:
+ *     bench_dominance [num_blocks] [nesting_depth]
+ * Without arguments it runs a range of sizes, and one function with deeply nested loops.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#include <api.h>
+#include <cfg.h>
+#include <lexer.h>
+#include <parser.h>
+#include <optimisation.h>
+#include <vector.h>
+#include <time.h>
+
+_Thread_local Arena arena;
+
+#define ITERATIONS 4
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void generate_loop(FILE *f, size_t *next_id, size_t depth) {
+    size_t id = (*next_id)++;
+    fprintf(f, "@while_cond_%zu\n\t%%c%zu =w loadw %%p\n\tjnz %%c%zu, @while_body_%zu, @while_end_%zu\n", id, id, id, id, id);
+    fprintf(f, "@while_body_%zu\n\t%%x%zu =w loadw %%p\n\tjnz %%x%zu, @if_true_%zu, @if_end_%zu\n", id, id, id, id, id);
+    fprintf(f, "@if_true_%zu\n\tstorew 0, %%p\n@if_end_%zu\n", id, id);
+    if (depth > 1) generate_loop(f, next_id, depth - 1);
+    fprintf(f, "\tjmp @while_cond_%zu\n@while_end_%zu\n", id, id);
+}
+
+// Each loop is 5 blocks, and they're nested `depth` deep until there are about `num_blocks` blocks
+static char *generate_function(size_t num_blocks, size_t depth, size_t *len_buf) {
+    char *buf;
+    FILE *f = open_memstream(&buf, len_buf);
+    fprintf(f, "export function w $main(l %%p) {\n@start\n");
+    size_t next_id = 0;
+    while (next_id * 5 < num_blocks) generate_loop(f, &next_id, depth);
+    fprintf(f, "\tret 0\n}\n");
+    fclose(f);
+    return buf;
+}
+
+static void run(size_t num_blocks, size_t depth) {
+    size_t len;
+    char *text = generate_function(num_blocks, depth, &len);
+    double best_cfg = 1e9, best_dom = 1e9, best_live = 1e9;
+    size_t actual_blocks = 0, frontier_size = 0;
+    for (size_t it = 0; it < ITERATIONS; it++) {
+        SourceBuf src;
+        source_from_buffer(text, len, &src);
+        Global **globals;
+        AggregateType **aggtypes;
+        FileDbg **filesdbg;
+        Token **toks = lex_file(&src, 1);
+        Function **fns = parse_program(toks, &globals, &aggtypes, &filesdbg);
+        Function *fn = &(*fns)[0];
+        double start = now();
+        cfg_build(fn);
+        double taken = now() - start;
+        if (taken < best_cfg) best_cfg = taken;
+        start = now();
+        DomTree *tree = dom_tree(fn);
+        taken = now() - start;
+        if (taken < best_dom) best_dom = taken;
+        start = now();
+        liveness(fn);
+        taken = now() - start;
+        if (taken < best_live) best_live = taken;
+        actual_blocks = fn->num_bblocks;
+        frontier_size = tree->frontier_start[fn->num_bblocks];
+        vec_free(toks);
+        vec_free(fns);
+        vec_free(globals);
+        vec_free(aggtypes);
+        vec_free(filesdbg);
+        arena_reset(&arena);
+    }
+    printf("%8zu blocks, depth %5zu: cfg_build %8.3f ms, dom_tree %8.3f ms, liveness %8.3f ms (%zu frontier entries)\n",
+           actual_blocks, depth, best_cfg * 1000, best_dom * 1000, best_live * 1000, frontier_size);
+    free(text);
+}
+
+int main(int argc, char **argv) {
+    printf("Best of %d runs\n", ITERATIONS);
+    if (argc > 1) {
+        run(strtoull(argv[1], NULL, 10), (argc > 2) ? strtoull(argv[2], NULL, 10) : 4);
+        return 0;
+    }
+    for (size_t num_blocks = 1000; num_blocks <= 64000; num_blocks *= 4)
+        run(num_blocks, 4);
+    run(5000, 1000);
+    return 0;
+}
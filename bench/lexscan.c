@@ -0,0 +1,99 @@
+/* Microbenchmark for the lexer's character classification, comparing the throughput of the
+ * vectorised scanners against the scalar ones. Build with -DUYB_BENCHMARKS=ON and run:
+ *     bench_lexscan [file.ssa] [min_megabytes]
+ * The input is repeated until it's at least min_megabytes long (16 by default).
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#include <lexer.h>
+#include <lexscan.h>
+#include <vector.h>
+#include <utils.h>
+#include <string.h>
+#include <time.h>
+
+_Thread_local Arena arena;
+
+#define ITERATIONS 8
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *load_input(char *fname, size_t min_bytes, size_t *len_buf) {
+    FILE *f = fopen(fname, "r");
+    if (!f) {
+        printf("Failed to open %s\n", fname);
+        exit(1);
+    }
+    size_t len;
+    char *contents = read_full_file(f, &len);
+    fclose(f);
+    if (!len) {
+        printf("%s is empty.\n", fname);
+        exit(1);
+    }
+    size_t copies = (min_bytes + len - 1) / len;
+    char *buf = malloc(copies * len);
+    for (size_t i = 0; i < copies; i++)
+        memcpy(&buf[i * len], contents, len);
+    free(contents);
+    *len_buf = copies * len;
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    char *fname = (argc > 1) ? argv[1] : "examples/rule110.ssa";
+    size_t min_mb = (argc > 2) ? strtoul(argv[2], NULL, 10) : 16;
+    size_t len;
+    char *buf = load_input(fname, min_mb * 1024 * 1024, &len);
+    double mb = len / (1024.0 * 1024.0);
+    printf("Input: %s repeated to %.1f MB, best of %d runs\n", fname, mb, ITERATIONS);
+    printf("%-8s %14s %14s\n", "", "line scan", "lex_buffer");
+    double scalar_scan = 0, scalar_lex = 0;
+    Token **scalar_toks = NULL;
+    for (ScanImpl impl = ScanScalar; impl <= ScanAVX2; impl++) {
+        if (!lexscan_use(impl)) {
+            printf("%-8s (not supported by this CPU)\n", scan_impl_as_str(impl));
+            continue;
+        }
+        double best_scan = 1e9, best_lex = 1e9;
+        size_t lines = 0;
+        Token **toks = NULL;
+        for (size_t it = 0; it < ITERATIONS; it++) {
+            double start = now();
+            lines = 0;
+            for (size_t at = 0; at < len; at++) {
+                at += lexscan.newline(&buf[at], len - at);
+                lines++;
+            }
+            double mid = now();
+            if (toks) vec_free(toks);
+            toks = vec_new(sizeof(Token));
+            lex_buffer(buf, len, 1, toks);
+            double end = now();
+            if (mid - start < best_scan) best_scan = mid - start;
+            if (end - mid < best_lex) best_lex = end - mid;
+        }
+        printf("%-8s %9.1f MB/s %9.1f MB/s", scan_impl_as_str(impl), mb / best_scan, mb / best_lex);
+        if (impl == ScanScalar) {
+            scalar_scan = best_scan;
+            scalar_lex = best_lex;
+            scalar_toks = toks;
+            printf("  (%zu lines, %zu tokens)\n", lines, vec_size(toks));
+            continue;
+        }
+        bool match = vec_size(toks) == vec_size(scalar_toks);
+        for (size_t t = 0; match && t < vec_size(toks); t++) {
+            match = (*toks)[t].line == (*scalar_toks)[t].line && (*toks)[t].type == (*scalar_toks)[t].type &&
+                    (*toks)[t].val == (*scalar_toks)[t].val && (*toks)[t].len == (*scalar_toks)[t].len;
+        }
+        printf("  %.2fx / %.2fx scalar, tokens %s\n", scalar_scan / best_scan, scalar_lex / best_lex,
+               (match) ? "match" : "DO NOT MATCH");
+        vec_free(toks);
+        if (!match) return 1;
+    }
+    return 0;
+}
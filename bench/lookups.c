@@ -0,0 +1,126 @@
+/* Benchmark of the lookups done while generating code, which should take about the same time per
+ * statement however big the function is. It times x86_64 code generation of functions with more and
+ * more loops, each with a phi joining the two sides of an if statement (the shape cproc emits for
+ * && and ||), then times looking up names in a HashMap against scanning an array for them, which is
+ * how aggregate types are found. Build with -DUYB_BENCHMARKS=ON and run:
+ *     bench_lookups [num_loops]
+ * Without arguments it runs a range of sizes.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#define ARENA_IMPLEMENTATION
+#include <arena.h>
+#include <api.h>
+#include <lexer.h>
+#include <parser.h>
+#include <hashmap.h>
+#include <intern.h>
+#include <vector.h>
+#include <time.h>
+
+_Thread_local Arena arena;
+int is_position_independent = 1;
+
+#define ITERATIONS 4
+#define NUM_LOOKUPS 1000000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Each loop is 6 blocks and 11 statements
+static char *generate_function(size_t num_loops, size_t *len_buf) {
+    char *buf;
+    FILE *f = open_memstream(&buf, len_buf);
+    fprintf(f, "export function w $main(l %%p) {\n@start\n");
+    for (size_t i = 0; i < num_loops; i++) {
+        fprintf(f, "@while_cond_%zu\n\t%%c%zu =w loadw %%p\n\tjnz %%c%zu, @while_body_%zu, @while_end_%zu\n", i, i, i, i, i);
+        fprintf(f, "@while_body_%zu\n\t%%x%zu =w loadw %%p\n\tjnz %%x%zu, @if_true_%zu, @if_false_%zu\n", i, i, i, i, i);
+        fprintf(f, "@if_true_%zu\n\tjmp @if_end_%zu\n@if_false_%zu\n\tjmp @if_end_%zu\n", i, i, i, i);
+        fprintf(f, "@if_end_%zu\n\t%%r%zu =w phi @if_true_%zu 1, @if_false_%zu 0\n\tstorew %%r%zu, %%p\n", i, i, i, i, i);
+        fprintf(f, "\tjmp @while_cond_%zu\n@while_end_%zu\n", i, i);
+    }
+    fprintf(f, "\tret 0\n}\n");
+    fclose(f);
+    return buf;
+}
+
+static void bench_codegen(size_t num_loops) {
+    size_t len;
+    char *text = generate_function(num_loops, &len);
+    FILE *null = fopen("/dev/null", "w");
+    double best = 1e9;
+    size_t num_statements = 0;
+    for (size_t it = 0; it < ITERATIONS; it++) {
+        SourceBuf src;
+        source_from_buffer(text, len, &src);
+        Global **globals;
+        AggregateType **aggtypes;
+        FileDbg **filesdbg;
+        Token **toks = lex_file(&src, 1);
+        Function **fns = parse_program(toks, &globals, &aggtypes, &filesdbg);
+        num_statements = (*fns)[0].num_statements;
+        double start = now();
+        build_program_x86_64(*fns, vec_size(fns), *globals, vec_size(globals), *aggtypes, vec_size(aggtypes),
+                             *filesdbg, vec_size(filesdbg), null);
+        double taken = now() - start;
+        if (taken < best) best = taken;
+        vec_free(toks);
+        vec_free(fns);
+        vec_free(globals);
+        vec_free(aggtypes);
+        vec_free(filesdbg);
+        reset_x86_64();
+        arena_reset(&arena);
+    }
+    printf("%8zu loops %9zu statements %10.2f ms %8.0f ns/statement\n", num_loops, num_statements,
+           best * 1000, best * 1e9 / num_statements);
+    fclose(null);
+    free(text);
+}
+
+static void bench_names(size_t num_names) {
+    char **names = (char**) malloc(sizeof(char*) * num_names);
+    for (size_t i = 0; i < num_names; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "struct.%zu", i);
+        names[i] = intern_cstr(name);
+    }
+    HashMap map;
+    hashmap_init(&map, &arena, num_names);
+    for (size_t i = 0; i < num_names; i++) hashmap_put(&map, (uint64_t) names[i], i + 1);
+    // the sum is printed so the lookups can't be left out
+    size_t sum = 0;
+    double start = now();
+    for (size_t l = 0; l < NUM_LOOKUPS; l++) {
+        char *name = names[(l * 7919) % num_names];
+        for (size_t i = 0; i < num_names; i++) {
+            if (names[i] != name) continue;
+            sum += i;
+            break;
+        }
+    }
+    double scan = now() - start;
+    start = now();
+    for (size_t l = 0; l < NUM_LOOKUPS; l++) {
+        uint64_t index;
+        if (hashmap_get(&map, (uint64_t) names[(l * 7919) % num_names], &index)) sum += index - 1;
+    }
+    double hashed = now() - start;
+    printf("%8zu names   scan %8.1f ns/lookup   hashmap %6.1f ns/lookup   (%zu)\n", num_names,
+           scan * 1e9 / NUM_LOOKUPS, hashed * 1e9 / NUM_LOOKUPS, sum);
+    free(names);
+    arena_reset(&arena);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        bench_codegen(strtoull(argv[1], NULL, 10));
+        return 0;
+    }
+    printf("x86_64 code generation, best of %d runs\n", ITERATIONS);
+    for (size_t num_loops = 1000; num_loops <= 16000; num_loops *= 2) bench_codegen(num_loops);
+    printf("\nLooking up aggregate type names, %d lookups\n", NUM_LOOKUPS);
+    for (size_t num_names = 4; num_names <= 4096; num_names *= 8) bench_names(num_names);
+    return 0;
+}
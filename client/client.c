@@ -0,0 +1,163 @@
+/* Client for UYB's compile server (see `uyb --server`). It takes the same arguments as uyb and gives
+ * the same output, but has a server that's already running do the compiling, so it only costs a
+ * small process start. The socket is given with --server <socket> or the UYB_SERVER environment
+ * variable. If neither is set, the server can't be reached, or the arguments need something only
+ * uyb itself can do (like several input files), it runs uyb (or $UYB if it's set) instead.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <server.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Runs uyb with the same arguments, minus any --server option
+static void run_uyb(int argc, char **argv) {
+    char **args = (char**) malloc(sizeof(char*) * (argc + 1));
+    size_t num_args = 0;
+    char *uyb = getenv("UYB");
+    args[num_args++] = (uyb) ? uyb : "uyb";
+    for (int arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "--server") || !strcmp(argv[arg], "-server")) {
+            arg++;
+            continue;
+        }
+        args[num_args++] = argv[arg];
+    }
+    args[num_args] = NULL;
+    execvp(args[0], args);
+    printf("Failed to run %s\n", args[0]);
+    exit(1);
+}
+
+static int connect_to_server(char *socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr*) &addr, sizeof(addr))) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static char *read_input(FILE *f, size_t *len_buf) {
+    size_t len = 0, capacity = 64 * 1024;
+    char *buf = malloc(capacity);
+    size_t n;
+    while ((n = fread(&buf[len], 1, capacity - len, f))) {
+        len += n;
+        if (len == capacity) buf = realloc(buf, capacity *= 2);
+    }
+    *len_buf = len;
+    return buf;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char*) buf + done, len - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, (char*) buf + done, len - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    char *socket_path = getenv("UYB_SERVER");
+    char *input_fname = NULL;
+    char *output_fname = NULL;
+    char options[SERVER_MAX_OPTIONS_LEN];
+    size_t options_len = 0;
+    for (int arg = 1; arg < argc; arg++) {
+        char *opt = argv[arg];
+        if (opt[0] != '-') {
+            if (input_fname) run_uyb(argc, argv);
+            input_fname = opt;
+            continue;
+        }
+        if (opt[1] == '-') opt++;
+        bool has_val = !strcmp(opt, "-o") || !strcmp(opt, "-t") || !strcmp(opt, "-server");
+        if (has_val && arg == argc - 1) run_uyb(argc, argv);
+        if (!strcmp(opt, "-server")) {
+            socket_path = argv[++arg];
+        } else if (!strcmp(opt, "-o")) {
+            output_fname = argv[++arg];
+        } else if (!strcmp(opt, "-t") || !strcmp(opt, "-no-pie") || !strcmp(opt, "-batch") || !strcmp(opt, "-emit-bin") ||
+                   (opt[1] == 'O' && opt[2] && !opt[3]) || !strncmp(opt, "-passes=", 8) ||
+                   !strncmp(opt, "-inline-threshold=", 18) || !strncmp(opt, "-inline-max-size=", 17) ||
+                   !strncmp(opt, "-unroll-threshold=", 18)) {
+            // passed on to the server as they are
+            for (int i = 0; i <= has_val; i++) {
+                size_t len = strlen(argv[arg + i]) + 1;
+                if (options_len + len > sizeof(options)) run_uyb(argc, argv);
+                memcpy(&options[options_len], argv[arg + i], len);
+                options_len += len;
+            }
+            arg += has_val;
+        } else {
+            run_uyb(argc, argv);
+        }
+    }
+    if (!socket_path) run_uyb(argc, argv);
+    int sock = connect_to_server(socket_path);
+    if (sock < 0) run_uyb(argc, argv);
+    FILE *inf = stdin;
+    if (input_fname) {
+        inf = fopen(input_fname, "r");
+        if (!inf) {
+            printf("Failed to open %s\n", input_fname);
+            return 1;
+        }
+    }
+    size_t input_len;
+    char *input = read_input(inf, &input_len);
+    fclose(inf);
+    ServerRequest request = {
+        .magic = SERVER_REQUEST_MAGIC,
+        .options_len = options_len,
+        .input_len = input_len,
+    };
+    ServerResponse response;
+    if (!write_all(sock, &request, sizeof(request)) || !write_all(sock, options, options_len) ||
+            !write_all(sock, input, input_len) || !read_all(sock, &response, sizeof(response)) ||
+            response.magic != SERVER_RESPONSE_MAGIC) {
+        printf("Lost connection to the compile server at %s\n", socket_path);
+        return 1;
+    }
+    free(input);
+    char *output = malloc(response.output_len);
+    if (!read_all(sock, output, response.output_len)) {
+        printf("Lost connection to the compile server at %s\n", socket_path);
+        return 1;
+    }
+    close(sock);
+    if (response.status) {
+        fwrite(output, 1, response.output_len, stdout);
+        return 1;
+    }
+    FILE *outf = stdout;
+    if (output_fname) {
+        outf = fopen(output_fname, "w");
+        if (!outf) {
+            printf("Failed to open %s\n", output_fname);
+            return 1;
+        }
+    }
+    fwrite(output, 1, response.output_len, outf);
+    fclose(outf);
+    free(output);
+    return 0;
+}
@@ -1,11 +1,18 @@
 /* This is the "library"/API file which is what is used to interact with the actual backend through
  * a non-textual representation.
+ * Every name in these structures (labels, symbols, block labels and aggregate type names) must come
+ * from intern() in intern.h, since the backend compares names by pointer rather than with strcmp.
+ * Inside a function, temporaries (%labels) and block labels (@labels) aren't referred to by name at
+ * all but by a ValueId or BlockId, which are dense numbers given out per function (see values.h),
+ * so that passes can keep information about them in flat arrays. The names are only kept in the
+ * Function for printing.
  * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <strslice.h>
+#include <intern.h>
 #include <stdio.h>
 
 typedef enum {
@@ -60,6 +67,10 @@ typedef enum {
     None,
 } Type;
 
+// IDs start at 1, so that 0 can mean "no value" or "no block"
+typedef uint32_t ValueId;
+typedef uint32_t BlockId;
+
 typedef enum {
     Label,
     Number,
@@ -73,7 +84,7 @@ typedef enum {
 } ValType;
 
 typedef struct {
-    char **args;
+    uint64_t *args; // same as Statement.vals
     Type *arg_sizes;
     char **arg_struct_types;
     bool *args_are_structs;
@@ -92,10 +103,12 @@ typedef struct {
 } Global;
 
 typedef struct {
-    char *label; // to store result in (NULL if none (only if it's a function or something))
+    ValueId label; // to store result in (0 if none (only if it's a function or something))
     Instruction instruction;
     Type type;
-    uint64_t vals[3];
+    Type arg_type;  // width of the operands for loads, stores, extensions and comparisons, otherwise None
+    bool is_signed; // whether a load, extension or comparison is signed
+    uint64_t vals[3]; // a ValueId for a Label and a BlockId for a BlkLbl
     ValType val_types[3];
 } Statement;
 
@@ -105,9 +118,21 @@ typedef struct {
         Type type;
         char *type_struct;
     };
-    char *label;
+    ValueId label;
 } FunctionArgument;
 
+/* A run of statements which is only entered at the start and only left at the end. Blocks are
+ * referred to by their index in Function.bblocks (see cfg.h). */
+typedef struct {
+    BlockId label;     // 0 if the block doesn't start with a block label
+    size_t start, end; // its statements are [start, end), including its BLKLBL if it has one
+    size_t succs[2];
+    size_t num_succs;
+    size_t *preds;
+    size_t num_preds;
+    bool falls_through; // whether the next block is a successor because control runs off the end
+} BasicBlock;
+
 typedef struct {
     bool is_global;
     char *name;
@@ -121,6 +146,14 @@ typedef struct {
     Statement *statements;
     size_t num_statements;
     bool is_variadic;
+    char **value_names; // indexed by ValueId
+    size_t num_values;  // one more than the highest ValueId
+    char **block_names; // indexed by BlockId
+    size_t num_blocks;  // one more than the highest BlockId
+    BasicBlock *bblocks; // the control flow graph, in the order the blocks appear in `statements`
+    size_t num_bblocks;
+    size_t *label_bblocks; // indexed by BlockId, the index in `bblocks` of the block it starts
+    struct DomTree *dom_tree; // cached by dom_tree() in optimisation.h, and dropped when the graph is rebuilt
 } Function;
 
 typedef struct {
@@ -130,7 +163,7 @@ typedef struct {
 } AggregateType;
 
 typedef struct {
-    char *blklbl_name;
+    BlockId blklbl;
     size_t val;
     ValType type;
 } PhiVal;
@@ -142,7 +175,7 @@ typedef struct {
 
 typedef struct {
     char *reg;
-    char *label;
+    uint64_t label; // a ValueId, unless copy elimination has replaced it with another type of value
     ValType type;
 } InlineAsmIO;
 
@@ -156,9 +189,23 @@ typedef struct {
 // for each target
 void build_program_x86_64(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf);
 void     build_program_IR(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf);
+// Writes the binary encoding of the IR (a .uybc file) instead of assembly or text
+void build_program_IR_bin(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf);
+
+/* For compiling one function at a time: build_function_* can be called on each function as soon as
+ * it's ready, but its output has to go after the output of build_header_*, which needs every global,
+ * aggregate type, debug file and exported function name. Together they give the same output as
+ * build_program_* for the same functions in the same order. */
+void build_function_x86_64(Function func, AggregateType *aggtypes, size_t num_aggtypes, FILE *outf);
+void     build_function_IR(Function func, AggregateType *aggtypes, size_t num_aggtypes, FILE *outf);
+void build_header_x86_64(Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, char **exported, size_t num_exported, FILE *outf);
+void     build_header_IR(Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, char **exported, size_t num_exported, FILE *outf);
+// Forgets anything the x86_64 target kept from the last file compiled on this thread
+void reset_x86_64();
 
 extern void (*instructions_x86_64[41])(uint64_t[2], ValType[2], Statement, String*);
 extern void (*instructions_IR[])(uint64_t[2], ValType[2], Statement, FILE*);
 char *instruction_as_str(Instruction instr);
+char *statement_mnemonic(Statement statement);
 char *type_as_str(Type type, char *struct_type, bool is_struct);
 void disasm_instr(String *fnbuf, Statement statement);
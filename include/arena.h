@@ -67,7 +67,7 @@ typedef struct {
     Region *begin, *end;
 } Arena;
 
-extern Arena arena; // defined in src/main.c
+extern _Thread_local Arena arena; // defined in src/main.c, one per thread so files can be compiled in parallel
 
 typedef struct  {
     Region *region;
@@ -0,0 +1,48 @@
+/* Dense bitsets, stored as arrays of 64 bit words, for dataflow analyses over ValueIds. The loops
+ * over whole sets are simple enough for the compiler to vectorise.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The number of words in a set that can hold 0 to num_bits - 1
+static inline size_t bitset_words(size_t num_bits) {
+    return (num_bits + 63) / 64;
+}
+
+static inline void bitset_set(uint64_t *set, size_t bit) {
+    set[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+static inline bool bitset_test(uint64_t *set, size_t bit) {
+    return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline bool bitset_any(uint64_t *set, size_t words) {
+    uint64_t any = 0;
+    for (size_t w = 0; w < words; w++) any |= set[w];
+    return any != 0;
+}
+
+// dst |= src, returning whether dst changed
+static inline bool bitset_union(uint64_t *dst, uint64_t *src, size_t words) {
+    uint64_t changed = 0;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t old = dst[w];
+        dst[w] |= src[w];
+        changed |= dst[w] ^ old;
+    }
+    return changed != 0;
+}
+
+// dst |= a & ~b, returning whether dst changed
+static inline bool bitset_union_diff(uint64_t *dst, uint64_t *a, uint64_t *b, size_t words) {
+    uint64_t changed = 0;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t old = dst[w];
+        dst[w] |= a[w] & ~b[w];
+        changed |= dst[w] ^ old;
+    }
+    return changed != 0;
+}
@@ -0,0 +1,21 @@
+/* Header for ../src/cache.c, the on-disk cache of compiled functions.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CACHE_DEFAULT_MAX_MB 256
+
+typedef struct {
+    uint64_t lo, hi;
+} CacheKey;
+
+void cache_open(char *dir, size_t max_bytes);
+bool cache_enabled();
+CacheKey cache_key(void *data, size_t len);
+char *cache_get(CacheKey key, size_t *len_buf);
+void cache_put(CacheKey key, void *data, size_t len);
+void cache_close();
+void cache_print_stats(FILE *f);
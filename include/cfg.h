@@ -0,0 +1,12 @@
+/* Header for ../src/cfg.c, which builds the control flow graph of each function.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <api.h>
+
+#define NO_BBLOCK ((size_t) -1)
+
+void cfg_build(Function *fn);
+size_t cfg_block_of_statement(Function *fn, size_t statement);
+bool is_terminator(Instruction instruction);
+size_t phi_pred(Function *fn, PhiVal *phi_val);
+void retarget(Statement *statement, BlockId from, BlockId to);
@@ -0,0 +1,24 @@
+/* Header for ../src/compile.c, which runs the whole compiler on one source file.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+#include <lexer.h>
+#include <optimisation.h>
+
+typedef enum {
+    X86_64,
+    IR,
+} Target;
+
+typedef struct {
+    Target target;
+    bool batch;       // parse the whole file before compiling any of it
+    bool emit_bin;    // output binary IR instead of assembly
+    size_t lex_threads;
+    Pipeline pipeline; // the passes to optimise each function with
+} CompileOptions;
+
+bool str_as_target(char *s, Target *target_buf);
+void compile_source(SourceBuf *src, CompileOptions *opts, FILE *outf);
+void compile_reset(CompileOptions *opts);
@@ -0,0 +1,6 @@
+/* Header for ../src/error.c, which reports errors in the program being compiled.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+
+_Noreturn void compile_error(char *fmt, ...) __attribute__((format(printf, 1, 2)));
+char *catch_compile_error(void (*fn)(void*), void *arg);
@@ -0,0 +1,40 @@
+/* Part of the hash map implementation for UYB compiler backend project, see ../src/hashmap.c for the
+ * rest of the code.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <arena.h>
+
+typedef struct {
+    uint64_t key; // HASHMAP_NO_KEY if the slot is empty
+    uint64_t val;
+} HashEntry;
+
+typedef struct {
+    Arena *arena;
+    HashEntry *entries;
+    size_t capacity; // always a power of two
+    size_t len;
+} HashMap;
+
+#define HASHMAP_NO_KEY 0
+
+void hashmap_init(HashMap *map, Arena *arena, size_t expected_len);
+void hashmap_put(HashMap *map, uint64_t key, uint64_t val);
+bool hashmap_get(HashMap *map, uint64_t key, uint64_t *val_buf);
+
+/* Usage of this header:
+ *  - To create a new map, use hashmap_init() with the arena it should be allocated in, and roughly
+ *    how many entries it'll have (it grows past that if it needs to):
+ *      HashMap map;
+ *      hashmap_init(&map, &arena, 64);
+ *  - To add an entry, or change the value of one that's already there, use hashmap_put():
+ *      hashmap_put(&map, key, value);
+ *  - To look up a key, use hashmap_get(), which returns false if it isn't in the map:
+ *      if (hashmap_get(&map, key, &value)) ...
+ *  - There's nothing to free, since everything is in the arena.
+ * Keys are integers, and can be anything except HASHMAP_NO_KEY (0). Names are all interned (see
+ * intern.h), so a name can be used as a key by casting its pointer to a uint64_t.
+ */
@@ -0,0 +1,10 @@
+/* Header for ../src/intern.c, the string interning table for names in the IR.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stddef.h>
+
+char *intern(char *str, size_t len);
+char *intern_cstr(char *str);
+size_t intern_id(char *interned);
+size_t intern_count();
+void intern_reset();
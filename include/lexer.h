@@ -3,6 +3,7 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <api.h>
 
@@ -28,10 +29,25 @@ typedef enum {
 typedef struct {
     size_t line;
     TokenType type;
-    uint64_t val;
+    uint64_t val; // for labels and strings, this is a pointer into the source buffer (not NUL terminated)
+    size_t len;   // length of the span pointed to by val, only for labels and strings
 } Token;
 
-void lex_line(char *str, size_t line_num, Token **ret);
-Token **lex_file(FILE *f);
+// The whole input file, which label and string tokens point into
+typedef struct {
+    char *data;
+    size_t len;
+    bool is_mapped; // if false, data was allocated with malloc
+} SourceBuf;
+
+void lex_line(char *str, size_t len, size_t line_num, Token **ret);
+void lex_buffer(char *buf, size_t len, size_t first_line, Token **ret);
+size_t lex_item(char *buf, size_t len, size_t *line, Token **ret);
+Token **lex_file(SourceBuf *src, size_t num_threads);
+void source_open(FILE *f, SourceBuf *src);
+void source_from_buffer(char *data, size_t len, SourceBuf *src);
+void source_close(SourceBuf *src);
+char *token_str(Token tok);
+uint64_t token_value(Token tok);
 char *token_to_str(TokenType ttype);
 Type char_to_type(char t_ch);
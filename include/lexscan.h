@@ -0,0 +1,26 @@
+/* Header for ../src/lexscan.c, the vectorised character classification used by the lexer.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    ScanScalar,
+    ScanSSE2,
+    ScanAVX2,
+} ScanImpl;
+
+/* Each of these returns the index of the first byte in `str` that isn't part of the run being
+ * scanned, or `len` if the whole buffer is part of it. */
+typedef struct {
+    size_t (*skip_space)(const char *str, size_t len); // whitespace (' ', '\t', '\r', NUL)
+    size_t (*label_end)(const char *str, size_t len);  // label characters ([A-Za-z0-9._])
+    size_t (*line_end)(const char *str, size_t len);   // stops at '\n' or '#'
+    size_t (*newline)(const char *str, size_t len);    // stops at '\n'
+} LexScanner;
+
+extern LexScanner lexscan;
+
+void lexscan_init();
+bool lexscan_use(ScanImpl impl);
+char *scan_impl_as_str(ScanImpl impl);
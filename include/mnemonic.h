@@ -0,0 +1,16 @@
+/* Header for ../src/mnemonic.c, the table of instruction mnemonics in the textual IR.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <api.h>
+
+#define NUM_INSTRUCTIONS (ASM + 1)
+
+typedef struct {
+    char *name;
+    Instruction instruction;
+    Type type;     // replaces the type given by the statement's label, unless it's None
+    Type arg_type; // see Statement.arg_type
+    bool is_signed;
+} Mnemonic;
+
+Mnemonic *lookup_mnemonic(char *name, size_t len);
@@ -2,15 +2,218 @@
 #include <api.h>
 #include <stddef.h>
 
+#define NO_USE ((size_t) -1)
+#define NO_STATEMENT ((size_t) -1)
+
+// One operand which uses a value (see uses.c)
+typedef struct {
+    size_t statement; // its index in Function.statements
+    uint64_t *val;    // the operand itself, along with its type
+    ValType *type;
+    size_t next;      // the next use of the same value, or NO_USE
+} Use;
+
+/* The definitions and uses of each value in a function. The uses of value v are a linked list
+ * through `uses`, starting at first_use[v]. Arguments are defined at NO_STATEMENT. */
+typedef struct {
+    Use *uses;
+    size_t *first_use; // indexed by ValueId
+    size_t *num_uses;  // indexed by ValueId
+    size_t *def;       // indexed by ValueId, the statement defining it (the last one if there's more than one)
+    size_t *num_defs;  // indexed by ValueId
+} UseLists;
+
+/* Dominator tree of a function's control flow graph (see dominance.c). Blocks are indexes into
+ * Function.bblocks, and the lists for each block b are items[start[b] .. start[b + 1]]. Blocks which
+ * can't be reached have NO_BBLOCK for their rpo_index, idom and tree_pre. */
+typedef struct DomTree {
+    size_t *rpo;            // the reachable blocks in reverse post order, starting with the entry block
+    size_t num_reachable;
+    size_t *rpo_index;      // indexed by block, its position in rpo
+    size_t *idom;           // indexed by block, its immediate dominator (the entry block's is itself)
+    size_t *children;       // the blocks each block immediately dominates, in reverse post order
+    size_t *children_start;
+    size_t *frontier;       // the dominance frontier of each block
+    size_t *frontier_start;
+    size_t *tree_pre;       // indexed by block, its position in a preorder walk of the tree
+    size_t *tree_size;      // indexed by block, how many blocks it dominates (including itself)
+} DomTree;
+
+#define NOT_IN_SETS UINT32_MAX
+#define LIVE_SLICE_WORDS 4
+#define LIVE_SLICE_BITS (LIVE_SLICE_WORDS * 64)
+
+/* Which values are live at the start and end of each block (see liveness.c). The sets are bitsets
+ * (see bitset.h), and only values that are used outside the block that defines them can be live
+ * there, so only they have a bit in the sets. The bits are split into slices of LIVE_SLICE_WORDS
+ * words, and a slice only has sets for the blocks where one of its values is live: for slice i, those
+ * are blocks[slice_start[i] .. slice_start[i + 1]], in order, and the sets for the jth of them start
+ * at live_in[j * LIVE_SLICE_WORDS] and live_out[j * LIVE_SLICE_WORDS]. */
+typedef struct {
+    uint32_t *index;  // indexed by ValueId, its bit in the sets, or NOT_IN_SETS
+    ValueId *values;  // indexed by bit, the value it's for
+    size_t num_values;
+    size_t num_slices;
+    size_t *slice_start;
+    size_t *blocks;
+    uint64_t *live_in;
+    uint64_t *live_out;
+} Liveness;
+
+#define NO_LOOP ((size_t) -1)
+
+typedef struct {
+    size_t header;
+    size_t parent;    // the loop it's nested in, or NO_LOOP
+    size_t depth;     // 1 for a loop that isn't nested in another
+    size_t preheader; // the only block outside the loop going to the header, if it goes nowhere else, or NO_BBLOCK
+} Loop;
+
+/* The natural loops of a function (see loops.c). A loop is a header block along with every block
+ * which can get back to it without leaving the blocks it dominates, and back edges to the same
+ * header make up one loop. Loops are in reverse post order of their headers, so a loop comes after
+ * any loop it's nested in, and the blocks of loop l (in reverse post order, starting with the header)
+ * are blocks[blocks_start[l] .. blocks_start[l + 1]]. */
+typedef struct {
+    Loop *loops;
+    size_t num_loops;
+    size_t *blocks;
+    size_t *blocks_start;
+    size_t *loop_of; // indexed by block, the innermost loop it's in, or NO_LOOP
+} Loops;
+
+#define NO_IV ((size_t) -1)
+#define NO_TRIP_COUNT ((size_t) -1)
+
+// A phi in a loop's header which has the same constant added to it each time round (see ivs.c)
 typedef struct {
-    char *label;
-    size_t val;
-    ValType type;
-} CopyVal;
+    ValueId phi;
+    size_t loop;
+    PhiVal *start;  // what it's given coming into the loop
+    PhiVal *next;   // what it's given coming round again, which is the phi plus step
+    uint64_t step;  // wrapped around at the phi's width, so going down is a big number
+} InductionVar;
+
+// How a loop's header decides whether to go round again, if it compares an induction variable to decide
+typedef struct {
+    size_t iv;          // NO_IV if the header's branch isn't on a comparison of one of the loop's induction variables
+    size_t compare;     // the statement comparing it with something that doesn't change in the loop
+    size_t iv_operand;  // which operand of the comparison the induction variable is
+    bool stays_if_true; // whether the loop goes round again when the comparison is true
+    size_t body;        // the header's successor in the loop
+    size_t trip_count;  // how many times the body runs, if it starts and is compared with constants, otherwise NO_TRIP_COUNT
+} LoopExit;
+
+/* The basic induction variables of a function's loops (see ivs.c), and how each loop's header
+ * decides to leave the loop. */
+typedef struct {
+    InductionVar *ivs;
+    size_t num_ivs;
+    size_t *iv_of;   // indexed by ValueId, the induction variable it's the phi of, or NO_IV
+    LoopExit *exits; // indexed by loop
+} InductionVars;
+
+// Analyses which a pass can keep up to date, so the pass manager doesn't have to throw them away
+typedef enum {
+    ANALYSIS_CFG      = 1 << 0, // Function.bblocks and the rest of the control flow graph
+    ANALYSIS_DOM_TREE = 1 << 1, // Function.dom_tree
+} Analysis;
+
+struct Pipeline;
+
+/* A pass either runs on one function at a time, or on every function in the program at once (a
+ * module pass), in which case it can also remove functions. */
+typedef struct {
+    char *name;
+    bool (*run)(Function *fn); // returns whether it changed anything
+    Analysis preserves;        // what's still right afterwards when it has changed something
+    bool (*run_module)(Function *fns, size_t *num_functions, struct Pipeline *pipeline); // NULL unless it's a module pass
+    bool (*run_configured)(Function *fn, struct Pipeline *pipeline); // instead of run, for a pass with settings in the pipeline
+} Pass;
+
+// Either one pass, or a group of them which is repeated until none of them change anything
+typedef struct PipelineStep {
+    Pass *pass; // NULL for a group
+    struct PipelineStep *group;
+    size_t group_len;
+} PipelineStep;
+
+#define DEFAULT_INLINE_THRESHOLD 30
+#define DEFAULT_INLINE_MAX_SIZE  3000
+#define DEFAULT_UNROLL_THRESHOLD 128
+
+typedef struct Pipeline {
+    PipelineStep *steps;
+    size_t num_steps;
+    bool time_passes; // add up how long each pass takes, for print_pass_times()
+    size_t inline_threshold; // the biggest cost of a call that the inliner still inlines
+    size_t inline_max_size;  // functions aren't inlined into a function with more statements than this
+    size_t unroll_threshold; // the most statements a loop can have once it's unrolled, or 0 to not unroll loops
+} Pipeline;
+
+// Counts of what passes have done, added up over every function and printed with -time-passes
+typedef enum {
+    STAT_DCE_STATEMENTS,
+    STAT_DCE_UNREACHABLE_BLOCKS,
+    STAT_DCE_PHIS_FOLDED,
+    STAT_SCCP_CONSTANTS,
+    STAT_SCCP_BRANCHES,
+    STAT_SCCP_UNREACHABLE_BLOCKS,
+    STAT_INLINE_CALLS,
+    STAT_INLINE_FUNCTIONS_REMOVED,
+    STAT_MEM2REG_SLOTS,
+    STAT_MEM2REG_PHIS,
+    STAT_GVN_STATEMENTS,
+    STAT_LICM_HOISTED,
+    STAT_LICM_PREHEADERS,
+    STAT_UNROLL_FULL,
+    STAT_UNROLL_PARTIAL,
+    STAT_LSR_REDUCED,
+    STAT_LSR_EXITS,
+    NUM_STATS,
+} Statistic;
+
+/* Pass manager */
+size_t optimise(Function *IR, size_t num_functions, Pipeline *pipeline);
+Pass *find_pass(char *name);
+bool pipeline_has_module_pass(Pipeline *pipeline);
+bool run_pass(Function *fn, Pass *pass, Pipeline *pipeline);
+char *pipeline_parse(char *s, Pipeline *pipeline_buf);
+bool pipeline_preset(size_t level, Pipeline *pipeline_buf);
+void pipeline_free(Pipeline *pipeline);
+void print_pass_times(FILE *f);
+void add_stat(Statistic stat, size_t n);
+
+/* Analyses */
+DomTree *dom_tree(Function *fn);
+bool dominates(DomTree *tree, size_t a, size_t b);
+Liveness liveness(Function *fn);
+bool is_live_in(Liveness *live, size_t block, ValueId value);
+bool is_live_out(Liveness *live, size_t block, ValueId value);
+UseLists use_lists(Function *fn);
+Loops find_loops(Function *fn);
+bool in_loop(Loops *loops, size_t loop, size_t block);
+size_t insert_preheaders(Function *fn, Loops *loops, bool *wanted);
+InductionVars find_ivs(Function *fn, Loops *loops, UseLists *uses);
+void replace_all_uses_with(UseLists *lists, ValueId value, uint64_t val, ValType type);
+size_t replace_uses_with_number(Function *fn, UseLists *lists, ValueId value, uint64_t number);
 
-void optimise(Function *IR, size_t num_functions);
+/* Helpers shared between passes */
+uint64_t type_mask(Type type);
+int64_t as_signed(uint64_t val, Type type);
+char *suffixed_name(char *name, char *fmt, ...);
+void append_names(char ***names, size_t *num_names, char* **names_vec);
 
 /* Specific optimisations */
-void opt_fold(Function *IR, size_t num_functions);
-void opt_copy_elim(Function *IR, size_t num_functions);
-void opt_unused_label_elim(Function *IR, size_t num_functions);
+bool can_eval_statement(Statement *statement);
+bool eval_statement(Statement *statement, uint64_t a, uint64_t b, uint64_t *result_buf);
+bool opt_fold(Function *fn);
+bool opt_sccp(Function *fn);
+bool opt_copy_elim(Function *fn);
+bool opt_dce(Function *fn);
+bool opt_inline(Function *fns, size_t *num_functions, Pipeline *pipeline);
+bool opt_mem2reg(Function *fn);
+bool opt_gvn(Function *fn);
+bool opt_licm(Function *fn);
+bool opt_unroll(Function *fn, Pipeline *pipeline);
+bool opt_lsr(Function *fn);
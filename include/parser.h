@@ -4,3 +4,4 @@
 #include <lexer.h>
 
 Function **parse_program(Token **toks, Global ***globals_buf, AggregateType ***aggtypes_buf, FileDbg ***filesdbg_buf);
+bool parse_item(Token **toks, size_t *tok, Function *fn_buf, Global **globals, AggregateType **aggtypes, FileDbg **filesdbg);
@@ -0,0 +1,30 @@
+/* Header for ../src/server.c, the compile server, and the protocol used to talk to it (which
+ * ../client/client.c also uses).
+ *
+ * A client sends a ServerRequest, then `options_len` bytes of command line options, each one
+ * followed by a NUL (for example "-t\0IR\0--no-pie\0"), then `input_len` bytes of IR, either text
+ * or binary. The server answers with a ServerResponse followed by `output_len` bytes, which are the
+ * compiled output if `status` is 0 and an error message otherwise. A connection can be used for
+ * any number of requests, one after the other. Integers are in the host's byte order, since the
+ * server is only ever reached through a Unix socket or a pipe on the same machine.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <stdint.h>
+
+#define SERVER_REQUEST_MAGIC  0x51425955 // "UYBQ" when stored little endian
+#define SERVER_RESPONSE_MAGIC 0x52425955 // "UYBR" when stored little endian
+#define SERVER_MAX_OPTIONS_LEN 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t options_len;
+    uint64_t input_len;
+} ServerRequest;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t status;
+    uint64_t output_len;
+} ServerResponse;
+
+void run_server(char *socket_path);
@@ -0,0 +1,13 @@
+/* Header for ../src/stream.c, which compiles a file one function at a time.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <api.h>
+#include <lexer.h>
+#include <optimisation.h>
+
+typedef struct {
+    void (*build_function)(Function, AggregateType*, size_t, FILE*);
+    void (*build_header)(Global*, size_t, AggregateType*, size_t, FileDbg*, size_t, char**, size_t, FILE*);
+} StreamTarget;
+
+void compile_streamed(SourceBuf *src, StreamTarget target, Pipeline *pipeline, FILE *outf);
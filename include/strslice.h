@@ -11,3 +11,4 @@ typedef struct {
 String *string_from(char *from);
 void string_push(String *str, char *new);
 void string_push_fmt(String *str, char *fmt, ...);
+void string_free(String *str);
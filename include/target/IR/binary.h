@@ -0,0 +1,134 @@
+/* Header for ../../../src/target/IR/binary.c, the binary encoding of UYB's IR (.uybc files).
+ *
+ * A file is a BinHeader followed by fixed size, 8 byte aligned records, with the string table at the
+ * end. Every offset is from the start of the file, so it can be mapped anywhere and read in place.
+ * Names and string literals are stored once each in the string table and referred to by their index,
+ * so loading only has to intern each distinct string once instead of once per use. Integers are in
+ * the host's byte order, which the magic number is used to check.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <api.h>
+
+#define UYBC_MAGIC   0x43425955 // "UYBC" when stored little endian
+#define UYBC_VERSION 2
+#define UYBC_NO_STR  0xFFFFFFFF // string index for NULL
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_functions;
+    uint32_t num_globals;
+    uint32_t num_aggtypes;
+    uint32_t num_filesdbg;
+    uint32_t num_strings;
+    uint32_t reserved;
+    uint64_t functions;   // BinFunction[num_functions]
+    uint64_t globals;     // BinGlobal[num_globals]
+    uint64_t aggtypes;    // BinAggregateType[num_aggtypes]
+    uint64_t filesdbg;    // BinFileDbg[num_filesdbg]
+    uint64_t strings;     // uint64_t[num_strings], the offset of each NUL terminated string
+} BinHeader;
+
+typedef struct {
+    uint32_t label;       // string, or UYBC_NO_STR
+    uint8_t instruction;
+    uint8_t type;
+    uint8_t arg_type;
+    uint8_t is_signed;
+    uint8_t val_types[3];
+    uint8_t reserved[5];
+    /* Numbers are stored as is, labels and other names as string indices, and FunctionArgs, PhiArg
+     * and InlineAssembly values as the offset of a BinArgList, BinPhiVal or BinInlineAsm. */
+    uint64_t vals[3];
+} BinStatement;
+
+typedef struct {
+    uint32_t label;
+    uint32_t type_struct;
+    uint8_t type_is_struct;
+    uint8_t type;
+    uint8_t reserved[6];
+} BinFunctionArgument;
+
+typedef struct {
+    uint32_t name;
+    uint32_t return_struct;
+    uint8_t is_global;
+    uint8_t ret_is_struct;
+    uint8_t return_type;
+    uint8_t is_variadic;
+    uint32_t num_args;
+    uint32_t num_statements;
+    uint32_t reserved;
+    uint64_t args;        // BinFunctionArgument[num_args]
+    uint64_t statements;  // BinStatement[num_statements]
+} BinFunction;
+
+typedef struct {
+    uint64_t val;         // same encoding as BinStatement.vals
+    uint32_t struct_type;
+    uint8_t size;
+    uint8_t is_struct;
+    uint8_t val_type;
+    uint8_t reserved;
+} BinCallArg;
+
+typedef struct {
+    uint64_t num_args;
+    BinCallArg args[];
+} BinArgList;
+
+typedef struct {
+    uint64_t val;
+    uint32_t blklbl_name;
+    uint8_t type;
+    uint8_t reserved[3];
+} BinPhiVal;
+
+typedef struct {
+    uint64_t label;       // a value, since copy elimination can replace the label with a number
+    uint32_t reg;
+    uint8_t type;
+    uint8_t reserved[3];
+} BinAsmIO;
+
+typedef struct {
+    uint32_t assembly;
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+    uint32_t num_clobbers;
+    uint64_t inputs;      // BinAsmIO[num_inputs]
+    uint64_t outputs;     // BinAsmIO[num_outputs]
+    uint64_t clobbers;    // uint32_t[num_clobbers] of string indices
+} BinInlineAsm;
+
+typedef struct {
+    uint64_t val;         // a string index for StrLit values
+    uint8_t type;
+    uint8_t size;
+    uint8_t reserved[6];
+} BinGlobalVal;
+
+typedef struct {
+    uint32_t name;
+    uint32_t section;
+    uint64_t num_vals;
+    uint64_t alignment;
+    uint64_t vals;        // BinGlobalVal[num_vals]
+} BinGlobal;
+
+typedef struct {
+    uint32_t name;
+    uint32_t reserved;
+    uint64_t alignment;
+    uint64_t size_bytes;
+} BinAggregateType;
+
+typedef struct {
+    uint64_t id;
+    uint32_t fname;
+    uint32_t reserved;
+} BinFileDbg;
+
+bool is_binary_IR(char *buf, size_t len);
+Function **load_program_bin(char *buf, size_t len, Global ***globals_buf, AggregateType ***aggtypes_buf, FileDbg ***filesdbg_buf);
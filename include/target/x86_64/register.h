@@ -4,9 +4,7 @@
 #include <stdint.h>
 #include <api.h>
 
-#define update_regalloc() regalloc.statement_idx++
-
-static char *arg_regs[] = {
+static char *arg_regs[] __attribute__((unused)) = {
     "%rdi",
     "%rsi",
     "%rdx",
@@ -15,23 +13,40 @@ static char *arg_regs[] = {
     "%r9",
 };
 
+typedef struct {
+    size_t offset; // below %rbp, or 0 if the value isn't on the stack
+    Type size;
+} StackSlot;
+
 typedef struct {
     size_t bytes_rip_pad;
     char* **used_regs_vec;
     Function *current_fn;
     size_t statement_idx;
-    size_t* **labels_as_offsets;
+    BlockId current_block;  // the label of the block being compiled, or 0 if it doesn't have one
+    StackSlot *stack_slots; // indexed by ValueId
+    size_t *refs_left;      // indexed by ValueId, references to it in the statements not compiled yet
+    bool *keep_after_refs;  // indexed by ValueId, whether it has to stay where it is after its last reference
+    bool *is_arg;           // indexed by ValueId
+    size_t *phis_start;     // indexed by BlockId, where the phis taking a value from that block start in phis
+    size_t *phis;           // the statement of each phi, grouped by the blocks it takes values from
 } RegAlloc;
 
-extern RegAlloc regalloc;
+extern _Thread_local RegAlloc regalloc;
 
-extern char *label_reg_tab[5][3];
-extern intptr_t reg_alloc_tab[5][3];
+extern _Thread_local char *label_reg_tab[5][3];
+extern _Thread_local intptr_t reg_alloc_tab[5][3];
+void reg_reset();
+void reg_state_write(FILE *f);
+char *reg_state_read(char *buf);
 void reg_init_fn(Function func);
-char *reg_alloc(char *label, Type reg_size);
-char *label_to_reg(size_t offset, char *label, bool allow_noexist);
+void reg_next_statement();
+void reg_stack_slot(ValueId value, size_t offset, Type size);
+char *reg_alloc(ValueId value, Type reg_size);
+char *label_to_reg(size_t offset, ValueId label, bool allow_noexist);
 char *reg_as_size(char *reg, Type size);
+AggregateType *find_aggtype(char *name);
 Type size_from_reg(char *reg);
-char *label_to_reg_noresize(size_t offset, char *label, bool allow_noexist);
-char *reg_alloc_noresize(char *label, Type reg_size);
-Type get_reg_size(char *reg, char *expected_label);
+char *label_to_reg_noresize(size_t offset, ValueId value, bool allow_noexist);
+char *reg_alloc_noresize(ValueId value, Type reg_size);
+Type get_reg_size(char *reg, ValueId expected_label);
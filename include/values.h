@@ -0,0 +1,9 @@
+/* Header for ../src/values.c, which numbers the temporaries and block labels of each function.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#pragma once
+#include <api.h>
+
+void values_begin();
+ValueId value_id(char *name);
+BlockId block_id(char *name);
+void values_end(Function *fn);
@@ -17,6 +17,7 @@ typedef struct {
 void *vec_new(size_t data_size);
 size_t vec_size(void *vec_data);
 int vec_contains(void *vec_data, size_t val);
+void vec_free(void *vec_data);
 
 #define vec_push(vec_data, val) \
     do { \
@@ -39,4 +40,6 @@ int vec_contains(void *vec_data, size_t val);
  *      value = (*vec)[8];
  *  - To get the length of a vector, use vec_size():
  *      length_of_vector = vec_size(vec);
+ *  - To free a vector and its data once it's no longer needed, use vec_free():
+ *      vec_free(vec);
  */
@@ -0,0 +1,230 @@
+/* On-disk cache of compiled functions, so that functions which haven't changed since the last build
+ * don't have to be compiled again. Entries are content addressed: a target hashes everything its
+ * output depends on into a key, and the entry for that key is its output. Each entry is a file
+ * named after its key, written to a temporary file first and then renamed into place, so several
+ * processes (and threads) can use the same cache at once without seeing half written entries.
+ * Using an entry updates its modification time, and once the cache grows past its size limit the
+ * least recently used entries are removed.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <cache.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC 0x43435955 // "UYCC" when stored little endian
+// once the cache is too big, entries are removed until it's down to this fraction of the limit
+#define CACHE_EVICT_TO(max) ((max) / 4 * 3)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t len;
+    CacheKey key; // checked when reading, in case the file was cut short or renamed
+} CacheEntryHeader;
+
+static char *cache_dir;
+static size_t cache_max_bytes;
+static atomic_size_t hits, misses, stores, evictions;
+static atomic_size_t bytes_stored; // since the cache was opened
+
+// MurmurHash3's 128 bit variant for x64, which is in the public domain
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccd;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53;
+    k ^= k >> 33;
+    return k;
+}
+
+CacheKey cache_key(void *data, size_t len) {
+    uint8_t *bytes = (uint8_t*) data;
+    const uint64_t c1 = 0x87c37b91114253d5, c2 = 0x4cf5ad432745937f;
+    uint64_t h1 = 0, h2 = 0;
+    size_t num_blocks = len / 16;
+    for (size_t i = 0; i < num_blocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, &bytes[i * 16], 8);
+        memcpy(&k2, &bytes[i * 16 + 8], 8);
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    uint8_t *tail = &bytes[num_blocks * 16];
+    uint64_t k1 = 0, k2 = 0;
+    for (size_t i = len & 15; i > 8; i--)
+        k2 ^= (uint64_t) tail[i - 1] << ((i - 9) * 8);
+    if ((len & 15) > 8) {
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (size_t i = (len & 15) < 8 ? (len & 15) : 8; i > 0; i--)
+        k1 ^= (uint64_t) tail[i - 1] << ((i - 1) * 8);
+    if (len & 15) {
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1); h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+    return (CacheKey) {h1, h2};
+}
+
+// Entries are spread over 256 subdirectories by the first byte of their key, to keep each one small
+static void entry_path(CacheKey key, char *buf, size_t len) {
+    snprintf(buf, len, "%s/%02x/%014llx%016llx", cache_dir, (unsigned) (key.hi >> 56),
+             (unsigned long long) (key.hi & 0xffffffffffffff), (unsigned long long) key.lo);
+}
+
+/* Turns the cache on, with entries kept in `dir` (which is created if needed). Without it, every
+ * lookup misses and nothing is stored. */
+void cache_open(char *dir, size_t max_bytes) {
+    mkdir(dir, 0777);
+    cache_dir = dir;
+    cache_max_bytes = max_bytes;
+}
+
+bool cache_enabled() {
+    return cache_dir != NULL;
+}
+
+/* Returns the entry for `key` (with a NUL after it, which isn't counted in `len_buf`), which must be
+ * freed by the caller, or NULL if there isn't one. */
+char *cache_get(CacheKey key, size_t *len_buf) {
+    if (!cache_dir) return NULL;
+    char path[4096];
+    entry_path(key, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        misses++;
+        return NULL;
+    }
+    CacheEntryHeader header;
+    char *data = NULL;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != CACHE_MAGIC ||
+            header.key.lo != key.lo || header.key.hi != key.hi)
+        goto invalid;
+    data = malloc(header.len + 1);
+    if (!data || read(fd, data, header.len) != header.len) goto invalid;
+    data[header.len] = 0;
+    // this is what makes it the most recently used entry
+    futimens(fd, NULL);
+    close(fd);
+    hits++;
+    *len_buf = header.len;
+    return data;
+invalid:
+    free(data);
+    close(fd);
+    misses++;
+    return NULL;
+}
+
+/* Stores `data` as the entry for `key`. Failing to store it isn't an error, since it only means it
+ * has to be compiled again next time. */
+void cache_put(CacheKey key, void *data, size_t len) {
+    if (!cache_dir) return;
+    char tmp_path[4096], path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s/tmp.XXXXXX", cache_dir);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) return;
+    CacheEntryHeader header = {.magic = CACHE_MAGIC, .len = len, .key = key};
+    bool written = write(fd, &header, sizeof(header)) == sizeof(header) && write(fd, data, len) == len;
+    close(fd);
+    entry_path(key, path, sizeof(path));
+    *strrchr(path, '/') = 0;
+    mkdir(path, 0777);
+    path[strlen(path)] = '/';
+    if (!written || rename(tmp_path, path)) {
+        unlink(tmp_path);
+        return;
+    }
+    stores++;
+    bytes_stored += sizeof(header) + len;
+}
+
+typedef struct {
+    char *path;
+    struct timespec used;
+    size_t size;
+} CacheFile;
+
+static int cmp_used(const void *a, const void *b) {
+    struct timespec x = ((CacheFile*) a)->used, y = ((CacheFile*) b)->used;
+    if (x.tv_sec != y.tv_sec) return (x.tv_sec < y.tv_sec) ? -1 : 1;
+    if (x.tv_nsec != y.tv_nsec) return (x.tv_nsec < y.tv_nsec) ? -1 : 1;
+    return 0;
+}
+
+// Removes the least recently used entries until the cache fits. Returns the size of what's left.
+static size_t evict() {
+    size_t num_files = 0, capacity = 1024, total = 0;
+    CacheFile *files = (CacheFile*) malloc(sizeof(CacheFile) * capacity);
+    char path[4096];
+    for (int sub = 0; sub < 256; sub++) {
+        snprintf(path, sizeof(path), "%s/%02x", cache_dir, sub);
+        DIR *dir = opendir(path);
+        if (!dir) continue;
+        struct dirent *ent;
+        while ((ent = readdir(dir))) {
+            if (ent->d_name[0] == '.') continue;
+            char *file_path = malloc(strlen(path) + strlen(ent->d_name) + 2);
+            sprintf(file_path, "%s/%s", path, ent->d_name);
+            struct stat st;
+            if (stat(file_path, &st)) {
+                free(file_path);
+                continue;
+            }
+            if (num_files == capacity) files = (CacheFile*) realloc(files, sizeof(CacheFile) * (capacity *= 2));
+            files[num_files++] = (CacheFile) {file_path, st.st_mtim, st.st_size};
+            total += st.st_size;
+        }
+        closedir(dir);
+    }
+    qsort(files, num_files, sizeof(CacheFile), cmp_used);
+    for (size_t i = 0; i < num_files; i++) {
+        if (total > CACHE_EVICT_TO(cache_max_bytes) && !unlink(files[i].path)) {
+            total -= files[i].size;
+            evictions++;
+        }
+        free(files[i].path);
+    }
+    free(files);
+    return total;
+}
+
+/* Adds what this process stored to the cache's total size, which is shared between every process
+ * using it, and removes old entries if that's over the limit. The first to take the lock does the
+ * eviction, and the rest just add to the total. */
+void cache_close() {
+    if (!cache_dir || !bytes_stored) return;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/usage", cache_dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) return;
+    if (!flock(fd, LOCK_EX)) {
+        uint64_t usage = 0;
+        if (pread(fd, &usage, sizeof(usage), 0) != sizeof(usage)) usage = 0;
+        usage += bytes_stored;
+        if (usage > cache_max_bytes) usage = evict();
+        pwrite(fd, &usage, sizeof(usage), 0);
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+    bytes_stored = 0;
+}
+
+void cache_print_stats(FILE *f) {
+    size_t lookups = hits + misses;
+    fprintf(f, "Function cache: %zu hits, %zu misses (%.1f%% hit rate), %zu stored, %zu evicted.\n",
+            (size_t) hits, (size_t) misses, (lookups) ? 100.0 * hits / lookups : 0.0, (size_t) stores, (size_t) evictions);
+}
@@ -0,0 +1,114 @@
+/* Splits a function's statements into basic blocks and links them up with their predecessors and
+ * successors. A block starts at the start of the function, at each block label, and after each
+ * jump, return or halt (so code after one that isn't labelled gets a block of its own, which
+ * nothing jumps to). A block that doesn't end in one of those, or ends in jz, falls through to the
+ * next one.
+ * Whoever builds a Function calls cfg_build() once its values are numbered, and any pass which adds,
+ * removes or moves statements has to call it again before it returns, so the graph always matches
+ * the statements it's given. That also drops any analyses of the old graph (like the dominator
+ * tree) cached in the Function, so they're worked out again the next time they're asked for.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <cfg.h>
+#include <error.h>
+#include <vector.h>
+#include <arena.h>
+#include <utils.h>
+#include <string.h>
+
+bool is_terminator(Instruction instruction) {
+    return instruction == JMP || instruction == JNZ || instruction == JZ || instruction == RET || instruction == HLT;
+}
+
+// The block a phi operand comes from, or NO_BBLOCK if it names a block that doesn't exist
+size_t phi_pred(Function *fn, PhiVal *phi_val) {
+    if (phi_val->blklbl >= fn->num_blocks) return NO_BBLOCK;
+    return fn->label_bblocks[phi_val->blklbl];
+}
+
+// Points a jump to block label `from` at `to` instead
+void retarget(Statement *statement, BlockId from, BlockId to) {
+    if (!is_terminator(statement->instruction)) return;
+    for (size_t i = 0; i < 3; i++) {
+        if (statement->val_types[i] == BlkLbl && statement->vals[i] == from) statement->vals[i] = to;
+    }
+}
+
+static void add_succ(Function *fn, BasicBlock *block, uint64_t target, ValType type) {
+    // anything that isn't a block label can't be followed, and the target will complain about it
+    if (type != BlkLbl) return;
+    size_t succ = (target < fn->num_blocks) ? fn->label_bblocks[target] : NO_BBLOCK;
+    if (succ == NO_BBLOCK)
+        compile_error("Jump to a block label which isn't in function %s: @%s\n", fn->name, fn->block_names[target]);
+    for (size_t i = 0; i < block->num_succs; i++) {
+        if (block->succs[i] == succ) return;
+    }
+    block->succs[block->num_succs++] = succ;
+}
+
+void cfg_build(Function *fn) {
+    BasicBlock **blocks = vec_new(sizeof(BasicBlock));
+    fn->label_bblocks = (size_t*) aalloc(sizeof(size_t) * fn->num_blocks);
+    memset(fn->label_bblocks, 0xFF, sizeof(size_t) * fn->num_blocks);
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement *statement = &fn->statements[s];
+        bool starts_block = !vec_size(blocks) || is_terminator(fn->statements[s - 1].instruction);
+        if (statement->instruction == BLKLBL) {
+            if (statement->val_types[0] != BlkLbl) compile_error("Expected block label in BLKLBL statement.\n");
+            BlockId label = statement->vals[0];
+            if (fn->label_bblocks[label] != NO_BBLOCK)
+                compile_error("Block label is defined more than once in function %s: @%s\n", fn->name, fn->block_names[label]);
+            fn->label_bblocks[label] = vec_size(blocks);
+            vec_push(blocks, ((BasicBlock) {.label = label, .start = s}));
+        } else if (starts_block) {
+            vec_push(blocks, ((BasicBlock) {.label = 0, .start = s}));
+        }
+        (*blocks)[vec_size(blocks) - 1].end = s + 1;
+    }
+    size_t num_bblocks = vec_size(blocks);
+    fn->bblocks = vec_into_arena(blocks);
+    fn->num_bblocks = num_bblocks;
+    // anything worked out from the old graph is out of date now
+    fn->dom_tree = NULL;
+    for (size_t b = 0; b < num_bblocks; b++) {
+        BasicBlock *block = &fn->bblocks[b];
+        Statement last = fn->statements[block->end - 1];
+        if (last.instruction == JMP) {
+            add_succ(fn, block, last.vals[0], last.val_types[0]);
+        } else if (last.instruction == JNZ) {
+            add_succ(fn, block, last.vals[1], last.val_types[1]);
+            add_succ(fn, block, last.vals[2], last.val_types[2]);
+        } else if (last.instruction == JZ) {
+            add_succ(fn, block, last.vals[1], last.val_types[1]);
+            block->falls_through = true;
+        } else if (last.instruction != RET && last.instruction != HLT) {
+            block->falls_through = true;
+        }
+        if (block->falls_through && b + 1 < num_bblocks && !(block->num_succs && block->succs[0] == b + 1))
+            block->succs[block->num_succs++] = b + 1;
+    }
+    for (size_t b = 0; b < num_bblocks; b++) {
+        for (size_t i = 0; i < fn->bblocks[b].num_succs; i++)
+            fn->bblocks[fn->bblocks[b].succs[i]].num_preds++;
+    }
+    for (size_t b = 0; b < num_bblocks; b++) {
+        fn->bblocks[b].preds = (size_t*) aalloc(sizeof(size_t) * fn->bblocks[b].num_preds);
+        fn->bblocks[b].num_preds = 0;
+    }
+    for (size_t b = 0; b < num_bblocks; b++) {
+        for (size_t i = 0; i < fn->bblocks[b].num_succs; i++) {
+            BasicBlock *succ = &fn->bblocks[fn->bblocks[b].succs[i]];
+            succ->preds[succ->num_preds++] = b;
+        }
+    }
+}
+
+// Returns the index of the block that `statement` is in
+size_t cfg_block_of_statement(Function *fn, size_t statement) {
+    size_t low = 0, high = fn->num_bblocks;
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (fn->bblocks[mid].start <= statement) low = mid;
+        else high = mid;
+    }
+    return low;
+}
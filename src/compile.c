@@ -0,0 +1,72 @@
+/* Runs the whole compiler on a source file which is already in memory, choosing between compiling
+ * it one function at a time and all at once. Shared by the command line and the compile server.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <compile.h>
+#include <api.h>
+#include <parser.h>
+#include <vector.h>
+#include <arena.h>
+#include <intern.h>
+#include <optimisation.h>
+#include <stream.h>
+#include <target/IR/binary.h>
+#include <string.h>
+
+void (*targets[])(Function*, size_t, Global*, size_t, AggregateType*, size_t, FileDbg*, size_t, FILE*) = {
+    build_program_x86_64,
+    build_program_IR,
+};
+
+StreamTarget stream_targets[] = {
+    {build_function_x86_64, build_header_x86_64},
+    {build_function_IR,     build_header_IR},
+};
+
+// For targets that keep state between functions
+void (*target_resets[])() = {
+    reset_x86_64,
+    NULL,
+};
+
+// Returns false if there's no target called `s`
+bool str_as_target(char *s, Target *target_buf) {
+    if (!strcmp(s, "x86_64")) *target_buf = X86_64;
+    else if (!strcmp(s, "IR")) *target_buf = IR;
+    else return false;
+    return true;
+}
+
+/* `src` must have been opened with source_open() or otherwise hold the whole input. Binary IR is
+ * recognised by its contents. Pipelines with module passes (like inline) need the whole program at
+ * once, so they're always compiled all at once. */
+void compile_source(SourceBuf *src, CompileOptions *opts, FILE *outf) {
+    bool is_binary = is_binary_IR(src->data, src->len);
+    if (!opts->batch && !opts->emit_bin && !is_binary && opts->lex_threads == 1 && !pipeline_has_module_pass(&opts->pipeline)) {
+        compile_streamed(src, stream_targets[opts->target], &opts->pipeline, outf);
+        return;
+    }
+    Global **globals;
+    AggregateType **aggs;
+    FileDbg **files_dbg;
+    Function **functs;
+    if (is_binary) {
+        functs = load_program_bin(src->data, src->len, &globals, &aggs, &files_dbg);
+    } else {
+        Token **toks = lex_file(src, opts->lex_threads);
+        functs = parse_program(toks, &globals, &aggs, &files_dbg);
+    }
+    size_t num_functions = optimise(*functs, vec_size(functs), &opts->pipeline);
+    // Assembly codegen
+    if (opts->emit_bin)
+        build_program_IR_bin(*functs, num_functions, *globals, vec_size(globals), *aggs, vec_size(aggs), *files_dbg, vec_size(files_dbg), outf);
+    else
+        targets[opts->target](*functs, num_functions, *globals, vec_size(globals), *aggs, vec_size(aggs), *files_dbg, vec_size(files_dbg), outf);
+}
+
+/* Puts this thread back the way it was before compile_source(), so the next source compiled on it
+ * gives the same output as it would on its own. Memory is kept to be reused rather than freed. */
+void compile_reset(CompileOptions *opts) {
+    arena_reset(&arena);
+    intern_reset();
+    if (target_resets[opts->target]) target_resets[opts->target]();
+}
@@ -0,0 +1,49 @@
+/* Reporting of errors in the program being compiled. Normally an error is printed and UYB exits,
+ * but a caller compiling several things in one process (like one of many input files) can catch
+ * the error instead, so that it only fails the one thing that caused it. Catching is per thread.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <error.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static _Thread_local jmp_buf *recover_to;
+static _Thread_local char *error_msg;
+
+/* Takes a printf style message (ending in a new line, like the rest of UYB's output). Never returns:
+ * either it jumps back to catch_compile_error() or it exits. */
+void compile_error(char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (!recover_to) {
+        vprintf(fmt, args);
+        exit(1);
+    }
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int len = vsnprintf(NULL, 0, fmt, args_copy);
+    va_end(args_copy);
+    error_msg = malloc(len + 1);
+    vsnprintf(error_msg, len + 1, fmt, args);
+    va_end(args);
+    longjmp(*recover_to, 1);
+}
+
+/* Calls fn(arg), returning NULL if it finished or the message if it failed with compile_error(), in
+ * which case the message must be freed by the caller. Anything fn was in the middle of is abandoned,
+ * so the caller must be able to clean up after it without fn's help. */
+char *catch_compile_error(void (*fn)(void*), void *arg) {
+    jmp_buf env;
+    jmp_buf *prev = recover_to;
+    recover_to = &env;
+    if (setjmp(env)) {
+        recover_to = prev;
+        char *msg = error_msg;
+        error_msg = NULL;
+        return msg;
+    }
+    fn(arg);
+    recover_to = prev;
+    return NULL;
+}
@@ -0,0 +1,57 @@
+/* Hash map from integers to integers, for looking things up by a key which isn't dense enough to index
+ * an array with. It uses open addressing with linear probing, and lives in an arena so that it goes
+ * away along with whatever it was made for. See ../include/hashmap.h for how to use it.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <hashmap.h>
+#include <string.h>
+
+// Fibonacci hashing: the top bits of the key multiplied by 2^64 / phi are well spread out
+static size_t slot_for(HashMap *map, uint64_t key) {
+    return (key * 0x9E3779B97F4A7C15ULL) >> (64 - __builtin_ctzll(map->capacity));
+}
+
+static void alloc_entries(HashMap *map, size_t capacity) {
+    map->capacity = capacity;
+    map->entries = (HashEntry*) arena_alloc(map->arena, sizeof(HashEntry) * capacity);
+    memset(map->entries, 0, sizeof(HashEntry) * capacity);
+}
+
+void hashmap_init(HashMap *map, Arena *arena, size_t expected_len) {
+    size_t capacity = 16;
+    // keep the load factor under 1/2
+    while (capacity < expected_len * 2) capacity *= 2;
+    map->arena = arena;
+    map->len = 0;
+    alloc_entries(map, capacity);
+}
+
+static HashEntry *find_entry(HashMap *map, uint64_t key) {
+    size_t slot = slot_for(map, key);
+    while (map->entries[slot].key != HASHMAP_NO_KEY && map->entries[slot].key != key)
+        slot = (slot + 1) & (map->capacity - 1);
+    return &map->entries[slot];
+}
+
+static void grow(HashMap *map) {
+    HashEntry *old_entries = map->entries;
+    size_t old_capacity = map->capacity;
+    alloc_entries(map, old_capacity * 2);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].key != HASHMAP_NO_KEY) *find_entry(map, old_entries[i].key) = old_entries[i];
+    }
+}
+
+void hashmap_put(HashMap *map, uint64_t key, uint64_t val) {
+    if ((map->len + 1) * 2 > map->capacity) grow(map);
+    HashEntry *entry = find_entry(map, key);
+    if (entry->key == HASHMAP_NO_KEY) map->len++;
+    *entry = (HashEntry) {.key = key, .val = val};
+}
+
+// Returns false if `key` isn't in the map, otherwise stores its value in val_buf
+bool hashmap_get(HashMap *map, uint64_t key, uint64_t *val_buf) {
+    HashEntry *entry = find_entry(map, key);
+    if (entry->key == HASHMAP_NO_KEY) return false;
+    *val_buf = entry->val;
+    return true;
+}
@@ -0,0 +1,93 @@
+/* String interning table for UYB. Every label, symbol, block label and aggregate type name in the
+ * IR goes through here, so each distinct name has exactly one canonical pointer which can be
+ * compared by identity, as well as a dense integer ID which can be used to index side tables.
+ * The table is an open addressing hash set, and both it and the strings live in their own arena,
+ * since names have to outlive the per-function memory in the main arena. Each thread has its own
+ * table, so files compiled in parallel don't share (or have to lock) anything.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <intern.h>
+#include <stdint.h>
+#include <string.h>
+#include <arena.h>
+
+// Stored right before the string itself, so that the ID can be found from an interned pointer
+typedef struct {
+    uint64_t hash;
+    uint32_t id;
+    uint32_t len;
+    char str[];
+} InternEntry;
+
+static _Thread_local Arena intern_arena;
+static _Thread_local InternEntry **table;
+static _Thread_local size_t table_capacity; // always a power of two
+static _Thread_local size_t num_interned;
+
+static uint64_t hash_str(char *str, size_t len) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static void table_grow() {
+    size_t old_capacity = table_capacity;
+    InternEntry **old_table = table;
+    table_capacity = (old_capacity) ? old_capacity * 2 : 1024;
+    table = (InternEntry**) arena_alloc(&intern_arena, sizeof(InternEntry*) * table_capacity);
+    memset(table, 0, sizeof(InternEntry*) * table_capacity);
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!old_table[i]) continue;
+        size_t slot = old_table[i]->hash & (table_capacity - 1);
+        while (table[slot]) slot = (slot + 1) & (table_capacity - 1);
+        table[slot] = old_table[i];
+    }
+}
+
+/* Returns the canonical NUL terminated copy of the first `len` bytes of `str`, which doesn't
+ * need to be NUL terminated itself. */
+char *intern(char *str, size_t len) {
+    // keep the load factor under 1/2
+    if ((num_interned + 1) * 2 > table_capacity) table_grow();
+    uint64_t hash = hash_str(str, len);
+    size_t slot = hash & (table_capacity - 1);
+    for (; table[slot]; slot = (slot + 1) & (table_capacity - 1)) {
+        InternEntry *entry = table[slot];
+        if (entry->hash == hash && entry->len == len && !memcmp(entry->str, str, len))
+            return entry->str;
+    }
+    InternEntry *entry = (InternEntry*) arena_alloc(&intern_arena, sizeof(InternEntry) + len + 1);
+    entry->hash = hash;
+    entry->id = num_interned++;
+    entry->len = len;
+    memcpy(entry->str, str, len);
+    entry->str[len] = 0;
+    table[slot] = entry;
+    return entry->str;
+}
+
+char *intern_cstr(char *str) {
+    return intern(str, strlen(str));
+}
+
+// `interned` must have been returned by intern(). IDs start at 0 and are given out in order.
+size_t intern_id(char *interned) {
+    return ((InternEntry*) (interned - offsetof(InternEntry, str)))->id;
+}
+
+// Returns the number of distinct strings interned so far, which is one more than the highest ID
+size_t intern_count() {
+    return num_interned;
+}
+
+/* Forgets every string interned by this thread, so that IDs start at 0 again. The memory is kept
+ * for the strings interned after this, so nothing returned by intern() before it can be used. */
+void intern_reset() {
+    arena_reset(&intern_arena);
+    table = NULL;
+    table_capacity = 0;
+    num_interned = 0;
+}
@@ -1,11 +1,18 @@
 /* Textual IR lexer for the UYB compiler backend project.
  * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
 #include <lexer.h>
+#include <error.h>
 #include <vector.h>
 #include <string.h>
 #include <ctype.h>
 #include <arena.h>
 #include <utils.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lexscan.h>
+#include <intern.h>
+#include <pthread.h>
 
 #define valid_label_char(ch) (ch == '.' || ch == '_' || isdigit(ch) || isalpha(ch))
 
@@ -15,8 +22,7 @@ Type char_to_type(char t_ch) {
     else if (t_ch == 'w') return Bits32;
     else if (t_ch == 'l') return Bits64;
     else {
-        printf("Invalid type: %c\n", t_ch);
-        exit(1);
+        compile_error("Invalid type: %c\n", t_ch);
     }
 }
 
@@ -46,11 +52,40 @@ char *token_to_str(TokenType ttype) {
     else return "TokInvalid";
 }
 
-// `ret` argument is a buffer for a vector which all the tokens will be pushed to.
-void lex_line(char *str, size_t line_num, Token **ret) {
-    size_t len = strlen(str);
+#define span_is(str, len, kw) (len == sizeof(kw) - 1 && !memcmp(str, kw, sizeof(kw) - 1))
+
+/* Returns a NUL terminated string for the span a label/string token refers to. Names (labels,
+ * symbols, block labels and aggregate types) are interned so that each one has a single canonical
+ * pointer, while string literals get their own copy since some users (like inline assembly) edit them. */
+char *token_str(Token tok) {
+    if (tok.type != TokStrLit)
+        return intern((char*) tok.val, tok.len);
+    char *buf = aalloc(tok.len + 1);
+    memcpy(buf, (char*) tok.val, tok.len);
+    buf[tok.len] = 0;
+    return buf;
+}
+
+// Returns the value of a token in the form that the IR stores it in (integers as-is, spans as strings)
+uint64_t token_value(Token tok) {
+    if (tok.type == TokLabel || tok.type == TokRawStr || tok.type == TokStrLit ||
+            tok.type == TokBlockLabel || tok.type == TokAggType)
+        return (uint64_t) token_str(tok);
+    return tok.val;
+}
+
+/* `str` is a single line of length `len` (not including the new line, and doesn't need to be NUL
+ * terminated). `ret` argument is a buffer for a vector which all the tokens will be pushed to.
+ * Label and string tokens store a pointer into `str` in val and their length in len, so the buffer
+ * must stay alive until the tokens have been parsed. */
+void lex_line(char *str, size_t len, size_t line_num, Token **ret) {
     for (size_t i = 0; i < len; i++) {
-        if      (str[i] == '\t' || str[i] == ' ' || str[i] == '\r' || str[i] == 0) continue;
+        if (str[i] == '\t' || str[i] == ' ' || str[i] == '\r' || str[i] == 0) {
+            // most runs of whitespace are a single space, which isn't worth a call to the scanner
+            if (i + 1 < len && (str[i + 1] == '\t' || str[i + 1] == ' ' || str[i + 1] == '\r' || str[i + 1] == 0))
+                i += lexscan.skip_space(&str[i], len - i) - 1;
+            continue;
+        }
         else if (str[i] == '#') break;
         else if (str[i] == '(') vec_push(ret, ((Token) {.line=line_num,.type=TokLParen,.val=0}));
         else if (str[i] == ')') vec_push(ret, ((Token) {.line=line_num,.type=TokRParen,.val=0}));
@@ -59,120 +94,256 @@ void lex_line(char *str, size_t line_num, Token **ret) {
         else if (str[i] == ',') vec_push(ret, ((Token) {.line=line_num,.type=TokComma,.val=0}));
         else if (str[i] == ':') vec_push(ret, ((Token) {.line=line_num,.type=TokColon,.val=0}));
         else if (str[i] == '|') vec_push(ret, ((Token) {.line=line_num,.type=TokBar,.val=0}));
-        else if (!memcmp(&str[i], "...", 3)) {
+        else if (len - i >= 3 && !memcmp(&str[i], "...", 3)) {
             vec_push(ret, ((Token) {.line=line_num,.type=TokTripleDot,.val=0}));
             i += 2;
         }
-        else if (str[i] == '=' && isalpha(str[i + 1])) {
+        else if (str[i] == '=' && i + 1 < len && isalpha(str[i + 1])) {
             vec_push(ret, ((Token) {.line=line_num,.type=TokAssign,.val=char_to_type(str[i+1])}));
             i++;
         } else if (str[i] == '=') {
             vec_push(ret, ((Token) {.line=line_num,.type=TokEqu,.val=0}));
         } else if (isdigit(str[i]) || str[i] == '-') {
-            size_t dig = 0;
-            for (; isdigit(str[i + dig]) || (str[i + dig] == '-' && dig == 0); dig++);
-            char *buf = aalloc(dig + 1); // perhaps I should move this to a fixed size buffer?
-            memcpy(buf, &str[i], dig);
-            buf[dig] = 0;
-            int negative_flag = 0;
-            if (str[i] == '-') {
-                negative_flag = true;
-                buf++;
-            }
-            uint64_t val = strtoll(buf,NULL,10);
-            if (negative_flag) {
-                val = -val;
-            }
+            // parsed in place rather than copied out for strtoll
+            bool negative = str[i] == '-';
+            size_t dig = negative;
+            uint64_t val = 0;
+            for (; i + dig < len && isdigit(str[i + dig]); dig++)
+                val = val * 10 + (str[i + dig] - '0');
+            if (negative) val = -val;
             vec_push(ret, ((Token) {.line=line_num,.type=TokInteger,.val=val}));
             i += dig - 1;
         } else if (str[i] == '"') {
-            size_t dig = 0;
-            for (; !(str[i + dig] == '"' && dig); dig++);
-            char *buf = aalloc(dig + 1);
-            memcpy(buf, &str[i + 1], dig);
-            buf[dig - 1] = 0;
-            vec_push(ret, ((Token) {.line=line_num,.type=TokStrLit,.val=(uint64_t) buf}));
+            size_t dig = 1;
+            for (; i + dig < len && str[i + dig] != '"'; dig++);
+            if (i + dig == len) {
+                compile_error("Unterminated string literal on line %zu\n", line_num);
+            }
+            vec_push(ret, ((Token) {.line=line_num,.type=TokStrLit,.val=(uint64_t) &str[i + 1],.len=dig - 1}));
             i += dig;
         } else if (str[i] == '%' || str[i] == '$' || str[i] == '@' || str[i] == ':') {
             i++;
-            size_t dig = 0;
-            for (; valid_label_char(str[i + dig]); dig++);
-            char *buf = aalloc(dig + 2);
-            memcpy(buf, &str[i], dig + 1);
-            buf[dig] = 0;
-            if (str[i - 1] == '%')
-                vec_push(ret, ((Token) {.line=line_num,.type=TokLabel,.val=(uint64_t) buf}));
-            else if (str[i - 1] == '$')
-                vec_push(ret, ((Token) {.line=line_num,.type=TokRawStr,.val=(uint64_t) buf}));
-            else if (str[i - 1] == '@')
-                vec_push(ret, ((Token) {.line=line_num,.type=TokBlockLabel,.val=(uint64_t) buf}));
-            else if (str[i - 1] == ':')
-                vec_push(ret, ((Token) {.line=line_num,.type=TokAggType,.val=(uint64_t) buf}));
+            size_t dig = lexscan.label_end(&str[i], len - i);
+            Token tok = {.line=line_num,.val=(uint64_t) &str[i],.len=dig};
+            if      (str[i - 1] == '%') tok.type = TokLabel;
+            else if (str[i - 1] == '$') tok.type = TokRawStr;
+            else if (str[i - 1] == '@') tok.type = TokBlockLabel;
+            else                        tok.type = TokAggType;
+            vec_push(ret, tok);
             i += dig - 1;
         } else if (valid_label_char(str[i])) {
-            size_t dig = 0;
-            for (; valid_label_char(str[i + dig]); dig++);
-            char *buf = aalloc(dig + 1);
-            memcpy(buf, &str[i], dig);
-            buf[dig] = 0;
-            if (!strcmp(buf, "function")) {
+            size_t dig = lexscan.label_end(&str[i], len - i);
+            char *word = &str[i];
+            if (span_is(word, dig, "function")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokFunction,.val=0}));
-            } else if (!strcmp(buf, "export")) {
+            } else if (span_is(word, dig, "export")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokExport,.val=0}));
-            } else if (!strcmp(buf, "data")) {
+            } else if (span_is(word, dig, "data")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokData,.val=0}));
-            } else if (!strcmp(buf, "section")) {
+            } else if (span_is(word, dig, "section")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokSection,.val=0}));
-            } else if (!strcmp(buf, "align")) {
+            } else if (span_is(word, dig, "align")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokAlign,.val=0}));
-            } else if (!strcmp(buf, "type")) {
+            } else if (span_is(word, dig, "type")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokType,.val=0}));
-            } else if (!strcmp(buf, ".file")) {
+            } else if (span_is(word, dig, ".file")) {
                 vec_push(ret, ((Token) {.line=line_num,.type=TokFile,.val=0}));
             } else {
-                vec_push(ret, ((Token) {.line=line_num,.type=TokRawStr,.val=(uint64_t) buf}));
+                vec_push(ret, ((Token) {.line=line_num,.type=TokRawStr,.val=(uint64_t) word,.len=dig}));
             }
             i += dig - 1;
         } else {
-            printf("Invalid token on line %zu: %c (%u)\n", line_num, str[i], str[i]);
-            exit(1);
+            compile_error("Invalid token on line %zu: %c (%u)\n", line_num, str[i], str[i]);
         }
     }
 }
 
-Token **lex_file(FILE *f) {
-    ssize_t sz;
-    char *contents;
-    Token **ret = vec_new(sizeof(Token));
-    size_t ln = 1;
-    size_t start = 0;
-    size_t end = 0;
-    if (f == stdin) {
-        contents = read_full_stdin();
-        sz = strlen(contents);
-        goto end_readfile;
+/* Maps the file into memory if possible, otherwise reads it into a growable buffer (for stdin and
+ * anything else that can't be mapped, like pipes). */
+static pthread_once_t lexscan_once = PTHREAD_ONCE_INIT;
+
+void source_open(FILE *f, SourceBuf *src) {
+    struct stat st;
+    pthread_once(&lexscan_once, lexscan_init);
+    src->is_mapped = false;
+    if (f != stdin && !fstat(fileno(f), &st) && S_ISREG(st.st_mode)) {
+        src->len = st.st_size;
+        if (!src->len) {
+            src->data = NULL;
+            return;
+        }
+        src->data = mmap(NULL, src->len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (src->data != MAP_FAILED) {
+            madvise(src->data, src->len, MADV_SEQUENTIAL);
+            src->is_mapped = true;
+            return;
+        }
+    }
+    src->data = read_full_file(f, &src->len);
+    if (!src->data) {
+        compile_error("Failed to read from file.\n");
+    }
+}
+
+/* For a source that's already in memory. It stays owned by the caller, so it mustn't be closed with
+ * source_close(). */
+void source_from_buffer(char *data, size_t len, SourceBuf *src) {
+    pthread_once(&lexscan_once, lexscan_init);
+    *src = (SourceBuf) {.data = data, .len = len, .is_mapped = false};
+}
+
+void source_close(SourceBuf *src) {
+    if (src->is_mapped)
+        munmap(src->data, src->len);
+    else
+        free(src->data);
+    src->data = NULL;
+}
+
+/* Lexes the line at the start of `buf` (and any comment after it), pushing its tokens and a
+ * TokNewLine to `ret`. Returns the number of bytes used, including the new line if there is one. */
+static size_t lex_next_line(char *buf, size_t len, size_t line_num, Token **ret) {
+    size_t line_len = lexscan.line_end(buf, len);
+    size_t next = line_len;
+    if (line_len < len && buf[line_len] == '#') {
+        // the rest of the line is a comment, unless the # is inside a string literal
+        next = line_len + lexscan.newline(&buf[line_len], len - line_len);
+        if (memchr(buf, '"', line_len)) line_len = next;
     }
-    fseek(f, 0, SEEK_END);
-    if ((sz = ftell(f)) < 0) {
-        printf("Failed to get file length (ftell error).\n");
-        exit(1);
+    lex_line(buf, line_len, line_num, ret);
+    vec_push(ret, ((Token) {.line=line_num,.type=TokNewLine,.val=0}));
+    return (next == len) ? len : next + 1;
+}
+
+/* Lexes `len` bytes of source starting at line `first_line`, pushing the tokens to `ret`.
+ * The first byte of `buf` must be the start of a line. */
+void lex_buffer(char *buf, size_t len, size_t first_line, Token **ret) {
+    size_t ln = first_line;
+    while (len) {
+        size_t used = lex_next_line(buf, len, ln++, ret);
+        buf += used;
+        len -= used;
+    }
+}
+
+/* Lexes lines from the start of `buf` until the end of the next top level item (a function, data,
+ * type or .file), for compiling one function at a time. Returns the number of bytes used, and
+ * `*line` is moved past the lines that were lexed. The tokens are exactly the same as the ones
+ * lex_buffer() would give for those lines. */
+size_t lex_item(char *buf, size_t len, size_t *line, Token **ret) {
+    size_t at = 0;
+    size_t depth = 0;
+    bool seen_brace = false;
+    bool is_file = false;
+    bool is_empty = true;
+    while (at < len) {
+        size_t first_tok = vec_size(ret);
+        at += lex_next_line(&buf[at], len - at, (*line)++, ret);
+        for (size_t t = first_tok; t < vec_size(ret); t++) {
+            TokenType type = (*ret)[t].type;
+            if (is_empty && type != TokNewLine) {
+                is_empty = false;
+                is_file = type == TokFile;
+            }
+            if (type == TokLBrace) {
+                depth++;
+                seen_brace = true;
+            } else if (type == TokRBrace && depth) {
+                depth--;
+            }
+        }
+        if (!depth && (seen_brace || is_file)) break;
+    }
+    return at;
+}
+
+// Files are only split for parallel lexing into chunks of at least this size
+#define MIN_LEX_CHUNK (256 * 1024)
+
+typedef struct LexChunk LexChunk;
+
+struct LexChunk {
+    char *buf;
+    size_t len;
+    size_t num_lines;
+    Token **toks;
+    size_t idx;
+    LexChunk *chunks; // all the chunks, so the lines in the previous ones can be counted
+    pthread_barrier_t *lines_counted;
+};
+
+static void *lex_chunk(void *arg) {
+    LexChunk *chunk = (LexChunk*) arg;
+    /* Count the lines in this chunk first so that, once every thread has done the same, the line
+     * number this chunk starts at is known and tokens (and error messages) have the right line. */
+    chunk->num_lines = 0;
+    for (size_t at = 0; at < chunk->len; at++) {
+        at += lexscan.newline(&chunk->buf[at], chunk->len - at);
+        chunk->num_lines++;
     }
-    fseek(f, 0, SEEK_SET);
-    contents = aalloc(sz + 1);
-    if (!fread(contents, sz, 1, f)) {
-        printf("Failed to read from file.\n");
-        exit(1);
+    pthread_barrier_wait(chunk->lines_counted);
+    size_t first_line = 1;
+    for (size_t i = 0; i < chunk->idx; i++)
+        first_line += chunk->chunks[i].num_lines;
+    chunk->toks = vec_new(sizeof(Token));
+    lex_buffer(chunk->buf, chunk->len, first_line, chunk->toks);
+    return NULL;
+}
+
+/* Splits the buffer at new lines into roughly equal chunks, lexes each chunk on its own thread,
+ * then concatenates the results so that the tokens are exactly the same as lexing it serially. */
+static void lex_parallel(char *buf, size_t len, size_t num_threads, Token **ret) {
+    LexChunk *chunks = (LexChunk*) malloc(sizeof(LexChunk) * num_threads);
+    pthread_t *threads = (pthread_t*) malloc(sizeof(pthread_t) * num_threads);
+    pthread_barrier_t lines_counted;
+    size_t num_chunks = 0;
+    size_t start = 0;
+    for (size_t i = 1; i <= num_threads && start < len; i++) {
+        size_t end = len;
+        if (i != num_threads) {
+            end = (len / num_threads) * i;
+            if (end < start) end = start;
+            end += lexscan.newline(&buf[end], len - end);
+            if (end < len) end++; // include the new line
+        }
+        chunks[num_chunks] = (LexChunk) {
+            .buf = &buf[start],
+            .len = end - start,
+            .idx = num_chunks,
+            .chunks = chunks,
+            .lines_counted = &lines_counted,
+        };
+        num_chunks++;
+        start = end;
     }
-end_readfile:
-    for (; end <= sz; end++) {
-        if (contents[end] == '\n') {
-            contents[end] = 0;
-            lex_line(&contents[start], ln, ret);
-            vec_push(ret, ((Token) {.line=ln,.type=TokNewLine,.val=0}));
-            start = end + 1;
-            ln++;
+    pthread_barrier_init(&lines_counted, NULL, num_chunks);
+    for (size_t i = 0; i < num_chunks; i++) {
+        if (pthread_create(&threads[i], NULL, lex_chunk, &chunks[i])) {
+            compile_error("Failed to create lexer thread.\n");
         }
     }
-    if (f == stdin) free(contents);
+    for (size_t i = 0; i < num_chunks; i++) {
+        pthread_join(threads[i], NULL);
+        size_t num_toks = vec_size(chunks[i].toks);
+        for (size_t t = 0; t < num_toks; t++)
+            vec_push(ret, (*chunks[i].toks)[t]);
+        vec_free(chunks[i].toks);
+    }
+    pthread_barrier_destroy(&lines_counted);
+    free(threads);
+    free(chunks);
+}
+
+/* `src` must have been opened with source_open(). Tokens point into it, so it must not be closed
+ * with source_close() until after the tokens have been parsed. Files big enough to be worth it are
+ * lexed using up to `num_threads` threads. */
+Token **lex_file(SourceBuf *src, size_t num_threads) {
+    Token **ret = vec_new(sizeof(Token));
+    if (num_threads > src->len / MIN_LEX_CHUNK)
+        num_threads = src->len / MIN_LEX_CHUNK;
+    if (num_threads > 1)
+        lex_parallel(src->data, src->len, num_threads, ret);
+    else
+        lex_buffer(src->data, src->len, 1, ret);
     return ret;
 }
@@ -0,0 +1,227 @@
+/* Vectorised character classification for the textual IR lexer. Each scanner has a scalar version
+ * and SSE2/AVX2 versions which classify 16/32 bytes at a time, and the best one which the CPU
+ * supports is picked at runtime. All versions must give exactly the same results.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <lexscan.h>
+#include <ctype.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LEXSCAN_X86
+#include <immintrin.h>
+#endif
+
+LexScanner lexscan;
+
+#define is_space(ch) (ch == ' ' || ch == '\t' || ch == '\r' || ch == 0)
+#define is_label_char(ch) (ch == '.' || ch == '_' || isdigit(ch) || isalpha(ch))
+
+static size_t skip_space_scalar(const char *str, size_t len) {
+    size_t i = 0;
+    for (; i < len && is_space(str[i]); i++);
+    return i;
+}
+
+static size_t label_end_scalar(const char *str, size_t len) {
+    size_t i = 0;
+    for (; i < len && is_label_char(str[i]); i++);
+    return i;
+}
+
+static size_t line_end_scalar(const char *str, size_t len) {
+    size_t i = 0;
+    for (; i < len && str[i] != '\n' && str[i] != '#'; i++);
+    return i;
+}
+
+static size_t newline_scalar(const char *str, size_t len) {
+    size_t i = 0;
+    for (; i < len && str[i] != '\n'; i++);
+    return i;
+}
+
+#ifdef LEXSCAN_X86
+/* Most runs the lexer scans (whitespace between tokens, short labels) are only a few bytes long, so
+ * setting up a vector compare for them costs more than it saves. The vector scanners check the first
+ * SCALAR_HEAD bytes one at a time and only start classifying whole vectors if the run is longer. */
+#define SCALAR_HEAD 16
+
+/* The masks below have a byte set to 0xFF where the character is part of the run being scanned.
+ * Ranges are checked with signed compares, which is fine since everything being looked for is
+ * ASCII and bytes >= 0x80 are negative so they never match. */
+
+static inline __m128i space_mask_sse2(__m128i c) {
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_set1_epi8('\t'))),
+                        _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(c, _mm_setzero_si128())));
+}
+
+static inline __m128i label_mask_sse2(__m128i c) {
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20)); // folds upper case into lower case
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i punct = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('.')), _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), punct);
+}
+
+static inline __m128i line_end_mask_sse2(__m128i c) {
+    return _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(c, _mm_set1_epi8('#')));
+}
+
+static size_t skip_space_sse2(const char *str, size_t len) {
+    size_t i = skip_space_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = ~_mm_movemask_epi8(space_mask_sse2(_mm_loadu_si128((const __m128i*) &str[i]))) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + skip_space_scalar(&str[i], len - i);
+}
+
+static size_t label_end_sse2(const char *str, size_t len) {
+    size_t i = label_end_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = ~_mm_movemask_epi8(label_mask_sse2(_mm_loadu_si128((const __m128i*) &str[i]))) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + label_end_scalar(&str[i], len - i);
+}
+
+static size_t line_end_sse2(const char *str, size_t len) {
+    size_t i = line_end_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = _mm_movemask_epi8(line_end_mask_sse2(_mm_loadu_si128((const __m128i*) &str[i])));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + line_end_scalar(&str[i], len - i);
+}
+
+static size_t newline_sse2(const char *str, size_t len) {
+    size_t i = newline_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) &str[i]), _mm_set1_epi8('\n')));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + newline_scalar(&str[i], len - i);
+}
+
+/* The AVX2 versions finish their tails themselves instead of calling the SSE2 versions, since
+ * switching between VEX and legacy SSE encoded code is really slow on some CPUs. */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i space_mask_avx2(__m256i c) {
+    return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('\t'))),
+                           _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(c, _mm256_setzero_si256())));
+}
+
+AVX2 static inline __m256i label_mask_avx2(__m256i c) {
+    __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+    __m256i punct = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), punct);
+}
+
+AVX2 static inline __m256i line_end_mask_avx2(__m256i c) {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(c, _mm256_set1_epi8('#')));
+}
+
+AVX2 static size_t skip_space_avx2(const char *str, size_t len) {
+    size_t i = skip_space_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(space_mask_avx2(_mm256_loadu_si256((const __m256i*) &str[i])));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i + 16 <= len) {
+        unsigned mask = ~_mm_movemask_epi8(space_mask_sse2(_mm_loadu_si128((const __m128i*) &str[i]))) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + skip_space_scalar(&str[i], len - i);
+}
+
+AVX2 static size_t label_end_avx2(const char *str, size_t len) {
+    size_t i = label_end_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(label_mask_avx2(_mm256_loadu_si256((const __m256i*) &str[i])));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i + 16 <= len) {
+        unsigned mask = ~_mm_movemask_epi8(label_mask_sse2(_mm_loadu_si128((const __m128i*) &str[i]))) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + label_end_scalar(&str[i], len - i);
+}
+
+AVX2 static size_t line_end_avx2(const char *str, size_t len) {
+    size_t i = line_end_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = _mm256_movemask_epi8(line_end_mask_avx2(_mm256_loadu_si256((const __m256i*) &str[i])));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i + 16 <= len) {
+        unsigned mask = _mm_movemask_epi8(line_end_mask_sse2(_mm_loadu_si128((const __m128i*) &str[i])));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + line_end_scalar(&str[i], len - i);
+}
+
+AVX2 static size_t newline_avx2(const char *str, size_t len) {
+    size_t i = newline_scalar(str, (len < SCALAR_HEAD) ? len : SCALAR_HEAD);
+    if (i < SCALAR_HEAD) return i;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) &str[i]), _mm256_set1_epi8('\n')));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    if (i + 16 <= len) {
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) &str[i]), _mm_set1_epi8('\n')));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + newline_scalar(&str[i], len - i);
+}
+#endif
+
+// Returns false (and leaves the current scanner alone) if the CPU doesn't support `impl`.
+bool lexscan_use(ScanImpl impl) {
+    if (impl == ScanScalar) {
+        lexscan = (LexScanner) {skip_space_scalar, label_end_scalar, line_end_scalar, newline_scalar};
+        return true;
+    }
+#ifdef LEXSCAN_X86
+    __builtin_cpu_init();
+    if (impl == ScanSSE2 && __builtin_cpu_supports("sse2")) {
+        lexscan = (LexScanner) {skip_space_sse2, label_end_sse2, line_end_sse2, newline_sse2};
+        return true;
+    }
+    if (impl == ScanAVX2 && __builtin_cpu_supports("avx2")) {
+        lexscan = (LexScanner) {skip_space_avx2, label_end_avx2, line_end_avx2, newline_avx2};
+        return true;
+    }
+#endif
+    return false;
+}
+
+/* Picks the fastest scanner that this CPU supports. Without optimisation the intrinsics aren't
+ * inlined and every one of them is a call, which makes lex_buffer slower with the vector scanners
+ * than with the scalar ones, so those builds always use the scalar scanners. */
+void lexscan_init() {
+#ifdef __OPTIMIZE__
+    if (lexscan_use(ScanAVX2)) return;
+    if (lexscan_use(ScanSSE2)) return;
+#endif
+    lexscan_use(ScanScalar);
+}
+
+char *scan_impl_as_str(ScanImpl impl) {
+    if      (impl == ScanScalar) return "scalar";
+    else if (impl == ScanSSE2)   return "SSE2";
+    else if (impl == ScanAVX2)   return "AVX2";
+    else return "unknown";
+}
@@ -8,33 +8,65 @@
 #include <string.h>
 #include <api.h>
 #include <lexer.h>
-#include <parser.h>
 #include <arena.h>
 #include <version.h>
+#include <compile.h>
 #include <optimisation.h>
+#include <server.h>
+#include <cache.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-Arena arena;
+_Thread_local Arena arena;
 int is_position_independent = 1;
 
-typedef enum {
-    X86_64,
-    IR,
-} Target;
-
-void (*targets[])(Function*, size_t, Global*, size_t, AggregateType*, size_t, FileDbg*, size_t, FILE*) = {
-    build_program_x86_64,
-    build_program_IR,
-};
-
 void help(char *cmd) {
-    printf("%s [options] <inputfile>\n", cmd);
+    printf("%s [options] <inputfiles...>\n", cmd);
     printf("Options:\n"
            "  --help      Display this information.\n"
            "  --version   Check the version of this copy of UYB.\n"
            "  --targets   List targets supported by UYB which the IR can be compiled to.\n"
            "  --no-pie    Ensure that the generated program is not position independent.\n"
-           "  -o <file>   Specify that the resulting assembly should be outputted to <file>.\n"
-           "  -t <target> Specify that assembly should be generated specifically for <target>.\n");
+           "  -o <file>   Specify that the resulting assembly should be outputted to <file>. If <file> is a\n"
+           "              directory (or ends in /), each input's output goes in it, named after the input.\n"
+           "  -t <target> Specify that assembly should be generated specifically for <target>.\n"
+           "  -j <n>      With one input file, use up to <n> threads to lex it (default is 1), which implies\n"
+           "              --batch. With several, compile up to <n> of them at once (default is one per CPU).\n"
+           "  --batch     Parse the whole input file before compiling it, instead of one function at a time.\n"
+           "  --emit-bin  Output the IR in UYB's binary format (.uybc) instead of assembly. Binary IR files\n"
+           "              are recognised automatically when they're used as input.\n"
+           "  -O<level>   Optimise with the passes for <level>: 0 for none, 1 (the default) or 2. Level 2\n"
+           "              inlines functions, so the whole input file is parsed before compiling it.\n"
+           "  --passes=<pipeline>\n"
+           "              Optimise with exactly the passes in <pipeline>, a list separated by commas, where\n"
+           "              repeat(...) runs the passes in it until they stop changing anything. The passes\n"
+           "              are fold, mem2reg, sccp, gvn, licm, unroll, lsr, copyelim, dce and inline.\n"
+           "  --inline-threshold=<n>\n"
+           "              Inline calls that cost up to <n>, which is about how many statements bigger they\n"
+           "              make the caller (default is %d).\n"
+           "  --inline-max-size=<n>\n"
+           "              Stop inlining into a function once it has <n> statements (default is %d).\n"
+           "  --unroll-threshold=<n>\n"
+           "              Unroll loops completely if they have up to <n> statements once they're unrolled,\n"
+           "              otherwise partially within <n> statements, or not at all if <n> is 0 (default is %d).\n"
+           "  --time-passes\n"
+           "              Print how long each optimisation pass took, and how many statements it was given\n"
+           "              and left, added up over every function (to stderr).\n"
+           "  --cache <dir>\n"
+           "              Keep the x86_64 output for each function in <dir>, and reuse it when a function\n"
+           "              hasn't changed since it was last compiled.\n"
+           "  --cache-size <MB>\n"
+           "              Remove the least recently used functions from the cache once it's bigger than\n"
+           "              <MB> megabytes (default is 256).\n"
+           "  --cache-stats\n"
+           "              Print how many functions were found in the cache afterwards (to stderr).\n"
+           "  --server <socket>\n"
+           "              Stay running and compile requests sent to the Unix socket <socket>, or through\n"
+           "              stdin if <socket> is -, instead of compiling input files. See uyb-client.\n",
+           DEFAULT_INLINE_THRESHOLD, DEFAULT_INLINE_MAX_SIZE, DEFAULT_UNROLL_THRESHOLD);
 }
 
 void targets_help() {
@@ -43,14 +75,14 @@ void targets_help() {
            "  - IR\n");
 }
 
-Target str_as_target(char *cmd, char *s) {
-    if (!strcmp(s, "x86_64")) return X86_64;
-    else if (!strcmp(s, "IR")) return IR;
-    else {
+Target parse_target(char *cmd, char *s) {
+    Target target;
+    if (!str_as_target(s, &target)) {
         printf("No such target: %s. To list all targets, run:\n"
                "%s --targets\n", s, cmd);
         exit(1);
     }
+    return target;
 }
 
 void sigsegv_handler(int sig, siginfo_t *si, void *unused) {
@@ -67,18 +99,161 @@ void setup_sigsev() {
     sigaction(SIGSEGV, &sa, NULL);
 }
 
+// Set from the command line, and the same for every input file
+static CompileOptions opts = {.target = X86_64, .lex_threads = 1};
+
+typedef struct {
+    char *input_fname;  // NULL for stdin
+    char *output_fname; // NULL for stdout
+    // kept here rather than in compile_file() so that they can be cleaned up if it fails
+    FILE *inf;
+    FILE *outf;
+    SourceBuf src;
+    char *error;
+} CompileJob;
+
+static void compile_file(void *arg) {
+    CompileJob *job = (CompileJob*) arg;
+    job->inf = stdin;
+    if (job->input_fname) {
+        job->inf = fopen(job->input_fname, "r");
+        if (!job->inf) compile_error("Failed to open %s\n", job->input_fname);
+    }
+    job->outf = stdout;
+    if (job->output_fname) {
+        job->outf = fopen(job->output_fname, "w");
+        if (!job->outf) compile_error("Failed to open %s\n", job->output_fname);
+    }
+    source_open(job->inf, &job->src);
+    fclose(job->inf);
+    job->inf = NULL;
+    compile_source(&job->src, &opts, job->outf);
+    source_close(&job->src);
+    fclose(job->outf);
+    job->outf = NULL;
+}
+
+// Closes whatever a failed compile_file() left open, and removes the partial output
+static void abandon_file(CompileJob *job) {
+    if (job->inf && job->inf != stdin) fclose(job->inf);
+    if (job->src.data) source_close(&job->src);
+    if (job->outf && job->outf != stdout) {
+        fclose(job->outf);
+        remove(job->output_fname);
+    }
+}
+
+typedef struct {
+    CompileJob *jobs;
+    size_t num_jobs;
+    atomic_size_t next_job;
+} JobQueue;
+
+static void *compile_worker(void *arg) {
+    JobQueue *queue = (JobQueue*) arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&queue->next_job, 1)) < queue->num_jobs) {
+        CompileJob *job = &queue->jobs[i];
+        job->error = catch_compile_error(compile_file, job);
+        if (job->error) abandon_file(job);
+        // every file starts from nothing, so its output doesn't depend on what else this thread did
+        compile_reset(&opts);
+    }
+    return NULL;
+}
+
+/* Compiles each job on a pool of `num_threads` threads, then reports any errors in the same order
+ * the files were given in. Returns the number of files that failed. */
+static size_t compile_files(CompileJob *jobs, size_t num_jobs, size_t num_threads) {
+    if (num_threads > num_jobs) num_threads = num_jobs;
+    JobQueue queue = {.jobs = jobs, .num_jobs = num_jobs};
+    atomic_init(&queue.next_job, 0);
+    pthread_t *threads = (pthread_t*) malloc(sizeof(pthread_t) * num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, compile_worker, &queue)) {
+            printf("Failed to create compiler thread.\n");
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    size_t num_failed = 0;
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (!jobs[i].error) continue;
+        printf("%s: %s", jobs[i].input_fname, jobs[i].error);
+        free(jobs[i].error);
+        num_failed++;
+    }
+    return num_failed;
+}
+
+// Names the output for `input_fname` after it, in `output_dir` or next to the input if that's NULL
+static char *output_fname_for(char *input_fname, char *output_dir) {
+    char *base = strrchr(input_fname, '/');
+    base = (base) ? base + 1 : input_fname;
+    char *ext = strrchr(base, '.');
+    size_t stem_len = (ext && ext != base) ? (size_t) (ext - base) : strlen(base);
+    char *dir = output_dir;
+    size_t dir_len = (dir) ? strlen(dir) : (size_t) (base - input_fname);
+    if (!dir) dir = input_fname;
+    char *new_ext = (opts.emit_bin) ? ".uybc" : (opts.target == IR) ? ".ir" : ".S";
+    bool add_slash = dir_len && dir[dir_len - 1] != '/';
+    size_t len = dir_len + add_slash + stem_len + strlen(new_ext);
+    char *ret = (char*) malloc(len + 1);
+    snprintf(ret, len + 1, "%.*s%s%.*s%s", (int) dir_len, dir, (add_slash) ? "/" : "", (int) stem_len, base, new_ext);
+    return ret;
+}
+
+static int cmp_fname(const void *a, const void *b) {
+    return strcmp(*(char**) a, *(char**) b);
+}
+
+// Makes sure no two jobs write to the same file, and that none of them overwrite an input
+static void check_output_fnames(CompileJob *jobs, size_t num_jobs) {
+    char **fnames = (char**) malloc(sizeof(char*) * num_jobs * 2);
+    for (size_t i = 0; i < num_jobs; i++) {
+        fnames[i * 2] = jobs[i].input_fname;
+        fnames[i * 2 + 1] = jobs[i].output_fname;
+    }
+    qsort(fnames, num_jobs * 2, sizeof(char*), cmp_fname);
+    for (size_t i = 1; i < num_jobs * 2; i++) {
+        if (strcmp(fnames[i - 1], fnames[i])) continue;
+        printf("%s would be used more than once as an input or output file, not allowed.\n", fnames[i]);
+        exit(1);
+    }
+    free(fnames);
+}
+
+static bool is_output_dir(char *path) {
+    struct stat st;
+    if (!stat(path, &st)) return S_ISDIR(st.st_mode);
+    if (path[strlen(path) - 1] != '/') return false;
+    if (mkdir(path, 0777)) {
+        printf("Failed to create output directory %s\n", path);
+        exit(1);
+    }
+    return true;
+}
+
 int main(int argc, char **argv) {
     setup_sigsev();
-    char *input_fname = NULL;
+    char* **input_fnames = vec_new(sizeof(char*));
     char *output_fname = NULL;
-    Target target = X86_64;
+    size_t num_threads = 1;
+    bool threads_given = false;
+    char *server_socket = NULL;
+    char *cache_dir = NULL;
+    size_t cache_mb = CACHE_DEFAULT_MAX_MB;
+    bool cache_stats = false;
+    bool pipeline_given = false;
+    bool time_passes = false;
+    size_t inline_threshold = DEFAULT_INLINE_THRESHOLD;
+    size_t inline_max_size = DEFAULT_INLINE_MAX_SIZE;
+    size_t unroll_threshold = DEFAULT_UNROLL_THRESHOLD;
     for (size_t arg = 1; arg < argc; arg++) {
         if (argv[arg][0] != '-') {
-            if (input_fname) {
-                printf("More than one input file passed, not allowed.\n");
-                return 1;
-            }
-            input_fname = argv[arg];
+            vec_push(input_fnames, argv[arg]);
             continue;
         }
         if (argv[arg][1] == '-') argv[arg]++;
@@ -99,8 +274,82 @@ int main(int argc, char **argv) {
                 printf("Target was expected to be provided after -t, got end of command instead.\n");
                 return 1;
             }
-            target = str_as_target(argv[0], argv[arg + 1]);
+            opts.target = parse_target(argv[0], argv[arg + 1]);
             arg++;
+        } else if (!memcmp(argv[arg], "-j", 2)) {
+            char *num = argv[arg] + 2;
+            if (!*num) {
+                if (arg == argc - 1) {
+                    printf("Number of threads was expected to be provided after -j, got end of command instead.\n");
+                    return 1;
+                }
+                num = argv[++arg];
+            }
+            char *end;
+            num_threads = strtoul(num, &end, 10);
+            if (*end || !num_threads) {
+                printf("Invalid number of threads: %s\n", num);
+                return 1;
+            }
+            threads_given = true;
+        } else if (!strcmp(argv[arg], "-cache")) {
+            if (arg == argc - 1) {
+                printf("Cache directory was expected to be provided after --cache, got end of command instead.\n");
+                return 1;
+            }
+            cache_dir = argv[++arg];
+        } else if (!strcmp(argv[arg], "-cache-size")) {
+            if (arg == argc - 1) {
+                printf("Cache size was expected to be provided after --cache-size, got end of command instead.\n");
+                return 1;
+            }
+            char *end;
+            cache_mb = strtoul(argv[++arg], &end, 10);
+            if (*end || !cache_mb) {
+                printf("Invalid cache size: %s\n", argv[arg]);
+                return 1;
+            }
+        } else if (!strcmp(argv[arg], "-cache-stats")) {
+            cache_stats = true;
+        } else if (!strcmp(argv[arg], "-server")) {
+            if (arg == argc - 1) {
+                printf("Socket path was expected to be provided after --server, got end of command instead.\n");
+                return 1;
+            }
+            server_socket = argv[++arg];
+        } else if (argv[arg][1] == 'O' && argv[arg][2] && !argv[arg][3]) {
+            if (pipeline_given) pipeline_free(&opts.pipeline);
+            if (argv[arg][2] < '0' || argv[arg][2] > '9' || !pipeline_preset(argv[arg][2] - '0', &opts.pipeline)) {
+                printf("No such optimisation level: %s\n", argv[arg]);
+                return 1;
+            }
+            pipeline_given = true;
+        } else if (!strncmp(argv[arg], "-passes=", 8)) {
+            if (pipeline_given) pipeline_free(&opts.pipeline);
+            char *error = pipeline_parse(argv[arg] + 8, &opts.pipeline);
+            if (error) {
+                printf("Invalid pass pipeline %s: %s", argv[arg] + 8, error);
+                return 1;
+            }
+            pipeline_given = true;
+        } else if (!strncmp(argv[arg], "-inline-threshold=", 18) || !strncmp(argv[arg], "-inline-max-size=", 17) ||
+                   !strncmp(argv[arg], "-unroll-threshold=", 18)) {
+            char *num = strchr(argv[arg], '=') + 1;
+            char *end;
+            size_t n = strtoul(num, &end, 10);
+            if (!*num || *end) {
+                printf("Invalid number in %s\n", argv[arg]);
+                return 1;
+            }
+            if (argv[arg][1] == 'u') unroll_threshold = n;
+            else if (argv[arg][8] == 't') inline_threshold = n;
+            else inline_max_size = n;
+        } else if (!strcmp(argv[arg], "-time-passes")) {
+            time_passes = true;
+        } else if (!strcmp(argv[arg], "-emit-bin")) {
+            opts.emit_bin = true;
+        } else if (!strcmp(argv[arg], "-batch")) {
+            opts.batch = true;
         } else if (!strcmp(argv[arg], "-targets")) {
             targets_help();
             return 0;
@@ -118,33 +367,54 @@ int main(int argc, char **argv) {
             help(argv[0]);
         }
     }
-    FILE *inf = stdin;
-    if (input_fname) {
-        inf = fopen(input_fname, "r");
-        if (!inf) {
-            printf("Failed to open %s\n", input_fname);
+    if (!pipeline_given) pipeline_preset(1, &opts.pipeline);
+    opts.pipeline.time_passes = time_passes;
+    opts.pipeline.inline_threshold = inline_threshold;
+    opts.pipeline.inline_max_size = inline_max_size;
+    opts.pipeline.unroll_threshold = unroll_threshold;
+    size_t num_inputs = vec_size(input_fnames);
+    if (cache_dir) cache_open(cache_dir, cache_mb * 1024 * 1024);
+    if (server_socket) {
+        if (num_inputs || output_fname) {
+            printf("Input and output files can't be used with --server, they're given in each request instead.\n");
             return 1;
         }
+        run_server(server_socket);
+        return 0;
     }
-    Token **toks = lex_file(inf);
-    fclose(inf);
-    Global **globals;
-    AggregateType **aggs;
-    FileDbg **files_dbg;
-    Function **functs = parse_program(toks, &globals, &aggs, &files_dbg);
-    FILE *outf = stdout;
-    if (output_fname) {
-        outf = fopen(output_fname, "w");
-        if (!outf) {
-            printf("Failed to open out.S\n");
-            exit(1);
-        }
+    bool output_is_dir = output_fname && num_inputs && is_output_dir(output_fname);
+    if (num_inputs <= 1 && !output_is_dir) {
+        CompileJob job = {
+            .input_fname = (num_inputs) ? (*input_fnames)[0] : NULL,
+            .output_fname = output_fname,
+        };
+        opts.lex_threads = num_threads;
+        compile_file(&job);
+        delete_arenas();
+        cache_close();
+        if (cache_stats) cache_print_stats(stderr);
+        if (time_passes) print_pass_times(stderr);
+        return 0;
+    }
+    if (output_fname && !output_is_dir) {
+        printf("Output must be a directory when compiling more than one input file, but %s is not.\n", output_fname);
+        return 1;
+    }
+    if (!threads_given) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!num_threads) num_threads = 1;
+    CompileJob *jobs = (CompileJob*) calloc(num_inputs, sizeof(CompileJob));
+    for (size_t i = 0; i < num_inputs; i++) {
+        jobs[i].input_fname = (*input_fnames)[i];
+        jobs[i].output_fname = output_fname_for(jobs[i].input_fname, output_fname);
     }
-    size_t num_functions = vec_size(functs);
-    optimise(*functs, num_functions);
-    // Assembly codegen
-    targets[target](*functs, num_functions, *globals, vec_size(globals), *aggs, vec_size(aggs), *files_dbg, vec_size(files_dbg), outf);
-    fclose(outf);
-    delete_arenas();
-    return 0;
+    check_output_fnames(jobs, num_inputs);
+    size_t num_failed = compile_files(jobs, num_inputs, num_threads);
+    cache_close();
+    if (cache_stats) cache_print_stats(stderr);
+    if (time_passes) print_pass_times(stderr);
+    for (size_t i = 0; i < num_inputs; i++)
+        free(jobs[i].output_fname);
+    free(jobs);
+    vec_free(input_fnames);
+    return num_failed != 0;
 }
@@ -0,0 +1,158 @@
+/* Table of every instruction mnemonic in the textual IR. It's used both to recognise instructions in
+ * the parser and to print them again in the IR target and in the x86_64 target's comments, so the
+ * two can't drift apart. Lookups go through a perfect hash of the name, so recognising a mnemonic
+ * costs one hash and one compare.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <mnemonic.h>
+#include <ctype.h>
+#include <string.h>
+#include <pthread.h>
+
+#define CMP(name, instr) \
+    {"c" name,     instr, None, None,   false}, \
+    {"c" name "w", instr, None, Bits32, false}, \
+    {"c" name "l", instr, None, Bits64, false}
+#define SCMP(name, instr) \
+    {"c" name,     instr, None, None,   true}, \
+    {"c" name "w", instr, None, Bits32, true}, \
+    {"c" name "l", instr, None, Bits64, true}
+
+/* When printing, the first mnemonic for an instruction with a matching operand type and
+ * signedness is used, so aliases go after the names QBE prefers. */
+static Mnemonic mnemonics[] = {
+    {"add",     ADD,     None,   None,   false},
+    {"sub",     SUB,     None,   None,   false},
+    {"div",     DIV,     None,   None,   false},
+    {"mul",     MUL,     None,   None,   false},
+    {"copy",    COPY,    None,   None,   false},
+    {"ret",     RET,     None,   None,   false},
+    {"call",    CALL,    None,   None,   false},
+    {"jz",      JZ,      None,   None,   false},
+    {"neg",     NEG,     None,   None,   false},
+    {"udiv",    UDIV,    None,   None,   false},
+    {"rem",     REM,     None,   None,   false},
+    {"urem",    UREM,    None,   None,   false},
+    {"and",     AND,     None,   None,   false},
+    {"or",      OR,      None,   None,   false},
+    {"xor",     XOR,     None,   None,   false},
+    {"shl",     SHL,     None,   None,   false},
+    {"shr",     SHR,     None,   None,   false},
+    {"storel",  STORE,   Bits64, Bits64, false},
+    {"storew",  STORE,   Bits32, Bits32, false},
+    {"storeh",  STORE,   Bits16, Bits16, false},
+    {"storeb",  STORE,   Bits8,  Bits8,  false},
+    {"loadl",   LOAD,    None,   Bits64, false},
+    {"loadsw",  LOAD,    None,   Bits32, true},
+    {"loaduw",  LOAD,    None,   Bits32, false},
+    {"loadsh",  LOAD,    None,   Bits16, true},
+    {"loaduh",  LOAD,    None,   Bits16, false},
+    {"loadsb",  LOAD,    None,   Bits8,  true},
+    {"loadub",  LOAD,    None,   Bits8,  false},
+    {"loadw",   LOAD,    None,   Bits32, true},
+    {"blit",    BLIT,    None,   None,   false},
+    {"alloc",   ALLOC,   None,   None,   false},
+    {"alloc4",  ALLOC,   Bits64, None,   false},
+    {"alloc8",  ALLOC,   Bits64, None,   false},
+    {"alloc16", ALLOC,   Bits64, None,   false},
+    CMP("eq", EQ),
+    CMP("ne", NE),
+    SCMP("sle", SLE),
+    SCMP("slt", SLT),
+    SCMP("sge", SGE),
+    SCMP("sgt", SGT),
+    CMP("ule", ULE),
+    CMP("ult", ULT),
+    CMP("uge", UGE),
+    CMP("ugt", UGT),
+    {"ext",     EXT,     None,   None,   false},
+    {"extsw",   EXT,     None,   Bits32, true},
+    {"extuw",   EXT,     None,   Bits32, false},
+    {"extsh",   EXT,     None,   Bits16, true},
+    {"extuh",   EXT,     None,   Bits16, false},
+    {"extsb",   EXT,     None,   Bits8,  true},
+    {"extub",   EXT,     None,   Bits8,  false},
+    {"hlt",     HLT,     None,   None,   false},
+    {"blklbl",  BLKLBL,  None,   None,   false},
+    {"jmp",     JMP,     None,   None,   false},
+    {"jnz",     JNZ,     None,   None,   false},
+    {"phi",     PHI,     None,   None,   false},
+    {"vastart", VASTART, None,   None,   false},
+    {"vaarg",   VAARG,   None,   None,   false},
+    {".loc",    LOC,     None,   None,   false},
+    {"asm",     ASM,     None,   None,   false},
+};
+
+#define NUM_MNEMONICS (sizeof(mnemonics) / sizeof(mnemonics[0]))
+#define MNEMONIC_SLOTS 1024 // must be a power of two
+#define MAX_MNEMONIC_LEN 8
+
+/* Hashes every mnemonic above to a different slot. If the table is changed and that stops being
+ * true, mnemonics_init() just searches upwards for a seed that works. */
+static uint32_t seed = 0x1f;
+static uint8_t slots[MNEMONIC_SLOTS]; // index into mnemonics + 1, or 0 if the slot is empty
+static Mnemonic *by_operands[NUM_INSTRUCTIONS][None + 1][2];
+static Mnemonic *canonical[NUM_INSTRUCTIONS];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+// `name` must already be lower case
+static size_t mnemonic_hash(char *name, size_t len, uint32_t seed) {
+    uint32_t hash = seed;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) name[i]) * 16777619;
+    hash ^= hash >> 16;
+    return hash & (MNEMONIC_SLOTS - 1);
+}
+
+static bool try_seed(uint32_t seed) {
+    memset(slots, 0, sizeof(slots));
+    for (size_t i = 0; i < NUM_MNEMONICS; i++) {
+        size_t slot = mnemonic_hash(mnemonics[i].name, strlen(mnemonics[i].name), seed);
+        if (slots[slot]) return false;
+        slots[slot] = i + 1;
+    }
+    return true;
+}
+
+static void mnemonics_init() {
+    while (!try_seed(seed)) seed++;
+    for (size_t i = 0; i < NUM_MNEMONICS; i++) {
+        Mnemonic *m = &mnemonics[i];
+        if (!canonical[m->instruction]) canonical[m->instruction] = m;
+        if (!by_operands[m->instruction][m->arg_type][m->is_signed])
+            by_operands[m->instruction][m->arg_type][m->is_signed] = m;
+    }
+}
+
+// Case insensitive. Returns NULL if `name` isn't a valid mnemonic.
+Mnemonic *lookup_mnemonic(char *name, size_t len) {
+    pthread_once(&init_once, mnemonics_init);
+    if (!len || len > MAX_MNEMONIC_LEN) return NULL;
+    char lower[MAX_MNEMONIC_LEN];
+    for (size_t i = 0; i < len; i++)
+        lower[i] = tolower(name[i]);
+    uint8_t idx = slots[mnemonic_hash(lower, len, seed)];
+    if (!idx) return NULL;
+    Mnemonic *m = &mnemonics[idx - 1];
+    if (memcmp(m->name, lower, len) || m->name[len]) return NULL;
+    return m;
+}
+
+/* Returns the mnemonic that gives back this statement's instruction, operand type and signedness
+ * when parsed. Statements built through the API without an operand type fall back to using their
+ * own type, then to the instruction's first mnemonic. */
+char *statement_mnemonic(Statement statement) {
+    pthread_once(&init_once, mnemonics_init);
+    Mnemonic *(*options)[2] = by_operands[statement.instruction];
+    bool is_signed = statement.is_signed;
+    Mnemonic *m = NULL;
+    if (statement.arg_type <= None) m = options[statement.arg_type][is_signed];
+    if (!m && statement.type <= None) m = options[statement.type][is_signed];
+    if (!m) m = canonical[statement.instruction];
+    return m->name;
+}
+
+char *instruction_as_str(Instruction instr) {
+    pthread_once(&init_once, mnemonics_init);
+    if (instr >= NUM_INSTRUCTIONS) return "unknown instruction";
+    return canonical[instr]->name;
+}
@@ -0,0 +1,157 @@
+/* Dead code elimination. Blocks which can't be reached from the entry are removed first, and phis
+ * taking a value from one of them become copies of their other value. Then, starting from the
+ * statements that do something besides define a value (calls, stores, jumps and so on), everything
+ * they use is marked as needed with a worklist, and anything that isn't marked by the end is dead,
+ * including phis and loops of phis that only use each other.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Whether a statement has to be kept even if nothing uses the value it defines
+static bool is_root(Instruction instruction) {
+    switch (instruction) {
+        case CALL: case STORE: case BLIT: case ASM: case VASTART: case VAARG: case RET:
+        case JMP: case JNZ: case JZ: case HLT: case BLKLBL: case LOC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+typedef struct {
+    Function *fn;
+    bool *live;          // indexed by statement
+    bool *value_live;    // indexed by ValueId
+    size_t *defs_start;  // indexed by ValueId, where the statements defining it start in defs
+    size_t *defs;
+    size_t *worklist;    // room for every statement, since each is only added once
+    size_t num_queued;
+} Marker;
+
+static void mark_statement(Marker *marker, size_t s) {
+    if (marker->live[s]) return;
+    marker->live[s] = true;
+    marker->worklist[marker->num_queued++] = s;
+}
+
+static void mark_value(Marker *marker, uint64_t value, ValType type) {
+    if (type != Label || marker->value_live[value]) return;
+    marker->value_live[value] = true;
+    for (size_t d = marker->defs_start[value]; d < marker->defs_start[value + 1]; d++)
+        mark_statement(marker, marker->defs[d]);
+}
+
+static void mark_operands(Marker *marker, Statement *statement) {
+    if (statement->instruction == CALL) {
+        FunctionArgList *args = (FunctionArgList*) statement->vals[1];
+        for (size_t a = 0; a < args->num_args; a++) mark_value(marker, args->args[a], args->arg_types[a]);
+        // the function called can be a label too
+        mark_value(marker, statement->vals[0], statement->val_types[0]);
+    } else if (statement->instruction == PHI) {
+        for (size_t i = 0; i < 2; i++) {
+            PhiVal *phi_val = (PhiVal*) statement->vals[i];
+            mark_value(marker, phi_val->val, phi_val->type);
+        }
+    } else if (statement->instruction == ASM) {
+        InlineAsm *info = (InlineAsm*) statement->vals[0];
+        for (size_t in = 0; in < vec_size(info->inputs_vec); in++)
+            mark_value(marker, (*info->inputs_vec)[in].label, (*info->inputs_vec)[in].type);
+    } else {
+        for (size_t i = 0; i < 3; i++) mark_value(marker, statement->vals[i], statement->val_types[i]);
+    }
+}
+
+/* Finds the statements defining each value, so that marking a value marks all of them (a value can
+ * be defined more than once if the input isn't in SSA form). */
+static void find_defs(Function *fn, Marker *marker) {
+    size_t *next = (size_t*) calloc(fn->num_values + 1, sizeof(size_t));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (fn->statements[s].label) next[fn->statements[s].label + 1]++;
+    }
+    for (size_t v = 0; v < fn->num_values; v++) next[v + 1] += next[v];
+    marker->defs_start = (size_t*) aalloc(sizeof(size_t) * (fn->num_values + 1));
+    memcpy(marker->defs_start, next, sizeof(size_t) * (fn->num_values + 1));
+    marker->defs = (size_t*) aalloc(sizeof(size_t) * next[fn->num_values]);
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (fn->statements[s].label) marker->defs[next[fn->statements[s].label]++] = s;
+    }
+    free(next);
+}
+
+static bool is_unreachable_block(Function *fn, DomTree *tree, BlockId blklbl) {
+    if (blklbl >= fn->num_blocks || fn->label_bblocks[blklbl] == NO_BBLOCK) return false;
+    return tree->rpo_index[fn->label_bblocks[blklbl]] == NO_BBLOCK;
+}
+
+/* Turns phis in reachable blocks which take a value from an unreachable one into copies of the other
+ * value. Returns whether there were any. */
+static bool fold_unreachable_phis(Function *fn, DomTree *tree) {
+    bool changed = false;
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        if (tree->rpo_index[b] == NO_BBLOCK) continue;
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            if (statement->instruction != PHI) continue;
+            PhiVal *phi_vals[2] = {(PhiVal*) statement->vals[0], (PhiVal*) statement->vals[1]};
+            bool unreachable[2] = {is_unreachable_block(fn, tree, phi_vals[0]->blklbl),
+                                   is_unreachable_block(fn, tree, phi_vals[1]->blklbl)};
+            // if both are unreachable, so is this block unless the phi's wrong, so it's left alone
+            if (unreachable[0] == unreachable[1]) continue;
+            PhiVal *other = phi_vals[unreachable[0]];
+            statement->instruction = COPY;
+            statement->vals[0] = other->val;
+            statement->val_types[0] = other->type;
+            statement->val_types[1] = Empty;
+            statement->val_types[2] = Empty;
+            add_stat(STAT_DCE_PHIS_FOLDED, 1);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool opt_dce(Function *fn) {
+    DomTree *tree = dom_tree(fn);
+    bool changed = fold_unreachable_phis(fn, tree);
+    Marker marker = {
+        .fn = fn,
+        .live = (bool*) aalloc(sizeof(bool) * fn->num_statements),
+        .value_live = (bool*) aalloc(sizeof(bool) * fn->num_values),
+        .worklist = (size_t*) malloc(sizeof(size_t) * (fn->num_statements + 1)),
+    };
+    memset(marker.live, 0, sizeof(bool) * fn->num_statements);
+    memset(marker.value_live, 0, sizeof(bool) * fn->num_values);
+    find_defs(fn, &marker);
+    size_t num_unreachable = 0;
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        if (tree->rpo_index[b] == NO_BBLOCK) {
+            num_unreachable++;
+            continue;
+        }
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            if (is_root(fn->statements[s].instruction)) mark_statement(&marker, s);
+        }
+    }
+    while (marker.num_queued)
+        mark_operands(&marker, &fn->statements[marker.worklist[--marker.num_queued]]);
+    free(marker.worklist);
+    Statement **statement_vec = vec_new(sizeof(Statement));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (marker.live[s]) vec_push(statement_vec, fn->statements[s]);
+    }
+    size_t num_removed = fn->num_statements - vec_size(statement_vec);
+    if (!num_removed) {
+        vec_free(statement_vec);
+        return changed;
+    }
+    add_stat(STAT_DCE_UNREACHABLE_BLOCKS, num_unreachable);
+    add_stat(STAT_DCE_STATEMENTS, num_removed);
+    fn->num_statements = vec_size(statement_vec);
+    fn->statements = vec_into_arena(statement_vec);
+    return true;
+}
@@ -0,0 +1,193 @@
+/* Dominator tree, dominance frontiers and reverse post order of a function's control flow graph, for
+ * passes that need to know which blocks always run before which. The immediate dominators are found
+ * with the iterative algorithm from Cooper, Harvey and Kennedy's "A Simple, Fast Dominance
+ * Algorithm", which walks the blocks in reverse post order and is faster than Lengauer-Tarjan on the
+ * sizes of graph that frontends actually emit. Blocks which can't be reached from the entry block
+ * aren't in the tree at all.
+ * The result is cached in the Function until cfg_build() is called on it again.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <string.h>
+#include <stdlib.h>
+
+static size_t *new_indices(size_t num) {
+    size_t *indices = (size_t*) aalloc(sizeof(size_t) * (num + 1));
+    memset(indices, 0xFF, sizeof(size_t) * (num + 1));
+    return indices;
+}
+
+// Numbers the blocks that can be reached from the entry block in reverse post order
+static void number_blocks(Function *fn, DomTree *tree) {
+    size_t num_bblocks = fn->num_bblocks;
+    size_t *postorder = (size_t*) aalloc(sizeof(size_t) * num_bblocks);
+    size_t num_visited = 0;
+    // the stack holds each block being visited and how many of its successors have been looked at
+    size_t (*stack)[2] = malloc(sizeof(size_t[2]) * num_bblocks);
+    bool *seen = (bool*) calloc(num_bblocks, sizeof(bool));
+    size_t depth = 0;
+    stack[depth++][0] = 0;
+    stack[0][1] = 0;
+    seen[0] = true;
+    while (depth) {
+        size_t *top = stack[depth - 1];
+        BasicBlock *block = &fn->bblocks[top[0]];
+        if (top[1] < block->num_succs) {
+            size_t succ = block->succs[top[1]++];
+            if (seen[succ]) continue;
+            seen[succ] = true;
+            stack[depth][0] = succ;
+            stack[depth][1] = 0;
+            depth++;
+        } else {
+            postorder[num_visited++] = top[0];
+            depth--;
+        }
+    }
+    free(stack);
+    free(seen);
+    tree->num_reachable = num_visited;
+    tree->rpo = (size_t*) aalloc(sizeof(size_t) * num_visited);
+    tree->rpo_index = new_indices(num_bblocks);
+    for (size_t i = 0; i < num_visited; i++) {
+        tree->rpo[i] = postorder[num_visited - 1 - i];
+        tree->rpo_index[tree->rpo[i]] = i;
+    }
+}
+
+static size_t intersect(DomTree *tree, size_t a, size_t b) {
+    while (a != b) {
+        while (tree->rpo_index[a] > tree->rpo_index[b]) a = tree->idom[a];
+        while (tree->rpo_index[b] > tree->rpo_index[a]) b = tree->idom[b];
+    }
+    return a;
+}
+
+static void find_idoms(Function *fn, DomTree *tree) {
+    tree->idom = new_indices(fn->num_bblocks);
+    tree->idom[0] = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < tree->num_reachable; i++) {
+            size_t b = tree->rpo[i];
+            size_t new_idom = NO_BBLOCK;
+            for (size_t p = 0; p < fn->bblocks[b].num_preds; p++) {
+                size_t pred = fn->bblocks[b].preds[p];
+                if (tree->idom[pred] == NO_BBLOCK) continue;
+                new_idom = (new_idom == NO_BBLOCK) ? pred : intersect(tree, pred, new_idom);
+            }
+            if (tree->idom[b] == new_idom) continue;
+            tree->idom[b] = new_idom;
+            changed = true;
+        }
+    }
+}
+
+/* Turns (block, item) pairs into lists for each block, where the list for block b is
+ * items[start[b] .. start[b + 1]]. */
+static void group_by_block(size_t num_bblocks, size_t (*pairs)[2], size_t num_pairs, size_t **items_buf, size_t **start_buf) {
+    size_t *start = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    size_t *items = (size_t*) aalloc(sizeof(size_t) * num_pairs);
+    memset(start, 0, sizeof(size_t) * (num_bblocks + 1));
+    for (size_t i = 0; i < num_pairs; i++) start[pairs[i][0] + 1]++;
+    for (size_t b = 0; b < num_bblocks; b++) start[b + 1] += start[b];
+    size_t *at = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    memcpy(at, start, sizeof(size_t) * (num_bblocks + 1));
+    for (size_t i = 0; i < num_pairs; i++) items[at[pairs[i][0]]++] = pairs[i][1];
+    free(at);
+    *items_buf = items;
+    *start_buf = start;
+}
+
+// Numbers the tree in preorder, so that whether one block dominates another is a range check
+static void number_tree(Function *fn, DomTree *tree) {
+    size_t num_bblocks = fn->num_bblocks;
+    size_t (*pairs)[2] = malloc(sizeof(size_t[2]) * (tree->num_reachable + 1));
+    size_t num_pairs = 0;
+    // in reverse post order, so that each block's children are in reverse post order too
+    for (size_t i = 1; i < tree->num_reachable; i++) {
+        pairs[num_pairs][0] = tree->idom[tree->rpo[i]];
+        pairs[num_pairs++][1] = tree->rpo[i];
+    }
+    group_by_block(num_bblocks, pairs, num_pairs, &tree->children, &tree->children_start);
+    free(pairs);
+    tree->tree_pre = new_indices(num_bblocks);
+    tree->tree_size = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    memset(tree->tree_size, 0, sizeof(size_t) * (num_bblocks + 1));
+    if (!tree->num_reachable) return;
+    size_t *stack = (size_t*) malloc(sizeof(size_t) * tree->num_reachable);
+    size_t *order = (size_t*) malloc(sizeof(size_t) * tree->num_reachable);
+    size_t depth = 0, num_numbered = 0;
+    stack[depth++] = 0;
+    while (depth) {
+        size_t b = stack[--depth];
+        tree->tree_pre[b] = num_numbered;
+        order[num_numbered++] = b;
+        for (size_t c = tree->children_start[b + 1]; c > tree->children_start[b]; c--)
+            stack[depth++] = tree->children[c - 1];
+    }
+    // every block comes after its parent in preorder, so going backwards sees children first
+    for (size_t i = num_numbered; i > 0; i--) {
+        size_t b = order[i - 1];
+        tree->tree_size[b]++;
+        if (b) tree->tree_size[tree->idom[b]] += tree->tree_size[b];
+    }
+    free(stack);
+    free(order);
+}
+
+static void find_frontiers(Function *fn, DomTree *tree) {
+    size_t num_bblocks = fn->num_bblocks;
+    size_t capacity = num_bblocks + 1, num_pairs = 0;
+    size_t (*pairs)[2] = malloc(sizeof(size_t[2]) * capacity);
+    // the last block that was added to each block's frontier, so nothing is added twice
+    size_t *last_added = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    memset(last_added, 0xFF, sizeof(size_t) * (num_bblocks + 1));
+    for (size_t b = 0; b < num_bblocks; b++) {
+        // the entry block also has an edge from outside the function, so one predecessor is enough
+        if (tree->idom[b] == NO_BBLOCK || fn->bblocks[b].num_preds < ((b) ? 2 : 1)) continue;
+        // and since nothing dominates it but itself, it's in the frontier of every block on the way there
+        size_t stop = (b) ? tree->idom[b] : NO_BBLOCK;
+        for (size_t p = 0; p < fn->bblocks[b].num_preds; p++) {
+            size_t runner = fn->bblocks[b].preds[p];
+            if (tree->idom[runner] == NO_BBLOCK) continue;
+            while (runner != stop && last_added[runner] != b) {
+                if (num_pairs == capacity) pairs = realloc(pairs, sizeof(size_t[2]) * (capacity *= 2));
+                pairs[num_pairs][0] = runner;
+                pairs[num_pairs++][1] = b;
+                last_added[runner] = b;
+                // the entry block is its own immediate dominator
+                if (!runner) break;
+                runner = tree->idom[runner];
+            }
+        }
+    }
+    group_by_block(num_bblocks, pairs, num_pairs, &tree->frontier, &tree->frontier_start);
+    free(pairs);
+    free(last_added);
+}
+
+// Returns the dominator tree of `fn`, working it out if it isn't cached already
+DomTree *dom_tree(Function *fn) {
+    if (fn->dom_tree) return fn->dom_tree;
+    DomTree *tree = (DomTree*) aalloc(sizeof(DomTree));
+    memset(tree, 0, sizeof(DomTree));
+    if (fn->num_bblocks) {
+        number_blocks(fn, tree);
+        find_idoms(fn, tree);
+    } else {
+        tree->rpo_index = new_indices(0);
+        tree->idom = new_indices(0);
+    }
+    number_tree(fn, tree);
+    find_frontiers(fn, tree);
+    fn->dom_tree = tree;
+    return tree;
+}
+
+// Whether every path from the entry block to block `b` goes through block `a` (which includes a == b)
+bool dominates(DomTree *tree, size_t a, size_t b) {
+    if (tree->tree_pre[a] == NO_BBLOCK || tree->tree_pre[b] == NO_BBLOCK) return false;
+    return tree->tree_pre[a] <= tree->tree_pre[b] && tree->tree_pre[b] < tree->tree_pre[a] + tree->tree_size[a];
+}
@@ -1,71 +1,151 @@
 #include <optimisation.h>
 #include <string.h>
+#include <arena.h>
 #include <vector.h>
 #include <utils.h>
+#include <stdlib.h>
 
-size_t get_val(ValType type, size_t val, size_t label_val) {
-    if      (type == Number) return val;
-    else if (type == Label) return label_val;
-    else return 0;
+/* Returns true if the value of an operand is known at compile time, storing it in val_buf. A missing
+ * operand counts as 0, for instructions which only take one. */
+static bool get_val(ValType type, uint64_t val, uint64_t *val_buf) {
+    if (type == Number) *val_buf = val;
+    else if (type == Empty) *val_buf = 0;
+    else return false;
+    return true;
 }
 
-void fold_funct(Function *fn) {
-    CopyVal **copyvals = vec_new(sizeof(CopyVal));
-    for (size_t s = 0; s < fn->num_statements; s++) {
-        ValType *valtypes = fn->statements[s].val_types;
-        size_t *vals = fn->statements[s].vals;
-        Instruction instr = fn->statements[s].instruction;
-        // If it's a COPY, save the value
-        if (instr == COPY && valtypes[0] == Number) {
-            vec_push(copyvals, ((CopyVal) {
-                .label = fn->statements[s].label,
-                .val = fn->statements[s].vals[0],
-            }));
-            continue;
-        }
-        size_t in_vals[2];
-        if ((valtypes[0] == Str || valtypes[0] == BlkLbl || (valtypes[0] != Number && !(valtypes[0] == Label && find_sizet_in_copyvals(copyvals, (char*) vals[0], &in_vals[0]))) ||
-             valtypes[1] == Str || valtypes[1] == BlkLbl || (valtypes[1] != Number && !(valtypes[1] == Label && find_sizet_in_copyvals(copyvals, (char*) vals[1], &in_vals[1])))) && valtypes[1] != Empty) {
-            // it can't constant fold it if the values can't be found at compile time
-            continue;
-        }
-        // Now solve for the value and replace it with a COPY.
-        size_t params[] = {get_val(valtypes[0], vals[0], in_vals[0]), get_val(valtypes[1], vals[1], in_vals[1])};
-        if (instr == ADD) {
-            fn->statements[s].vals[0] = params[0] + params[1];
-        } else if (instr == MUL) {
-            fn->statements[s].vals[0] = params[0] * params[1];
-        } else if (instr == DIV) {
-            fn->statements[s].vals[0] = params[0] / params[1];
-        } else if (instr == SUB) {
-            fn->statements[s].vals[0] = params[0] - params[1];
-        } else if (instr == SHL) {
-            fn->statements[s].vals[0] = params[0] << params[1];
-        } else if (instr == SHR) {
-            fn->statements[s].vals[0] = params[0] >> params[1];
-        } else if (instr == EQ) {
-            fn->statements[s].vals[0] = params[0] == params[1];
-        } else if (instr == NE) {
-            fn->statements[s].vals[0] = params[0] != params[1];
-        } else if (instr == OR) {
-            fn->statements[s].vals[0] = params[0] | params[1];
-        } else if (instr == AND) {
-            fn->statements[s].vals[0] = params[0] & params[1];
-        } else if (instr == XOR) {
-            fn->statements[s].vals[0] = params[0] ^ params[1];
-        } else if (instr == NEG) {
-            fn->statements[s].vals[0] = -params[0];
-        } else {
-            continue;
-        }
-        fn->statements[s].instruction = COPY;
-        fn->statements[s].val_types[0] = Number;
-        fn->statements[s].val_types[1] = Empty;
+// Every bit of a value of type `type`
+uint64_t type_mask(Type type) {
+    return (type == Bits64) ? ~0ULL : (1ULL << (8 << type)) - 1;
+}
+
+// Sign extends a value of type `type` to 64 bits
+int64_t as_signed(uint64_t val, Type type) {
+    size_t shift = 64 - (8 << type);
+    return (int64_t) (val << shift) >> shift;
+}
+
+// Whether eval_statement() can work out `statement` when all its operands are known
+bool can_eval_statement(Statement *statement) {
+    if (statement->type >= None) return false;
+    switch (statement->instruction) {
+        case COPY: case ADD: case SUB: case MUL: case NEG: case AND: case OR: case XOR: case DIV: case REM:
+        case UDIV: case UREM: case SHL: case SHR: case EQ: case NE: case ULE: case ULT: case UGE: case UGT:
+        case SLE: case SLT: case SGE: case SGT:
+            return true;
+        case EXT:
+            return statement->arg_type != None;
+        default:
+            return false;
     }
 }
 
-void opt_fold(Function *IR, size_t num_functions) {
-    for (size_t fn = 0; fn < num_functions; fn++) {
-        fold_funct(&IR[fn]);
+/* Works out what `statement` gives with `a` and `b` as its operands, wrapping around at the width of
+ * its type as the target would. Comparisons and extensions read their operands at their arg_type.
+ * Returns false if it isn't an integer instruction or can't be worked out at compile time, such as
+ * when dividing by zero, which has to be left to happen (or not) when the program runs. */
+bool eval_statement(Statement *statement, uint64_t a, uint64_t b, uint64_t *result_buf) {
+    if (!can_eval_statement(statement)) return false;
+    Type type = statement->type;
+    Type arg_type = (statement->arg_type == None) ? type : statement->arg_type;
+    uint64_t mask = type_mask(type), arg_mask = type_mask(arg_type);
+    int64_t sa = as_signed(a, type), sb = as_signed(b, type);
+    uint64_t result;
+    switch (statement->instruction) {
+        case COPY: result = a; break;
+        case ADD:  result = a + b; break;
+        case SUB:  result = a - b; break;
+        case MUL:  result = a * b; break;
+        case NEG:  result = -a; break;
+        case AND:  result = a & b; break;
+        case OR:   result = a | b; break;
+        case XOR:  result = a ^ b; break;
+        case DIV:
+        case REM:
+            // the most negative number divided by -1 overflows, which traps just like dividing by zero
+            if (!(b & mask) || (sb == -1 && sa == as_signed(1ULL << ((8 << type) - 1), type))) return false;
+            result = (statement->instruction == DIV) ? (uint64_t) (sa / sb) : (uint64_t) (sa % sb);
+            break;
+        case UDIV:
+        case UREM:
+            if (!(b & mask)) return false;
+            result = (statement->instruction == UDIV) ? (a & mask) / (b & mask) : (a & mask) % (b & mask);
+            break;
+        case SHL:
+        case SHR:
+            // the target only looks at the low bits of the shift amount, so leave big shifts to it
+            if ((b & mask) >= (8U << type)) return false;
+            result = (statement->instruction == SHL) ? a << (b & mask) : (a & mask) >> (b & mask);
+            break;
+        case EQ:  result = (a & arg_mask) == (b & arg_mask); break;
+        case NE:  result = (a & arg_mask) != (b & arg_mask); break;
+        case ULE: result = (a & arg_mask) <= (b & arg_mask); break;
+        case ULT: result = (a & arg_mask) <  (b & arg_mask); break;
+        case UGE: result = (a & arg_mask) >= (b & arg_mask); break;
+        case UGT: result = (a & arg_mask) >  (b & arg_mask); break;
+        case SLE: result = as_signed(a, arg_type) <= as_signed(b, arg_type); break;
+        case SLT: result = as_signed(a, arg_type) <  as_signed(b, arg_type); break;
+        case SGE: result = as_signed(a, arg_type) >= as_signed(b, arg_type); break;
+        case SGT: result = as_signed(a, arg_type) >  as_signed(b, arg_type); break;
+        case EXT:
+            result = (statement->is_signed) ? (uint64_t) as_signed(a, arg_type) : a & arg_mask;
+            break;
+        default:
+            return false;
+    }
+    *result_buf = result & mask;
+    return true;
+}
+
+// Replaces statement `s` with a COPY of a number if its operands are known, returning whether it did
+static bool fold_statement(Function *fn, size_t s) {
+    Statement *statement = &fn->statements[s];
+    uint64_t params[2], result;
+    // it can't constant fold it if the values can't be found at compile time
+    if (!get_val(statement->val_types[0], statement->vals[0], &params[0]) ||
+        !get_val(statement->val_types[1], statement->vals[1], &params[1]))
+        return false;
+    if (!eval_statement(statement, params[0], params[1], &result)) return false;
+    statement->instruction = COPY;
+    statement->vals[0] = result;
+    statement->val_types[0] = Number;
+    statement->val_types[1] = Empty;
+    statement->val_types[2] = Empty;
+    return true;
+}
+
+/* Folds each statement whose operands are known, and puts the result straight into everything that
+ * uses it, so that those statements get another go at being folded. Only values with one definition
+ * are replaced, as the uses of the others might see a different definition. */
+bool opt_fold(Function *fn) {
+    bool changed = false;
+    UseLists uses = use_lists(fn);
+    size_t *worklist = (size_t*) malloc(sizeof(size_t) * (fn->num_statements + 1));
+    bool *queued = (bool*) malloc(sizeof(bool) * (fn->num_statements + 1));
+    size_t num_queued = 0;
+    for (size_t s = fn->num_statements; s > 0; s--) {
+        worklist[num_queued++] = s - 1;
+        queued[s - 1] = true;
+    }
+    while (num_queued) {
+        size_t s = worklist[--num_queued];
+        queued[s] = false;
+        Statement *statement = &fn->statements[s];
+        bool is_constant = statement->instruction == COPY && statement->val_types[0] == Number;
+        if (!is_constant) {
+            if (!fold_statement(fn, s)) continue;
+            changed = true;
+        }
+        if (uses.num_defs[statement->label] != 1) continue;
+        for (size_t u = uses.first_use[statement->label]; u != NO_USE; u = uses.uses[u].next) {
+            size_t user = uses.uses[u].statement;
+            if (queued[user]) continue;
+            queued[user] = true;
+            worklist[num_queued++] = user;
+        }
+        if (replace_uses_with_number(fn, &uses, statement->label, statement->vals[0])) changed = true;
     }
+    free(worklist);
+    free(queued);
+    return changed;
 }
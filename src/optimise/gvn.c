@@ -0,0 +1,249 @@
+/* Global value numbering. Frontends recompute the same things over and over, like the address of an
+ * array element every time it's used, so this finds statements that compute something that has
+ * already been computed by a statement dominating them, and uses that value instead.
+ * The dominator tree is walked with a scoped hash table of every statement seen on the way down, keyed
+ * by its instruction, types and operands (in a fixed order for instructions where the order doesn't
+ * matter), so a statement is only replaced by one that always runs before it. The statements found
+ * to be redundant are removed, and their uses rewritten on the spot so that statements using them
+ * can be matched too.
+ * Loads are matched as well, but only while nothing that could write to memory (a store, call, blit,
+ * inline assembly or vaarg) can have run between them. Since that's only known within a block and
+ * into blocks whose only way in is from their immediate dominator, any other block starts with
+ * memory that's different from anything before it.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <hashmap.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_EXPR ((size_t) -1)
+
+// What a statement computes, which two statements have to share to compute the same value
+typedef struct {
+    Instruction instruction;
+    Type type;
+    Type arg_type;
+    bool is_signed;
+    uint64_t vals[2];
+    ValType val_types[2];
+    size_t memory; // which state of memory a load sees, otherwise 0
+} Expr;
+
+typedef struct {
+    Expr expr;
+    ValueId value; // the first value found to be computing it
+    size_t next;   // the next expression with the same hash, or NO_EXPR
+} ExprEntry;
+
+// An expression added to the table, which is taken out again after leaving the block it was added in
+typedef struct {
+    uint64_t hash;
+    size_t prev_head;
+} Scoped;
+
+typedef struct {
+    Function *fn;
+    DomTree *tree;
+    UseLists uses;
+    HashMap heads;       // from the hash of an expression to the last entry added with it
+    ExprEntry *entries;  // room for every statement
+    size_t num_entries;
+    Scoped *scoped;      // room for every statement
+    size_t num_scoped;
+    size_t *memory_at_end; // indexed by block
+    size_t num_memories;
+    bool *removed;       // indexed by statement
+    size_t num_removed;
+} Numberer;
+
+static bool is_commutative(Instruction instruction) {
+    switch (instruction) {
+        case ADD: case MUL: case AND: case OR: case XOR: case EQ: case NE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether a statement computes its value only from its operands, so it can be reused wherever it's dominated
+static bool is_pure(Instruction instruction) {
+    switch (instruction) {
+        case ADD: case SUB: case DIV: case MUL: case NEG: case UDIV: case REM: case UREM:
+        case AND: case OR: case XOR: case SHL: case SHR: case EXT:
+        case EQ: case NE: case SLE: case SLT: case SGE: case SGT: case ULE: case ULT: case UGE: case UGT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool writes_memory(Instruction instruction) {
+    switch (instruction) {
+        case STORE: case CALL: case BLIT: case ASM: case VASTART: case VAARG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool operand_before(uint64_t a, ValType a_type, uint64_t b, ValType b_type) {
+    return (a_type != b_type) ? a_type < b_type : a < b;
+}
+
+// Whether `val` is the same value everywhere it can be seen, which isn't true of labels defined more than once
+static bool is_single_value(UseLists *uses, uint64_t val, ValType type) {
+    if (type == Label) return uses->num_defs[val] == 1;
+    return type == Number || type == Str || type == Empty;
+}
+
+static uint64_t hash_expr(Expr *expr) {
+    uint64_t hash = expr->instruction;
+    hash = hash * 31 + expr->type;
+    hash = hash * 31 + expr->arg_type;
+    hash = hash * 31 + expr->is_signed;
+    for (size_t i = 0; i < 2; i++) {
+        hash = (hash ^ expr->vals[i]) * 0x100000001B3ULL;
+        hash = hash * 31 + expr->val_types[i];
+    }
+    hash = (hash ^ expr->memory) * 0x100000001B3ULL;
+    // 0 means an empty slot in the hash map
+    return (hash) ? hash : 1;
+}
+
+static bool same_expr(Expr *a, Expr *b) {
+    if (a->instruction != b->instruction || a->type != b->type || a->arg_type != b->arg_type) return false;
+    if (a->is_signed != b->is_signed || a->memory != b->memory) return false;
+    for (size_t i = 0; i < 2; i++) {
+        if (a->val_types[i] != b->val_types[i]) return false;
+        if (a->val_types[i] != Empty && a->vals[i] != b->vals[i]) return false;
+    }
+    return true;
+}
+
+// Fills in what `statement` computes, returning false if it's not something that can be numbered
+static bool expr_of(Numberer *numberer, Statement *statement, size_t memory, Expr *expr_buf) {
+    if (!statement->label || numberer->uses.num_defs[statement->label] != 1) return false;
+    if (!is_pure(statement->instruction) && statement->instruction != LOAD) return false;
+    if (statement->val_types[2] != Empty) return false;
+    *expr_buf = (Expr) {
+        .instruction = statement->instruction,
+        .type = statement->type,
+        .arg_type = statement->arg_type,
+        .is_signed = statement->is_signed,
+        .memory = (statement->instruction == LOAD) ? memory : 0,
+    };
+    for (size_t i = 0; i < 2; i++) {
+        if (!is_single_value(&numberer->uses, statement->vals[i], statement->val_types[i])) return false;
+        expr_buf->vals[i] = (statement->val_types[i] == Empty) ? 0 : statement->vals[i];
+        expr_buf->val_types[i] = statement->val_types[i];
+    }
+    if (is_commutative(statement->instruction) &&
+        operand_before(expr_buf->vals[1], expr_buf->val_types[1], expr_buf->vals[0], expr_buf->val_types[0])) {
+        uint64_t val = expr_buf->vals[0];
+        ValType type = expr_buf->val_types[0];
+        expr_buf->vals[0] = expr_buf->vals[1];
+        expr_buf->val_types[0] = expr_buf->val_types[1];
+        expr_buf->vals[1] = val;
+        expr_buf->val_types[1] = type;
+    }
+    return true;
+}
+
+// Returns the value that already computes `expr`, or adds it to the table as computed by `value` and returns 0
+static ValueId find_or_add(Numberer *numberer, Expr *expr, ValueId value) {
+    uint64_t hash = hash_expr(expr);
+    uint64_t head;
+    if (!hashmap_get(&numberer->heads, hash, &head)) head = NO_EXPR;
+    for (size_t e = head; e != NO_EXPR; e = numberer->entries[e].next) {
+        if (same_expr(&numberer->entries[e].expr, expr)) return numberer->entries[e].value;
+    }
+    numberer->entries[numberer->num_entries] = (ExprEntry) {.expr = *expr, .value = value, .next = head};
+    numberer->scoped[numberer->num_scoped++] = (Scoped) {.hash = hash, .prev_head = head};
+    hashmap_put(&numberer->heads, hash, numberer->num_entries++);
+    return 0;
+}
+
+/* Memory is only the same at the start of a block as at the end of its immediate dominator if that's
+ * the only way into it, otherwise anything could have changed it on the way. */
+static size_t memory_at_start(Numberer *numberer, size_t block) {
+    BasicBlock *bblock = &numberer->fn->bblocks[block];
+    if (block && bblock->num_preds == 1 && bblock->preds[0] == numberer->tree->idom[block])
+        return numberer->memory_at_end[bblock->preds[0]];
+    return ++numberer->num_memories;
+}
+
+static void number_block(Numberer *numberer, size_t block) {
+    Function *fn = numberer->fn;
+    size_t memory = memory_at_start(numberer, block);
+    for (size_t s = fn->bblocks[block].start; s < fn->bblocks[block].end; s++) {
+        Statement *statement = &fn->statements[s];
+        if (writes_memory(statement->instruction)) {
+            memory = ++numberer->num_memories;
+            continue;
+        }
+        Expr expr;
+        if (!expr_of(numberer, statement, memory, &expr)) continue;
+        ValueId leader = find_or_add(numberer, &expr, statement->label);
+        if (!leader) continue;
+        replace_all_uses_with(&numberer->uses, statement->label, leader, Label);
+        numberer->removed[s] = true;
+        numberer->num_removed++;
+    }
+    numberer->memory_at_end[block] = memory;
+}
+
+bool opt_gvn(Function *fn) {
+    DomTree *tree = dom_tree(fn);
+    if (!tree->num_reachable) return false;
+    Numberer numberer = {
+        .fn = fn,
+        .tree = tree,
+        .uses = use_lists(fn),
+        .entries = (ExprEntry*) malloc(sizeof(ExprEntry) * (fn->num_statements + 1)),
+        .scoped = (Scoped*) malloc(sizeof(Scoped) * (fn->num_statements + 1)),
+        .memory_at_end = (size_t*) malloc(sizeof(size_t) * (fn->num_bblocks + 1)),
+        .removed = (bool*) aalloc(sizeof(bool) * fn->num_statements),
+    };
+    hashmap_init(&numberer.heads, &arena, fn->num_statements);
+    memset(numberer.removed, 0, sizeof(bool) * fn->num_statements);
+    // each block is on the stack twice, once to go into it and once (as ~block) to come back out
+    size_t *stack = (size_t*) malloc(sizeof(size_t) * (tree->num_reachable * 2 + 1));
+    size_t *scoped_at = (size_t*) malloc(sizeof(size_t) * (fn->num_bblocks + 1));
+    size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth) {
+        size_t b = stack[--depth];
+        if (b > fn->num_bblocks) {
+            // the entries go in order, so taking them out in reverse leaves each hash's list as it was
+            for (; numberer.num_scoped > scoped_at[~b]; numberer.num_scoped--) {
+                Scoped *scoped = &numberer.scoped[numberer.num_scoped - 1];
+                hashmap_put(&numberer.heads, scoped->hash, scoped->prev_head);
+            }
+            continue;
+        }
+        scoped_at[b] = numberer.num_scoped;
+        number_block(&numberer, b);
+        stack[depth++] = ~b;
+        for (size_t c = tree->children_start[b + 1]; c > tree->children_start[b]; c--)
+            stack[depth++] = tree->children[c - 1];
+    }
+    free(stack);
+    free(scoped_at);
+    free(numberer.entries);
+    free(numberer.scoped);
+    free(numberer.memory_at_end);
+    if (!numberer.num_removed) return false;
+    // the uses point into the statements, so they can only be moved once everything's been replaced
+    Statement **statement_vec = vec_new(sizeof(Statement));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (!numberer.removed[s]) vec_push(statement_vec, fn->statements[s]);
+    }
+    fn->num_statements = vec_size(statement_vec);
+    fn->statements = vec_into_arena(statement_vec);
+    add_stat(STAT_GVN_STATEMENTS, numberer.num_removed);
+    return true;
+}
@@ -0,0 +1,538 @@
+/* Function inlining, which is a module pass since it needs every function at once. First a call graph
+ * is built, and split into strongly connected components so that a function which can end up calling
+ * itself is never inlined. Functions are then looked at callees first, so that anything inlined into
+ * a callee is inlined along with it. At each call to a function defined in the same file, the cost of
+ * inlining it is worked out from the size of its body, less what the call itself would have cost and a
+ * bonus for each constant argument (which can be folded once it's inlined). Calls costing up to
+ * Pipeline.inline_threshold are inlined, as long as the caller doesn't grow past
+ * Pipeline.inline_max_size. The only call to a function that isn't exported is always inlined if there's
+ * room, since the function can be removed afterwards.
+ * Inlining a call puts a copy of each argument in the callee's parameter, then a copy of the callee's
+ * body with every temporary and block label given a new name, then the rest of the caller's block after
+ * the call in a new block. Each ret jumps to that block instead, and if the call's result is used, the
+ * values returned are joined with phis (which only take two values, so there's a chain of them with
+ * more than two rets). Finally, functions which aren't exported and aren't called or referred to by any
+ * function that's left are removed.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <hashmap.h>
+#include <intern.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How much cheaper each constant argument makes a call look, since it can be folded into the callee
+#define CONSTANT_ARG_BONUS 4
+
+#define NOT_VISITED ((size_t) -1)
+
+typedef struct {
+    char *name;
+    bool is_call; // otherwise it's the function's address being used
+} FunctionRef;
+
+typedef struct {
+    Function *fns;
+    size_t num_functions;
+    HashMap indexes;      // the index of each function, keyed by its name
+    size_t *callees;      // the functions called by function f are callees[callees_start[f] .. callees_start[f + 1]]
+    size_t *callees_start;
+    size_t *order;        // every function, with the functions each one calls before it unless they're recursive
+    bool *is_recursive;   // indexed by function, whether it can end up calling itself
+    size_t *num_calls;    // indexed by function, how many calls there are to it in the whole program
+    bool *address_taken;  // indexed by function, whether it's used other than by calling it
+} CallGraph;
+
+// The state for inlining calls into one function
+typedef struct {
+    Function *fn;
+    Statement **statements_vec;
+    char* **value_names_vec;
+    char* **block_names_vec;
+    size_t num_blocks;      // how many block labels the function had before anything was inlined into it
+    BlockId *end_label;     // indexed by the function's own BlockIds, the block its end is now in, or 0 if it hasn't moved
+    BlockId current_label;  // the label of the block statements are being added to, or 0 if it doesn't have one
+} Inliner;
+
+// Finds the functions referred to by `fn`, adding them to refs_vec
+static void find_refs(Function *fn, FunctionRef **refs_vec) {
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction == CALL) {
+            if (statement->val_types[0] == Str) vec_push(refs_vec, ((FunctionRef) {(char*) statement->vals[0], true}));
+            FunctionArgList *args = (FunctionArgList*) statement->vals[1];
+            for (size_t a = 0; a < args->num_args; a++) {
+                if (args->arg_types[a] == Str) vec_push(refs_vec, ((FunctionRef) {(char*) args->args[a], false}));
+            }
+        } else if (statement->instruction == PHI) {
+            for (size_t i = 0; i < 2; i++) {
+                PhiVal *phi_val = (PhiVal*) statement->vals[i];
+                if (phi_val->type == Str) vec_push(refs_vec, ((FunctionRef) {(char*) phi_val->val, false}));
+            }
+        } else if (statement->instruction == ASM) {
+            InlineAsm *info = (InlineAsm*) statement->vals[0];
+            for (size_t in = 0; in < vec_size(info->inputs_vec); in++) {
+                if ((*info->inputs_vec)[in].type == Str) vec_push(refs_vec, ((FunctionRef) {(char*) (*info->inputs_vec)[in].label, false}));
+            }
+        } else {
+            for (size_t i = 0; i < 3; i++) {
+                if (statement->val_types[i] == Str) vec_push(refs_vec, ((FunctionRef) {(char*) statement->vals[i], false}));
+            }
+        }
+    }
+}
+
+static bool find_function(CallGraph *graph, char *name, size_t *index_buf) {
+    uint64_t index;
+    if (!hashmap_get(&graph->indexes, (uint64_t) name, &index)) return false;
+    *index_buf = index;
+    return true;
+}
+
+/* Puts the functions in graph->order one strongly connected component at a time, in the order Tarjan's
+ * algorithm finds them, which is callees first. It's done with a stack of its own rather than recursion
+ * since call chains can be very deep. */
+static void find_sccs(CallGraph *graph) {
+    size_t n = graph->num_functions;
+    size_t *index = (size_t*) malloc(sizeof(size_t) * n * 5);
+    size_t *lowlink = &index[n];
+    size_t *stack = &index[n * 2];
+    size_t *frames = &index[n * 3];    // the function being visited at each depth
+    size_t *next_edge = &index[n * 4]; // indexed by function, the next of its callees to look at
+    bool *on_stack = (bool*) calloc(n, sizeof(bool));
+    for (size_t f = 0; f < n; f++) index[f] = NOT_VISITED;
+    size_t num_visited = 0, stack_len = 0, num_ordered = 0;
+    for (size_t root = 0; root < n; root++) {
+        if (index[root] != NOT_VISITED) continue;
+        size_t depth = 0;
+        frames[depth++] = root;
+        index[root] = lowlink[root] = num_visited++;
+        next_edge[root] = graph->callees_start[root];
+        stack[stack_len++] = root;
+        on_stack[root] = true;
+        while (depth) {
+            size_t f = frames[depth - 1];
+            if (next_edge[f] < graph->callees_start[f + 1]) {
+                size_t callee = graph->callees[next_edge[f]++];
+                if (callee == f) graph->is_recursive[f] = true;
+                if (index[callee] == NOT_VISITED) {
+                    index[callee] = lowlink[callee] = num_visited++;
+                    next_edge[callee] = graph->callees_start[callee];
+                    stack[stack_len++] = callee;
+                    on_stack[callee] = true;
+                    frames[depth++] = callee;
+                } else if (on_stack[callee] && index[callee] < lowlink[f]) {
+                    lowlink[f] = index[callee];
+                }
+                continue;
+            }
+            if (lowlink[f] == index[f]) {
+                size_t scc_start = num_ordered;
+                size_t member;
+                do {
+                    member = stack[--stack_len];
+                    on_stack[member] = false;
+                    graph->order[num_ordered++] = member;
+                } while (member != f);
+                if (num_ordered - scc_start > 1) {
+                    for (size_t m = scc_start; m < num_ordered; m++) graph->is_recursive[graph->order[m]] = true;
+                }
+            }
+            depth--;
+            if (depth && lowlink[f] < lowlink[frames[depth - 1]]) lowlink[frames[depth - 1]] = lowlink[f];
+        }
+    }
+    free(on_stack);
+    free(index);
+}
+
+static void build_call_graph(Function *fns, size_t num_functions, CallGraph *graph_buf) {
+    *graph_buf = (CallGraph) {
+        .fns = fns,
+        .num_functions = num_functions,
+        .callees_start = (size_t*) aalloc(sizeof(size_t) * (num_functions + 1)),
+        .order = (size_t*) aalloc(sizeof(size_t) * num_functions),
+        .is_recursive = (bool*) aalloc(sizeof(bool) * num_functions),
+        .num_calls = (size_t*) aalloc(sizeof(size_t) * num_functions),
+        .address_taken = (bool*) aalloc(sizeof(bool) * num_functions),
+    };
+    memset(graph_buf->is_recursive, 0, sizeof(bool) * num_functions);
+    memset(graph_buf->num_calls, 0, sizeof(size_t) * num_functions);
+    memset(graph_buf->address_taken, 0, sizeof(bool) * num_functions);
+    hashmap_init(&graph_buf->indexes, &arena, num_functions);
+    for (size_t f = 0; f < num_functions; f++) hashmap_put(&graph_buf->indexes, (uint64_t) fns[f].name, f);
+    size_t **callees_vec = vec_new(sizeof(size_t));
+    for (size_t f = 0; f < num_functions; f++) {
+        graph_buf->callees_start[f] = vec_size(callees_vec);
+        FunctionRef **refs_vec = vec_new(sizeof(FunctionRef));
+        find_refs(&fns[f], refs_vec);
+        for (size_t r = 0; r < vec_size(refs_vec); r++) {
+            size_t index;
+            if (!find_function(graph_buf, (*refs_vec)[r].name, &index)) continue;
+            if (!(*refs_vec)[r].is_call) {
+                graph_buf->address_taken[index] = true;
+                continue;
+            }
+            graph_buf->num_calls[index]++;
+            vec_push(callees_vec, index);
+        }
+        vec_free(refs_vec);
+    }
+    graph_buf->callees_start[num_functions] = vec_size(callees_vec);
+    graph_buf->callees = vec_into_arena(callees_vec);
+    find_sccs(graph_buf);
+}
+
+// The statements in a function which generate any code
+static size_t body_size(Function *fn) {
+    size_t size = 0;
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Instruction instruction = fn->statements[s].instruction;
+        if (instruction != BLKLBL && instruction != LOC) size++;
+    }
+    return size;
+}
+
+// Whether anything about the callee itself means it can't be inlined
+static bool can_inline_function(Function *callee) {
+    if (callee->is_variadic || callee->ret_is_struct) return false;
+    for (size_t a = 0; a < callee->num_args; a++) {
+        if (callee->args[a].type_is_struct) return false;
+    }
+    bool has_ret = false;
+    for (size_t s = 0; s < callee->num_statements; s++) {
+        Instruction instruction = callee->statements[s].instruction;
+        // labels in inline assembly would be defined twice if it was copied
+        if (instruction == ASM || instruction == VASTART || instruction == VAARG) return false;
+        if (instruction == RET) has_ret = true;
+    }
+    return has_ret;
+}
+
+// Whether the call matches the callee closely enough for the arguments to just be copied in
+static bool call_matches(Statement *call, Function *callee) {
+    FunctionArgList *args = (FunctionArgList*) call->vals[1];
+    if (args->num_args != callee->num_args) return false;
+    for (size_t a = 0; a < args->num_args; a++) {
+        if (args->args_are_structs[a] || args->arg_sizes[a] != callee->args[a].type) return false;
+    }
+    if (!call->label) return true;
+    if (call->type != callee->return_type) return false;
+    for (size_t s = 0; s < callee->num_statements; s++) {
+        if (callee->statements[s].instruction == RET && callee->statements[s].val_types[0] == Empty) return false;
+    }
+    return true;
+}
+
+static long long call_cost(CallGraph *graph, Statement *call, size_t callee_index) {
+    Function *callee = &graph->fns[callee_index];
+    FunctionArgList *args = (FunctionArgList*) call->vals[1];
+    size_t size = body_size(callee);
+    // the call itself and moving each argument into place
+    long long cost = (long long) size - 1 - (long long) args->num_args;
+    for (size_t a = 0; a < args->num_args; a++) {
+        if (args->arg_types[a] == Number || args->arg_types[a] == Str) cost -= CONSTANT_ARG_BONUS;
+    }
+    bool is_only_call = !callee->is_global && !graph->address_taken[callee_index] && graph->num_calls[callee_index] == 1;
+    if (is_only_call) cost -= size;
+    return cost;
+}
+
+static BlockId new_block(Inliner *inliner, char *name) {
+    BlockId id = vec_size(inliner->block_names_vec);
+    vec_push(inliner->block_names_vec, name);
+    return id;
+}
+
+static ValueId new_value(Inliner *inliner, char *name) {
+    ValueId id = vec_size(inliner->value_names_vec);
+    vec_push(inliner->value_names_vec, name);
+    return id;
+}
+
+static void add_statement(Inliner *inliner, Statement statement) {
+    if (statement.instruction == BLKLBL) inliner->current_label = statement.vals[0];
+    else if (is_terminator(statement.instruction)) inliner->current_label = 0;
+    vec_push(inliner->statements_vec, statement);
+}
+
+static void add_block_label(Inliner *inliner, BlockId label) {
+    add_statement(inliner, (Statement) {
+        .instruction = BLKLBL,
+        .arg_type = None,
+        .vals = {label},
+        .val_types = {BlkLbl, Empty, Empty},
+    });
+}
+
+static void add_jmp(Inliner *inliner, BlockId target) {
+    add_statement(inliner, (Statement) {
+        .instruction = JMP,
+        .arg_type = None,
+        .vals = {target},
+        .val_types = {BlkLbl, Empty, Empty},
+    });
+}
+
+static PhiVal *new_phi_val(BlockId blklbl, uint64_t val, ValType type) {
+    PhiVal *phi_val = (PhiVal*) aalloc(sizeof(PhiVal));
+    *phi_val = (PhiVal) {.blklbl = blklbl, .val = val, .type = type};
+    return phi_val;
+}
+
+typedef struct {
+    BlockId block; // where the ret was
+    uint64_t val;
+    ValType type;
+} InlinedRet;
+
+// Copies a statement from the callee, giving its values and block labels their new IDs
+static Statement copy_statement(Statement statement, ValueId value_base, BlockId block_base) {
+    if (statement.label) statement.label += value_base;
+    if (statement.instruction == CALL) {
+        FunctionArgList *args = (FunctionArgList*) aalloc(sizeof(FunctionArgList));
+        *args = *(FunctionArgList*) statement.vals[1];
+        uint64_t *vals = args->args;
+        ValType *types = args->arg_types;
+        args->args = (uint64_t*) aalloc(sizeof(uint64_t) * args->num_args);
+        args->arg_types = (ValType*) aalloc(sizeof(ValType) * args->num_args);
+        for (size_t a = 0; a < args->num_args; a++) {
+            args->args[a] = (types[a] == Label) ? vals[a] + value_base : vals[a];
+            args->arg_types[a] = types[a];
+        }
+        statement.vals[1] = (uint64_t) args;
+        if (statement.val_types[0] == Label) statement.vals[0] += value_base;
+        return statement;
+    }
+    if (statement.instruction == PHI) {
+        for (size_t i = 0; i < 2; i++) {
+            PhiVal *phi_val = (PhiVal*) statement.vals[i];
+            statement.vals[i] = (uint64_t) new_phi_val(phi_val->blklbl + block_base,
+                                    (phi_val->type == Label) ? phi_val->val + value_base : phi_val->val, phi_val->type);
+        }
+        return statement;
+    }
+    for (size_t i = 0; i < 3; i++) {
+        if (statement.val_types[i] == Label) statement.vals[i] += value_base;
+        else if (statement.val_types[i] == BlkLbl) statement.vals[i] += block_base;
+    }
+    return statement;
+}
+
+/* Adds the body of `callee` in place of `call`, so that the statements after it in the caller go in a
+ * new block. */
+static void inline_call(Inliner *inliner, CallGraph *graph, Statement *call, size_t callee_index, BlockId current_orig_label) {
+    Function *callee = &graph->fns[callee_index];
+    size_t id = vec_size(inliner->block_names_vec);
+    // everything in the callee gets a new ID after the ones already in the caller
+    ValueId value_base = vec_size(inliner->value_names_vec) - 1;
+    BlockId block_base = vec_size(inliner->block_names_vec) - 1;
+    for (ValueId v = 1; v < callee->num_values; v++) new_value(inliner, suffixed_name(callee->value_names[v], ".inl%zu", id));
+    for (BlockId b = 1; b < callee->num_blocks; b++) new_block(inliner, suffixed_name(callee->block_names[b], ".inl%zu", id));
+    size_t num_rets = 0;
+    for (size_t s = 0; s < callee->num_statements; s++) num_rets += callee->statements[s].instruction == RET;
+    // with a result and more than one ret, rets[r] jumps to joins[max(r, 1) - 1], and joins[num_rets - 2] is the continuation
+    bool join_results = call->label && num_rets > 1;
+    size_t num_joins = (join_results) ? num_rets - 1 : 1;
+    BlockId *joins = (BlockId*) aalloc(sizeof(BlockId) * num_joins);
+    char name[48];
+    for (size_t j = 0; j < num_joins; j++) {
+        snprintf(name, sizeof(name), "inl%zu.join%zu", id, j);
+        joins[j] = new_block(inliner, intern_cstr(name));
+    }
+    BlockId continuation = joins[num_joins - 1];
+    // the rest of the block the call was in is in the continuation now, so phis after it have to know
+    if (current_orig_label) inliner->end_label[current_orig_label] = continuation;
+    // parameters
+    FunctionArgList *args = (FunctionArgList*) call->vals[1];
+    for (size_t a = 0; a < callee->num_args; a++) {
+        add_statement(inliner, (Statement) {
+            .label = callee->args[a].label + value_base,
+            .instruction = COPY,
+            .type = callee->args[a].type,
+            .arg_type = None,
+            .vals = {args->args[a]},
+            .val_types = {args->arg_types[a], Empty, Empty},
+        });
+    }
+    // body
+    InlinedRet *rets = (InlinedRet*) aalloc(sizeof(InlinedRet) * num_rets);
+    size_t ret = 0;
+    for (size_t s = 0; s < callee->num_statements; s++) {
+        Statement statement = callee->statements[s];
+        if (statement.instruction != RET) {
+            Statement copy = copy_statement(statement, value_base, block_base);
+            if (copy.instruction == CALL && copy.val_types[0] == Str) {
+                size_t index;
+                if (find_function(graph, (char*) copy.vals[0], &index)) graph->num_calls[index]++;
+            }
+            add_statement(inliner, copy);
+            continue;
+        }
+        Statement copy = copy_statement(statement, value_base, block_base);
+        BlockId target = continuation;
+        if (join_results) {
+            // the phi this goes to has to be able to name the block it's in
+            if (!inliner->current_label) {
+                snprintf(name, sizeof(name), "inl%zu.ret%zu", id, ret);
+                add_block_label(inliner, new_block(inliner, intern_cstr(name)));
+            }
+            rets[ret] = (InlinedRet) {inliner->current_label, copy.vals[0], copy.val_types[0]};
+            target = joins[(ret) ? ret - 1 : 0];
+        } else if (call->label) {
+            add_statement(inliner, (Statement) {
+                .label = call->label,
+                .instruction = COPY,
+                .type = call->type,
+                .arg_type = None,
+                .vals = {copy.vals[0]},
+                .val_types = {copy.val_types[0], Empty, Empty},
+            });
+        }
+        ret++;
+        // the last statement can run straight on into the first block after the body
+        if (s != callee->num_statements - 1 || target != joins[0]) add_jmp(inliner, target);
+    }
+    // join the values returned with a chain of phis, the last of which is the call's result
+    ValueId joined = 0;
+    for (size_t j = 0; j < num_joins; j++) {
+        add_block_label(inliner, joins[j]);
+        if (!join_results) break;
+        PhiVal *from_before = (j) ? new_phi_val(joins[j - 1], joined, Label)
+                                  : new_phi_val(rets[0].block, rets[0].val, rets[0].type);
+        PhiVal *from_ret = new_phi_val(rets[j + 1].block, rets[j + 1].val, rets[j + 1].type);
+        if (j == num_joins - 1) {
+            joined = call->label;
+        } else {
+            snprintf(name, sizeof(name), "inl%zu.joined%zu", id, j);
+            joined = new_value(inliner, intern_cstr(name));
+        }
+        add_statement(inliner, (Statement) {
+            .label = joined,
+            .instruction = PHI,
+            .type = call->type,
+            .arg_type = None,
+            .vals = {(uint64_t) from_before, (uint64_t) from_ret},
+            .val_types = {PhiArg, PhiArg, Empty},
+        });
+    }
+    graph->num_calls[callee_index]--;
+    add_stat(STAT_INLINE_CALLS, 1);
+}
+
+// Inlines whatever calls in function `f` are worth it. Returns whether there were any.
+static bool inline_calls_in(CallGraph *graph, size_t f, Pipeline *pipeline, bool *can_inline) {
+    Function *fn = &graph->fns[f];
+    Inliner inliner = {
+        .fn = fn,
+        .statements_vec = vec_new(sizeof(Statement)),
+        .value_names_vec = vec_new(sizeof(char*)),
+        .block_names_vec = vec_new(sizeof(char*)),
+        .num_blocks = fn->num_blocks,
+        .end_label = (BlockId*) aalloc(sizeof(BlockId) * fn->num_blocks),
+    };
+    memset(inliner.end_label, 0, sizeof(BlockId) * fn->num_blocks);
+    for (ValueId v = 0; v < fn->num_values; v++) vec_push(inliner.value_names_vec, fn->value_names[v]);
+    for (BlockId b = 0; b < fn->num_blocks; b++) vec_push(inliner.block_names_vec, fn->block_names[b]);
+    // the label of the block in the caller that the statements being looked at are in
+    BlockId current_orig_label = 0;
+    bool changed = false;
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction == BLKLBL) current_orig_label = statement->vals[0];
+        else if (is_terminator(statement->instruction)) current_orig_label = 0;
+        size_t callee;
+        bool should_inline = statement->instruction == CALL && statement->val_types[0] == Str &&
+                             find_function(graph, (char*) statement->vals[0], &callee) &&
+                             can_inline[callee] && !graph->is_recursive[callee] && call_matches(statement, &graph->fns[callee]);
+        if (should_inline) {
+            size_t caller_size = vec_size(inliner.statements_vec) + fn->num_statements - s;
+            should_inline = caller_size + body_size(&graph->fns[callee]) <= pipeline->inline_max_size &&
+                            call_cost(graph, statement, callee) <= (long long) pipeline->inline_threshold;
+        }
+        if (!should_inline) {
+            add_statement(&inliner, *statement);
+            continue;
+        }
+        inline_call(&inliner, graph, statement, callee, current_orig_label);
+        changed = true;
+    }
+    if (!changed) {
+        vec_free(inliner.statements_vec);
+        vec_free(inliner.value_names_vec);
+        vec_free(inliner.block_names_vec);
+        return false;
+    }
+    // phis in the caller which took a value from a block that had a call inlined into it
+    for (size_t s = 0; s < vec_size(inliner.statements_vec); s++) {
+        Statement *statement = &(*inliner.statements_vec)[s];
+        if (statement->instruction != PHI) continue;
+        for (size_t i = 0; i < 2; i++) {
+            PhiVal *phi_val = (PhiVal*) statement->vals[i];
+            if (phi_val->blklbl < inliner.num_blocks && inliner.end_label[phi_val->blklbl])
+                phi_val->blklbl = inliner.end_label[phi_val->blklbl];
+        }
+    }
+    fn->num_statements = vec_size(inliner.statements_vec);
+    fn->statements = vec_into_arena(inliner.statements_vec);
+    fn->num_values = vec_size(inliner.value_names_vec);
+    fn->value_names = vec_into_arena(inliner.value_names_vec);
+    fn->num_blocks = vec_size(inliner.block_names_vec);
+    fn->block_names = vec_into_arena(inliner.block_names_vec);
+    return true;
+}
+
+/* Removes functions which aren't exported and can't be reached from any that are, keeping the order
+ * of the rest. Returns whether there were any. */
+static bool remove_unused_functions(CallGraph *graph, Function *fns, size_t *num_functions) {
+    size_t n = *num_functions;
+    bool *used = (bool*) calloc(n, sizeof(bool));
+    size_t *worklist = (size_t*) malloc(sizeof(size_t) * (n + 1));
+    size_t num_queued = 0;
+    for (size_t f = 0; f < n; f++) {
+        if (!fns[f].is_global) continue;
+        used[f] = true;
+        worklist[num_queued++] = f;
+    }
+    while (num_queued) {
+        size_t f = worklist[--num_queued];
+        FunctionRef **refs_vec = vec_new(sizeof(FunctionRef));
+        find_refs(&fns[f], refs_vec);
+        for (size_t r = 0; r < vec_size(refs_vec); r++) {
+            size_t index;
+            if (!find_function(graph, (*refs_vec)[r].name, &index) || used[index]) continue;
+            used[index] = true;
+            worklist[num_queued++] = index;
+        }
+        vec_free(refs_vec);
+    }
+    free(worklist);
+    size_t num_used = 0;
+    for (size_t f = 0; f < n; f++) {
+        if (used[f]) fns[num_used++] = fns[f];
+    }
+    free(used);
+    add_stat(STAT_INLINE_FUNCTIONS_REMOVED, n - num_used);
+    *num_functions = num_used;
+    return num_used != n;
+}
+
+bool opt_inline(Function *fns, size_t *num_functions, Pipeline *pipeline) {
+    CallGraph graph;
+    build_call_graph(fns, *num_functions, &graph);
+    bool *can_inline = (bool*) aalloc(sizeof(bool) * *num_functions);
+    memset(can_inline, 0, sizeof(bool) * *num_functions);
+    bool changed = false;
+    for (size_t o = 0; o < *num_functions; o++) {
+        size_t f = graph.order[o];
+        changed |= inline_calls_in(&graph, f, pipeline, can_inline);
+        // only decided once anything that's going to be inlined into it has been
+        can_inline[f] = can_inline_function(&fns[f]);
+    }
+    changed |= remove_unused_functions(&graph, fns, num_functions);
+    return changed;
+}
@@ -0,0 +1,182 @@
+/* Basic induction variables, which are phis in a loop's header that have the same constant added to
+ * them each time round the loop. What a phi's given coming round again has to be worked out from the
+ * phi itself by nothing but adding and taking away constants, which is followed back through as many
+ * statements as it takes (an unrolled loop adds to it once for each copy of its body), and the
+ * constants are added up into its step.
+ * A loop's header usually decides whether to go round again by comparing one of them with something
+ * that doesn't change in the loop. If both that and where it starts off are constants, the number of
+ * times the body runs is worked out by running the phi forward until the comparison says to stop,
+ * which also gets wrapping around and the width of the comparison right.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The trip count of a loop isn't worked out past this
+#define MAX_TRIP_COUNT 65536
+// The most statements followed back from what a phi's given coming round again to the phi
+#define MAX_STEP_CHAIN 16
+
+typedef struct {
+    Function *fn;
+    Loops *loops;
+    UseLists *uses;
+    size_t *block_of; // indexed by statement
+} IVFinder;
+
+static bool is_comparison(Instruction instruction) {
+    switch (instruction) {
+        case EQ: case NE: case SLE: case SLT: case SGE: case SGT: case ULE: case ULT: case UGE: case UGT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The block of the statement defining `value`, or NO_BBLOCK if it isn't defined exactly once by a statement
+static size_t def_block(IVFinder *finder, ValueId value) {
+    if (finder->uses->num_defs[value] != 1 || finder->uses->def[value] == NO_STATEMENT) return NO_BBLOCK;
+    return finder->block_of[finder->uses->def[value]];
+}
+
+// Whether `val` is the same every time round `loop`
+static bool is_invariant(IVFinder *finder, size_t loop, uint64_t val, ValType type) {
+    if (type == Number || type == Str) return true;
+    if (type != Label || finder->uses->num_defs[val] != 1) return false;
+    if (finder->uses->def[val] == NO_STATEMENT) return true;
+    return !in_loop(finder->loops, loop, finder->block_of[finder->uses->def[val]]);
+}
+
+/* Adds up the constants added to `phi` to get `next`, following it back through the statements
+ * defining it. Returns false if it isn't the phi plus a constant. */
+static bool find_step(IVFinder *finder, size_t loop, Statement *phi, PhiVal *next, uint64_t *step_buf) {
+    if (next->type != Label) return false;
+    uint64_t step = 0;
+    ValueId value = next->val;
+    for (size_t i = 0; i < MAX_STEP_CHAIN; i++) {
+        size_t block = def_block(finder, value);
+        if (block == NO_BBLOCK || !in_loop(finder->loops, loop, block)) return false;
+        Statement *statement = &finder->fn->statements[finder->uses->def[value]];
+        if (statement->type != phi->type) return false;
+        size_t operand;
+        if (statement->val_types[0] == Label && statement->val_types[1] == Number) operand = 0;
+        else if (statement->val_types[0] == Number && statement->val_types[1] == Label) operand = 1;
+        else return false;
+        if (statement->instruction == ADD) step += statement->vals[!operand];
+        else if (statement->instruction == SUB && !operand) step -= statement->vals[1];
+        else return false;
+        value = statement->vals[operand];
+        if (value == phi->label) {
+            *step_buf = step & type_mask(phi->type);
+            return *step_buf != 0;
+        }
+    }
+    return false;
+}
+
+static size_t find_trip_count(InductionVar *iv, Type type, Statement *compare, size_t iv_operand, bool stays_if_true) {
+    if (iv->start->type != Number || compare->val_types[!iv_operand] != Number) return NO_TRIP_COUNT;
+    // adds the step at the phi's width, the same way the loop does
+    Statement step = {
+        .instruction = ADD,
+        .type = type,
+        .arg_type = None,
+        .val_types = {Number, Number, Empty},
+    };
+    uint64_t value = iv->start->val;
+    for (size_t n = 0; n <= MAX_TRIP_COUNT; n++) {
+        uint64_t result;
+        uint64_t a = (iv_operand) ? compare->vals[0] : value;
+        uint64_t b = (iv_operand) ? value : compare->vals[1];
+        if (!eval_statement(compare, a, b, &result)) return NO_TRIP_COUNT;
+        if (!result == stays_if_true) return n;
+        if (!eval_statement(&step, value, iv->step, &value)) return NO_TRIP_COUNT;
+    }
+    return NO_TRIP_COUNT;
+}
+
+// Finds the induction variable `loop`'s header compares to decide whether to go round again, if there is one
+static LoopExit find_exit(IVFinder *finder, InductionVars *ivs, size_t loop) {
+    Function *fn = finder->fn;
+    LoopExit exit = {.iv = NO_IV, .body = NO_BBLOCK, .trip_count = NO_TRIP_COUNT};
+    BasicBlock *header = &fn->bblocks[finder->loops->loops[loop].header];
+    if (header->num_succs != 2) return exit;
+    bool stays[2] = {in_loop(finder->loops, loop, header->succs[0]), in_loop(finder->loops, loop, header->succs[1])};
+    if (stays[0] == stays[1]) return exit;
+    size_t body = header->succs[!stays[0]];
+    Statement *branch = &fn->statements[header->end - 1];
+    if ((branch->instruction != JNZ && branch->instruction != JZ) || branch->val_types[0] != Label) return exit;
+    if (branch->val_types[1] != BlkLbl || branch->vals[1] >= fn->num_blocks) return exit;
+    // jz goes to its target when the condition is zero, and jnz to its first one when it isn't
+    bool target_is_body = fn->label_bblocks[branch->vals[1]] == body;
+    bool stays_if_true = (branch->instruction == JNZ) ? target_is_body : !target_is_body;
+    if (def_block(finder, branch->vals[0]) != finder->loops->loops[loop].header) return exit;
+    size_t compare = finder->uses->def[branch->vals[0]];
+    Statement *statement = &fn->statements[compare];
+    if (!is_comparison(statement->instruction)) return exit;
+    for (size_t i = 0; i < 2; i++) {
+        if (statement->val_types[i] != Label || ivs->iv_of[statement->vals[i]] == NO_IV) continue;
+        InductionVar *iv = &ivs->ivs[ivs->iv_of[statement->vals[i]]];
+        if (iv->loop != loop || !is_invariant(finder, loop, statement->vals[!i], statement->val_types[!i])) continue;
+        return (LoopExit) {
+            .iv = ivs->iv_of[statement->vals[i]],
+            .compare = compare,
+            .iv_operand = i,
+            .stays_if_true = stays_if_true,
+            .body = body,
+            .trip_count = find_trip_count(iv, fn->statements[finder->uses->def[iv->phi]].type, statement, i, stays_if_true),
+        };
+    }
+    return exit;
+}
+
+InductionVars find_ivs(Function *fn, Loops *loops, UseLists *uses) {
+    IVFinder finder = {
+        .fn = fn,
+        .loops = loops,
+        .uses = uses,
+        .block_of = (size_t*) malloc(sizeof(size_t) * (fn->num_statements + 1)),
+    };
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) finder.block_of[s] = b;
+    }
+    InductionVars ivs = {
+        .iv_of = (size_t*) aalloc(sizeof(size_t) * (fn->num_values + 1)),
+        .exits = (LoopExit*) aalloc(sizeof(LoopExit) * (loops->num_loops + 1)),
+    };
+    memset(ivs.iv_of, 0xFF, sizeof(size_t) * (fn->num_values + 1));
+    InductionVar **ivs_vec = vec_new(sizeof(InductionVar));
+    for (size_t l = 0; l < loops->num_loops; l++) {
+        BasicBlock *header = &fn->bblocks[loops->loops[l].header];
+        // a phi only has two values, so they have to be from the one way into the loop and the one way round it
+        for (size_t s = header->start; header->num_preds == 2 && s < header->end; s++) {
+            Statement *phi = &fn->statements[s];
+            if (phi->instruction != PHI || uses->num_defs[phi->label] != 1) continue;
+            PhiVal *start = (PhiVal*) phi->vals[0], *next = (PhiVal*) phi->vals[1];
+            size_t from[2] = {phi_pred(fn, start), phi_pred(fn, next)};
+            if (from[0] == NO_BBLOCK || from[1] == NO_BBLOCK) continue;
+            if (in_loop(loops, l, from[0])) {
+                PhiVal *swap = start;
+                start = next;
+                next = swap;
+                size_t swap_from = from[0];
+                from[0] = from[1];
+                from[1] = swap_from;
+            }
+            if (in_loop(loops, l, from[0]) || !in_loop(loops, l, from[1])) continue;
+            InductionVar iv = {.phi = phi->label, .loop = l, .start = start, .next = next};
+            if (!find_step(&finder, l, phi, next, &iv.step)) continue;
+            ivs.iv_of[phi->label] = vec_size(ivs_vec);
+            vec_push(ivs_vec, iv);
+        }
+    }
+    ivs.num_ivs = vec_size(ivs_vec);
+    ivs.ivs = vec_into_arena(ivs_vec);
+    for (size_t l = 0; l < loops->num_loops; l++) ivs.exits[l] = find_exit(&finder, &ivs, l);
+    free(finder.block_of);
+    return ivs;
+}
@@ -0,0 +1,221 @@
+/* Loop invariant code motion. A statement in a loop that works out the same value every time round
+ * (because everything it uses is defined outside the loop, or by another statement being moved) is
+ * moved to the loop's preheader, so it only runs once before the loop starts. Loops are done from the
+ * innermost out, so something moved out of an inner loop can keep going if it's invariant in the
+ * outer one too.
+ * Only statements that can't go wrong are moved, since they then run even when the loop's body
+ * wouldn't have: pure arithmetic and comparisons, and division only by a constant that can't trap.
+ * Loads are moved too, but only out of loops with nothing in them that could write to memory, and
+ * only from blocks that run every time the loop does (ones that dominate every way out of it).
+ * Preheaders are only added to loops that have something to move out of them.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Function *fn;
+    DomTree *tree;
+    Loops loops;
+    UseLists uses;
+    size_t *block_of;     // indexed by statement, the block it's in now
+    size_t *def_block;    // indexed by ValueId, the block defining it now, or NO_BBLOCK if it's an argument
+    size_t ***hoisted_vecs; // indexed by block, the statements moved to the end of it (before its terminator)
+    size_t *in_loop;      // indexed by block, stamped with the loop being looked at
+    size_t num_hoisted;
+} Hoister;
+
+static bool writes_memory(Instruction instruction) {
+    switch (instruction) {
+        case STORE: case CALL: case BLIT: case ASM: case VASTART: case VAARG:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether dividing by `statement`'s second operand can't trap, which means it has to be a constant
+static bool is_safe_divisor(Statement *statement) {
+    if (statement->val_types[1] != Number) return false;
+    uint64_t mask = type_mask(statement->type);
+    uint64_t divisor = statement->vals[1] & mask;
+    // dividing the smallest signed number by -1 overflows
+    return divisor && divisor != mask;
+}
+
+// Whether a statement can be run whether or not its loop would have, as long as its operands are there
+static bool can_speculate(Statement *statement) {
+    switch (statement->instruction) {
+        case ADD: case SUB: case MUL: case NEG: case AND: case OR: case XOR: case SHL: case SHR: case EXT:
+        case COPY: case EQ: case NE: case SLE: case SLT: case SGE: case SGT: case ULE: case ULT: case UGE: case UGT:
+            return true;
+        case DIV: case UDIV: case REM: case UREM:
+            return is_safe_divisor(statement);
+        default:
+            return false;
+    }
+}
+
+static bool is_invariant_val(Hoister *hoister, size_t loop, uint64_t val, ValType type) {
+    if (type != Label) return type == Number || type == Str || type == Empty;
+    if (hoister->uses.num_defs[val] != 1) return false;
+    size_t block = hoister->def_block[val];
+    return block == NO_BBLOCK || hoister->in_loop[block] != loop;
+}
+
+typedef struct {
+    bool writes_memory;
+    size_t *exits; // the blocks in the loop with a successor outside it
+    size_t num_exits;
+} LoopSummary;
+
+static bool is_invariant(Hoister *hoister, size_t loop, LoopSummary *summary, size_t block, Statement *statement) {
+    if (!statement->label || hoister->uses.num_defs[statement->label] != 1) return false;
+    if (statement->instruction == LOAD) {
+        // a loop with no way out never has to get as far as the load
+        if (summary->writes_memory || !summary->num_exits) return false;
+        for (size_t e = 0; e < summary->num_exits; e++) {
+            if (!dominates(hoister->tree, block, summary->exits[e])) return false;
+        }
+    } else if (!can_speculate(statement)) {
+        return false;
+    }
+    for (size_t i = 0; i < 3; i++) {
+        if (!is_invariant_val(hoister, loop, statement->vals[i], statement->val_types[i])) return false;
+    }
+    return true;
+}
+
+static void summarise_loop(Hoister *hoister, size_t loop, LoopSummary *summary_buf) {
+    Function *fn = hoister->fn;
+    Loops *loops = &hoister->loops;
+    *summary_buf = (LoopSummary) {
+        .exits = (size_t*) aalloc(sizeof(size_t) * (loops->blocks_start[loop + 1] - loops->blocks_start[loop])),
+    };
+    for (size_t i = loops->blocks_start[loop]; i < loops->blocks_start[loop + 1]; i++)
+        hoister->in_loop[loops->blocks[i]] = loop;
+    for (size_t i = loops->blocks_start[loop]; i < loops->blocks_start[loop + 1]; i++) {
+        BasicBlock *bblock = &fn->bblocks[loops->blocks[i]];
+        for (size_t s = bblock->start; s < bblock->end; s++)
+            summary_buf->writes_memory |= writes_memory(fn->statements[s].instruction);
+        bool exits = false;
+        for (size_t succ = 0; succ < bblock->num_succs; succ++) exits |= hoister->in_loop[bblock->succs[succ]] != loop;
+        if (exits) summary_buf->exits[summary_buf->num_exits++] = loops->blocks[i];
+    }
+}
+
+static void hoist(Hoister *hoister, size_t s, size_t to) {
+    if (!hoister->hoisted_vecs[to]) hoister->hoisted_vecs[to] = vec_new(sizeof(size_t));
+    vec_push(hoister->hoisted_vecs[to], s);
+    hoister->block_of[s] = to;
+    hoister->def_block[hoister->fn->statements[s].label] = to;
+}
+
+/* Moves whatever's invariant in `loop` to its preheader, or if `dry_run` is set, only returns whether
+ * there's anything that could be. */
+static bool hoist_loop(Hoister *hoister, size_t loop, bool dry_run) {
+    Function *fn = hoister->fn;
+    Loops *loops = &hoister->loops;
+    LoopSummary summary;
+    summarise_loop(hoister, loop, &summary);
+    bool found = false;
+    // in reverse post order, so whatever a statement uses has been looked at before it
+    for (size_t i = loops->blocks_start[loop]; i < loops->blocks_start[loop + 1]; i++) {
+        size_t b = loops->blocks[i];
+        BasicBlock *bblock = &fn->bblocks[b];
+        for (size_t s = bblock->start; s < bblock->end; s++) {
+            if (hoister->block_of[s] != b || !is_invariant(hoister, loop, &summary, b, &fn->statements[s])) continue;
+            if (dry_run) return true;
+            hoist(hoister, s, loops->loops[loop].preheader);
+            hoister->num_hoisted++;
+            found = true;
+        }
+        // and the ones moved here out of loops nested in this one, which may be able to go further
+        if (!hoister->hoisted_vecs[b]) continue;
+        for (size_t h = 0; h < vec_size(hoister->hoisted_vecs[b]); h++) {
+            size_t s = (*hoister->hoisted_vecs[b])[h];
+            if (hoister->block_of[s] != b || !is_invariant(hoister, loop, &summary, b, &fn->statements[s])) continue;
+            hoist(hoister, s, loops->loops[loop].preheader);
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void init_hoister(Hoister *hoister, Function *fn) {
+    *hoister = (Hoister) {
+        .fn = fn,
+        .tree = dom_tree(fn),
+        .loops = find_loops(fn),
+        .uses = use_lists(fn),
+        .block_of = (size_t*) aalloc(sizeof(size_t) * (fn->num_statements + 1)),
+        .def_block = (size_t*) aalloc(sizeof(size_t) * (fn->num_values + 1)),
+        .hoisted_vecs = (size_t***) aalloc(sizeof(size_t**) * (fn->num_bblocks + 1)),
+        .in_loop = (size_t*) aalloc(sizeof(size_t) * (fn->num_bblocks + 1)),
+    };
+    memset(hoister->def_block, 0xFF, sizeof(size_t) * (fn->num_values + 1));
+    memset(hoister->hoisted_vecs, 0, sizeof(size_t**) * (fn->num_bblocks + 1));
+    memset(hoister->in_loop, 0xFF, sizeof(size_t) * (fn->num_bblocks + 1));
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            hoister->block_of[s] = b;
+            if (fn->statements[s].label) hoister->def_block[fn->statements[s].label] = b;
+        }
+    }
+}
+
+// Puts the statements that were moved at the end of their new blocks, before the terminator if there is one
+static void rebuild_statements(Hoister *hoister) {
+    Function *fn = hoister->fn;
+    Statement **statement_vec = vec_new(sizeof(Statement));
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        BasicBlock *bblock = &fn->bblocks[b];
+        bool has_terminator = is_terminator(fn->statements[bblock->end - 1].instruction);
+        size_t end = bblock->end - has_terminator;
+        for (size_t s = bblock->start; s < end; s++) {
+            if (hoister->block_of[s] == b) vec_push(statement_vec, fn->statements[s]);
+        }
+        if (hoister->hoisted_vecs[b]) {
+            for (size_t h = 0; h < vec_size(hoister->hoisted_vecs[b]); h++) {
+                size_t s = (*hoister->hoisted_vecs[b])[h];
+                if (hoister->block_of[s] == b) vec_push(statement_vec, fn->statements[s]);
+            }
+            vec_free(hoister->hoisted_vecs[b]);
+        }
+        if (has_terminator) vec_push(statement_vec, fn->statements[bblock->end - 1]);
+    }
+    fn->num_statements = vec_size(statement_vec);
+    fn->statements = vec_into_arena(statement_vec);
+}
+
+bool opt_licm(Function *fn) {
+    if (!fn->num_bblocks) return false;
+    Hoister hoister;
+    init_hoister(&hoister, fn);
+    if (!hoister.loops.num_loops) return false;
+    // first find which loops have anything to move out, so that only they get preheaders
+    bool *wanted = (bool*) aalloc(sizeof(bool) * hoister.loops.num_loops);
+    bool any_wanted = false;
+    for (size_t l = hoister.loops.num_loops; l > 0; l--) {
+        wanted[l - 1] = hoist_loop(&hoister, l - 1, true);
+        any_wanted |= wanted[l - 1];
+    }
+    if (!any_wanted) return false;
+    size_t num_preheaders = insert_preheaders(fn, &hoister.loops, wanted);
+    if (num_preheaders) {
+        add_stat(STAT_LICM_PREHEADERS, num_preheaders);
+        init_hoister(&hoister, fn);
+    }
+    // inner loops come after the loops they're nested in
+    for (size_t l = hoister.loops.num_loops; l > 0; l--) {
+        if (hoister.loops.loops[l - 1].preheader != NO_BBLOCK) hoist_loop(&hoister, l - 1, false);
+    }
+    if (!hoister.num_hoisted) return num_preheaders;
+    rebuild_statements(&hoister);
+    add_stat(STAT_LICM_HOISTED, hoister.num_hoisted);
+    return true;
+}
@@ -0,0 +1,338 @@
+/* Liveness of values at the start and end of each block, found with the usual backward dataflow
+ * problem over dense bitsets:
+ *     live_out(b) = union over successors s of live_in(s), plus the values phis in s take from b
+ *     live_in(b)  = uses(b) + (live_out(b) - defs(b))
+ * where uses(b) are the values used in b before it defines them. Phi operands count as used at the
+ * end of the block they come from rather than in the phi's block. Values which are only used in the
+ * block that defines them are left out of the sets entirely.
+ * Sets of every value for every block would cost the number of values times the number of blocks
+ * however short-lived each value is, and optimisations like gvn leave behind lots of values which
+ * are only live in a block or two after the one defining them. So the bits are solved a slice of
+ * LIVE_SLICE_WORDS words at a time, with a worklist which only ever holds blocks where a value in the
+ * slice is live, and a slice only keeps sets for those blocks. Values are numbered in the order
+ * they're first used, so the values in a slice tend to be live in the same few blocks.
+ * Unlike the dominator tree, this depends on the statements as well as the graph, so it isn't
+ * cached: whoever needs it works it out, and works it out again after changing the function.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <bitset.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <string.h>
+#include <stdlib.h>
+#include <utils.h>
+
+/* Calls `visit` on each value a statement uses, then on the value it defines (if any), with
+ * `is_def` set. Phi operands aren't visited, since they're used in another block. */
+static void visit_statement(Statement *statement, void (*visit)(void*, uint64_t, bool), void *ctx) {
+    if (statement->instruction == CALL) {
+        FunctionArgList *args = (FunctionArgList*) statement->vals[1];
+        for (size_t a = 0; a < args->num_args; a++) {
+            if (args->arg_types[a] == Label) visit(ctx, args->args[a], false);
+        }
+    } else if (statement->instruction == ASM) {
+        InlineAsm *info = (InlineAsm*) statement->vals[0];
+        for (size_t in = 0; in < vec_size(info->inputs_vec); in++) {
+            if ((*info->inputs_vec)[in].type == Label) visit(ctx, (*info->inputs_vec)[in].label, false);
+        }
+        for (size_t out = 0; out < vec_size(info->outputs_vec); out++)
+            visit(ctx, (*info->outputs_vec)[out].label, true);
+    } else if (statement->instruction != PHI) {
+        for (size_t i = 0; i < 3; i++) {
+            if (statement->val_types[i] == Label) visit(ctx, statement->vals[i], false);
+        }
+    }
+    if (statement->label) visit(ctx, statement->label, true);
+}
+
+typedef struct {
+    size_t block;
+    size_t *def_block; // indexed by ValueId, the block it was last seen defined in
+    uint32_t *index;   // indexed by ValueId, where it is in the sets, or NOT_IN_SETS
+    ValueId **values;  // the values which are in the sets
+} FindGlobals;
+
+static void find_global(void *ctx, uint64_t value, bool is_def) {
+    FindGlobals *find = (FindGlobals*) ctx;
+    if (is_def) {
+        find->def_block[value] = find->block;
+    } else if (find->def_block[value] != find->block && find->index[value] == NOT_IN_SETS) {
+        find->index[value] = vec_size(find->values);
+        vec_push(find->values, (ValueId) value);
+    }
+}
+
+/* Numbers the values which are used in a block without being defined before it there (including
+ * phi operands). Nothing else can be live at the start or end of a block, so only these need to be
+ * in the sets, which keeps them small even in functions with lots of values and lots of blocks. */
+static void find_globals(Function *fn, Liveness *live) {
+    FindGlobals find = {
+        .def_block = (size_t*) malloc(sizeof(size_t) * fn->num_values),
+        .index = (uint32_t*) aalloc(sizeof(uint32_t) * fn->num_values),
+        .values = vec_new(sizeof(ValueId)),
+    };
+    memset(find.def_block, 0xFF, sizeof(size_t) * fn->num_values);
+    memset(find.index, 0xFF, sizeof(uint32_t) * fn->num_values);
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        find.block = b;
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            if (statement->instruction == PHI) {
+                for (size_t i = 0; i < 2; i++) {
+                    PhiVal *phi_val = (PhiVal*) statement->vals[i];
+                    if (phi_val->type == Label) find_global(&find, phi_val->val, false);
+                }
+            }
+            visit_statement(statement, find_global, &find);
+        }
+    }
+    free(find.def_block);
+    live->index = find.index;
+    live->num_values = vec_size(find.values);
+    live->values = vec_into_arena(find.values);
+}
+
+typedef enum {
+    EVENT_DEF,     // the block defines the value
+    EVENT_USE,     // the block uses the value before defining it
+    EVENT_PHI_OUT, // a phi takes the value from the end of the block
+} EventKind;
+
+typedef struct {
+    uint32_t index;
+    EventKind kind;
+    size_t block;
+} Event;
+
+typedef struct {
+    Liveness *live;
+    size_t block;
+    size_t *defined_in; // indexed by bit, the last block it was defined in
+    size_t *used_in;    // indexed by bit, the last block it was found used in
+    Event **events;
+} FindEvents;
+
+static void find_event(void *ctx, uint64_t value, bool is_def) {
+    FindEvents *find = (FindEvents*) ctx;
+    uint32_t index = find->live->index[value];
+    if (index == NOT_IN_SETS) return;
+    if (is_def) {
+        if (find->defined_in[index] == find->block) return;
+        find->defined_in[index] = find->block;
+        vec_push(find->events, ((Event) {.index = index, .kind = EVENT_DEF, .block = find->block}));
+    } else if (find->defined_in[index] != find->block && find->used_in[index] != find->block) {
+        find->used_in[index] = find->block;
+        vec_push(find->events, ((Event) {.index = index, .kind = EVENT_USE, .block = find->block}));
+    }
+}
+
+// Finds every block defining or using each value in the sets, grouped by slice
+static Event *find_events(Function *fn, Liveness *live, size_t *events_start) {
+    FindEvents find = {
+        .live = live,
+        .defined_in = (size_t*) malloc(sizeof(size_t) * (live->num_values + 1)),
+        .used_in = (size_t*) malloc(sizeof(size_t) * (live->num_values + 1)),
+        .events = vec_new(sizeof(Event)),
+    };
+    memset(find.defined_in, 0xFF, sizeof(size_t) * live->num_values);
+    memset(find.used_in, 0xFF, sizeof(size_t) * live->num_values);
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        find.block = b;
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            visit_statement(statement, find_event, &find);
+            if (statement->instruction != PHI) continue;
+            for (size_t i = 0; i < 2; i++) {
+                PhiVal *phi_val = (PhiVal*) statement->vals[i];
+                size_t pred = phi_pred(fn, phi_val);
+                if (phi_val->type != Label || pred == NO_BBLOCK) continue;
+                vec_push(find.events, ((Event) {.index = live->index[phi_val->val], .kind = EVENT_PHI_OUT, .block = pred}));
+            }
+        }
+    }
+    free(find.defined_in);
+    free(find.used_in);
+    // counting sort by slice
+    size_t num_events = vec_size(find.events);
+    memset(events_start, 0, sizeof(size_t) * (live->num_slices + 1));
+    for (size_t e = 0; e < num_events; e++) events_start[(*find.events)[e].index / LIVE_SLICE_BITS + 1]++;
+    for (size_t i = 0; i < live->num_slices; i++) events_start[i + 1] += events_start[i];
+    size_t *next = (size_t*) malloc(sizeof(size_t) * (live->num_slices + 1));
+    memcpy(next, events_start, sizeof(size_t) * live->num_slices);
+    Event *events = (Event*) malloc(sizeof(Event) * (num_events + 1));
+    for (size_t e = 0; e < num_events; e++) events[next[(*find.events)[e].index / LIVE_SLICE_BITS]++] = (*find.events)[e];
+    free(next);
+    vec_free(find.events);
+    return events;
+}
+
+/* The sets for one slice, kept for only the blocks it's got to so far. Each of those blocks has a
+ * slot, which is where its sets are in uses, defs, live_in and live_out. */
+typedef struct {
+    Function *fn;
+    size_t stamp;        // the slice being solved, plus 1
+    size_t *slot_stamp;  // indexed by block, the stamp of the slice its slot is for
+    size_t *slot;        // indexed by block
+    size_t *slot_block;  // indexed by slot
+    size_t num_slots;
+    uint64_t *uses;
+    uint64_t *defs;
+    uint64_t *live_in;
+    uint64_t *live_out;
+    bool *queued;        // indexed by slot
+    size_t *worklist;
+    size_t num_work;
+} Solver;
+
+// The slot of `block` in the slice being solved, giving it one with empty sets if it hasn't got one
+static size_t block_slot(Solver *solver, size_t block) {
+    if (solver->slot_stamp[block] == solver->stamp) return solver->slot[block];
+    size_t slot = solver->num_slots++;
+    solver->slot_stamp[block] = solver->stamp;
+    solver->slot[block] = slot;
+    solver->slot_block[slot] = block;
+    solver->queued[slot] = false;
+    memset(&solver->uses[slot * LIVE_SLICE_WORDS], 0, sizeof(uint64_t) * LIVE_SLICE_WORDS);
+    memset(&solver->defs[slot * LIVE_SLICE_WORDS], 0, sizeof(uint64_t) * LIVE_SLICE_WORDS);
+    memset(&solver->live_in[slot * LIVE_SLICE_WORDS], 0, sizeof(uint64_t) * LIVE_SLICE_WORDS);
+    memset(&solver->live_out[slot * LIVE_SLICE_WORDS], 0, sizeof(uint64_t) * LIVE_SLICE_WORDS);
+    return slot;
+}
+
+static void enqueue(Solver *solver, size_t slot) {
+    if (solver->queued[slot]) return;
+    solver->queued[slot] = true;
+    solver->worklist[solver->num_work++] = slot;
+}
+
+static void solve_slice(Solver *solver, Event *events, size_t num_events) {
+    size_t words = LIVE_SLICE_WORDS;
+    for (size_t e = 0; e < num_events; e++) {
+        size_t slot = block_slot(solver, events[e].block);
+        size_t bit = events[e].index % LIVE_SLICE_BITS;
+        if (events[e].kind == EVENT_DEF) {
+            bitset_set(&solver->defs[slot * words], bit);
+        } else {
+            // phi operands never change, so they're put in the live out sets to start with
+            bitset_set((events[e].kind == EVENT_USE) ? &solver->uses[slot * words] : &solver->live_out[slot * words], bit);
+            enqueue(solver, slot);
+        }
+    }
+    while (solver->num_work) {
+        size_t slot = solver->worklist[--solver->num_work];
+        solver->queued[slot] = false;
+        BasicBlock *block = &solver->fn->bblocks[solver->slot_block[slot]];
+        uint64_t *out = &solver->live_out[slot * words], *in = &solver->live_in[slot * words];
+        // a successor without a slot has nothing from this slice live in to it
+        for (size_t i = 0; i < block->num_succs; i++) {
+            size_t succ = block->succs[i];
+            if (solver->slot_stamp[succ] == solver->stamp)
+                bitset_union(out, &solver->live_in[solver->slot[succ] * words], words);
+        }
+        bool changed = bitset_union(in, &solver->uses[slot * words], words);
+        changed |= bitset_union_diff(in, out, &solver->defs[slot * words], words);
+        if (!changed) continue;
+        for (size_t p = 0; p < block->num_preds; p++) enqueue(solver, block_slot(solver, block->preds[p]));
+    }
+}
+
+static int compare_blocks(const void *a, const void *b) {
+    size_t x = *(size_t*) a, y = *(size_t*) b;
+    return (x > y) - (x < y);
+}
+
+Liveness liveness(Function *fn) {
+    size_t num_bblocks = fn->num_bblocks;
+    Liveness live;
+    find_globals(fn, &live);
+    live.num_slices = (live.num_values + LIVE_SLICE_BITS - 1) / LIVE_SLICE_BITS;
+    size_t *events_start = (size_t*) malloc(sizeof(size_t) * (live.num_slices + 1));
+    Event *events = find_events(fn, &live, events_start);
+    size_t set_bytes = sizeof(uint64_t) * LIVE_SLICE_WORDS * (num_bblocks + 1);
+    Solver solver = {
+        .fn = fn,
+        .slot_stamp = (size_t*) calloc(num_bblocks + 1, sizeof(size_t)),
+        .slot = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1)),
+        .slot_block = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1)),
+        .uses = (uint64_t*) malloc(set_bytes),
+        .defs = (uint64_t*) malloc(set_bytes),
+        .live_in = (uint64_t*) malloc(set_bytes),
+        .live_out = (uint64_t*) malloc(set_bytes),
+        .queued = (bool*) malloc(sizeof(bool) * (num_bblocks + 1)),
+        .worklist = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1)),
+    };
+    size_t *live_blocks = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    size_t **blocks_vec = vec_new(sizeof(size_t));
+    uint64_t **live_in_vec = vec_new(sizeof(uint64_t));
+    uint64_t **live_out_vec = vec_new(sizeof(uint64_t));
+    live.slice_start = (size_t*) aalloc(sizeof(size_t) * (live.num_slices + 1));
+    for (size_t i = 0; i < live.num_slices; i++) {
+        // stamps start at 1 so the zeroed slot_stamp doesn't match anything
+        solver.stamp = i + 1;
+        solver.num_slots = 0;
+        solve_slice(&solver, &events[events_start[i]], events_start[i + 1] - events_start[i]);
+        // only the blocks where something in the slice is live keep their sets, in order of block
+        size_t num_live_blocks = 0;
+        for (size_t slot = 0; slot < solver.num_slots; slot++) {
+            if (bitset_any(&solver.live_in[slot * LIVE_SLICE_WORDS], LIVE_SLICE_WORDS) ||
+                bitset_any(&solver.live_out[slot * LIVE_SLICE_WORDS], LIVE_SLICE_WORDS))
+                live_blocks[num_live_blocks++] = solver.slot_block[slot];
+        }
+        qsort(live_blocks, num_live_blocks, sizeof(size_t), compare_blocks);
+        live.slice_start[i] = vec_size(blocks_vec);
+        for (size_t j = 0; j < num_live_blocks; j++) {
+            size_t slot = solver.slot[live_blocks[j]];
+            vec_push(blocks_vec, live_blocks[j]);
+            for (size_t w = 0; w < LIVE_SLICE_WORDS; w++) {
+                vec_push(live_in_vec, solver.live_in[slot * LIVE_SLICE_WORDS + w]);
+                vec_push(live_out_vec, solver.live_out[slot * LIVE_SLICE_WORDS + w]);
+            }
+        }
+    }
+    live.slice_start[live.num_slices] = vec_size(blocks_vec);
+    live.blocks = vec_into_arena(blocks_vec);
+    live.live_in = vec_into_arena(live_in_vec);
+    live.live_out = vec_into_arena(live_out_vec);
+    free(events);
+    free(events_start);
+    free(live_blocks);
+    free(solver.slot_stamp);
+    free(solver.slot);
+    free(solver.slot_block);
+    free(solver.uses);
+    free(solver.defs);
+    free(solver.live_in);
+    free(solver.live_out);
+    free(solver.queued);
+    free(solver.worklist);
+    return live;
+}
+
+// Where `block`'s sets are for the slice holding bit `index`, or NO_BBLOCK if it has none there
+static size_t find_sets(Liveness *live, uint32_t index, size_t block) {
+    size_t start = live->slice_start[index / LIVE_SLICE_BITS], end = live->slice_start[index / LIVE_SLICE_BITS + 1];
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (live->blocks[mid] == block) return mid;
+        if (live->blocks[mid] < block) start = mid + 1;
+        else end = mid;
+    }
+    return NO_BBLOCK;
+}
+
+bool is_live_in(Liveness *live, size_t block, ValueId value) {
+    uint32_t index = live->index[value];
+    if (index == NOT_IN_SETS) return false;
+    size_t sets = find_sets(live, index, block);
+    if (sets == NO_BBLOCK) return false;
+    return bitset_test(&live->live_in[sets * LIVE_SLICE_WORDS], index % LIVE_SLICE_BITS);
+}
+
+bool is_live_out(Liveness *live, size_t block, ValueId value) {
+    uint32_t index = live->index[value];
+    if (index == NOT_IN_SETS) return false;
+    size_t sets = find_sets(live, index, block);
+    if (sets == NO_BBLOCK) return false;
+    return bitset_test(&live->live_out[sets * LIVE_SLICE_WORDS], index % LIVE_SLICE_BITS);
+}
@@ -0,0 +1,185 @@
+/* Natural loops of a function's control flow graph, for passes that move things in and out of loops.
+ * An edge from a block to one that dominates it is a back edge, and the block it goes to is the
+ * header of a loop, which is made up of the header and every block that can reach one of its back
+ * edges without going through the header. Loops with different headers are either nested or don't
+ * share any blocks, so going through the headers in reverse post order finds each loop after the ones
+ * it's nested in, and the innermost loop each block is in is just the last one found to contain it.
+ * Blocks which can't be reached aren't in any loop.
+ * insert_preheaders() gives loops a block of their own to come in through, which is where anything
+ * moved out of a loop goes. It changes the function, so the loops have to be found again afterwards.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+static DomTree *sort_tree;
+
+static int compare_rpo(const void *a, const void *b) {
+    size_t a_index = sort_tree->rpo_index[*(size_t*) a];
+    size_t b_index = sort_tree->rpo_index[*(size_t*) b];
+    return (a_index > b_index) - (a_index < b_index);
+}
+
+// The only block outside `loop` that goes to its header, if that's the only place it goes
+static size_t find_preheader(Function *fn, Loops *loops, size_t loop) {
+    BasicBlock *header = &fn->bblocks[loops->loops[loop].header];
+    size_t preheader = NO_BBLOCK;
+    for (size_t p = 0; p < header->num_preds; p++) {
+        if (in_loop(loops, loop, header->preds[p])) continue;
+        if (preheader != NO_BBLOCK) return NO_BBLOCK;
+        preheader = header->preds[p];
+    }
+    if (preheader == NO_BBLOCK || fn->bblocks[preheader].num_succs != 1) return NO_BBLOCK;
+    return preheader;
+}
+
+Loops find_loops(Function *fn) {
+    DomTree *tree = dom_tree(fn);
+    size_t num_bblocks = fn->num_bblocks;
+    Loop **loops_vec = vec_new(sizeof(Loop));
+    size_t **blocks_vec = vec_new(sizeof(size_t));
+    size_t **starts_vec = vec_new(sizeof(size_t));
+    size_t *loop_of = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    memset(loop_of, 0xFF, sizeof(size_t) * (num_bblocks + 1));
+    // indexed by block, the last loop it was found to be in, so it isn't added to the same loop twice
+    size_t *seen = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    memset(seen, 0xFF, sizeof(size_t) * (num_bblocks + 1));
+    size_t *worklist = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    for (size_t i = 0; i < tree->num_reachable; i++) {
+        size_t header = tree->rpo[i];
+        BasicBlock *bblock = &fn->bblocks[header];
+        size_t loop = vec_size(loops_vec);
+        size_t start = vec_size(blocks_vec);
+        size_t num_queued = 0;
+        for (size_t p = 0; p < bblock->num_preds; p++) {
+            size_t pred = bblock->preds[p];
+            if (!dominates(tree, header, pred) || seen[pred] == loop) continue;
+            seen[pred] = loop;
+            worklist[num_queued++] = pred;
+        }
+        if (!num_queued) continue;
+        seen[header] = loop;
+        vec_push(blocks_vec, header);
+        while (num_queued) {
+            size_t b = worklist[--num_queued];
+            // going back past the header would leave the loop (it only gets queued if it jumps to itself)
+            if (b == header) continue;
+            vec_push(blocks_vec, b);
+            for (size_t p = 0; p < fn->bblocks[b].num_preds; p++) {
+                size_t pred = fn->bblocks[b].preds[p];
+                if (seen[pred] == loop || tree->rpo_index[pred] == NO_BBLOCK) continue;
+                seen[pred] = loop;
+                worklist[num_queued++] = pred;
+            }
+        }
+        // the header comes first in reverse post order anyway, since it dominates the rest
+        sort_tree = tree;
+        qsort(&(*blocks_vec)[start], vec_size(blocks_vec) - start, sizeof(size_t), compare_rpo);
+        size_t parent = loop_of[header];
+        Loop new_loop = {
+            .header = header,
+            .parent = parent,
+            .depth = (parent == NO_LOOP) ? 1 : (*loops_vec)[parent].depth + 1,
+            .preheader = NO_BBLOCK,
+        };
+        vec_push(loops_vec, new_loop);
+        vec_push(starts_vec, start);
+        for (size_t b = start; b < vec_size(blocks_vec); b++) loop_of[(*blocks_vec)[b]] = loop;
+    }
+    free(seen);
+    free(worklist);
+    size_t end = vec_size(blocks_vec);
+    vec_push(starts_vec, end);
+    size_t num_loops = vec_size(loops_vec);
+    Loops loops = {
+        .num_loops = num_loops,
+        .loops = vec_into_arena(loops_vec),
+        .blocks = vec_into_arena(blocks_vec),
+        .blocks_start = vec_into_arena(starts_vec),
+        .loop_of = loop_of,
+    };
+    for (size_t l = 0; l < loops.num_loops; l++) loops.loops[l].preheader = find_preheader(fn, &loops, l);
+    return loops;
+}
+
+// Whether `block` is in `loop`, including in a loop nested in it
+bool in_loop(Loops *loops, size_t loop, size_t block) {
+    size_t l = loops->loop_of[block];
+    while (l != NO_LOOP && loops->loops[l].depth > loops->loops[loop].depth) l = loops->loops[l].parent;
+    return l == loop;
+}
+
+/* Adds a preheader to each loop that doesn't have one, if `wanted` (indexed by loop) is set for it or
+ * is NULL. The preheader goes just before the header, so anything falling through to the header from
+ * outside the loop falls through to the preheader instead, and everything else outside the loop
+ * that goes to the header (including the phis in the header) is pointed at the preheader. Loops
+ * headed by the entry block are left alone, since nothing comes into them.
+ * Returns how many it added, and if there were any, `loops` is out of date. */
+size_t insert_preheaders(Function *fn, Loops *loops, bool *wanted) {
+    // indexed by block, the new label of the preheader going before it, or 0
+    BlockId *preheaders = (BlockId*) aalloc(sizeof(BlockId) * (fn->num_bblocks + 1));
+    memset(preheaders, 0, sizeof(BlockId) * (fn->num_bblocks + 1));
+    char* **block_names_vec = vec_new(sizeof(char*));
+    for (size_t l = 0; l < loops->num_loops; l++) {
+        Loop *loop = &loops->loops[l];
+        if ((wanted && !wanted[l]) || loop->preheader != NO_BBLOCK || !loop->header) continue;
+        BasicBlock *header = &fn->bblocks[loop->header];
+        bool has_entry = false;
+        for (size_t p = 0; p < header->num_preds; p++) has_entry |= !in_loop(loops, l, header->preds[p]);
+        if (!has_entry) continue;
+        preheaders[loop->header] = fn->num_blocks + vec_size(block_names_vec);
+        vec_push(block_names_vec, suffixed_name(fn->block_names[header->label], ".preheader"));
+        for (size_t p = 0; p < header->num_preds; p++) {
+            BasicBlock *pred = &fn->bblocks[header->preds[p]];
+            if (!in_loop(loops, l, header->preds[p]))
+                retarget(&fn->statements[pred->end - 1], header->label, preheaders[loop->header]);
+        }
+        for (size_t s = header->start; s < header->end; s++) {
+            Statement *statement = &fn->statements[s];
+            if (statement->instruction != PHI) continue;
+            PhiVal *phi_vals[2] = {(PhiVal*) statement->vals[0], (PhiVal*) statement->vals[1]};
+            // the header has to have two predecessors to have phis, and one of them is in the loop
+            for (size_t i = 0; i < 2; i++) {
+                size_t from = phi_pred(fn, phi_vals[i]);
+                if (from != NO_BBLOCK && !in_loop(loops, l, from)) phi_vals[i]->blklbl = preheaders[loop->header];
+            }
+        }
+    }
+    size_t num_new = vec_size(block_names_vec);
+    if (!num_new) {
+        vec_free(block_names_vec);
+        return 0;
+    }
+    append_names(&fn->block_names, &fn->num_blocks, block_names_vec);
+    Statement **statement_vec = vec_new(sizeof(Statement));
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        BasicBlock *bblock = &fn->bblocks[b];
+        if (preheaders[b]) {
+            // a block in the loop that falls through to the header has to jump over the preheader now
+            BasicBlock *before = &fn->bblocks[b - 1];
+            if (before->falls_through && in_loop(loops, loops->loop_of[b], b - 1)) {
+                vec_push(statement_vec, ((Statement) {
+                    .instruction = JMP,
+                    .arg_type = None,
+                    .vals = {bblock->label},
+                    .val_types = {BlkLbl, Empty, Empty},
+                }));
+            }
+            vec_push(statement_vec, ((Statement) {
+                .instruction = BLKLBL,
+                .arg_type = None,
+                .vals = {preheaders[b]},
+                .val_types = {BlkLbl, Empty, Empty},
+            }));
+        }
+        for (size_t s = bblock->start; s < bblock->end; s++) vec_push(statement_vec, fn->statements[s]);
+    }
+    fn->num_statements = vec_size(statement_vec);
+    fn->statements = vec_into_arena(statement_vec);
+    cfg_build(fn);
+    return num_new;
+}
@@ -0,0 +1,547 @@
+/* Loop strength reduction. Frontends work out the address of an array element from the loop counter
+ * every time round, as something like `base + ext(i) * 4`, which takes a multiplication each time
+ * even though it only ever goes up by the same amount. This finds values in a loop which are worked
+ * out from one of its induction variables (see ivs.c) as base + scale * iv + offset, by adding,
+ * taking away, multiplying and shifting by constants, adding something that doesn't change in the
+ * loop, and extending. Each one that's used for anything else, and took a multiplication or an
+ * extension to get to, gets a phi of its own in the loop's header instead, which starts off as what
+ * it would be on the first time round and has scale * step added to it each time round. Ones that
+ * only differ by their offset share a phi, and are worked out from it with one addition.
+ * Extending an induction variable (or it plus a constant) to 64 bits only goes up by the same amount
+ * each time if it never wraps around, which is known if the loop goes round a known number of times
+ * and it stays in range the whole way, or if it goes up (or down) by 1 and the loop only goes round
+ * while it's less (or more) than something, which it can't be at the very top (or bottom) of the
+ * range.
+ * If the header leaves the loop by comparing the induction variable with a constant after a known
+ * number of times round, the comparison is made into one between a reduced phi and what it'll be by
+ * then, so the original counter is left with nothing using it for dce to take away.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A value worked out from an induction variable as base + scale * iv + offset, at its own width
+typedef struct {
+    size_t iv;         // NO_IV if it isn't one
+    Type type;
+    bool is_extended;  // whether the induction variable is extended from 32 to 64 bits on the way
+    bool is_signed;    // and if it is, whether it's sign extended
+    bool is_costly;    // whether it takes a multiplication or an extension to work out from the induction variable
+    uint64_t scale;
+    uint64_t offset;
+    uint64_t base;     // something that doesn't change in the loop, unless base_type is Empty
+    ValType base_type;
+} Derived;
+
+// The values worked out the same way apart from their offset, which share one new phi
+typedef struct {
+    Derived derived;  // with the offset of the value the phi is for
+    ValueId phi;
+    ValueId next;     // the phi plus scale * step, at the end of the latch
+    ValueId root;     // the value the phi is for, which it's named after
+    size_t next_of_iv; // the next one from the same induction variable, or NO_REDUCED
+} Reduced;
+
+#define NO_REDUCED ((size_t) -1)
+
+typedef struct {
+    uint64_t val;
+    ValType type;
+} Operand;
+
+typedef struct {
+    Function *fn;
+    DomTree *tree;
+    Loops loops;
+    UseLists uses;
+    InductionVars ivs;
+    size_t *block_of;       // indexed by statement
+    Derived *derived;       // indexed by ValueId
+    Reduced **reduced_vec;
+    size_t *first_reduced;  // indexed by induction variable, the first of its phis in reduced_vec, or NO_REDUCED
+    ValueId **roots_vec;    // the values which get worked out from a new phi
+    Statement ***added_vecs; // indexed by block, the statements added at the end of it (before its terminator)
+    Statement ***phi_vecs;   // indexed by block, the phis added at the start of it
+    char* **value_names_vec;
+} Reducer;
+
+static bool is_invariant(Reducer *reducer, size_t loop, uint64_t val, ValType type) {
+    if (type == Number || type == Str) return true;
+    if (type != Label || reducer->uses.num_defs[val] != 1) return false;
+    if (reducer->uses.def[val] == NO_STATEMENT) return true;
+    return !in_loop(&reducer->loops, loop, reducer->block_of[reducer->uses.def[val]]);
+}
+
+// What `val` is worked out from in `loop`, if it's an induction variable of it or worked out from one
+static Derived *derived_in(Reducer *reducer, size_t loop, uint64_t val, ValType type) {
+    if (type != Label) return NULL;
+    Derived *derived = &reducer->derived[val];
+    if (derived->iv == NO_IV || reducer->ivs.ivs[derived->iv].loop != loop) return NULL;
+    return derived;
+}
+
+// Flips a comparison round for swapping its operands
+static Instruction swap_comparison(Instruction instruction) {
+    switch (instruction) {
+        case SLT: return SGT;
+        case SLE: return SGE;
+        case SGT: return SLT;
+        case SGE: return SLE;
+        case ULT: return UGT;
+        case ULE: return UGE;
+        case UGT: return ULT;
+        case UGE: return ULE;
+        default:  return instruction;
+    }
+}
+
+// The comparison which is true whenever `instruction` isn't
+static Instruction negate_comparison(Instruction instruction) {
+    switch (instruction) {
+        case EQ:  return NE;
+        case NE:  return EQ;
+        case SLT: return SGE;
+        case SLE: return SGT;
+        case SGT: return SLE;
+        case SGE: return SLT;
+        case ULT: return UGE;
+        case ULE: return UGT;
+        case UGT: return ULE;
+        case UGE: return ULT;
+        default:  return instruction;
+    }
+}
+
+/* Whether the 32 bit induction variable `iv` plus `offset` can be extended to 64 bits in `block`
+ * without it ever having wrapped around, so that extending it is the same as extending the induction
+ * variable and adding the offset afterwards. */
+static bool extends_linearly(Reducer *reducer, size_t iv_index, int64_t offset, bool is_signed, size_t block) {
+    InductionVar *iv = &reducer->ivs.ivs[iv_index];
+    LoopExit *exit = &reducer->ivs.exits[iv->loop];
+    if (exit->iv != iv_index) return false;
+    int64_t min = (is_signed) ? INT32_MIN : 0;
+    int64_t max = (is_signed) ? INT32_MAX : UINT32_MAX;
+    int64_t step = as_signed(iv->step, Bits32);
+    if (exit->trip_count != NO_TRIP_COUNT) {
+        // it goes in a straight line from where it starts to where it is when the loop stops
+        int64_t first = ((is_signed) ? as_signed(iv->start->val, Bits32) : (int64_t) (iv->start->val & UINT32_MAX)) + offset;
+        int64_t last = first + (int64_t) exit->trip_count * step;
+        return first >= min && first <= max && last >= min && last <= max;
+    }
+    if (step != 1 && step != -1) return false;
+    // only once it's known that the header's comparison said to go round again
+    if (reducer->fn->bblocks[exit->body].num_preds != 1 || !dominates(reducer->tree, exit->body, block)) return false;
+    Statement *compare = &reducer->fn->statements[exit->compare];
+    if (compare->arg_type != Bits32) return false;
+    Instruction instruction = compare->instruction;
+    if (exit->iv_operand) instruction = swap_comparison(instruction);
+    if (!exit->stays_if_true) instruction = negate_comparison(instruction);
+    // staying while it's at most a constant which isn't the biggest there is is the same as staying while it's less than one more
+    uint64_t limit = compare->vals[!exit->iv_operand];
+    if (compare->val_types[!exit->iv_operand] == Number) {
+        int64_t n = (is_signed) ? as_signed(limit, Bits32) : (int64_t) (limit & UINT32_MAX);
+        if (instruction == ((is_signed) ? SLE : ULE) && n != max) instruction = (is_signed) ? SLT : ULT;
+        if (instruction == ((is_signed) ? SGE : UGE) && n != min) instruction = (is_signed) ? SGT : UGT;
+    }
+    if (step == 1) return instruction == ((is_signed) ? SLT : ULT) && (offset == 0 || offset == 1);
+    return instruction == ((is_signed) ? SGT : UGT) && (offset == 0 || offset == -1);
+}
+
+// Works out what `statement` is derived from, if it's worked out from one of `loop`'s induction variables
+static bool derive(Reducer *reducer, size_t loop, size_t block, Statement *statement, Derived *derived_buf) {
+    if (statement->val_types[2] != Empty) return false;
+    Derived *a = derived_in(reducer, loop, statement->vals[0], statement->val_types[0]);
+    Derived *b = derived_in(reducer, loop, statement->vals[1], statement->val_types[1]);
+    // only one operand can be worked out from the induction variable, and the other has to stay the same
+    if (a && b) return false;
+    size_t operand = (a) ? 0 : 1;
+    Derived *from = (a) ? a : b;
+    if (!from) return false;
+    uint64_t other = statement->vals[!operand];
+    ValType other_type = statement->val_types[!operand];
+    switch (statement->instruction) {
+        case COPY:
+            if (from->type != statement->type) return false;
+            *derived_buf = *from;
+            return true;
+        case ADD: case SUB:
+            if (from->type != statement->type || (statement->instruction == SUB && operand)) return false;
+            *derived_buf = *from;
+            if (other_type == Number) {
+                derived_buf->offset += (statement->instruction == SUB) ? -other : other;
+                return true;
+            }
+            if (statement->instruction == SUB || from->base_type != Empty || !is_invariant(reducer, loop, other, other_type))
+                return false;
+            derived_buf->base = other;
+            derived_buf->base_type = other_type;
+            return true;
+        case MUL: case SHL:
+            if (from->type != statement->type || from->base_type != Empty || other_type != Number) return false;
+            if (statement->instruction == SHL) {
+                if (operand || other >= (uint64_t) (8 << statement->type)) return false;
+                other = 1ULL << other;
+            }
+            *derived_buf = *from;
+            derived_buf->scale *= other;
+            derived_buf->offset *= other;
+            derived_buf->is_costly = true;
+            return true;
+        case EXT: {
+            if (from->type != Bits32 || statement->arg_type != Bits32 || statement->type != Bits64) return false;
+            if (from->base_type != Empty || (from->scale & UINT32_MAX) != 1) return false;
+            int64_t offset = as_signed(from->offset, Bits32);
+            if (!extends_linearly(reducer, from->iv, offset, statement->is_signed, block)) return false;
+            *derived_buf = (Derived) {
+                .iv = from->iv,
+                .type = Bits64,
+                .is_extended = true,
+                .is_signed = statement->is_signed,
+                .is_costly = true,
+                .scale = 1,
+                .offset = (uint64_t) offset,
+                .base_type = Empty,
+            };
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Finds what every value in a loop is derived from, going in reverse post order so operands come first
+static void find_derived(Reducer *reducer) {
+    Function *fn = reducer->fn;
+    for (size_t v = 0; v < fn->num_values; v++) reducer->derived[v].iv = NO_IV;
+    for (size_t i = 0; i < reducer->ivs.num_ivs; i++) {
+        ValueId phi = reducer->ivs.ivs[i].phi;
+        reducer->derived[phi] = (Derived) {
+            .iv = i,
+            .type = fn->statements[reducer->uses.def[phi]].type,
+            .scale = 1,
+            .base_type = Empty,
+        };
+    }
+    for (size_t i = 0; i < reducer->tree->num_reachable; i++) {
+        size_t b = reducer->tree->rpo[i];
+        size_t loop = reducer->loops.loop_of[b];
+        if (loop == NO_LOOP) continue;
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            if (!statement->label || statement->instruction == PHI || reducer->uses.num_defs[statement->label] != 1) continue;
+            Derived derived;
+            if (derive(reducer, loop, b, statement, &derived)) reducer->derived[statement->label] = derived;
+        }
+    }
+}
+
+// Whether `value` is used by anything besides what's derived from it, so it's worth having a phi for
+static bool is_root(Reducer *reducer, ValueId value) {
+    Derived *derived = &reducer->derived[value];
+    if (derived->iv == NO_IV || !derived->is_costly) return false;
+    for (size_t u = reducer->uses.first_use[value]; u != NO_USE; u = reducer->uses.uses[u].next) {
+        Statement *user = &reducer->fn->statements[reducer->uses.uses[u].statement];
+        if (user->instruction == PHI || !user->label || reducer->derived[user->label].iv == NO_IV) return true;
+    }
+    return false;
+}
+
+// Collects the values to be reduced, and marks the loops they're in in `wanted`
+static bool find_roots(Reducer *reducer, bool *wanted) {
+    Function *fn = reducer->fn;
+    for (size_t i = 0; i < reducer->tree->num_reachable; i++) {
+        size_t b = reducer->tree->rpo[i];
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            ValueId value = fn->statements[s].label;
+            if (!value || fn->statements[s].instruction == PHI || !is_root(reducer, value)) continue;
+            wanted[reducer->ivs.ivs[reducer->derived[value].iv].loop] = true;
+            vec_push(reducer->roots_vec, value);
+        }
+    }
+    return vec_size(reducer->roots_vec) != 0;
+}
+
+static void init_reducer(Reducer *reducer, Function *fn) {
+    *reducer = (Reducer) {
+        .fn = fn,
+        .tree = dom_tree(fn),
+        .loops = find_loops(fn),
+        .uses = use_lists(fn),
+        .block_of = (size_t*) aalloc(sizeof(size_t) * (fn->num_statements + 1)),
+        .derived = (Derived*) malloc(sizeof(Derived) * (fn->num_values + 1)),
+        .roots_vec = vec_new(sizeof(ValueId)),
+    };
+    reducer->ivs = find_ivs(fn, &reducer->loops, &reducer->uses);
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) reducer->block_of[s] = b;
+    }
+}
+
+static void free_reducer(Reducer *reducer) {
+    free(reducer->derived);
+    vec_free(reducer->roots_vec);
+}
+
+static ValueId new_value(Reducer *reducer, ValueId like) {
+    ValueId id = reducer->fn->num_values + vec_size(reducer->value_names_vec);
+    vec_push(reducer->value_names_vec, suffixed_name(reducer->fn->value_names[like], ".lsr%zu", id));
+    return id;
+}
+
+static void add_to_block(Statement ***vecs, size_t block, Statement statement) {
+    if (!vecs[block]) vecs[block] = vec_new(sizeof(Statement));
+    vec_push(vecs[block], statement);
+}
+
+// `a` plus a constant, taking away instead if it's negative at `type`'s width
+static Statement add_constant(ValueId label, Type type, Operand a, uint64_t constant) {
+    uint64_t mask = type_mask(type);
+    bool is_negative = as_signed(constant & mask, type) < 0;
+    return (Statement) {
+        .label = label,
+        .instruction = (is_negative) ? SUB : ADD,
+        .type = type,
+        .arg_type = None,
+        .vals = {a.val, ((is_negative) ? 0 - constant : constant) & mask},
+        .val_types = {a.type, Number, Empty},
+    };
+}
+
+static Operand emit(Reducer *reducer, size_t block, ValueId like, Statement statement) {
+    statement.label = new_value(reducer, like);
+    add_to_block(reducer->added_vecs, block, statement);
+    return (Operand) {.val = statement.label, .type = Label};
+}
+
+static Operand emit_binary(Reducer *reducer, size_t block, ValueId like, Instruction instruction, Type type, Operand a, Operand b) {
+    return emit(reducer, block, like, (Statement) {
+        .instruction = instruction,
+        .type = type,
+        .arg_type = None,
+        .vals = {a.val, b.val},
+        .val_types = {a.type, b.type, Empty},
+    });
+}
+
+/* Adds statements to the end of `block` working out what `derived` is when its induction variable is
+ * `iv`, plus `extra`. */
+static Operand emit_derived(Reducer *reducer, size_t block, ValueId like, Derived *derived, Operand iv, uint64_t extra) {
+    uint64_t mask = type_mask(derived->type);
+    Operand base = {.val = derived->base, .type = derived->base_type};
+    uint64_t offset = (derived->offset + extra) & mask;
+    if (iv.type == Number) {
+        if (derived->is_extended) iv.val = (derived->is_signed) ? (uint64_t) as_signed(iv.val, Bits32) : iv.val & UINT32_MAX;
+        Operand value = {.val = (iv.val * derived->scale + offset) & mask, .type = Number};
+        if (derived->base_type == Empty) return value;
+        if (!value.val && base.type == Label) return base;
+        return emit(reducer, block, like, add_constant(0, derived->type, base, value.val));
+    }
+    Operand value = iv;
+    if (derived->is_extended) {
+        value = emit(reducer, block, like, (Statement) {
+            .instruction = EXT,
+            .type = Bits64,
+            .arg_type = Bits32,
+            .is_signed = derived->is_signed,
+            .vals = {iv.val},
+            .val_types = {iv.type, Empty, Empty},
+        });
+    }
+    if ((derived->scale & mask) != 1)
+        value = emit_binary(reducer, block, like, MUL, derived->type, value, (Operand) {.val = derived->scale & mask, .type = Number});
+    if (derived->base_type != Empty) value = emit_binary(reducer, block, like, ADD, derived->type, value, base);
+    if (offset) value = emit(reducer, block, like, add_constant(0, derived->type, value, offset));
+    return value;
+}
+
+// How much `derived` goes up by each time round its loop
+static uint64_t derived_step(Reducer *reducer, Derived *derived) {
+    uint64_t step = reducer->ivs.ivs[derived->iv].step;
+    if (derived->is_extended) step = (uint64_t) as_signed(step, Bits32);
+    return (step * derived->scale) & type_mask(derived->type);
+}
+
+static bool same_reduction(Derived *a, Derived *b) {
+    uint64_t mask = type_mask(a->type);
+    if (a->iv != b->iv || a->type != b->type || a->is_extended != b->is_extended || a->is_signed != b->is_signed) return false;
+    if ((a->scale & mask) != (b->scale & mask) || a->base_type != b->base_type) return false;
+    return a->base_type == Empty || a->base == b->base;
+}
+
+// Finds the phi that `root` can be worked out from, adding one if there isn't one yet
+static size_t find_reduced(Reducer *reducer, ValueId root) {
+    Function *fn = reducer->fn;
+    Derived *derived = &reducer->derived[root];
+    for (size_t r = reducer->first_reduced[derived->iv]; r != NO_REDUCED; r = (*reducer->reduced_vec)[r].next_of_iv) {
+        if (same_reduction(&(*reducer->reduced_vec)[r].derived, derived)) return r;
+    }
+    InductionVar *iv = &reducer->ivs.ivs[derived->iv];
+    size_t preheader = reducer->loops.loops[iv->loop].preheader;
+    size_t header = reducer->loops.loops[iv->loop].header;
+    size_t latch = fn->label_bblocks[iv->next->blklbl];
+    Reduced reduced = {
+        .derived = *derived,
+        .phi = new_value(reducer, root),
+        .next = new_value(reducer, root),
+        .root = root,
+        .next_of_iv = reducer->first_reduced[derived->iv],
+    };
+    Operand start = emit_derived(reducer, preheader, root, derived, (Operand) {.val = iv->start->val, .type = iv->start->type}, 0);
+    PhiVal *vals[2] = {(PhiVal*) aalloc(sizeof(PhiVal)), (PhiVal*) aalloc(sizeof(PhiVal))};
+    *vals[0] = (PhiVal) {.blklbl = iv->start->blklbl, .val = start.val, .type = start.type};
+    *vals[1] = (PhiVal) {.blklbl = iv->next->blklbl, .val = reduced.next, .type = Label};
+    add_to_block(reducer->phi_vecs, header, (Statement) {
+        .label = reduced.phi,
+        .instruction = PHI,
+        .type = derived->type,
+        .arg_type = None,
+        .vals = {(uint64_t) vals[0], (uint64_t) vals[1]},
+        .val_types = {PhiArg, PhiArg, Empty},
+    });
+    Operand phi = {.val = reduced.phi, .type = Label};
+    add_to_block(reducer->added_vecs, latch, add_constant(reduced.next, derived->type, phi, derived_step(reducer, derived)));
+    reducer->first_reduced[derived->iv] = vec_size(reducer->reduced_vec);
+    vec_push(reducer->reduced_vec, reduced);
+    return vec_size(reducer->reduced_vec) - 1;
+}
+
+/* Makes `loop`'s header compare the phi of `reduced` with what it'll be when the loop stops, instead of
+ * comparing the induction variable, if the loop goes round a known number of times and the phi
+ * can't come back round to that value before then. Returns whether it did. */
+static bool rewrite_exit(Reducer *reducer, size_t loop, Reduced *reduced) {
+    Function *fn = reducer->fn;
+    LoopExit *exit = &reducer->ivs.exits[loop];
+    if (exit->iv != reduced->derived.iv || exit->trip_count == NO_TRIP_COUNT) return false;
+    Statement *compare = &fn->statements[exit->compare];
+    if (reducer->uses.num_uses[compare->label] != 1) return false;
+    Type type = reduced->derived.type;
+    uint64_t step = derived_step(reducer, &reduced->derived);
+    int64_t signed_step = as_signed(step, type);
+    uint64_t magnitude = (signed_step < 0) ? 0 - (uint64_t) signed_step : (uint64_t) signed_step;
+    if (magnitude > (type_mask(type) >> 1) / (exit->trip_count + 1)) return false;
+    InductionVar *iv = &reducer->ivs.ivs[exit->iv];
+    Operand start = {.val = iv->start->val, .type = iv->start->type};
+    Operand end = emit_derived(reducer, reducer->loops.loops[loop].preheader, reduced->root, &reduced->derived,
+                               start, step * exit->trip_count);
+    *compare = (Statement) {
+        .label = compare->label,
+        .instruction = (exit->stays_if_true) ? NE : EQ,
+        .type = compare->type,
+        .arg_type = type,
+        .vals = {reduced->phi, end.val},
+        .val_types = {Label, end.type, Empty},
+    };
+    return true;
+}
+
+// Works out each root from a phi of its own (or one it shares), returning how many phis were added
+static size_t reduce_roots(Reducer *reducer) {
+    Function *fn = reducer->fn;
+    size_t num_roots = vec_size(reducer->roots_vec);
+    ValueId *roots = *reducer->roots_vec;
+    size_t *reduced_of = (size_t*) malloc(sizeof(size_t) * (num_roots + 1));
+    for (size_t i = 0; i < num_roots; i++) {
+        size_t loop = reducer->ivs.ivs[reducer->derived[roots[i]].iv].loop;
+        reduced_of[i] = (reducer->loops.loops[loop].preheader == NO_BBLOCK) ? NO_REDUCED : find_reduced(reducer, roots[i]);
+    }
+    // the uses point into the statements, so every one has to be replaced before any statement changes
+    for (size_t i = 0; i < num_roots; i++) {
+        if (reduced_of[i] == NO_REDUCED) continue;
+        Reduced *reduced = &(*reducer->reduced_vec)[reduced_of[i]];
+        if ((reducer->derived[roots[i]].offset - reduced->derived.offset) & type_mask(reduced->derived.type)) continue;
+        for (size_t u = reducer->uses.first_use[roots[i]]; u != NO_USE; u = reducer->uses.uses[u].next)
+            *reducer->uses.uses[u].val = reduced->phi;
+    }
+    size_t num_exits = 0;
+    for (size_t i = 0; i < reducer->ivs.num_ivs; i++) {
+        if (reducer->first_reduced[i] == NO_REDUCED) continue;
+        Reduced *reduced = &(*reducer->reduced_vec)[reducer->first_reduced[i]];
+        num_exits += rewrite_exit(reducer, reducer->ivs.ivs[i].loop, reduced);
+    }
+    // and the rest are worked out from the phi they share
+    for (size_t i = 0; i < num_roots; i++) {
+        if (reduced_of[i] == NO_REDUCED) continue;
+        Reduced *reduced = &(*reducer->reduced_vec)[reduced_of[i]];
+        uint64_t delta = (reducer->derived[roots[i]].offset - reduced->derived.offset) & type_mask(reduced->derived.type);
+        if (!delta) continue;
+        Operand phi = {.val = reduced->phi, .type = Label};
+        fn->statements[reducer->uses.def[roots[i]]] = add_constant(roots[i], reduced->derived.type, phi, delta);
+    }
+    free(reduced_of);
+    add_stat(STAT_LSR_EXITS, num_exits);
+    return vec_size(reducer->reduced_vec);
+}
+
+// Puts the new phis at the start of their blocks, and the other new statements at the end before the terminator
+static void rebuild_statements(Reducer *reducer) {
+    Function *fn = reducer->fn;
+    Statement **statement_vec = vec_new(sizeof(Statement));
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        BasicBlock *bblock = &fn->bblocks[b];
+        bool has_terminator = is_terminator(fn->statements[bblock->end - 1].instruction);
+        size_t s = bblock->start;
+        if (fn->statements[s].instruction == BLKLBL) vec_push(statement_vec, fn->statements[s++]);
+        if (reducer->phi_vecs[b]) {
+            for (size_t p = 0; p < vec_size(reducer->phi_vecs[b]); p++) vec_push(statement_vec, (*reducer->phi_vecs[b])[p]);
+            vec_free(reducer->phi_vecs[b]);
+        }
+        for (; s < bblock->end - has_terminator; s++) vec_push(statement_vec, fn->statements[s]);
+        if (reducer->added_vecs[b]) {
+            for (size_t a = 0; a < vec_size(reducer->added_vecs[b]); a++) vec_push(statement_vec, (*reducer->added_vecs[b])[a]);
+            vec_free(reducer->added_vecs[b]);
+        }
+        if (has_terminator) vec_push(statement_vec, fn->statements[bblock->end - 1]);
+    }
+    fn->num_statements = vec_size(statement_vec);
+    fn->statements = vec_into_arena(statement_vec);
+}
+
+bool opt_lsr(Function *fn) {
+    if (!fn->num_bblocks) return false;
+    Reducer reducer;
+    init_reducer(&reducer, fn);
+    if (!reducer.ivs.num_ivs) {
+        free_reducer(&reducer);
+        return false;
+    }
+    // first find which loops have anything to reduce, so that only they get preheaders
+    bool *wanted = (bool*) aalloc(sizeof(bool) * reducer.loops.num_loops);
+    memset(wanted, 0, sizeof(bool) * reducer.loops.num_loops);
+    find_derived(&reducer);
+    if (!find_roots(&reducer, wanted)) {
+        free_reducer(&reducer);
+        return false;
+    }
+    size_t num_preheaders = insert_preheaders(fn, &reducer.loops, wanted);
+    if (num_preheaders) {
+        free_reducer(&reducer);
+        init_reducer(&reducer, fn);
+        wanted = (bool*) aalloc(sizeof(bool) * reducer.loops.num_loops);
+        memset(wanted, 0, sizeof(bool) * reducer.loops.num_loops);
+        find_derived(&reducer);
+        find_roots(&reducer, wanted);
+    }
+    reducer.reduced_vec = vec_new(sizeof(Reduced));
+    reducer.first_reduced = (size_t*) aalloc(sizeof(size_t) * (reducer.ivs.num_ivs + 1));
+    memset(reducer.first_reduced, 0xFF, sizeof(size_t) * (reducer.ivs.num_ivs + 1));
+    reducer.added_vecs = (Statement***) aalloc(sizeof(Statement**) * (fn->num_bblocks + 1));
+    reducer.phi_vecs = (Statement***) aalloc(sizeof(Statement**) * (fn->num_bblocks + 1));
+    memset(reducer.added_vecs, 0, sizeof(Statement**) * (fn->num_bblocks + 1));
+    memset(reducer.phi_vecs, 0, sizeof(Statement**) * (fn->num_bblocks + 1));
+    reducer.value_names_vec = vec_new(sizeof(char*));
+    size_t num_reduced = reduce_roots(&reducer);
+    if (num_reduced) {
+        rebuild_statements(&reducer);
+        append_names(&fn->value_names, &fn->num_values, reducer.value_names_vec);
+        add_stat(STAT_LSR_REDUCED, num_reduced);
+    } else {
+        vec_free(reducer.value_names_vec);
+    }
+    vec_free(reducer.reduced_vec);
+    free_reducer(&reducer);
+    return num_reduced || num_preheaders;
+}
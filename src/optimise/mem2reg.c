@@ -0,0 +1,464 @@
+/* Promotion of allocs to values (mem2reg). Frontends like cproc keep every local variable in an alloc
+ * and load and store it each time it's used, which would otherwise mean going to memory every time.
+ * An alloc can be promoted if its address is only ever used as the address of loads and stores (or
+ * copied to a value that is), and they're all the same width, since then nothing else can see the
+ * memory.
+ * Each promoted alloc needs a phi in the iterated dominance frontier of the blocks storing to it, but
+ * only where some load could still see the value, so no more phis are made than are needed. Phis only
+ * take two values, so if one would have to go in a block with some other number of predecessors (or a
+ * block without a label to name it by), the alloc is left alone.
+ * Then the dominator tree is walked keeping the value last stored to each alloc: loads become copies
+ * of it (or extensions, if they're narrower than what they give), stores are removed, and the phis in
+ * each successor are given it. A load before any store reads 0, as does a load in a block that can't
+ * be reached.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOT_PROMOTED ((size_t) -1)
+#define NO_PHI       ((size_t) -1)
+
+typedef struct {
+    ValueId value; // defined by the alloc
+    Type width;    // of every load and store of it
+    bool rejected; // if it turned out to need a phi where one can't go
+} Slot;
+
+// A block which stores to a slot, or loads it before storing to it
+typedef struct {
+    size_t slot;
+    size_t block;
+} SlotAccess;
+
+typedef struct {
+    size_t slot;
+    ValueId value;
+    PhiVal *vals[2]; // from preds[0] and preds[1] of its block
+    size_t next;     // the next phi in the same block, or NO_PHI
+} NewPhi;
+
+typedef struct {
+    uint64_t val;
+    ValType type;
+} CurrentVal;
+
+typedef struct {
+    size_t slot;
+    CurrentVal old;
+} Undo;
+
+typedef struct {
+    Function *fn;
+    DomTree *tree;
+    UseLists uses;
+    Slot *slots;
+    size_t num_slots;
+    size_t *slot_of;       // indexed by ValueId, NOT_PROMOTED unless it's the address of a slot
+    ValueId *names;        // room for every value, for finding the names of a slot's address
+    // indexed by block, each stamped with the last slot they were set for
+    size_t *defines;
+    size_t *live;
+    size_t *in_frontier;
+    size_t *worklist;      // room for every block
+    size_t *phi_blocks;    // where the slot being placed needs phis, before they're known to be possible
+    NewPhi **phis_vec;
+    size_t *first_phi;     // indexed by block
+    CurrentVal *current;   // indexed by slot
+    Undo *undo;            // what to put back in `current` when leaving each block, with room for every store and phi
+    size_t num_undo;
+    bool *removed;         // indexed by statement
+} Promoter;
+
+static size_t slot_named(Promoter *promoter, uint64_t val, ValType type) {
+    if (type != Label || promoter->slot_of[val] == NOT_PROMOTED) return NOT_PROMOTED;
+    return (promoter->slots[promoter->slot_of[val]].rejected) ? NOT_PROMOTED : promoter->slot_of[val];
+}
+
+// Returns the slot `statement` loads from or stores to, or NOT_PROMOTED if it's neither
+static size_t slot_accessed(Promoter *promoter, Statement *statement) {
+    if (statement->instruction == LOAD) return slot_named(promoter, statement->vals[0], statement->val_types[0]);
+    if (statement->instruction == STORE) return slot_named(promoter, statement->vals[1], statement->val_types[1]);
+    return NOT_PROMOTED;
+}
+
+/* Whether every use of `slot`'s address is as the address of a load or store of the same width, and
+ * everything stored to it can be used wherever it's loaded instead. The address can also be copied,
+ * in which case the copy is just another name for the slot. Sets the slot's width, and marks each
+ * name for it in slot_of, if so. */
+static bool can_promote(Promoter *promoter, Slot *slot, size_t index) {
+    UseLists *uses = &promoter->uses;
+    if (!uses->num_uses[slot->value]) return false;
+    slot->width = None;
+    ValueId *names = promoter->names;
+    size_t num_names = 0;
+    names[num_names++] = slot->value;
+    promoter->slot_of[slot->value] = index;
+    for (size_t n = 0; n < num_names; n++) {
+        if (uses->num_defs[names[n]] != 1) goto fail;
+        for (size_t u = uses->first_use[names[n]]; u != NO_USE; u = uses->uses[u].next) {
+            Statement *statement = &promoter->fn->statements[uses->uses[u].statement];
+            if (statement->instruction == COPY && statement->label) {
+                if (promoter->slot_of[statement->label] != NOT_PROMOTED) goto fail;
+                promoter->slot_of[statement->label] = index;
+                names[num_names++] = statement->label;
+                continue;
+            }
+            bool is_load = statement->instruction == LOAD && uses->uses[u].val == &statement->vals[0];
+            bool is_store = statement->instruction == STORE && uses->uses[u].val == &statement->vals[1];
+            if (!is_load && !is_store) goto fail;
+            if (slot->width != None && slot->width != statement->arg_type) goto fail;
+            slot->width = statement->arg_type;
+            if (!is_store) continue;
+            // a value defined more than once might not be the same by the time it's loaded
+            if (statement->val_types[0] == Label && uses->num_defs[statement->vals[0]] > 1) goto fail;
+            if (statement->val_types[0] != Label && statement->val_types[0] != Number) goto fail;
+        }
+    }
+    return true;
+fail:
+    for (size_t n = 0; n < num_names; n++) promoter->slot_of[names[n]] = NOT_PROMOTED;
+    return false;
+}
+
+// Sorts `accesses` by slot, returning where each slot's accesses start
+static size_t *group_by_slot(SlotAccess *accesses, size_t num_accesses, size_t num_slots) {
+    size_t *start = (size_t*) aalloc(sizeof(size_t) * (num_slots + 1));
+    memset(start, 0, sizeof(size_t) * (num_slots + 1));
+    for (size_t a = 0; a < num_accesses; a++) start[accesses[a].slot + 1]++;
+    for (size_t s = 0; s < num_slots; s++) start[s + 1] += start[s];
+    size_t *next = (size_t*) malloc(sizeof(size_t) * (num_slots + 1));
+    memcpy(next, start, sizeof(size_t) * num_slots);
+    SlotAccess *sorted = (SlotAccess*) malloc(sizeof(SlotAccess) * (num_accesses + 1));
+    for (size_t a = 0; a < num_accesses; a++) sorted[next[accesses[a].slot]++] = accesses[a];
+    memcpy(accesses, sorted, sizeof(SlotAccess) * num_accesses);
+    free(sorted);
+    free(next);
+    return start;
+}
+
+/* Finds which reachable blocks store to each slot, and which load it before storing to it, as two lists
+ * of SlotAccesses grouped by slot. */
+static void find_accesses(Promoter *promoter, SlotAccess **stores_buf, size_t **stores_start_buf,
+                          SlotAccess **loads_buf, size_t **loads_start_buf) {
+    Function *fn = promoter->fn;
+    SlotAccess **stores_vec = vec_new(sizeof(SlotAccess));
+    SlotAccess **loads_vec = vec_new(sizeof(SlotAccess));
+    // the last block each slot was seen being stored to or loaded in
+    size_t *stored_in = (size_t*) malloc(sizeof(size_t) * (promoter->num_slots + 1));
+    size_t *seen_in = (size_t*) malloc(sizeof(size_t) * (promoter->num_slots + 1));
+    memset(stored_in, 0xFF, sizeof(size_t) * promoter->num_slots);
+    memset(seen_in, 0xFF, sizeof(size_t) * promoter->num_slots);
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        if (promoter->tree->rpo_index[b] == NO_BBLOCK) continue;
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            size_t slot = slot_accessed(promoter, statement);
+            if (slot == NOT_PROMOTED || (seen_in[slot] == b && stored_in[slot] == b)) continue;
+            if (statement->instruction == STORE) {
+                SlotAccess access = {.slot = slot, .block = b};
+                vec_push(stores_vec, access);
+                stored_in[slot] = b;
+            } else if (seen_in[slot] != b) {
+                SlotAccess access = {.slot = slot, .block = b};
+                vec_push(loads_vec, access);
+            }
+            seen_in[slot] = b;
+        }
+    }
+    free(stored_in);
+    free(seen_in);
+    *stores_start_buf = group_by_slot(*stores_vec, vec_size(stores_vec), promoter->num_slots);
+    *loads_start_buf = group_by_slot(*loads_vec, vec_size(loads_vec), promoter->num_slots);
+    *stores_buf = vec_into_arena(stores_vec);
+    *loads_buf = vec_into_arena(loads_vec);
+}
+
+// Whether a phi can go at the start of `block`, which it can't if it'd need more or less than two values
+static bool can_have_phi(Function *fn, size_t block) {
+    BasicBlock *bblock = &fn->bblocks[block];
+    if (bblock->num_preds != 2 || bblock->preds[0] == bblock->preds[1] || !bblock->label) return false;
+    return fn->bblocks[bblock->preds[0]].label && fn->bblocks[bblock->preds[1]].label;
+}
+
+/* Marks the blocks where `slot` is live at the start, which are the ones that load it before storing
+ * to it and any that can reach one of those without storing to it first. The blocks storing to it
+ * have to have been marked in `defines` already. */
+static void find_live_blocks(Promoter *promoter, size_t slot, SlotAccess *loads, size_t num_loads) {
+    size_t num_queued = 0;
+    for (size_t l = 0; l < num_loads; l++) {
+        promoter->live[loads[l].block] = slot;
+        promoter->worklist[num_queued++] = loads[l].block;
+    }
+    while (num_queued) {
+        BasicBlock *bblock = &promoter->fn->bblocks[promoter->worklist[--num_queued]];
+        for (size_t p = 0; p < bblock->num_preds; p++) {
+            size_t pred = bblock->preds[p];
+            if (promoter->live[pred] == slot || promoter->defines[pred] == slot) continue;
+            if (promoter->tree->rpo_index[pred] == NO_BBLOCK) continue;
+            promoter->live[pred] = slot;
+            promoter->worklist[num_queued++] = pred;
+        }
+    }
+}
+
+/* Adds the phis `slot` needs to promoter->phis_vec, unless one of them can't be made, in which case
+ * none are. Returns whether it could. */
+static bool place_phis(Promoter *promoter, size_t slot, SlotAccess *stores, size_t num_stores,
+                       SlotAccess *loads, size_t num_loads) {
+    Function *fn = promoter->fn;
+    DomTree *tree = promoter->tree;
+    for (size_t s = 0; s < num_stores; s++) promoter->defines[stores[s].block] = slot;
+    find_live_blocks(promoter, slot, loads, num_loads);
+    size_t num_queued = 0, num_phis = 0;
+    for (size_t s = 0; s < num_stores; s++) promoter->worklist[num_queued++] = stores[s].block;
+    while (num_queued) {
+        size_t block = promoter->worklist[--num_queued];
+        for (size_t f = tree->frontier_start[block]; f < tree->frontier_start[block + 1]; f++) {
+            size_t frontier = tree->frontier[f];
+            if (promoter->in_frontier[frontier] == slot) continue;
+            promoter->in_frontier[frontier] = slot;
+            // where nothing loads it afterwards a phi isn't needed, but it still counts as a store to it
+            if (promoter->live[frontier] == slot) {
+                if (!can_have_phi(fn, frontier)) return false;
+                promoter->phi_blocks[num_phis++] = frontier;
+            }
+            if (promoter->defines[frontier] != slot) {
+                promoter->defines[frontier] = slot;
+                promoter->worklist[num_queued++] = frontier;
+            }
+        }
+    }
+    for (size_t p = 0; p < num_phis; p++) {
+        BasicBlock *bblock = &fn->bblocks[promoter->phi_blocks[p]];
+        NewPhi phi = {.slot = slot, .next = promoter->first_phi[promoter->phi_blocks[p]]};
+        // a predecessor that can't be reached never gets to give it a value
+        for (size_t i = 0; i < 2; i++) {
+            phi.vals[i] = (PhiVal*) aalloc(sizeof(PhiVal));
+            *phi.vals[i] = (PhiVal) {.blklbl = fn->bblocks[bblock->preds[i]].label, .val = 0, .type = Number};
+        }
+        promoter->first_phi[promoter->phi_blocks[p]] = vec_size(promoter->phis_vec);
+        vec_push(promoter->phis_vec, phi);
+    }
+    return true;
+}
+
+static void set_current(Promoter *promoter, size_t slot, uint64_t val, ValType type) {
+    promoter->undo[promoter->num_undo++] = (Undo) {.slot = slot, .old = promoter->current[slot]};
+    promoter->current[slot] = (CurrentVal) {.val = val, .type = type};
+}
+
+/* Replaces a load with `val`, the last thing stored. Only the low bits the load reads from memory made
+ * it there, so a load giving a wider type than it reads becomes an EXT of them, just as it would have
+ * extended them from memory. */
+static void load_to_copy(Statement *statement, CurrentVal val) {
+    bool extends = statement->arg_type < statement->type;
+    statement->instruction = (extends) ? EXT : COPY;
+    if (!extends) {
+        statement->arg_type = None;
+        statement->is_signed = false;
+    }
+    statement->vals[0] = val.val;
+    statement->val_types[0] = val.type;
+    statement->val_types[1] = Empty;
+    statement->val_types[2] = Empty;
+}
+
+// Replaces the loads and stores of promoted slots in `block`, and gives its successors' phis their values
+static void rename_block(Promoter *promoter, size_t block) {
+    Function *fn = promoter->fn;
+    for (size_t p = promoter->first_phi[block]; p != NO_PHI; p = (*promoter->phis_vec)[p].next) {
+        NewPhi *phi = &(*promoter->phis_vec)[p];
+        set_current(promoter, phi->slot, phi->value, Label);
+    }
+    for (size_t s = fn->bblocks[block].start; s < fn->bblocks[block].end; s++) {
+        Statement *statement = &fn->statements[s];
+        size_t slot = slot_accessed(promoter, statement);
+        if (slot == NOT_PROMOTED) continue;
+        if (statement->instruction == LOAD) {
+            load_to_copy(statement, promoter->current[slot]);
+        } else {
+            set_current(promoter, slot, statement->vals[0], statement->val_types[0]);
+            promoter->removed[s] = true;
+        }
+    }
+    BasicBlock *bblock = &fn->bblocks[block];
+    for (size_t i = 0; i < bblock->num_succs; i++) {
+        size_t succ = bblock->succs[i];
+        for (size_t p = promoter->first_phi[succ]; p != NO_PHI; p = (*promoter->phis_vec)[p].next) {
+            NewPhi *phi = &(*promoter->phis_vec)[p];
+            size_t pred = fn->bblocks[succ].preds[0] != block;
+            phi->vals[pred]->val = promoter->current[phi->slot].val;
+            phi->vals[pred]->type = promoter->current[phi->slot].type;
+        }
+    }
+}
+
+// Walks the dominator tree, so that the value a slot has in each block is whatever it had in its idom
+static void rename_slots(Promoter *promoter) {
+    Function *fn = promoter->fn;
+    DomTree *tree = promoter->tree;
+    for (size_t s = 0; s < promoter->num_slots; s++) promoter->current[s] = (CurrentVal) {.val = 0, .type = Number};
+    promoter->undo = (Undo*) malloc(sizeof(Undo) * (fn->num_statements + vec_size(promoter->phis_vec) + 1));
+    promoter->num_undo = 0;
+    // each block is on the stack twice, once to go into it and once (as ~block) to come back out
+    size_t *stack = (size_t*) malloc(sizeof(size_t) * (tree->num_reachable * 2 + 1));
+    size_t *undo_at = (size_t*) malloc(sizeof(size_t) * (fn->num_bblocks + 1));
+    size_t depth = 0;
+    if (tree->num_reachable) stack[depth++] = 0;
+    while (depth) {
+        size_t b = stack[--depth];
+        if (b > fn->num_bblocks) {
+            for (; promoter->num_undo > undo_at[~b]; promoter->num_undo--) {
+                Undo *undo = &promoter->undo[promoter->num_undo - 1];
+                promoter->current[undo->slot] = undo->old;
+            }
+            continue;
+        }
+        undo_at[b] = promoter->num_undo;
+        rename_block(promoter, b);
+        stack[depth++] = ~b;
+        for (size_t c = tree->children_start[b + 1]; c > tree->children_start[b]; c--)
+            stack[depth++] = tree->children[c - 1];
+    }
+    free(stack);
+    free(undo_at);
+    free(promoter->undo);
+    // nothing in an unreachable block runs, so what its loads read doesn't matter
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        if (tree->rpo_index[b] != NO_BBLOCK) continue;
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            size_t slot = slot_accessed(promoter, statement);
+            if (slot == NOT_PROMOTED) continue;
+            if (statement->instruction == LOAD) load_to_copy(statement, (CurrentVal) {.val = 0, .type = Number});
+            else promoter->removed[s] = true;
+        }
+    }
+}
+
+// Gives each new phi a value, and puts them in after the label of their block
+static void insert_phis(Promoter *promoter) {
+    Function *fn = promoter->fn;
+    size_t num_phis = vec_size(promoter->phis_vec);
+    char **value_names = (char**) aalloc(sizeof(char*) * (fn->num_values + num_phis));
+    memcpy(value_names, fn->value_names, sizeof(char*) * fn->num_values);
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        for (size_t p = promoter->first_phi[b]; p != NO_PHI; p = (*promoter->phis_vec)[p].next) {
+            NewPhi *phi = &(*promoter->phis_vec)[p];
+            phi->value = fn->num_values++;
+            char *block_name = fn->block_names[fn->bblocks[b].label];
+            value_names[phi->value] = suffixed_name(fn->value_names[promoter->slots[phi->slot].value], ".phi.%s", (block_name) ? block_name : "");
+        }
+    }
+    fn->value_names = value_names;
+}
+
+static void rebuild_statements(Promoter *promoter) {
+    Function *fn = promoter->fn;
+    Statement **statement_vec = vec_new(sizeof(Statement));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (promoter->removed[s]) continue;
+        Statement *statement = &fn->statements[s];
+        vec_push(statement_vec, *statement);
+        if (statement->instruction != BLKLBL) continue;
+        size_t block = fn->label_bblocks[statement->vals[0]];
+        for (size_t p = promoter->first_phi[block]; p != NO_PHI; p = (*promoter->phis_vec)[p].next) {
+            NewPhi *phi = &(*promoter->phis_vec)[p];
+            // values are never narrower than a word, so a byte or halfword slot's phi is a word
+            Type width = promoter->slots[phi->slot].width;
+            vec_push(statement_vec, ((Statement) {
+                .label = phi->value,
+                .instruction = PHI,
+                .type = (width < Bits32) ? Bits32 : width,
+                .arg_type = None,
+                .vals = {(uint64_t) phi->vals[0], (uint64_t) phi->vals[1]},
+                .val_types = {PhiArg, PhiArg, Empty},
+            }));
+        }
+    }
+    fn->num_statements = vec_size(statement_vec);
+    fn->statements = vec_into_arena(statement_vec);
+}
+
+bool opt_mem2reg(Function *fn) {
+    Slot **slots_vec = vec_new(sizeof(Slot));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction == ALLOC && statement->label) {
+            Slot slot = {.value = statement->label};
+            vec_push(slots_vec, slot);
+        }
+    }
+    if (!vec_size(slots_vec)) {
+        vec_free(slots_vec);
+        return false;
+    }
+    Promoter promoter = {
+        .fn = fn,
+        .tree = dom_tree(fn),
+        .uses = use_lists(fn),
+        .slot_of = (size_t*) aalloc(sizeof(size_t) * fn->num_values),
+    };
+    memset(promoter.slot_of, 0xFF, sizeof(size_t) * fn->num_values);
+    promoter.names = (ValueId*) malloc(sizeof(ValueId) * (fn->num_values + 1));
+    Slot **promoted_vec = vec_new(sizeof(Slot));
+    for (size_t s = 0; s < vec_size(slots_vec); s++) {
+        Slot slot = (*slots_vec)[s];
+        if (can_promote(&promoter, &slot, vec_size(promoted_vec))) vec_push(promoted_vec, slot);
+    }
+    vec_free(slots_vec);
+    free(promoter.names);
+    promoter.num_slots = vec_size(promoted_vec);
+    promoter.slots = vec_into_arena(promoted_vec);
+    if (!promoter.num_slots) return false;
+
+    size_t num_bblocks = fn->num_bblocks;
+    promoter.defines = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    promoter.live = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    promoter.in_frontier = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    promoter.first_phi = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    memset(promoter.defines, 0xFF, sizeof(size_t) * num_bblocks);
+    memset(promoter.live, 0xFF, sizeof(size_t) * num_bblocks);
+    memset(promoter.in_frontier, 0xFF, sizeof(size_t) * num_bblocks);
+    memset(promoter.first_phi, 0xFF, sizeof(size_t) * num_bblocks);
+    promoter.worklist = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    promoter.phi_blocks = (size_t*) malloc(sizeof(size_t) * (num_bblocks + 1));
+    promoter.phis_vec = vec_new(sizeof(NewPhi));
+    SlotAccess *stores, *loads;
+    size_t *stores_start, *loads_start;
+    find_accesses(&promoter, &stores, &stores_start, &loads, &loads_start);
+    size_t num_promoted = 0;
+    for (size_t s = 0; s < promoter.num_slots; s++) {
+        promoter.slots[s].rejected = !place_phis(&promoter, s, &stores[stores_start[s]], stores_start[s + 1] - stores_start[s],
+                                                 &loads[loads_start[s]], loads_start[s + 1] - loads_start[s]);
+        if (!promoter.slots[s].rejected) num_promoted++;
+    }
+    free(promoter.worklist);
+    free(promoter.phi_blocks);
+    if (!num_promoted) {
+        vec_free(promoter.phis_vec);
+        return false;
+    }
+
+    promoter.current = (CurrentVal*) aalloc(sizeof(CurrentVal) * promoter.num_slots);
+    promoter.removed = (bool*) aalloc(sizeof(bool) * fn->num_statements);
+    memset(promoter.removed, 0, sizeof(bool) * fn->num_statements);
+    // the allocs go, and so do copies of their addresses
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction != ALLOC && statement->instruction != COPY) continue;
+        if (slot_named(&promoter, statement->label, Label) != NOT_PROMOTED) promoter.removed[s] = true;
+    }
+    insert_phis(&promoter);
+    rename_slots(&promoter);
+    rebuild_statements(&promoter);
+    add_stat(STAT_MEM2REG_SLOTS, num_promoted);
+    add_stat(STAT_MEM2REG_PHIS, vec_size(promoter.phis_vec));
+    vec_free(promoter.phis_vec);
+    return true;
+}
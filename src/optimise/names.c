@@ -0,0 +1,43 @@
+/* Names for the values and block labels passes add to a function. A new one is named after the one
+ * it's made from with a suffix saying which pass made it (like `%x.inl3`), and they're added after the
+ * function's existing names so every ValueId and BlockId already in it stays the same.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <intern.h>
+#include <arena.h>
+#include <vector.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// `name` (or nothing if it's NULL) followed by the suffix printed from `fmt`, interned
+char *suffixed_name(char *name, char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int suffix_len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    size_t name_len = (name) ? strlen(name) : 0;
+    char *buf = (char*) malloc(name_len + suffix_len + 1);
+    memcpy(buf, (name) ? name : "", name_len);
+    va_start(args, fmt);
+    vsnprintf(&buf[name_len], suffix_len + 1, fmt, args);
+    va_end(args);
+    char *ret = intern_cstr(buf);
+    free(buf);
+    return ret;
+}
+
+/* Adds the names in `names_vec` after the `*num_names` in `*names` (a function's value_names or
+ * block_names), so the first one gets the ID *num_names, and frees the vector. */
+void append_names(char ***names, size_t *num_names, char* **names_vec) {
+    size_t num_new = vec_size(names_vec);
+    if (num_new) {
+        char **new_names = (char**) aalloc(sizeof(char*) * (*num_names + num_new));
+        memcpy(new_names, *names, sizeof(char*) * *num_names);
+        memcpy(&new_names[*num_names], *names_vec, sizeof(char*) * num_new);
+        *names = new_names;
+        *num_names += num_new;
+    }
+    vec_free(names_vec);
+}
@@ -0,0 +1,289 @@
+/* Pass manager, which runs a pipeline of passes over each function. Every pass is registered here
+ * along with the analyses it keeps up to date, and whatever it doesn't keep is thrown away or rebuilt
+ * after it changes a function, so passes don't need to know what comes after them.
+ * A pipeline is written as a list of pass names separated by commas, where repeat(...) runs the
+ * passes inside it again and again until none of them change anything, eg.
+ *     repeat(sccp,copyelim,dce)
+ * Most passes run on one function at a time, and a pipeline of them is run over each function in
+ * turn. Module passes (like inline) need every function at once instead, so the passes either side
+ * of them are run over every function before moving on, and a repeat(...) with a module pass in it
+ * repeats over the whole program.
+ * With -time-passes, the time taken by each pass and how many statements it was given and left
+ * behind are added up over every function compiled, on every thread, along with the statistics
+ * passes keep about what they've done.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A repeated group stops after this many times round even if it's still changing things
+#define MAX_REPEATS 16
+
+static Pass passes[] = {
+    {"fold",      opt_fold,              ANALYSIS_CFG | ANALYSIS_DOM_TREE},
+    {"mem2reg",   opt_mem2reg,           0},
+    {"sccp",      opt_sccp,              0},
+    {"copyelim",  opt_copy_elim,         0},
+    {"gvn",       opt_gvn,               0},
+    {"licm",      opt_licm,              0},
+    {"unroll",    NULL,                  0, NULL, opt_unroll},
+    {"lsr",       opt_lsr,               0},
+    {"dce",       opt_dce,               0},
+    {"inline",    NULL,                  0, opt_inline},
+};
+
+#define NUM_PASSES (sizeof(passes) / sizeof(passes[0]))
+
+/* -O1 is what runs by default, so it's kept to the conservative passes. The ones that add blocks or
+ * phis, or move statements between blocks, are only in -O2. */
+static char *presets[] = {
+    "",
+    "sccp,copyelim,dce",
+    "mem2reg,inline,repeat(mem2reg,sccp,copyelim,gvn,licm,unroll,lsr,dce)",
+};
+
+typedef struct {
+    atomic_uint_fast64_t runs;
+    atomic_uint_fast64_t nanoseconds;
+    atomic_uint_fast64_t statements_in;
+    atomic_uint_fast64_t statements_out;
+} PassTimes;
+
+// One for each pass, and one more for rebuilding the control flow graph after them
+static PassTimes pass_times[NUM_PASSES + 1];
+
+static char *stat_names[NUM_STATS] = {
+    [STAT_DCE_STATEMENTS]           = "dce: statements removed",
+    [STAT_DCE_UNREACHABLE_BLOCKS]   = "dce: unreachable blocks removed",
+    [STAT_DCE_PHIS_FOLDED]          = "dce: phis made into copies",
+    [STAT_SCCP_CONSTANTS]           = "sccp: values found to be constant",
+    [STAT_SCCP_BRANCHES]            = "sccp: branches on constants made into jumps",
+    [STAT_SCCP_UNREACHABLE_BLOCKS]  = "sccp: blocks found to be unreachable",
+    [STAT_INLINE_CALLS]             = "inline: calls inlined",
+    [STAT_INLINE_FUNCTIONS_REMOVED] = "inline: functions removed after having every call inlined",
+    [STAT_MEM2REG_SLOTS]            = "mem2reg: allocs promoted to values",
+    [STAT_MEM2REG_PHIS]             = "mem2reg: phis inserted",
+    [STAT_GVN_STATEMENTS]           = "gvn: redundant statements removed",
+    [STAT_LICM_HOISTED]             = "licm: statements moved out of loops",
+    [STAT_LICM_PREHEADERS]          = "licm: preheaders added to loops",
+    [STAT_UNROLL_FULL]              = "unroll: loops unrolled completely",
+    [STAT_UNROLL_PARTIAL]           = "unroll: loops unrolled partially",
+    [STAT_LSR_REDUCED]              = "lsr: induction variables added",
+    [STAT_LSR_EXITS]                = "lsr: loop exits rewritten",
+};
+
+static atomic_uint_fast64_t stats[NUM_STATS];
+
+void add_stat(Statistic stat, size_t n) {
+    if (n) atomic_fetch_add(&stats[stat], n);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_time(PassTimes *times, uint64_t start, size_t statements_in, size_t statements_out) {
+    atomic_fetch_add(&times->runs, 1);
+    atomic_fetch_add(&times->nanoseconds, now_ns() - start);
+    atomic_fetch_add(&times->statements_in, statements_in);
+    atomic_fetch_add(&times->statements_out, statements_out);
+}
+
+// Returns NULL if there's no pass called `name`
+Pass *find_pass(char *name) {
+    for (size_t p = 0; p < NUM_PASSES; p++) {
+        if (!strcmp(passes[p].name, name)) return &passes[p];
+    }
+    return NULL;
+}
+
+/* Runs `pass` on `fn` and throws away the analyses it doesn't preserve if it changed anything.
+ * Returns whether it changed anything. */
+bool run_pass(Function *fn, Pass *pass, Pipeline *pipeline) {
+    bool time_passes = pipeline->time_passes;
+    size_t statements_in = fn->num_statements;
+    uint64_t start = (time_passes) ? now_ns() : 0;
+    bool changed = (pass->run_configured) ? pass->run_configured(fn, pipeline) : pass->run(fn);
+    if (time_passes) add_time(&pass_times[pass - passes], start, statements_in, fn->num_statements);
+    if (!changed) return false;
+    if (!(pass->preserves & ANALYSIS_CFG)) {
+        start = (time_passes) ? now_ns() : 0;
+        cfg_build(fn);
+        if (time_passes) add_time(&pass_times[NUM_PASSES], start, fn->num_statements, fn->num_statements);
+    }
+    if (!(pass->preserves & ANALYSIS_DOM_TREE)) fn->dom_tree = NULL;
+    return true;
+}
+
+static bool run_steps(Function *fn, PipelineStep *steps, size_t num_steps, Pipeline *pipeline) {
+    bool changed = false;
+    for (size_t s = 0; s < num_steps; s++) {
+        if (steps[s].pass) {
+            changed |= run_pass(fn, steps[s].pass, pipeline);
+            continue;
+        }
+        for (size_t i = 0; i < MAX_REPEATS && run_steps(fn, steps[s].group, steps[s].group_len, pipeline); i++)
+            changed = true;
+    }
+    return changed;
+}
+
+static bool has_module_pass(PipelineStep *steps, size_t num_steps) {
+    for (size_t s = 0; s < num_steps; s++) {
+        if (steps[s].pass && steps[s].pass->run_module) return true;
+        if (!steps[s].pass && has_module_pass(steps[s].group, steps[s].group_len)) return true;
+    }
+    return false;
+}
+
+// Whether the pipeline has to be given the whole program at once, rather than a function at a time
+bool pipeline_has_module_pass(Pipeline *pipeline) {
+    return has_module_pass(pipeline->steps, pipeline->num_steps);
+}
+
+/* Like run_pass() but for a module pass, which can change any function, so the analyses it doesn't
+ * preserve are thrown away or rebuilt for all of them. */
+static bool run_module_pass(Function *fns, size_t *num_functions, Pass *pass, Pipeline *pipeline) {
+    size_t statements_in = 0;
+    for (size_t f = 0; f < *num_functions; f++) statements_in += fns[f].num_statements;
+    uint64_t start = (pipeline->time_passes) ? now_ns() : 0;
+    bool changed = pass->run_module(fns, num_functions, pipeline);
+    size_t statements_out = 0;
+    for (size_t f = 0; f < *num_functions; f++) statements_out += fns[f].num_statements;
+    if (pipeline->time_passes) add_time(&pass_times[pass - passes], start, statements_in, statements_out);
+    if (!changed) return false;
+    for (size_t f = 0; f < *num_functions; f++) {
+        if (!(pass->preserves & ANALYSIS_CFG)) {
+            start = (pipeline->time_passes) ? now_ns() : 0;
+            cfg_build(&fns[f]);
+            if (pipeline->time_passes) add_time(&pass_times[NUM_PASSES], start, fns[f].num_statements, fns[f].num_statements);
+        }
+        if (!(pass->preserves & ANALYSIS_DOM_TREE)) fns[f].dom_tree = NULL;
+    }
+    return true;
+}
+
+/* Runs steps which might include module passes over every function. Steps without any module passes
+ * in them are run over each function in turn, like run_steps(). */
+static bool run_module_steps(Function *fns, size_t *num_functions, PipelineStep *steps, size_t num_steps, Pipeline *pipeline) {
+    bool changed = false;
+    for (size_t s = 0; s < num_steps; s++) {
+        if (steps[s].pass && steps[s].pass->run_module) {
+            changed |= run_module_pass(fns, num_functions, steps[s].pass, pipeline);
+        } else if (!steps[s].pass && has_module_pass(steps[s].group, steps[s].group_len)) {
+            for (size_t i = 0; i < MAX_REPEATS && run_module_steps(fns, num_functions, steps[s].group, steps[s].group_len, pipeline); i++)
+                changed = true;
+        } else {
+            size_t end = s + 1;
+            while (end < num_steps && !has_module_pass(&steps[end], 1)) end++;
+            for (size_t f = 0; f < *num_functions; f++)
+                changed |= run_steps(&fns[f], &steps[s], end - s, pipeline);
+            s = end - 1;
+        }
+    }
+    return changed;
+}
+
+/* Takes a pointer to an array of Function structures and the number of functions in the IR.
+ * Changes the statements in the given function to be more optimised. Module passes can remove
+ * functions, in which case the ones left are moved to the start of the array. Returns how many
+ * functions there are afterwards. */
+size_t optimise(Function *IR, size_t num_functions, Pipeline *pipeline) {
+    run_module_steps(IR, &num_functions, pipeline->steps, pipeline->num_steps, pipeline);
+    return num_functions;
+}
+
+static void free_steps(PipelineStep *steps, size_t num_steps) {
+    for (size_t s = 0; s < num_steps; s++) {
+        if (!steps[s].pass) free_steps(steps[s].group, steps[s].group_len);
+    }
+    free(steps);
+}
+
+static char *parse_steps(char **s, PipelineStep **steps_buf, size_t *num_steps_buf) {
+    PipelineStep *steps = NULL;
+    size_t num_steps = 0;
+    char *error = NULL;
+    while (**s && **s != ')') {
+        size_t len = strcspn(*s, ",()");
+        PipelineStep step = {0};
+        if (len == 6 && !memcmp(*s, "repeat", 6) && (*s)[6] == '(') {
+            *s += 7;
+            error = parse_steps(s, &step.group, &step.group_len);
+            if (!error && **s != ')') error = "Missing ) at the end of repeat(...).\n";
+            if (error) {
+                free_steps(step.group, step.group_len);
+                break;
+            }
+            (*s)++;
+        } else {
+            char name[32];
+            if (!len || len >= sizeof(name)) {
+                error = "Expected the name of a pass.\n";
+                break;
+            }
+            memcpy(name, *s, len);
+            name[len] = 0;
+            if (!(step.pass = find_pass(name))) {
+                error = "No such pass.\n";
+                break;
+            }
+            *s += len;
+        }
+        steps = (PipelineStep*) realloc(steps, sizeof(PipelineStep) * (num_steps + 1));
+        steps[num_steps++] = step;
+        if (**s == ',') (*s)++;
+        else if (**s && **s != ')') {
+            error = "Expected a comma between passes.\n";
+            break;
+        }
+    }
+    *steps_buf = steps;
+    *num_steps_buf = num_steps;
+    return error;
+}
+
+/* Reads a pipeline like "fold,copyelim" into `pipeline_buf`, which should be freed with
+ * pipeline_free() afterwards. Returns NULL if it's valid, otherwise an error message. */
+char *pipeline_parse(char *s, Pipeline *pipeline_buf) {
+    *pipeline_buf = (Pipeline) {
+        .inline_threshold = DEFAULT_INLINE_THRESHOLD,
+        .inline_max_size = DEFAULT_INLINE_MAX_SIZE,
+        .unroll_threshold = DEFAULT_UNROLL_THRESHOLD,
+    };
+    char *error = parse_steps(&s, &pipeline_buf->steps, &pipeline_buf->num_steps);
+    if (!error && *s) error = "Unexpected ) in pipeline.\n";
+    if (error) pipeline_free(pipeline_buf);
+    return error;
+}
+
+// Returns false if there's no preset for `level`, as in -O<level>
+bool pipeline_preset(size_t level, Pipeline *pipeline_buf) {
+    if (level >= sizeof(presets) / sizeof(presets[0])) return false;
+    pipeline_parse(presets[level], pipeline_buf);
+    return true;
+}
+
+void pipeline_free(Pipeline *pipeline) {
+    free_steps(pipeline->steps, pipeline->num_steps);
+    *pipeline = (Pipeline) {0};
+}
+
+// Prints what was added up with -time-passes, for the passes that ran at least once
+void print_pass_times(FILE *f) {
+    fprintf(f, "%-12s %8s %12s %14s %14s\n", "Pass", "Runs", "Time (ms)", "Statements in", "Statements out");
+    for (size_t p = 0; p <= NUM_PASSES; p++) {
+        PassTimes *times = &pass_times[p];
+        if (!times->runs) continue;
+        fprintf(f, "%-12s %8zu %12.3f %14zu %14zu\n", (p < NUM_PASSES) ? passes[p].name : "(cfg_build)",
+                (size_t) times->runs, times->nanoseconds / 1e6, (size_t) times->statements_in, (size_t) times->statements_out);
+    }
+    for (size_t s = 0; s < NUM_STATS; s++) {
+        if (stats[s]) fprintf(f, "%8zu %s\n", (size_t) stats[s], stat_names[s]);
+    }
+}
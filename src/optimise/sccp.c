@@ -0,0 +1,288 @@
+/* Sparse conditional constant propagation (Wegman and Zadeck). Each value starts off unknown and can
+ * only go down to a constant and then to varying, while edges of the control flow graph are only
+ * followed once they're found to be taken, so a branch on a constant only makes its target block
+ * executable, and a phi only takes the values coming from edges which are. Two worklists drive it:
+ * blocks that have just become executable, and values whose lattice value has just gone down, whose
+ * uses are looked at again.
+ * Once it's done, values found to be constant are put straight into their uses, branches on constant
+ * conditions become jumps, and phis with only one executable edge into them become copies. Blocks
+ * which were never executable can't be reached any more after that, and are left for dce to remove.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    UNKNOWN,  // no definition of it has been found to run yet
+    CONSTANT,
+    VARYING,
+} LatticeKind;
+
+typedef struct {
+    LatticeKind kind;
+    uint64_t val; // if it's CONSTANT
+} LatticeVal;
+
+typedef struct {
+    Function *fn;
+    UseLists uses;
+    LatticeVal *values;     // indexed by ValueId
+    size_t *block_of;       // indexed by statement
+    bool *block_executable; // indexed by block
+    bool *edge_executable;  // indexed by block * 2 + the index of the successor in its succs
+    size_t *block_worklist; // room for every block, since each is only added when it becomes executable
+    size_t num_blocks_queued;
+    size_t *value_worklist; // room for every value, since each is only in it once at a time
+    bool *value_queued;
+    size_t num_values_queued;
+} Solver;
+
+static LatticeVal operand(Solver *solver, ValType type, uint64_t val) {
+    if (type == Number) return (LatticeVal) {CONSTANT, val};
+    if (type == Empty) return (LatticeVal) {CONSTANT, 0};
+    if (type == Label) return solver->values[val];
+    return (LatticeVal) {VARYING, 0};
+}
+
+static LatticeVal meet(LatticeVal a, LatticeVal b) {
+    if (a.kind == UNKNOWN) return b;
+    if (b.kind == UNKNOWN) return a;
+    if (a.kind == VARYING || b.kind == VARYING || a.val != b.val) return (LatticeVal) {VARYING, 0};
+    return a;
+}
+
+// Moves `value` down to meet it with `new`, and queues its uses to be looked at again if it changed
+static void lower(Solver *solver, ValueId value, LatticeVal new) {
+    LatticeVal old = solver->values[value];
+    LatticeVal lowered = meet(old, new);
+    if (lowered.kind == old.kind && lowered.val == old.val) return;
+    solver->values[value] = lowered;
+    if (solver->value_queued[value]) return;
+    solver->value_queued[value] = true;
+    solver->value_worklist[solver->num_values_queued++] = value;
+}
+
+// Whether the edge from block `pred` to block `b` has been found to be taken
+static bool is_edge_executable(Solver *solver, size_t pred, size_t b) {
+    BasicBlock *block = &solver->fn->bblocks[pred];
+    for (size_t i = 0; i < block->num_succs; i++) {
+        if (block->succs[i] == b && solver->edge_executable[pred * 2 + i]) return true;
+    }
+    return false;
+}
+
+static void visit_phi(Solver *solver, Statement *phi, size_t b) {
+    LatticeVal result = {UNKNOWN, 0};
+    for (size_t i = 0; i < 2; i++) {
+        PhiVal *phi_val = (PhiVal*) phi->vals[i];
+        size_t pred = phi_pred(solver->fn, phi_val);
+        if (pred == NO_BBLOCK || !is_edge_executable(solver, pred, b)) continue;
+        result = meet(result, operand(solver, phi_val->type, phi_val->val));
+    }
+    lower(solver, phi->label, result);
+}
+
+static void visit_statement(Solver *solver, size_t s) {
+    Statement *statement = &solver->fn->statements[s];
+    if (statement->instruction == PHI) {
+        visit_phi(solver, statement, solver->block_of[s]);
+        return;
+    }
+    if (statement->instruction == ASM) {
+        InlineAsm *info = (InlineAsm*) statement->vals[0];
+        for (size_t out = 0; out < vec_size(info->outputs_vec); out++)
+            lower(solver, (*info->outputs_vec)[out].label, (LatticeVal) {VARYING, 0});
+    }
+    if (!statement->label) return;
+    if (!can_eval_statement(statement)) {
+        lower(solver, statement->label, (LatticeVal) {VARYING, 0});
+        return;
+    }
+    LatticeVal a = operand(solver, statement->val_types[0], statement->vals[0]);
+    LatticeVal b = operand(solver, statement->val_types[1], statement->vals[1]);
+    if (a.kind == VARYING || b.kind == VARYING) {
+        lower(solver, statement->label, (LatticeVal) {VARYING, 0});
+    } else if (a.kind == CONSTANT && b.kind == CONSTANT) {
+        LatticeVal result = {CONSTANT, 0};
+        if (!eval_statement(statement, a.val, b.val, &result.val)) result.kind = VARYING;
+        lower(solver, statement->label, result);
+    }
+}
+
+static void visit_phis(Solver *solver, size_t b) {
+    BasicBlock *block = &solver->fn->bblocks[b];
+    for (size_t s = block->start; s < block->end; s++) {
+        if (solver->fn->statements[s].instruction == PHI) visit_phi(solver, &solver->fn->statements[s], b);
+    }
+}
+
+static void mark_edge(Solver *solver, size_t b, size_t i) {
+    if (solver->edge_executable[b * 2 + i]) return;
+    solver->edge_executable[b * 2 + i] = true;
+    size_t succ = solver->fn->bblocks[b].succs[i];
+    if (!solver->block_executable[succ]) {
+        solver->block_executable[succ] = true;
+        solver->block_worklist[solver->num_blocks_queued++] = succ;
+    } else {
+        // it's already been visited, so only its phis can see anything new
+        visit_phis(solver, succ);
+    }
+}
+
+/* The block a jnz goes to when its condition is known to be `cond`, or NO_BBLOCK if it isn't a jnz
+ * on a known condition. */
+static size_t known_branch_target(Solver *solver, Statement *statement) {
+    if (statement->instruction != JNZ) return NO_BBLOCK;
+    LatticeVal cond = operand(solver, statement->val_types[0], statement->vals[0]);
+    if (cond.kind != CONSTANT) return NO_BBLOCK;
+    BlockId target = statement->vals[(cond.val) ? 1 : 2];
+    if (statement->val_types[(cond.val) ? 1 : 2] != BlkLbl || target >= solver->fn->num_blocks) return NO_BBLOCK;
+    return solver->fn->label_bblocks[target];
+}
+
+// Marks the edges out of block `b` which its terminator can take as it's known so far
+static void visit_terminator(Solver *solver, size_t b) {
+    BasicBlock *block = &solver->fn->bblocks[b];
+    if (block->start == block->end) return;
+    Statement *last = &solver->fn->statements[block->end - 1];
+    if (last->instruction == JNZ) {
+        LatticeVal cond = operand(solver, last->val_types[0], last->vals[0]);
+        if (cond.kind == UNKNOWN) return;
+        size_t target = known_branch_target(solver, last);
+        if (target != NO_BBLOCK) {
+            for (size_t i = 0; i < block->num_succs; i++) {
+                if (block->succs[i] == target) mark_edge(solver, b, i);
+            }
+            return;
+        }
+    }
+    for (size_t i = 0; i < block->num_succs; i++) mark_edge(solver, b, i);
+}
+
+static void solve(Solver *solver) {
+    Function *fn = solver->fn;
+    while (solver->num_blocks_queued || solver->num_values_queued) {
+        if (solver->num_blocks_queued) {
+            size_t b = solver->block_worklist[--solver->num_blocks_queued];
+            for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) visit_statement(solver, s);
+            visit_terminator(solver, b);
+            continue;
+        }
+        ValueId value = solver->value_worklist[--solver->num_values_queued];
+        solver->value_queued[value] = false;
+        for (size_t u = solver->uses.first_use[value]; u != NO_USE; u = solver->uses.uses[u].next) {
+            size_t s = solver->uses.uses[u].statement;
+            size_t b = solver->block_of[s];
+            if (!solver->block_executable[b]) continue;
+            visit_statement(solver, s);
+            if (s == fn->bblocks[b].end - 1) visit_terminator(solver, b);
+        }
+    }
+}
+
+static void init_solver(Solver *solver, Function *fn) {
+    *solver = (Solver) {
+        .fn = fn,
+        .uses = use_lists(fn),
+        .values = (LatticeVal*) aalloc(sizeof(LatticeVal) * fn->num_values),
+        .block_of = (size_t*) aalloc(sizeof(size_t) * fn->num_statements),
+        .block_executable = (bool*) aalloc(sizeof(bool) * fn->num_bblocks),
+        .edge_executable = (bool*) aalloc(sizeof(bool) * fn->num_bblocks * 2),
+        .block_worklist = (size_t*) malloc(sizeof(size_t) * (fn->num_bblocks + 1)),
+        .value_worklist = (size_t*) malloc(sizeof(size_t) * (fn->num_values + 1)),
+        .value_queued = (bool*) calloc(fn->num_values + 1, sizeof(bool)),
+    };
+    memset(solver->block_executable, 0, sizeof(bool) * fn->num_bblocks);
+    memset(solver->edge_executable, 0, sizeof(bool) * fn->num_bblocks * 2);
+    // arguments and values defined more than once (if the input isn't in SSA form) could be anything
+    for (size_t v = 0; v < fn->num_values; v++) {
+        LatticeKind kind = (solver->uses.num_defs[v] == 1) ? UNKNOWN : VARYING;
+        solver->values[v] = (LatticeVal) {kind, 0};
+    }
+    for (size_t a = 0; a < fn->num_args; a++) solver->values[fn->args[a].label].kind = VARYING;
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) solver->block_of[s] = b;
+    }
+}
+
+static void free_solver(Solver *solver) {
+    free(solver->block_worklist);
+    free(solver->value_worklist);
+    free(solver->value_queued);
+}
+
+// Puts the constants found into the function, returning whether anything changed
+static bool rewrite(Solver *solver) {
+    Function *fn = solver->fn;
+    bool changed = false;
+    for (size_t v = 1; v < fn->num_values; v++) {
+        if (solver->values[v].kind != CONSTANT) continue;
+        size_t def = solver->uses.def[v];
+        Statement *statement = &fn->statements[def];
+        bool was_constant = statement->instruction == COPY && statement->val_types[0] == Number;
+        if (!was_constant) {
+            statement->instruction = COPY;
+            statement->vals[0] = solver->values[v].val;
+            statement->val_types[0] = Number;
+            statement->val_types[1] = Empty;
+            statement->val_types[2] = Empty;
+            changed = true;
+        }
+        size_t num_replaced = replace_uses_with_number(fn, &solver->uses, v, solver->values[v].val);
+        if (!was_constant || num_replaced) add_stat(STAT_SCCP_CONSTANTS, 1);
+        if (num_replaced) changed = true;
+    }
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        if (!solver->block_executable[b]) {
+            add_stat(STAT_SCCP_UNREACHABLE_BLOCKS, 1);
+            continue;
+        }
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) {
+            Statement *statement = &fn->statements[s];
+            if (statement->instruction == JNZ) {
+                // the operands may have been rewritten above, but the solver's values still say which way it goes
+                size_t target = known_branch_target(solver, statement);
+                if (target == NO_BBLOCK) continue;
+                statement->instruction = JMP;
+                statement->vals[0] = fn->bblocks[target].label;
+                statement->val_types[0] = BlkLbl;
+                statement->val_types[1] = Empty;
+                statement->val_types[2] = Empty;
+                add_stat(STAT_SCCP_BRANCHES, 1);
+                changed = true;
+            } else if (statement->instruction == PHI) {
+                PhiVal *phi_vals[2] = {(PhiVal*) statement->vals[0], (PhiVal*) statement->vals[1]};
+                bool executable[2];
+                for (size_t i = 0; i < 2; i++) {
+                    size_t pred = phi_pred(fn, phi_vals[i]);
+                    executable[i] = pred != NO_BBLOCK && is_edge_executable(solver, pred, b);
+                }
+                if (executable[0] == executable[1]) continue;
+                PhiVal *taken = phi_vals[executable[1]];
+                statement->instruction = COPY;
+                statement->vals[0] = taken->val;
+                statement->val_types[0] = taken->type;
+                statement->val_types[1] = Empty;
+                statement->val_types[2] = Empty;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+bool opt_sccp(Function *fn) {
+    if (!fn->num_bblocks) return false;
+    Solver solver;
+    init_solver(&solver, fn);
+    solver.block_executable[0] = true;
+    solver.block_worklist[solver.num_blocks_queued++] = 0;
+    solve(&solver);
+    bool changed = rewrite(&solver);
+    free_solver(&solver);
+    return changed;
+}
@@ -0,0 +1,500 @@
+/* Loop unrolling, for loops that go round a number of times which can be worked out at compile time.
+ * Only loops in the shape a frontend makes of a for or while loop are unrolled: the header decides
+ * whether to go round again and is the only way out, the body has no loops nested in it, and one block
+ * in the body (the latch) goes back to the header. The trip count comes from an induction variable
+ * (see ivs.c) which starts off as a constant and which the header's branch compares to a constant.
+ * If the loop's statements times its trip count is no more than Pipeline.unroll_threshold, the loop is
+ * unrolled completely: there's a copy of the header and body for each time round, one after another,
+ * with the header's phis made into copies of what they'd have been given and its branch made into a
+ * jump to the body, and then the original header once more, which now jumps straight out. Otherwise
+ * it's unrolled partially, with as many copies of the header and body in the loop as fit in the
+ * threshold (up to MAX_UNROLL_FACTOR), where only the first copy of the header still checks whether to
+ * keep going. If the trip count isn't a multiple of that, the times round left over are put before the
+ * loop as copies as well, so the loop always goes round a whole number of times.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <cfg.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The most copies of a loop's body there can be in the loop after it's partially unrolled
+#define MAX_UNROLL_FACTOR 4
+
+#define NO_UNROLL ((size_t) -1)
+
+typedef struct {
+    size_t header;
+    size_t latch;      // the block in the loop that goes back to the header
+    size_t entry;      // the block outside the loop that goes to the header
+    size_t body;       // the header's successor in the loop
+    size_t *blocks;    // in the order they're in the function
+    size_t num_blocks;
+    ValueId *defs;     // every value defined in the loop
+    size_t num_defs;
+    size_t num_phis;   // in the header
+    size_t trip_count; // how many times the body runs
+    size_t prologue;   // how many copies of the loop go before it
+    size_t factor;     // how many copies of the body are in the loop afterwards, or 0 if it's unrolled completely
+    Statement **before_header_vec; // the copies that go before the header
+    Statement **after_latch_vec;   // the copies that go after the latch
+    BlockId first_before_header;   // the label of the first copy of the header in each, if there are any
+    BlockId first_after_latch;
+    PhiVal *entry_vals; // indexed by phi in the header, what it's given coming into the loop after the copies before it
+    PhiVal *latch_vals; // and coming from the last copy in the loop
+} Unroll;
+
+typedef struct {
+    Function *fn;
+    Loops loops;
+    UseLists uses;
+    InductionVars ivs;
+    size_t unroll_threshold;
+    size_t *block_of;        // indexed by statement
+    size_t *in_loop;         // indexed by block, stamped with the loop being looked at
+    ValueId *value_map;      // indexed by ValueId, its name in the copy being made
+    BlockId *label_map;      // indexed by block, its label in the copy being made
+    char* **value_names_vec; // the names of the values added
+    char* **block_names_vec; // the names of the block labels added
+    Statement **copy_vec;    // where the copy being made goes
+    Statement **statements_vec;
+    BlockId pending_jmp;     // see add_statement()
+} Unroller;
+
+static int compare_blocks(const void *a, const void *b) {
+    size_t block_a = *(const size_t*) a, block_b = *(const size_t*) b;
+    return (block_a > block_b) - (block_a < block_b);
+}
+
+// Whether everything using `value`, which is defined in the body of the loop, is in the body too (or is a phi in the header)
+static bool used_only_in_loop(Unroller *unroller, Unroll *unroll, size_t loop, ValueId value) {
+    for (size_t u = unroller->uses.first_use[value]; u != NO_USE; u = unroller->uses.uses[u].next) {
+        size_t statement = unroller->uses.uses[u].statement;
+        size_t block = unroller->block_of[statement];
+        if (unroller->in_loop[block] != loop) return false;
+        if (block == unroll->header && unroller->fn->statements[statement].instruction != PHI) return false;
+    }
+    return true;
+}
+
+/* Checks whether `loop` is in a shape that can be unrolled, and if it is, fills in `unroll_buf` with
+ * how it'll be unrolled. */
+static bool can_unroll(Unroller *unroller, size_t loop, Unroll *unroll_buf) {
+    Function *fn = unroller->fn;
+    Loops *loops = &unroller->loops;
+    size_t header = loops->loops[loop].header;
+    BasicBlock *header_block = &fn->bblocks[header];
+    if (!header || !header_block->label || header_block->num_preds != 2 || header_block->num_succs != 2) return false;
+    size_t num_blocks = loops->blocks_start[loop + 1] - loops->blocks_start[loop];
+    for (size_t i = loops->blocks_start[loop]; i < loops->blocks_start[loop + 1]; i++) {
+        // a block that's in a loop nested in this one
+        if (loops->loop_of[loops->blocks[i]] != loop) return false;
+        unroller->in_loop[loops->blocks[i]] = loop;
+    }
+    *unroll_buf = (Unroll) {.header = header, .latch = NO_BBLOCK, .entry = NO_BBLOCK, .body = NO_BBLOCK};
+    for (size_t p = 0; p < 2; p++) {
+        size_t pred = header_block->preds[p];
+        if (unroller->in_loop[pred] == loop) unroll_buf->latch = pred;
+        else unroll_buf->entry = pred;
+    }
+    for (size_t s = 0; s < 2; s++) {
+        if (unroller->in_loop[header_block->succs[s]] == loop) unroll_buf->body = header_block->succs[s];
+    }
+    if (unroll_buf->latch == NO_BBLOCK || unroll_buf->entry == NO_BBLOCK || unroll_buf->latch == header) return false;
+    if (unroll_buf->body == NO_BBLOCK || unroll_buf->body == header) return false;
+    ValueId **defs_vec = vec_new(sizeof(ValueId));
+    size_t size = 0;
+    bool ok = true;
+    for (size_t i = loops->blocks_start[loop]; ok && i < loops->blocks_start[loop + 1]; i++) {
+        size_t b = loops->blocks[i];
+        BasicBlock *bblock = &fn->bblocks[b];
+        // the header's the only way out
+        for (size_t s = 0; b != header && s < bblock->num_succs; s++) ok &= unroller->in_loop[bblock->succs[s]] == loop;
+        for (size_t s = bblock->start; ok && s < bblock->end; s++) {
+            Statement *statement = &fn->statements[s];
+            // each copy of an alloc would be a different slot, and inline assembly can define values without labels
+            if (statement->instruction == ALLOC || statement->instruction == ASM) ok = false;
+            if (statement->instruction == PHI) {
+                size_t from[2] = {phi_pred(fn, (PhiVal*) statement->vals[0]), phi_pred(fn, (PhiVal*) statement->vals[1])};
+                if (b == header) {
+                    ok &= (from[0] == unroll_buf->entry && from[1] == unroll_buf->latch) ||
+                          (from[1] == unroll_buf->entry && from[0] == unroll_buf->latch);
+                    unroll_buf->num_phis++;
+                } else {
+                    ok &= from[0] != NO_BBLOCK && from[1] != NO_BBLOCK &&
+                          unroller->in_loop[from[0]] == loop && unroller->in_loop[from[1]] == loop;
+                }
+            }
+            if (statement->label) {
+                ok &= unroller->uses.num_defs[statement->label] == 1;
+                ok &= b == header || used_only_in_loop(unroller, unroll_buf, loop, statement->label);
+                vec_push(defs_vec, (ValueId) statement->label);
+            }
+            size += statement->instruction != BLKLBL;
+        }
+    }
+    LoopExit *exit = &unroller->ivs.exits[loop];
+    if (!ok || exit->trip_count == NO_TRIP_COUNT || exit->body != unroll_buf->body) {
+        vec_free(defs_vec);
+        return false;
+    }
+    unroll_buf->trip_count = exit->trip_count;
+    if (unroll_buf->trip_count * size <= unroller->unroll_threshold) {
+        unroll_buf->prologue = unroll_buf->trip_count;
+        unroll_buf->factor = 0;
+    } else {
+        size_t factor = unroller->unroll_threshold / size;
+        if (factor > MAX_UNROLL_FACTOR) factor = MAX_UNROLL_FACTOR;
+        if (factor < 2) {
+            vec_free(defs_vec);
+            return false;
+        }
+        unroll_buf->prologue = unroll_buf->trip_count % factor;
+        unroll_buf->factor = factor;
+    }
+    unroll_buf->num_defs = vec_size(defs_vec);
+    unroll_buf->defs = vec_into_arena(defs_vec);
+    unroll_buf->num_blocks = num_blocks;
+    unroll_buf->blocks = (size_t*) aalloc(sizeof(size_t) * num_blocks);
+    memcpy(unroll_buf->blocks, &loops->blocks[loops->blocks_start[loop]], sizeof(size_t) * num_blocks);
+    qsort(unroll_buf->blocks, num_blocks, sizeof(size_t), compare_blocks);
+    return true;
+}
+
+static ValueId new_value(Unroller *unroller, ValueId value) {
+    ValueId id = unroller->fn->num_values + vec_size(unroller->value_names_vec);
+    vec_push(unroller->value_names_vec, suffixed_name(unroller->fn->value_names[value], ".unroll%zu", id));
+    return id;
+}
+
+static BlockId new_block(Unroller *unroller, size_t block) {
+    BlockId id = unroller->fn->num_blocks + vec_size(unroller->block_names_vec);
+    BlockId label = unroller->fn->bblocks[block].label;
+    vec_push(unroller->block_names_vec, suffixed_name((label) ? unroller->fn->block_names[label] : NULL, ".unroll%zu", id));
+    return id;
+}
+
+static Statement block_label(BlockId label) {
+    return (Statement) {
+        .instruction = BLKLBL,
+        .arg_type = None,
+        .vals = {label},
+        .val_types = {BlkLbl, Empty, Empty},
+    };
+}
+
+static Statement jmp(BlockId target) {
+    return (Statement) {
+        .instruction = JMP,
+        .arg_type = None,
+        .vals = {target},
+        .val_types = {BlkLbl, Empty, Empty},
+    };
+}
+
+static PhiVal *new_phi_val(PhiVal phi_val) {
+    PhiVal *ret = (PhiVal*) aalloc(sizeof(PhiVal));
+    *ret = phi_val;
+    return ret;
+}
+
+// Where a jump to block label `label` in the loop goes in the copy being made, where the header is the next copy's header
+static BlockId copy_target(Unroller *unroller, Unroll *unroll, uint64_t label, BlockId next_header) {
+    size_t block = unroller->fn->label_bblocks[label];
+    return (block == unroll->header) ? next_header : unroller->label_map[block];
+}
+
+static uint64_t copy_val(Unroller *unroller, uint64_t val, ValType type) {
+    return (type == Label) ? unroller->value_map[val] : val;
+}
+
+static Statement copy_statement(Unroller *unroller, Unroll *unroll, Statement statement, BlockId next_header) {
+    Function *fn = unroller->fn;
+    if (statement.label) statement.label = unroller->value_map[statement.label];
+    if (statement.instruction == CALL) {
+        FunctionArgList *args = (FunctionArgList*) aalloc(sizeof(FunctionArgList));
+        *args = *(FunctionArgList*) statement.vals[1];
+        uint64_t *vals = args->args;
+        ValType *types = args->arg_types;
+        args->args = (uint64_t*) aalloc(sizeof(uint64_t) * args->num_args);
+        args->arg_types = (ValType*) aalloc(sizeof(ValType) * args->num_args);
+        for (size_t a = 0; a < args->num_args; a++) {
+            args->args[a] = copy_val(unroller, vals[a], types[a]);
+            args->arg_types[a] = types[a];
+        }
+        statement.vals[0] = copy_val(unroller, statement.vals[0], statement.val_types[0]);
+        statement.vals[1] = (uint64_t) args;
+        return statement;
+    }
+    if (statement.instruction == PHI) {
+        for (size_t i = 0; i < 2; i++) {
+            PhiVal *phi_val = (PhiVal*) statement.vals[i];
+            statement.vals[i] = (uint64_t) new_phi_val((PhiVal) {
+                .blklbl = unroller->label_map[phi_pred(fn, phi_val)],
+                .val = copy_val(unroller, phi_val->val, phi_val->type),
+                .type = phi_val->type,
+            });
+        }
+        return statement;
+    }
+    for (size_t i = 0; i < 3; i++) {
+        if (statement.val_types[i] == Label) statement.vals[i] = unroller->value_map[statement.vals[i]];
+        else if (statement.val_types[i] == BlkLbl) statement.vals[i] = copy_target(unroller, unroll, statement.vals[i], next_header);
+    }
+    return statement;
+}
+
+// A phi in the header made into a copy of what it'd have been given
+static Statement phi_as_copy(Statement phi, ValueId label, PhiVal *incoming) {
+    phi.instruction = COPY;
+    phi.label = label;
+    phi.vals[0] = incoming->val;
+    phi.val_types[0] = incoming->type;
+    phi.val_types[1] = Empty;
+    phi.val_types[2] = Empty;
+    return phi;
+}
+
+/* Adds a copy of the header and body to copy_vec, with the header labelled `header_label`, its phis
+ * given `incoming` (indexed by phi), and the latch going to `next_header`. Afterwards, `incoming` is
+ * what the phis are given by this copy's latch. */
+static void add_copy(Unroller *unroller, Unroll *unroll, PhiVal *incoming, BlockId header_label, BlockId next_header) {
+    Function *fn = unroller->fn;
+    for (size_t d = 0; d < unroll->num_defs; d++) unroller->value_map[unroll->defs[d]] = new_value(unroller, unroll->defs[d]);
+    for (size_t i = 0; i < unroll->num_blocks; i++) {
+        size_t b = unroll->blocks[i];
+        unroller->label_map[b] = (b == unroll->header) ? header_label : new_block(unroller, b);
+    }
+    BasicBlock *header = &fn->bblocks[unroll->header];
+    vec_push(unroller->copy_vec, block_label(header_label));
+    size_t phi = 0;
+    // the header's branch is left off, since which way it goes is already known
+    for (size_t s = header->start; s < header->end - 1; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction == BLKLBL) continue;
+        if (statement->instruction == PHI)
+            vec_push(unroller->copy_vec, phi_as_copy(*statement, unroller->value_map[statement->label], &incoming[phi++]));
+        else
+            vec_push(unroller->copy_vec, copy_statement(unroller, unroll, *statement, next_header));
+    }
+    vec_push(unroller->copy_vec, jmp(unroller->label_map[unroll->body]));
+    for (size_t i = 0; i < unroll->num_blocks; i++) {
+        size_t b = unroll->blocks[i];
+        if (b == unroll->header) continue;
+        BasicBlock *bblock = &fn->bblocks[b];
+        vec_push(unroller->copy_vec, block_label(unroller->label_map[b]));
+        for (size_t s = bblock->start; s < bblock->end; s++) {
+            if (fn->statements[s].instruction != BLKLBL)
+                vec_push(unroller->copy_vec, copy_statement(unroller, unroll, fn->statements[s], next_header));
+        }
+        // the copies aren't in the same place as the blocks they're copies of, so nothing can fall through
+        if (bblock->falls_through && b + 1 < fn->num_bblocks) {
+            BlockId next = (b + 1 == unroll->header) ? next_header : unroller->label_map[b + 1];
+            vec_push(unroller->copy_vec, jmp(next));
+        }
+    }
+    phi = 0;
+    for (size_t s = header->start; s < header->end; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction != PHI) continue;
+        PhiVal *from_latch = (PhiVal*) statement->vals[phi_pred(fn, (PhiVal*) statement->vals[0]) != unroll->latch];
+        incoming[phi++] = (PhiVal) {
+            .blklbl = unroller->label_map[unroll->latch],
+            .val = copy_val(unroller, from_latch->val, from_latch->type),
+            .type = from_latch->type,
+        };
+    }
+}
+
+// Adds `num_copies` copies of the loop one after another to a new vector, the last one going back to the header
+static Statement **add_copies(Unroller *unroller, Unroll *unroll, PhiVal *incoming, size_t num_copies, BlockId *first_buf) {
+    Function *fn = unroller->fn;
+    unroller->copy_vec = vec_new(sizeof(Statement));
+    BlockId header_label = (num_copies) ? new_block(unroller, unroll->header) : 0;
+    *first_buf = header_label;
+    for (size_t c = 0; c < num_copies; c++) {
+        BlockId next_header = (c + 1 < num_copies) ? new_block(unroller, unroll->header) : fn->bblocks[unroll->header].label;
+        add_copy(unroller, unroll, incoming, header_label, next_header);
+        header_label = next_header;
+    }
+    return unroller->copy_vec;
+}
+
+static void make_copies(Unroller *unroller, Unroll *unroll) {
+    Function *fn = unroller->fn;
+    BasicBlock *header = &fn->bblocks[unroll->header];
+    unroll->entry_vals = (PhiVal*) aalloc(sizeof(PhiVal) * (unroll->num_phis + 1));
+    unroll->latch_vals = (PhiVal*) aalloc(sizeof(PhiVal) * (unroll->num_phis + 1));
+    size_t phi = 0;
+    for (size_t s = header->start; s < header->end; s++) {
+        Statement *statement = &fn->statements[s];
+        if (statement->instruction != PHI) continue;
+        bool latch_first = phi_pred(fn, (PhiVal*) statement->vals[0]) == unroll->latch;
+        unroll->entry_vals[phi] = *(PhiVal*) statement->vals[latch_first];
+        unroll->latch_vals[phi++] = *(PhiVal*) statement->vals[!latch_first];
+    }
+    unroll->before_header_vec = add_copies(unroller, unroll, unroll->entry_vals, unroll->prologue, &unroll->first_before_header);
+    // the first copy in the loop comes after the original body, so it starts off with what the original latch gives
+    size_t in_loop = (unroll->factor) ? unroll->factor - 1 : 0;
+    unroll->after_latch_vec = add_copies(unroller, unroll, unroll->latch_vals, in_loop, &unroll->first_after_latch);
+    for (size_t d = 0; d < unroll->num_defs; d++) unroller->value_map[unroll->defs[d]] = unroll->defs[d];
+}
+
+/* Adds a statement to the function being rebuilt. Jumps are held back until the statement after them,
+ * so that a jump to the block straight after it can be left out. */
+static void add_statement(Unroller *unroller, Statement statement) {
+    if (unroller->pending_jmp) {
+        if (statement.instruction != BLKLBL || statement.vals[0] != unroller->pending_jmp)
+            vec_push(unroller->statements_vec, jmp(unroller->pending_jmp));
+        unroller->pending_jmp = 0;
+    }
+    if (statement.instruction == JMP && statement.val_types[0] == BlkLbl) unroller->pending_jmp = statement.vals[0];
+    else vec_push(unroller->statements_vec, statement);
+}
+
+static void add_statements(Unroller *unroller, Statement **statements_vec) {
+    for (size_t s = 0; s < vec_size(statements_vec); s++) add_statement(unroller, (*statements_vec)[s]);
+    vec_free(statements_vec);
+}
+
+typedef struct {
+    size_t *header_of; // indexed by block, the unroll it's the header of, or NO_UNROLL
+    size_t *latch_of;
+    BlockId *redirect_from; // indexed by block, a label its terminator goes to which has to change, or 0
+    BlockId *redirect_to;
+    bool *removed;     // indexed by block
+} Rebuild;
+
+static void add_terminator(Unroller *unroller, Rebuild *rebuild, size_t block, Statement statement) {
+    if (rebuild->redirect_from[block]) retarget(&statement, rebuild->redirect_from[block], rebuild->redirect_to[block]);
+    add_statement(unroller, statement);
+}
+
+// Adds the original header of `unroll`, with its phis taking their values from the copies
+static void add_header(Unroller *unroller, Rebuild *rebuild, Unroll *unroll) {
+    Function *fn = unroller->fn;
+    BasicBlock *header = &fn->bblocks[unroll->header];
+    size_t phi = 0;
+    for (size_t s = header->start; s < header->end; s++) {
+        Statement statement = fn->statements[s];
+        if (statement.instruction == PHI) {
+            if (!unroll->factor) {
+                // every copy has been and gone, so the latch never comes back here
+                add_statement(unroller, phi_as_copy(statement, statement.label, &unroll->entry_vals[phi++]));
+                continue;
+            }
+            bool latch_first = phi_pred(fn, (PhiVal*) statement.vals[0]) == unroll->latch;
+            statement.vals[latch_first] = (uint64_t) new_phi_val(unroll->entry_vals[phi]);
+            statement.vals[!latch_first] = (uint64_t) new_phi_val(unroll->latch_vals[phi++]);
+            add_statement(unroller, statement);
+        } else if (s == header->end - 1) {
+            if (unroll->factor) {
+                add_terminator(unroller, rebuild, unroll->header, statement);
+                continue;
+            }
+            // it's the last time the header runs, so it always leaves the loop
+            for (size_t i = 1; i < 3; i++) {
+                if (statement.val_types[i] == BlkLbl && fn->label_bblocks[statement.vals[i]] != unroll->body)
+                    add_terminator(unroller, rebuild, unroll->header, jmp(statement.vals[i]));
+            }
+        } else {
+            add_statement(unroller, statement);
+        }
+    }
+}
+
+static void rebuild_statements(Unroller *unroller, Unroll *unrolls, size_t num_unrolls, Rebuild *rebuild) {
+    Function *fn = unroller->fn;
+    unroller->statements_vec = vec_new(sizeof(Statement));
+    for (size_t b = 0; b < fn->num_bblocks; b++) {
+        BasicBlock *bblock = &fn->bblocks[b];
+        if (rebuild->header_of[b] != NO_UNROLL) {
+            Unroll *unroll = &unrolls[rebuild->header_of[b]];
+            add_statements(unroller, unroll->before_header_vec);
+            add_header(unroller, rebuild, unroll);
+        } else if (!rebuild->removed[b]) {
+            for (size_t s = bblock->start; s < bblock->end; s++) {
+                if (is_terminator(fn->statements[s].instruction)) add_terminator(unroller, rebuild, b, fn->statements[s]);
+                else add_statement(unroller, fn->statements[s]);
+            }
+        }
+        if (rebuild->latch_of[b] != NO_UNROLL) add_statements(unroller, unrolls[rebuild->latch_of[b]].after_latch_vec);
+    }
+    if (unroller->pending_jmp) vec_push(unroller->statements_vec, jmp(unroller->pending_jmp));
+    fn->num_statements = vec_size(unroller->statements_vec);
+    fn->statements = vec_into_arena(unroller->statements_vec);
+}
+
+bool opt_unroll(Function *fn, Pipeline *pipeline) {
+    if (!fn->num_bblocks || !pipeline->unroll_threshold) return false;
+    Unroller unroller = {
+        .fn = fn,
+        .loops = find_loops(fn),
+        .unroll_threshold = pipeline->unroll_threshold,
+    };
+    if (!unroller.loops.num_loops) return false;
+    size_t num_bblocks = fn->num_bblocks;
+    unroller.uses = use_lists(fn);
+    unroller.ivs = find_ivs(fn, &unroller.loops, &unroller.uses);
+    unroller.block_of = (size_t*) aalloc(sizeof(size_t) * (fn->num_statements + 1));
+    for (size_t b = 0; b < num_bblocks; b++) {
+        for (size_t s = fn->bblocks[b].start; s < fn->bblocks[b].end; s++) unroller.block_of[s] = b;
+    }
+    unroller.in_loop = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1));
+    memset(unroller.in_loop, 0xFF, sizeof(size_t) * (num_bblocks + 1));
+    Rebuild rebuild = {
+        .header_of = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1)),
+        .latch_of = (size_t*) aalloc(sizeof(size_t) * (num_bblocks + 1)),
+        .redirect_from = (BlockId*) aalloc(sizeof(BlockId) * (num_bblocks + 1)),
+        .redirect_to = (BlockId*) aalloc(sizeof(BlockId) * (num_bblocks + 1)),
+        .removed = (bool*) aalloc(sizeof(bool) * (num_bblocks + 1)),
+    };
+    memset(rebuild.header_of, 0xFF, sizeof(size_t) * (num_bblocks + 1));
+    memset(rebuild.latch_of, 0xFF, sizeof(size_t) * (num_bblocks + 1));
+    memset(rebuild.redirect_from, 0, sizeof(BlockId) * (num_bblocks + 1));
+    memset(rebuild.removed, 0, sizeof(bool) * (num_bblocks + 1));
+    Unroll **unrolls_vec = vec_new(sizeof(Unroll));
+    for (size_t l = 0; l < unroller.loops.num_loops; l++) {
+        Unroll unroll;
+        if (!can_unroll(&unroller, l, &unroll)) continue;
+        // a block can only have one of its jumps changed, which only matters if it goes to two loops at once
+        if (unroll.prologue && rebuild.redirect_from[unroll.entry]) continue;
+        if (unroll.prologue) rebuild.redirect_from[unroll.entry] = fn->bblocks[unroll.header].label;
+        vec_push(unrolls_vec, unroll);
+    }
+    size_t num_unrolls = vec_size(unrolls_vec);
+    if (!num_unrolls) {
+        vec_free(unrolls_vec);
+        return false;
+    }
+    unroller.value_map = (ValueId*) malloc(sizeof(ValueId) * (fn->num_values + 1));
+    for (size_t v = 0; v < fn->num_values; v++) unroller.value_map[v] = v;
+    unroller.label_map = (BlockId*) malloc(sizeof(BlockId) * (num_bblocks + 1));
+    unroller.value_names_vec = vec_new(sizeof(char*));
+    unroller.block_names_vec = vec_new(sizeof(char*));
+    Unroll *unrolls = *unrolls_vec;
+    for (size_t u = 0; u < num_unrolls; u++) {
+        Unroll *unroll = &unrolls[u];
+        make_copies(&unroller, unroll);
+        BlockId header_label = fn->bblocks[unroll->header].label;
+        rebuild.header_of[unroll->header] = u;
+        if (unroll->prologue) rebuild.redirect_to[unroll->entry] = unroll->first_before_header;
+        if (unroll->factor) {
+            rebuild.latch_of[unroll->latch] = u;
+            rebuild.redirect_from[unroll->latch] = header_label;
+            rebuild.redirect_to[unroll->latch] = unroll->first_after_latch;
+        } else {
+            for (size_t i = 0; i < unroll->num_blocks; i++) rebuild.removed[unroll->blocks[i]] = unroll->blocks[i] != unroll->header;
+        }
+        add_stat((unroll->factor) ? STAT_UNROLL_PARTIAL : STAT_UNROLL_FULL, 1);
+    }
+    rebuild_statements(&unroller, unrolls, num_unrolls, &rebuild);
+    append_names(&fn->value_names, &fn->num_values, unroller.value_names_vec);
+    append_names(&fn->block_names, &fn->num_blocks, unroller.block_names_vec);
+    free(unroller.value_map);
+    free(unroller.label_map);
+    vec_free(unrolls_vec);
+    return true;
+}
@@ -0,0 +1,128 @@
+/* Def-use chains: for each value, the statements that define it and a list of every operand that
+ * uses it, whether that's in a statement's vals, a call's FunctionArgList, a PhiVal or an InlineAsm
+ * input. Each Use points straight at the operand, so replace_all_uses_with() can rewrite a value
+ * everywhere without scanning the function, and passes like copy elimination and folding can be
+ * done in one go over the statements.
+ * The Uses point into the function's statements, so the lists only last until something moves
+ * the statements (which is when cfg_build() has to be called too).
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <optimisation.h>
+#include <arena.h>
+#include <vector.h>
+#include <utils.h>
+#include <string.h>
+
+static void add_use(UseLists *lists, Use **uses_vec, size_t statement, uint64_t *val, ValType *type) {
+    if (*type != Label) return;
+    Use use = {
+        .statement = statement,
+        .val = val,
+        .type = type,
+        .next = lists->first_use[*val],
+    };
+    lists->first_use[*val] = vec_size(uses_vec);
+    lists->num_uses[*val]++;
+    vec_push(uses_vec, use);
+}
+
+static void add_def(UseLists *lists, size_t statement, ValueId value) {
+    lists->def[value] = statement;
+    lists->num_defs[value]++;
+}
+
+UseLists use_lists(Function *fn) {
+    UseLists lists = {
+        .first_use = (size_t*) aalloc(sizeof(size_t) * fn->num_values),
+        .num_uses = (size_t*) aalloc(sizeof(size_t) * fn->num_values),
+        .def = (size_t*) aalloc(sizeof(size_t) * fn->num_values),
+        .num_defs = (size_t*) aalloc(sizeof(size_t) * fn->num_values),
+    };
+    memset(lists.first_use, 0xFF, sizeof(size_t) * fn->num_values);
+    memset(lists.num_uses, 0, sizeof(size_t) * fn->num_values);
+    memset(lists.def, 0xFF, sizeof(size_t) * fn->num_values);
+    memset(lists.num_defs, 0, sizeof(size_t) * fn->num_values);
+    // arguments are defined before the first statement
+    for (size_t a = 0; a < fn->num_args; a++) add_def(&lists, NO_STATEMENT, fn->args[a].label);
+    Use **uses_vec = vec_new(sizeof(Use));
+    // backwards, so that the list for each value ends up in the order the uses appear in
+    for (size_t s = fn->num_statements; s > 0; s--) {
+        Statement *statement = &fn->statements[s - 1];
+        if (statement->instruction == CALL) {
+            FunctionArgList *args = (FunctionArgList*) statement->vals[1];
+            for (size_t a = args->num_args; a > 0; a--)
+                add_use(&lists, uses_vec, s - 1, &args->args[a - 1], &args->arg_types[a - 1]);
+        } else if (statement->instruction == PHI) {
+            for (size_t i = 2; i > 0; i--) {
+                PhiVal *phi_val = (PhiVal*) statement->vals[i - 1];
+                add_use(&lists, uses_vec, s - 1, (uint64_t*) &phi_val->val, &phi_val->type);
+            }
+        } else if (statement->instruction == ASM) {
+            InlineAsm *info = (InlineAsm*) statement->vals[0];
+            for (size_t in = vec_size(info->inputs_vec); in > 0; in--)
+                add_use(&lists, uses_vec, s - 1, &(*info->inputs_vec)[in - 1].label, &(*info->inputs_vec)[in - 1].type);
+            for (size_t out = 0; out < vec_size(info->outputs_vec); out++)
+                add_def(&lists, s - 1, (*info->outputs_vec)[out].label);
+        } else {
+            for (size_t i = 3; i > 0; i--)
+                add_use(&lists, uses_vec, s - 1, &statement->vals[i - 1], &statement->val_types[i - 1]);
+        }
+        if (statement->label) add_def(&lists, s - 1, statement->label);
+    }
+    lists.uses = vec_into_arena(uses_vec);
+    return lists;
+}
+
+/* Rewrites every use of `value` to be `val` of type `type` instead. If the new value is a label, the
+ * uses are moved onto its list, so that it can be replaced again later. */
+void replace_all_uses_with(UseLists *lists, ValueId value, uint64_t val, ValType type) {
+    if (type == Label && val == value) return;
+    size_t last = NO_USE;
+    for (size_t u = lists->first_use[value]; u != NO_USE; u = lists->uses[u].next) {
+        *lists->uses[u].val = val;
+        *lists->uses[u].type = type;
+        last = u;
+    }
+    if (last == NO_USE) return;
+    if (type == Label) {
+        lists->uses[last].next = lists->first_use[val];
+        lists->first_use[val] = lists->first_use[value];
+        lists->num_uses[val] += lists->num_uses[value];
+    }
+    lists->first_use[value] = NO_USE;
+    lists->num_uses[value] = 0;
+}
+
+/* Whether `val` is an operand of `statement` which has to stay a label, like the address of a load
+ * or store, since the target can't take a number there. */
+static bool needs_label(Function *fn, Statement *statement, uint64_t *val) {
+    switch (statement->instruction) {
+        case STORE:
+            return val == &statement->vals[1];
+        case LOAD: case JZ: case VASTART: case VAARG:
+            return val == &statement->vals[0];
+        case RET:
+            return fn->ret_is_struct;
+        default:
+            return false;
+    }
+}
+
+/* Rewrites the uses of `value` to be `number` instead, except for the ones which have to be labels,
+ * which are left on its list. Returns how many were rewritten. */
+size_t replace_uses_with_number(Function *fn, UseLists *lists, ValueId value, uint64_t number) {
+    size_t num_replaced = 0;
+    size_t *link = &lists->first_use[value];
+    while (*link != NO_USE) {
+        Use *use = &lists->uses[*link];
+        if (needs_label(fn, &fn->statements[use->statement], use->val)) {
+            link = &use->next;
+            continue;
+        }
+        *use->val = number;
+        *use->type = Number;
+        *link = use->next;
+        num_replaced++;
+    }
+    lists->num_uses[value] -= num_replaced;
+    return num_replaced;
+}
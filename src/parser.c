@@ -1,21 +1,18 @@
 /* Textual IR parser for the UYB compiler backend project.
  * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
 #include <parser.h>
+#include <error.h>
 #include <math.h>
 #include <vector.h>
 #include <ctype.h>
 #include <api.h>
+#include <mnemonic.h>
 #include <assert.h>
 #include <string.h>
 #include <arena.h>
-
-// WARNING: Edits the original string
-void str_toupper(char* str) {
-    while (*str) {
-        *str = toupper(*str);
-        str++;
-    }
-}
+#include <utils.h>
+#include <values.h>
+#include <cfg.h>
 
 size_t bytes_from_size(Type sz) {
     switch (sz) {
@@ -26,61 +23,6 @@ size_t bytes_from_size(Type sz) {
     }
 }
 
-// really messy, there's probably a cleaner way to do this. Or at least, move it into another file.
-Instruction parse_instruction(char *instr, size_t line, Type *type) {
-    str_toupper(instr);
-    if      (!strcmp(instr, "ADD"   )) return ADD;
-    else if (!strcmp(instr, "SUB"   )) return SUB;
-    else if (!strcmp(instr, "DIV"   )) return DIV;
-    else if (!strcmp(instr, "MUL"   )) return MUL;
-    else if (!strcmp(instr, "COPY"  )) return COPY;
-    else if (!strcmp(instr, "RET"   )) return RET;
-    else if (!strcmp(instr, "CALL"  )) return CALL;
-    else if (!strcmp(instr, "JZ"    )) return JZ;
-    else if (!strcmp(instr, "NEG"   )) return NEG;
-    else if (!strcmp(instr, "UDIV"  )) return UDIV;
-    else if (!memcmp(instr, "STORE", 5)) {
-        if (strlen(instr) > 5)
-            *type = char_to_type(tolower(instr[5]));
-        return STORE;
-    }
-    else if (!memcmp(instr, "LOAD", 4)) {
-        if (strlen(instr) > 5)
-            *type = char_to_type(tolower(instr[5]));
-        return LOAD;
-    }
-    else if (!strcmp(instr, "BLIT"    )) return BLIT;
-    else if (!strcmp(instr, "ALLOC"   )) return ALLOC;
-    else if (!memcmp(instr+1, "EQ", 2 )) return EQ;
-    else if (!memcmp(instr+1, "NE", 2 )) return NE;
-    else if (!memcmp(instr+1, "SGE", 3)) return SGE;
-    else if (!memcmp(instr+1, "SGT", 3)) return SGT;
-    else if (!memcmp(instr+1, "SLE", 3)) return SLE;
-    else if (!memcmp(instr+1, "SLT", 3)) return SLT;
-    else if (!memcmp(instr+1, "UGE", 3)) return UGE;
-    else if (!memcmp(instr+1, "UGT", 3)) return UGT;
-    else if (!memcmp(instr+1, "ULE", 3)) return ULE;
-    else if (!memcmp(instr+1, "ULT", 3)) return ULT;
-    else if (!memcmp(instr, "EXT", 3  )) return EXT;
-    else if (!strcmp(instr, "HLT"     )) return HLT;
-    else if (!strcmp(instr, "BLKLBL"  )) return BLKLBL;
-    else if (!strcmp(instr, "JMP"     )) return JMP;
-    else if (!strcmp(instr, "JNZ"     )) return JNZ;
-    else if (!strcmp(instr, "SHL"     )) return SHL;
-    else if (!strcmp(instr, "SHR"     )) return SHR;
-    else if (!strcmp(instr, "OR"      )) return OR;
-    else if (!strcmp(instr, "AND"     )) return AND;
-    else if (!strcmp(instr, "PHI"     )) return PHI;
-    else if (!strcmp(instr, "VASTART" )) return VASTART;
-    else if (!strcmp(instr, "VAARG"   )) return VAARG;
-    else if (!strcmp(instr, ".LOC"    )) return LOC;
-    else if (!strcmp(instr, "ASM"     )) return ASM;
-    else {
-        printf("Invalid instruction on line %zu: %s\n", line, instr);
-        exit(1);
-    }
-}
-
 ValType tok_as_valtype(TokenType tok, size_t line) {
     if      (tok == TokInteger)     return Number;
     else if (tok == TokLabel)       return Label;
@@ -88,11 +30,18 @@ ValType tok_as_valtype(TokenType tok, size_t line) {
     else if (tok == TokBlockLabel)  return BlkLbl;
     else if (tok == TokStrLit)      return StrLit;
     else {
-        printf("Token can't be converted to ValType: Invalid instruction value on line %zu\n", line);
-        exit(1);
+        compile_error("Token can't be converted to ValType: Invalid instruction value on line %zu\n", line);
     }
 }
 
+/* Like token_value(), except that temporaries and block labels are given as their ID in the function
+ * being parsed rather than their name. */
+uint64_t operand_value(Token tok) {
+    if (tok.type == TokLabel) return value_id(token_str(tok));
+    if (tok.type == TokBlockLabel) return block_id(token_str(tok));
+    return token_value(tok);
+}
+
 void parse_statement_parameters(Token *toks, size_t at, Statement *ret) {
     size_t num_args = 0;
     size_t v = 0;
@@ -100,7 +49,7 @@ void parse_statement_parameters(Token *toks, size_t at, Statement *ret) {
         if (toks[at + i].type == TokComma) {
             continue;
         }
-        ret->vals[v] = toks[at + i].val;
+        ret->vals[v] = operand_value(toks[at + i]);
         ret->val_types[v] = tok_as_valtype(toks[at + i].type, toks[at + i].line);
         num_args++;
         v++;
@@ -112,23 +61,21 @@ void parse_statement_parameters(Token *toks, size_t at, Statement *ret) {
 
 void parse_phi_parameters(Token *toks, size_t at, Statement *ret) {
     if (toks[at].type != TokBlockLabel || toks[at + 3].type != TokBlockLabel) {
-        printf("Phi instruction format is not correct, expected a block label on line %zu\n", toks->line);
-        exit(1);
+        compile_error("Phi instruction format is not correct, expected a block label on line %zu\n", toks->line);
     }
     if (toks[at + 2].type != TokComma) {
-        printf("Expected comma between phi node values on line %zu\n", toks->line);
-        exit(1);
+        compile_error("Expected comma between phi node values on line %zu\n", toks->line);
     }
     ret->vals[0] = (size_t) aalloc(sizeof(PhiVal));
     ret->vals[1] = (size_t) aalloc(sizeof(PhiVal));
     *((PhiVal*) ret->vals[0]) = (PhiVal) {
-        .blklbl_name = (char*) toks[at].val,
-        .val = toks[at + 1].val,
+        .blklbl = block_id(token_str(toks[at])),
+        .val = operand_value(toks[at + 1]),
         .type = tok_as_valtype(toks[at + 1].type, toks[at + 1].line),
     };
     *((PhiVal*) ret->vals[1]) = (PhiVal) {
-        .blklbl_name = (char*) toks[at + 3].val,
-        .val = toks[at + 4].val,
+        .blklbl = block_id(token_str(toks[at + 3])),
+        .val = operand_value(toks[at + 4]),
         .type = tok_as_valtype(toks[at + 4].type, toks[at + 4].line),
     };
     ret->val_types[0] = PhiArg;
@@ -143,16 +90,14 @@ size_t parse_asm_io(Token *toks, size_t at, InlineAsmIO ***io_vec_buf) {
     *io_vec_buf = vec_new(sizeof(InlineAsmIO));
     while (toks[at].type == TokLabel) {
         if (toks[at + 1].type != TokBar) {
-            printf("Expected vertical bar (|) after label in I/O list for inline assembly on line %zu.\n", toks[at + 1].line);
-            exit(1);
+            compile_error("Expected vertical bar (|) after label in I/O list for inline assembly on line %zu.\n", toks[at + 1].line);
         }
         if (toks[at + 2].type != TokStrLit) {
-            printf("Expected string literal referring to register in I/O list for inline assembly on line %zu.\n", toks[at + 2].line);
-            exit(1);
+            compile_error("Expected string literal referring to register in I/O list for inline assembly on line %zu.\n", toks[at + 2].line);
         }
         vec_push(*io_vec_buf, ((InlineAsmIO) {
-            .reg   = (char*) toks[at + 2].val,
-            .label = (char*) toks[at].val,
+            .reg   = token_str(toks[at + 2]),
+            .label = value_id(token_str(toks[at])),
             .type  = tok_as_valtype(toks[at].type, toks[at].line),
         }));
         at += 3;
@@ -167,10 +112,9 @@ void parse_asm_clobbers(Token *toks, size_t at, char** **clobbers_buf_vec) {
     while (toks[at].type != TokRParen) {
         if (toks[at].type == TokComma) at++;
         else if (toks[at].type == TokStrLit)
-            vec_push(*clobbers_buf_vec, (char*) toks[at++].val);
+            vec_push(*clobbers_buf_vec, token_str(toks[at++]));
         else {
-            printf("Invalid token in inline assembly clobber list, expected string literal or comma on line %zu.\n", toks[at].line);
-            exit(1);
+            compile_error("Invalid token in inline assembly clobber list, expected string literal or comma on line %zu.\n", toks[at].line);
         }
     }
 }
@@ -179,16 +123,15 @@ void parse_asm_parameters(Token *toks, size_t at, Statement *ret) {
     ret->val_types[0] = InlineAssembly;
     ret->val_types[1] = ret->val_types[2] = Empty;
     InlineAsm *buf = (InlineAsm*) malloc(sizeof(InlineAsm));
+    *buf = (InlineAsm) {0};
     // get the assembly itself
     if (toks[at].type != TokLParen) {
-        printf("Expected left parenthesis after ASM instruction keyword on line %zu\n", toks[at].line);
-        exit(1);
+        compile_error("Expected left parenthesis after ASM instruction keyword on line %zu\n", toks[at].line);
     }
     if (toks[at + 1].type != TokStrLit) {
-        printf("Expected string literal after \"asm(\" on line %zu\n", toks[at + 1].line);
-        exit(1);
+        compile_error("Expected string literal after \"asm(\" on line %zu\n", toks[at + 1].line);
     }
-    buf->assembly = (char*) toks[at + 1].val;
+    buf->assembly = token_str(toks[at + 1]);
     // replace instances of \t and \n with their correct values
     size_t len = strlen(buf->assembly);
     for (size_t c = 0; c < len; c++) {
@@ -198,8 +141,7 @@ void parse_asm_parameters(Token *toks, size_t at, Statement *ret) {
         else if (buf->assembly[c + 1] == 't')
             buf->assembly[c] = 9; // 9 is carriage return
         else {
-            printf("Unknown escape sequence (only \\t and \\n can be used in UYB)\n");
-            exit(1);
+            compile_error("Unknown escape sequence (only \\t and \\n can be used in UYB)\n");
         }
         memmove(&buf->assembly[c + 1], &buf->assembly[c + 2], len - c);
         c--;
@@ -219,21 +161,23 @@ void parse_asm_parameters(Token *toks, size_t at, Statement *ret) {
     if (toks[at].type == TokColon)
         parse_asm_clobbers(toks, at, &buf->clobbers_vec);
 end_asm_parse:
+    // any lists that were left out are empty
+    if (!buf->inputs_vec)   buf->inputs_vec = vec_new(sizeof(InlineAsmIO));
+    if (!buf->outputs_vec)  buf->outputs_vec = vec_new(sizeof(InlineAsmIO));
+    if (!buf->clobbers_vec) buf->clobbers_vec = vec_new(sizeof(char*));
     ret->vals[0] = (uint64_t) buf;
 }
 
 void parse_call_parameters(Token *toks, size_t at, Statement *ret) {
     if (toks[at].type != TokRawStr) {
-        printf("Expected function name after CALL instruction on line %zu.\n", toks[at].line);
-        exit(1);
+        compile_error("Expected function name after CALL instruction on line %zu.\n", toks[at].line);
     }
     if (toks[at + 1].type != TokLParen) {
-        printf("Expected function arguments within parenthesis for CALL instruction on line %zu.\n", toks[at + 1].line);
-        exit(1);
+        compile_error("Expected function arguments within parenthesis for CALL instruction on line %zu.\n", toks[at + 1].line);
     }
-    ret->vals[0] = toks[at].val;
+    ret->vals[0] = token_value(toks[at]);
     at += 2;
-    char* **args = vec_new(sizeof(char*));
+    uint64_t **args = vec_new(sizeof(uint64_t));
     Type **arg_sizes = vec_new(sizeof(Type));
     char* **arg_struct_types = vec_new(sizeof(char*));
     bool **args_are_structs = vec_new(sizeof(bool));
@@ -247,80 +191,73 @@ void parse_call_parameters(Token *toks, size_t at, Statement *ret) {
             at += 2;
             continue;
         }
-        if ((toks[at].type != TokRawStr || ((char*) toks[at].val)[1] != 0) && toks[at].type != TokAggType) {
-            printf("Expected argument type before argument in argument list in CALL instruction parameters on line %zu.\n", toks[at].line);
-            exit(1);
+        if ((toks[at].type != TokRawStr || toks[at].len != 1) && toks[at].type != TokAggType) {
+            compile_error("Expected argument type before argument in argument list in CALL instruction parameters on line %zu.\n", toks[at].line);
         }
         if (toks[at + 1].type != TokLabel && toks[at + 1].type != TokRawStr && toks[at + 1].type != TokInteger) {
-            printf("Expected label, integer literal, or global in argument list for CALL instruction on line %zu.\n", toks[at + 1].line);
-            exit(1);
+            compile_error("Expected label, integer literal, or global in argument list for CALL instruction on line %zu.\n", toks[at + 1].line);
         }
         if (toks[at].type == TokRawStr) {
             vec_push(arg_sizes, char_to_type(((char*) toks[at].val)[0]));
-            vec_push(arg_struct_types, 0);
+            vec_push(arg_struct_types, (char*) NULL);
             vec_push(args_are_structs, (bool) false);
         } else {
-            vec_push(arg_sizes, 0);
-            vec_push(arg_struct_types, (char*) toks[at].val);
+            vec_push(arg_sizes, (Type) 0);
+            vec_push(arg_struct_types, token_str(toks[at]));
             vec_push(args_are_structs, (bool) true);
         }
-        vec_push(args, (char*) toks[at + 1].val);
+        vec_push(args, operand_value(toks[at + 1]));
         vec_push(arg_types, tok_as_valtype(toks[at + 1].type, toks[at + 1].line));
         at += 2;
     }
     ret->vals[1] = (uint64_t) aalloc(sizeof(FunctionArgList));
+    size_t num_args = vec_size(args);
     *((FunctionArgList*) ret->vals[1]) = (FunctionArgList) {
-        .args = *args,
-        .arg_sizes = *arg_sizes,
-        .arg_struct_types = *arg_struct_types,
-        .args_are_structs = *args_are_structs,
-        .arg_types = *arg_types,
-        .num_args = vec_size(args),
+        .args = vec_into_arena(args),
+        .arg_sizes = vec_into_arena(arg_sizes),
+        .arg_struct_types = vec_into_arena(arg_struct_types),
+        .args_are_structs = vec_into_arena(args_are_structs),
+        .arg_types = vec_into_arena(arg_types),
+        .num_args = num_args,
     };
     ret->val_types[0] = Str;
     ret->val_types[1] = FunctionArgs;
     ret->val_types[2] = Empty;
 }
 
-Type instruction_remove_size(char *instr) {
-    while (*instr) {
-        if (*instr >= '0' && *instr <= '9') {
-            *instr = 0;
-            return Bits64;
-        }
-        instr++;
-    }
-    return 50;
-}
-
 // Expects tokens to end with TokNewLine
 Statement parse_statement(Token *toks) {
     if (toks[0].type == TokNewLine) toks++;
     if (toks[0].type == TokBlockLabel) {
         return (Statement) {
-            .label = NULL,
+            .label = 0,
             .instruction = BLKLBL,
-            .vals = {toks[0].val},
-            .val_types = {Str, Empty, Empty},
+            .arg_type = None,
+            .vals = {operand_value(toks[0])},
+            .val_types = {BlkLbl, Empty, Empty},
         };
     }
     Statement ret = {0};
     size_t at = 0;
     if (toks[0].type == TokLabel) {
-        ret.label = (char*) toks[0].val;
+        ret.label = value_id(token_str(toks[0]));
         ret.type = toks[1].val;
         at = 2;
     } else {
-        ret.label = NULL;
+        ret.label = 0;
     }
     if (toks[at].type != TokRawStr) {
-        printf("Expected instruction in statement on line %zu, got %s instead.\n", toks[at].line, token_to_str(toks[at].type));
-        exit(1);
+        compile_error("Expected instruction in statement on line %zu, got %s instead.\n", toks[at].line, token_to_str(toks[at].type));
+    }
+    Mnemonic *mnemonic = lookup_mnemonic((char*) toks[at].val, toks[at].len);
+    if (!mnemonic) {
+        compile_error("Invalid instruction on line %zu: %.*s\n", toks[at].line, (int) toks[at].len, (char*) toks[at].val);
     }
-    size_t new_size = instruction_remove_size((char*) toks[at].val);
-    if (new_size != 50)
-        ret.type = new_size;
-    ret.instruction = parse_instruction((char*) toks[at].val, toks[at].line, &ret.type);
+    ret.instruction = mnemonic->instruction;
+    if (mnemonic->type != None)
+        ret.type = mnemonic->type;
+    ret.arg_type = mnemonic->arg_type;
+    ret.is_signed = mnemonic->is_signed;
     at++;
     if (ret.instruction == CALL)
         parse_call_parameters(toks, at, &ret);
@@ -339,27 +276,25 @@ size_t parse_function(Token **toks, size_t loc, Function *buf) {
     size_t skip = 1 + loc;
     if ((*toks)[skip].type == TokNewLine) skip++;
     if (buf->is_global) skip++;
-    if (((*toks)[skip].type != TokRawStr || ((char*) (*toks)[skip].val)[1])
+    if (((*toks)[skip].type != TokRawStr || (*toks)[skip].len != 1)
             && (*toks)[skip].type != TokAggType) {
-        printf("Not a valid function return type on line %zu.\n", (*toks)[skip].line);
-        exit(1);
+        compile_error("Not a valid function return type on line %zu.\n", (*toks)[skip].line);
     }
     if ((*toks)[skip].type == TokRawStr) {
         buf->return_type = char_to_type(((char*) (*toks)[skip].val)[0]);
         buf->ret_is_struct = false;
     } else {
-        buf->return_struct = (char*) (*toks)[skip].val;
+        buf->return_struct = token_str((*toks)[skip]);
         buf->ret_is_struct = true;
     }
     skip++;
     if ((*toks)[skip].type != TokRawStr) {
-        printf("Expected function name on line %zu.\n", (*toks)[skip].line);
-        exit(1);
+        compile_error("Expected function name on line %zu.\n", (*toks)[skip].line);
     }
-    buf->name = (char*) (*toks)[skip].val;
+    buf->name = token_str((*toks)[skip]);
+    values_begin();
     if ((*toks)[skip + 1].type != TokLParen) {
-        printf("Expected left parenthesis after function name in function definition on line %zu, got %s instead.\n", (*toks)[skip + 1].line, token_to_str((*toks)[skip + 1].type));
-        exit(1);
+        compile_error("Expected left parenthesis after function name in function definition on line %zu, got %s instead.\n", (*toks)[skip + 1].line, token_to_str((*toks)[skip + 1].type));
     }
     skip += 2;
     FunctionArgument **args = vec_new(sizeof(FunctionArgument));
@@ -374,37 +309,33 @@ size_t parse_function(Token **toks, size_t loc, Function *buf) {
             skip++;
             continue;
         }
-        if (((*toks)[skip].type != TokRawStr || ((char*) (*toks)[skip].val)[1] != 0) && (*toks)[skip].type != TokAggType) {
-            printf("Expected argument type as character (l,w,d,b), got something else instead on line %zu.\n", (*toks)[skip].line);
-            exit(1);
+        if (((*toks)[skip].type != TokRawStr || (*toks)[skip].len != 1) && (*toks)[skip].type != TokAggType) {
+            compile_error("Expected argument type as character (l,w,d,b), got something else instead on line %zu.\n", (*toks)[skip].line);
         }
         if ((*toks)[skip + 1].type != TokLabel) {
-            printf("Argument value isn't a label on line %zu.\n", (*toks)[skip + 1].line);
-            exit(1);
+            compile_error("Argument value isn't a label on line %zu.\n", (*toks)[skip + 1].line);
         }
         FunctionArgument arg;
-        arg.label = (char*) (*toks)[skip + 1].val;
+        arg.label = value_id(token_str((*toks)[skip + 1]));
         if ((*toks)[skip].type == TokRawStr) {
             arg.type_is_struct = false;
             arg.type = char_to_type(((char*) (*toks)[skip].val)[0]);
         } else {
             arg.type_is_struct = true;
-            arg.type_struct = (char*) (*toks)[skip].val;
+            arg.type_struct = token_str((*toks)[skip]);
         }
         vec_push(args, arg);
         skip += 2;
     }
     buf->num_args = vec_size(args);
-    buf->args = *args;
+    buf->args = vec_into_arena(args);
     skip++;
     if ((*toks)[skip].type != TokLBrace) {
-        printf("Expected brace after function signature on line %zu\n", (*toks)[skip].line);
-        exit(1);
+        compile_error("Expected brace after function signature on line %zu\n", (*toks)[skip].line);
     }
     skip++;
     if ((*toks)[skip].type != TokNewLine) {
-        printf("Expected new line after left brace in function declaration on line %zu\n", (*toks)[skip].line);
-        exit(1);
+        compile_error("Expected new line after left brace in function declaration on line %zu\n", (*toks)[skip].line);
     }
     skip++;
     size_t depth = 1;
@@ -428,7 +359,9 @@ size_t parse_function(Token **toks, size_t loc, Function *buf) {
         }
         skip++;
     }
-    buf->statements = *statements;
+    buf->statements = vec_into_arena(statements);
+    values_end(buf);
+    cfg_build(buf);
     return skip + 1 - loc;
 }
 
@@ -438,39 +371,33 @@ size_t parse_global(Token **toks, size_t loc, Global *buf) {
     if ((*toks)[loc].type == TokSection) {
         loc++;
         if ((*toks)[loc].type != TokStrLit) {
-            printf("Expected string literal after section keyword on line %zu\n", (*toks)[loc].line);
-            exit(1);
+            compile_error("Expected string literal after section keyword on line %zu\n", (*toks)[loc].line);
         }
-        buf->section = (char*) (*toks)[loc].val;
+        buf->section = token_str((*toks)[loc]);
         loc += 2;
     } else {
         buf->section = NULL;
     }
     if ((*toks)[loc].type != TokData) {
-        printf("Expected data global definition after section specification on line %zu\n", (*toks)[loc].line);
-        exit(1);
+        compile_error("Expected data global definition after section specification on line %zu\n", (*toks)[loc].line);
     }
     if ((*toks)[loc + 1].type != TokRawStr) {
-        printf("Expected name of global after data keyword on line %zu, got %s instead, data = %s\n", (*toks)[loc + 1].line, token_to_str((*toks)[loc + 1].type), (char*) (*toks)[loc + 1].val);
-        exit(1);
+        compile_error("Expected name of global after data keyword on line %zu, got %s instead, data = %.*s\n", (*toks)[loc + 1].line, token_to_str((*toks)[loc + 1].type), (int) (*toks)[loc + 1].len, (char*) (*toks)[loc + 1].val);
     }
-    buf->name = (char*) (*toks)[loc + 1].val;
+    buf->name = token_str((*toks)[loc + 1]);
     if ((*toks)[loc + 2].type != TokEqu) {
-        printf("Expected = after global label name on line %zu\n", (*toks)[loc + 2].line);
-        exit(1);
+        compile_error("Expected = after global label name on line %zu\n", (*toks)[loc + 2].line);
     }
     if ((*toks)[loc + 3].type == TokAlign) {
         if ((*toks)[loc + 4].type != TokInteger) {
-            printf("Expected integer literal after Align token on line %zu\n", (*toks)[loc + 4].line);
-            exit(1);
+            compile_error("Expected integer literal after Align token on line %zu\n", (*toks)[loc + 4].line);
         }
         buf->alignment = (*toks)[loc + 4].val;
         loc += 2;
     } else
         buf->alignment = 1;
     if ((*toks)[loc + 3].type != TokLBrace) {
-        printf("Expected left brace ({) after = on line %zu\n", (*toks)[loc + 3].line);
-        exit(1);
+        compile_error("Expected left brace ({) after = on line %zu\n", (*toks)[loc + 3].line);
     }
     loc += 4;
     Type **sizes = vec_new(sizeof(Type));
@@ -481,29 +408,27 @@ size_t parse_global(Token **toks, size_t loc, Global *buf) {
             loc++;
             continue;
         }
-        if ((*toks)[loc].type != TokRawStr || ((char*) (*toks)[loc].val)[1] != 0) {
-            printf("Invalid type in global declaration on line %zu\n", (*toks)[loc].line);
-            exit(1);
+        if ((*toks)[loc].type != TokRawStr || (*toks)[loc].len != 1) {
+            compile_error("Invalid type in global declaration on line %zu\n", (*toks)[loc].line);
         }
         vec_push(sizes, char_to_type(((char*) (*toks)[loc].val)[0]));
         if ((*toks)[loc + 1].type == TokInteger) vec_push(types, Number);
         else if ((*toks)[loc + 1].type == TokStrLit) vec_push(types, StrLit);
         else {
-            printf("Global values can only be a number or a strlit token on line %zu, got something else.\n", (*toks)[loc + 1].line);
-            exit(1);
+            compile_error("Global values can only be a number or a strlit token on line %zu, got something else.\n", (*toks)[loc + 1].line);
         }
-        vec_push(vals, (*toks)[loc + 1].val);
+        vec_push(vals, token_value((*toks)[loc + 1]));
         loc += 2;
     }
     buf->num_vals = vec_size(vals);
-    buf->vals  = *vals;
-    buf->types = *types;
-    buf->sizes = *sizes;
+    buf->vals  = vec_into_arena(vals);
+    buf->types = vec_into_arena(types);
+    buf->sizes = vec_into_arena(sizes);
     return loc - start_loc;
 }
 
 size_t get_element_size(Token **toks, size_t *loc, AggregateType *buf) {
-    if ((*toks)[*loc].type == TokRawStr && ((char*) (*toks)[*loc].val)[1] == 0) {
+    if ((*toks)[*loc].type == TokRawStr && (*toks)[*loc].len == 1) {
         // If it's a type element, like `l`
         size_t this_size = bytes_from_size(char_to_type(((char*) (*toks)[*loc].val)[0]));
         if (buf->alignment > this_size)
@@ -529,8 +454,7 @@ size_t get_element_size(Token **toks, size_t *loc, AggregateType *buf) {
         }
         return max_size;
     } else {
-        printf("Invalid element for aggregate type on line %zu.\n", (*toks)[*loc].line);
-        exit(1);
+        compile_error("Invalid element for aggregate type on line %zu.\n", (*toks)[*loc].line);
     }
 }
 
@@ -550,26 +474,22 @@ void parse_aggtype_size(Token **toks, size_t *loc, AggregateType *buf) {
 size_t parse_aggtype(Token **toks, size_t loc, AggregateType *buf) {
     size_t start_loc = loc;
     if ((*toks)[loc + 1].type != TokAggType) {
-        printf("Expected type name after type token, got something else on line %zu\n", (*toks)[loc + 1].line);
-        exit(1);
+        compile_error("Expected type name after type token, got something else on line %zu\n", (*toks)[loc + 1].line);
     }
-    buf->name = (char*) (*toks)[loc + 1].val;
+    buf->name = token_str((*toks)[loc + 1]);
     if ((*toks)[loc + 2].type != TokEqu) {
-        printf("Equal sign expected after type name in aggregate type definiton, got something else on line %zu\n", (*toks)[loc + 2].line);
-        exit(1);
+        compile_error("Equal sign expected after type name in aggregate type definiton, got something else on line %zu\n", (*toks)[loc + 2].line);
     }
     if ((*toks)[loc + 3].type == TokAlign) {
         if ((*toks)[loc + 4].type != TokInteger) {
-            printf("Expected integer literal after Align token on line %zu\n", (*toks)[loc + 4].line);
-            exit(1);
+            compile_error("Expected integer literal after Align token on line %zu\n", (*toks)[loc + 4].line);
         }
         buf->alignment = (*toks)[loc + 4].val;
         loc += 2;
     } else
         buf->alignment = 1;
     if ((*toks)[loc + 3].type != TokLBrace) {
-        printf("Expected left brace in aggregate type definition on line %zu\n", (*toks)[loc + 3].line);
-        exit(1);
+        compile_error("Expected left brace in aggregate type definition on line %zu\n", (*toks)[loc + 3].line);
     }
     loc += 4;
     parse_aggtype_size(toks, &loc, buf);
@@ -580,19 +500,44 @@ size_t parse_aggtype(Token **toks, size_t loc, AggregateType *buf) {
 size_t parse_filedbg(Token **toks, size_t loc, FileDbg *filebuf) {
     size_t start_loc = loc;
     if ((*toks)[loc + 1].type != TokInteger) {
-        printf("First argument of .file must be integer literal (file identification number)\n");
-        exit(1);
+        compile_error("First argument of .file must be integer literal (file identification number)\n");
     }
     if ((*toks)[loc + 2].type != TokStrLit) {
-        printf("Second argument of .file must be string literal (file name)\n");
-        exit(1);
+        compile_error("Second argument of .file must be string literal (file name)\n");
     }
     filebuf->id = (*toks)[loc + 1].val;
-    filebuf->fname = (char*) (*toks)[loc + 2].val;
+    filebuf->fname = token_str((*toks)[loc + 2]);
     loc += 2;
     return loc - start_loc;
 }
 
+/* Parses the top level item (a function, global, aggregate type or .file) starting at `*tok`, then
+ * moves `*tok` to the last token of it. Functions are stored in `fn_buf` and true is returned, and
+ * anything else is pushed to its vector. */
+bool parse_item(Token **toks, size_t *tok, Function *fn_buf, Global **globals, AggregateType **aggtypes, FileDbg **filesdbg) {
+    if ((*toks)[*tok].type == TokFunction || (*toks)[*tok].type == TokExport) {
+        *tok += parse_function(toks, *tok, fn_buf) - 1;
+        return true;
+    } else if ((*toks)[*tok].type == TokNewLine) {
+        return false;
+    } else if ((*toks)[*tok].type == TokData || (*toks)[*tok].type == TokSection) {
+        Global newglobal;
+        *tok += parse_global(toks, *tok, &newglobal);
+        vec_push(globals, newglobal);
+    } else if ((*toks)[*tok].type == TokType) {
+        AggregateType newtype;
+        *tok += parse_aggtype(toks, *tok, &newtype);
+        vec_push(aggtypes, newtype);
+    } else if ((*toks)[*tok].type == TokFile) {
+        FileDbg newfile;
+        *tok += parse_filedbg(toks, *tok, &newfile);
+        vec_push(filesdbg, newfile);
+    } else {
+        compile_error("Something was found outside of a function body which isn't a constant definition on line %zu: %s, token id %u, val %p\n", (*toks)[*tok].line, token_to_str((*toks)[*tok].type), (*toks)[*tok].type, (void*) (*toks)[*tok].val);
+    }
+    return false;
+}
+
 // Returns vector of functions
 Function **parse_program(Token **toks, Global ***globals_buf, AggregateType ***aggtypes_buf, FileDbg ***filesdbg_buf) {
     size_t num_toks = vec_size(toks);
@@ -601,28 +546,9 @@ Function **parse_program(Token **toks, Global ***globals_buf, AggregateType ***a
     *aggtypes_buf = vec_new(sizeof(AggregateType));
     *filesdbg_buf = vec_new(sizeof(FileDbg));
     for (size_t tok = 0; tok < num_toks; tok++) {
-        if ((*toks)[tok].type == TokFunction || (*toks)[tok].type == TokExport) {
-            Function fnbuf;
-            tok += parse_function(toks, tok, &fnbuf) - 1;
+        Function fnbuf;
+        if (parse_item(toks, &tok, &fnbuf, *globals_buf, *aggtypes_buf, *filesdbg_buf))
             vec_push(functions, fnbuf);
-        } else if ((*toks)[tok].type == TokNewLine) {
-            continue;
-        } else if ((*toks)[tok].type == TokData || (*toks)[tok].type == TokSection) {
-            Global newglobal;
-            tok += parse_global(toks, tok, &newglobal);
-            vec_push(*globals_buf, newglobal);
-        } else if ((*toks)[tok].type == TokType) {
-            AggregateType newtype;
-            tok += parse_aggtype(toks, tok, &newtype);
-            vec_push(*aggtypes_buf, newtype);
-        } else if ((*toks)[tok].type == TokFile) {
-            FileDbg newfile;
-            tok += parse_filedbg(toks, tok, &newfile);
-            vec_push(*filesdbg_buf, newfile);
-        } else {
-            printf("Something was found outside of a function body which isn't a constant definition on line %zu: %s, token id %u, val %p\n", (*toks)[tok].line, token_to_str((*toks)[tok].type), (*toks)[tok].type, (void*) (*toks)[tok].val);
-            exit(1);
-        }
     }
     return functions;
 }
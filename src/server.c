@@ -0,0 +1,185 @@
+/* Compile server, which stays resident and compiles requests sent over a Unix socket or through
+ * stdin, so that a build with lots of small files doesn't pay for starting UYB for every one of them.
+ * The arenas, intern table and temporary files are reused between requests rather than being set
+ * up again, and errors in a request are sent back to the client instead of ending the server. See
+ * ../include/server.h for the protocol.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <server.h>
+#include <compile.h>
+#include <error.h>
+#include <cache.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+extern int is_position_independent;
+
+typedef struct {
+    SourceBuf src;
+    CompileOptions opts;
+    FILE *outf;
+} ServerJob;
+
+static bool read_all(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char*) buf + done, len - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, (char*) buf + done, len - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool respond(int fd, uint32_t status, char *output, size_t output_len) {
+    ServerResponse response = {
+        .magic = SERVER_RESPONSE_MAGIC,
+        .status = status,
+        .output_len = output_len,
+    };
+    return write_all(fd, &response, sizeof(response)) && write_all(fd, output, output_len);
+}
+
+/* Returns NULL if the options are valid, otherwise an error message. Either way, the pipeline in
+ * `opts` has to be freed afterwards. */
+static char *parse_options(char *options, size_t len, CompileOptions *opts) {
+    *opts = (CompileOptions) {.target = X86_64, .lex_threads = 1};
+    pipeline_preset(1, &opts->pipeline);
+    size_t inline_threshold = DEFAULT_INLINE_THRESHOLD;
+    size_t inline_max_size = DEFAULT_INLINE_MAX_SIZE;
+    size_t unroll_threshold = DEFAULT_UNROLL_THRESHOLD;
+    is_position_independent = 1;
+    char *end = options + len;
+    for (char *opt = options; opt < end; opt += strlen(opt) + 1) {
+        if (opt[0] == '-' && opt[1] == '-') opt++;
+        if (!strcmp(opt, "-t")) {
+            opt += strlen(opt) + 1;
+            if (opt >= end) return "Target was expected to be provided after -t.\n";
+            if (!str_as_target(opt, &opts->target)) return "No such target.\n";
+        } else if (!strcmp(opt, "-no-pie")) {
+            is_position_independent = 0;
+        } else if (!strcmp(opt, "-batch")) {
+            opts->batch = true;
+        } else if (!strcmp(opt, "-emit-bin")) {
+            opts->emit_bin = true;
+        } else if (opt[1] == 'O' && opt[2] >= '0' && opt[2] <= '9' && !opt[3]) {
+            pipeline_free(&opts->pipeline);
+            if (!pipeline_preset(opt[2] - '0', &opts->pipeline)) return "No such optimisation level.\n";
+        } else if (!strncmp(opt, "-passes=", 8)) {
+            pipeline_free(&opts->pipeline);
+            char *error = pipeline_parse(opt + 8, &opts->pipeline);
+            if (error) return error;
+        } else if (!strncmp(opt, "-inline-threshold=", 18) || !strncmp(opt, "-inline-max-size=", 17) ||
+                   !strncmp(opt, "-unroll-threshold=", 18)) {
+            char *num = strchr(opt, '=') + 1;
+            char *num_end;
+            size_t n = strtoul(num, &num_end, 10);
+            if (!*num || *num_end) return "Invalid number in inlining or unrolling option.\n";
+            if (opt[1] == 'u') unroll_threshold = n;
+            else if (opt[8] == 't') inline_threshold = n;
+            else inline_max_size = n;
+        } else {
+            return "Unsupported option in request to the compile server.\n";
+        }
+    }
+    opts->pipeline.inline_threshold = inline_threshold;
+    opts->pipeline.inline_max_size = inline_max_size;
+    opts->pipeline.unroll_threshold = unroll_threshold;
+    return NULL;
+}
+
+static void compile_job(void *arg) {
+    ServerJob *job = (ServerJob*) arg;
+    compile_source(&job->src, &job->opts, job->outf);
+}
+
+/* Answers requests from `in_fd` on `out_fd` until the client closes the connection or sends
+ * something that isn't a request. The input buffer is kept between calls. */
+static void serve_connection(int in_fd, int out_fd) {
+    static char *input;
+    static size_t input_capacity;
+    char options[SERVER_MAX_OPTIONS_LEN + 1];
+    ServerRequest request;
+    while (read_all(in_fd, &request, sizeof(request))) {
+        if (request.magic != SERVER_REQUEST_MAGIC || request.options_len > SERVER_MAX_OPTIONS_LEN) {
+            char *msg = "Invalid request to the compile server.\n";
+            respond(out_fd, 1, msg, strlen(msg));
+            return;
+        }
+        if (request.input_len + 1 > input_capacity) {
+            char *new_input = realloc(input, request.input_len + 1);
+            if (!new_input) {
+                char *msg = "Request to the compile server is too big.\n";
+                respond(out_fd, 1, msg, strlen(msg));
+                return;
+            }
+            input = new_input;
+            input_capacity = request.input_len + 1;
+        }
+        if (!read_all(in_fd, options, request.options_len)) return;
+        if (!read_all(in_fd, input, request.input_len)) return;
+        options[request.options_len] = 0;
+        ServerJob job;
+        source_from_buffer(input, request.input_len, &job.src);
+        char *error = parse_options(options, request.options_len, &job.opts);
+        if (error) {
+            pipeline_free(&job.opts.pipeline);
+            if (!respond(out_fd, 1, error, strlen(error))) return;
+            continue;
+        }
+        char *output = NULL;
+        size_t output_len = 0;
+        job.outf = open_memstream(&output, &output_len);
+        error = catch_compile_error(compile_job, &job);
+        fclose(job.outf);
+        bool sent = (error) ? respond(out_fd, 1, error, strlen(error)) : respond(out_fd, 0, output, output_len);
+        free(error);
+        free(output);
+        compile_reset(&job.opts);
+        pipeline_free(&job.opts.pipeline);
+        cache_close();
+        if (!sent) return;
+    }
+}
+
+/* Serves requests on a Unix socket at `socket_path` (replacing a socket that's already there) one
+ * connection at a time, or on stdin and stdout if `socket_path` is "-". Only returns once stdin is
+ * closed, since a socket can always get new connections. */
+void run_server(char *socket_path) {
+    // a client going away part way through a response shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    if (!strcmp(socket_path, "-")) {
+        serve_connection(STDIN_FILENO, STDOUT_FILENO);
+        return;
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Socket path is too long: %s\n", socket_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
+    struct stat st;
+    if (!stat(socket_path, &st) && S_ISSOCK(st.st_mode)) unlink(socket_path);
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr*) &addr, sizeof(addr)) || listen(sock, 64)) {
+        printf("Failed to listen on socket %s\n", socket_path);
+        exit(1);
+    }
+    for (;;) {
+        int conn = accept(sock, NULL, NULL);
+        if (conn < 0) continue;
+        serve_connection(conn, conn);
+        close(conn);
+    }
+}
@@ -0,0 +1,76 @@
+/* Streaming compilation, where each function is lexed, parsed, optimised and compiled before moving
+ * on to the next one, and everything that was allocated for it is released afterwards. This keeps
+ * memory use proportional to the biggest function rather than the whole file.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <stream.h>
+#include <error.h>
+#include <parser.h>
+#include <vector.h>
+#include <arena.h>
+#include <optimisation.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// How much of a mapped source file is parsed before the pages behind it are given back
+#define RELEASE_SOURCE_EVERY (16 * 1024 * 1024)
+
+static void copy_file(FILE *from, FILE *to) {
+    char buf[64 * 1024];
+    size_t len;
+    rewind(from);
+    while ((len = fread(buf, 1, sizeof(buf), from)))
+        fwrite(buf, 1, len, to);
+}
+
+/* Gives the same output as parsing the whole file and calling the target's build_program, as long
+ * as aggregate types are defined before the functions that use them. */
+void compile_streamed(SourceBuf *src, StreamTarget target, Pipeline *pipeline, FILE *outf) {
+    /* Functions go after the globals in the output, so they're kept in a temporary file until the end.
+     * It's kept for the next file compiled on this thread, which also means it isn't leaked if
+     * compiling this one fails part way through. */
+    static _Thread_local FILE *text;
+    if (!text) text = tmpfile();
+    if (!text) {
+        compile_error("Failed to create a temporary file for the compiled functions.\n");
+    }
+    rewind(text);
+    if (ftruncate(fileno(text), 0)) {
+        compile_error("Failed to clear the temporary file for the compiled functions.\n");
+    }
+    Global **globals = vec_new(sizeof(Global));
+    AggregateType **aggtypes = vec_new(sizeof(AggregateType));
+    FileDbg **filesdbg = vec_new(sizeof(FileDbg));
+    char* **exported = vec_new(sizeof(char*));
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t line = 1;
+    size_t released = 0;
+    for (size_t at = 0; at < src->len;) {
+        Token **toks = vec_new(sizeof(Token));
+        at += lex_item(&src->data[at], src->len - at, &line, toks);
+        size_t num_toks = vec_size(toks);
+        for (size_t tok = 0; tok < num_toks; tok++) {
+            Arena_Mark mark = arena_snapshot(&arena);
+            Function fn;
+            if (!parse_item(toks, &tok, &fn, globals, aggtypes, filesdbg)) continue;
+            optimise(&fn, 1, pipeline);
+            if (fn.is_global) vec_push(exported, fn.name);
+            target.build_function(fn, *aggtypes, vec_size(aggtypes), text);
+            // names are interned outside of the arena, so nothing allocated for the function is needed now
+            arena_rewind(&arena, mark);
+        }
+        vec_free(toks);
+        // everything taken from the source has been copied by now, so the pages behind it can go
+        if (src->is_mapped && at - released >= RELEASE_SOURCE_EVERY) {
+            size_t end = at & ~(page_size - 1);
+            madvise(&src->data[released], end - released, MADV_DONTNEED);
+            released = end;
+        }
+    }
+    target.build_header(*globals, vec_size(globals), *aggtypes, vec_size(aggtypes), *filesdbg, vec_size(filesdbg),
+                        *exported, vec_size(exported), outf);
+    copy_file(text, outf);
+    vec_free(globals);
+    vec_free(aggtypes);
+    vec_free(filesdbg);
+    vec_free(exported);
+}
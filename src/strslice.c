@@ -33,3 +33,8 @@ void string_push_fmt(String *str, char *fmt, ...) {
     va_end(args);
     str->len = new_len;
 }
+
+void string_free(String *str) {
+    free(str->data);
+    free(str);
+}
@@ -0,0 +1,463 @@
+/* Conversion between UYB's IR structures and the binary encoding of them (.uybc files), see
+ * ../../../include/target/IR/binary.h for the format itself.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <target/IR/binary.h>
+#include <error.h>
+#include <mnemonic.h>
+#include <values.h>
+#include <cfg.h>
+#include <vector.h>
+#include <arena.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+    uint32_t *str_index;  // indexed by intern ID, holds the string's index + 1 or 0 if it's not in the table
+    size_t str_index_len;
+    char* **strings;      // in the order they're stored in the string table
+    Function *fn;         // the function being written, for the names of its values and blocks
+} BinWriter;
+
+#define bin_at(writer, type, offset) ((type*) &(writer)->data[offset])
+
+// Appends zeroed space for `bytes` bytes, aligned to 8 bytes, and returns its offset
+static uint64_t bin_reserve(BinWriter *w, size_t bytes) {
+    size_t offset = (w->len + 7) & ~7ULL;
+    if (offset + bytes > w->capacity) {
+        while (offset + bytes > w->capacity) w->capacity *= 2;
+        w->data = realloc(w->data, w->capacity);
+    }
+    memset(&w->data[w->len], 0, offset + bytes - w->len);
+    w->len = offset + bytes;
+    return offset;
+}
+
+static uint32_t write_str(BinWriter *w, char *str) {
+    if (!str) return UYBC_NO_STR;
+    // string literals aren't interned by the parser, but interning them here means each is stored once
+    char *interned = intern_cstr(str);
+    size_t id = intern_id(interned);
+    if (id >= w->str_index_len) {
+        size_t new_len = (id + 1) * 2;
+        w->str_index = realloc(w->str_index, new_len * sizeof(uint32_t));
+        memset(&w->str_index[w->str_index_len], 0, (new_len - w->str_index_len) * sizeof(uint32_t));
+        w->str_index_len = new_len;
+    }
+    if (!w->str_index[id]) {
+        vec_push(w->strings, interned);
+        w->str_index[id] = vec_size(w->strings);
+    }
+    return w->str_index[id] - 1;
+}
+
+static uint64_t write_val(BinWriter *w, uint64_t val, ValType type);
+
+static uint64_t write_arglist(BinWriter *w, FunctionArgList *args) {
+    uint64_t offset = bin_reserve(w, sizeof(BinArgList) + sizeof(BinCallArg) * args->num_args);
+    bin_at(w, BinArgList, offset)->num_args = args->num_args;
+    for (size_t a = 0; a < args->num_args; a++) {
+        uint64_t val = write_val(w, args->args[a], args->arg_types[a]);
+        uint32_t struct_type = write_str(w, (args->args_are_structs[a]) ? args->arg_struct_types[a] : NULL);
+        bin_at(w, BinArgList, offset)->args[a] = (BinCallArg) {
+            .val = val,
+            .struct_type = struct_type,
+            .size = args->arg_sizes[a],
+            .is_struct = args->args_are_structs[a],
+            .val_type = args->arg_types[a],
+        };
+    }
+    return offset;
+}
+
+static uint64_t write_phival(BinWriter *w, PhiVal *phi) {
+    uint64_t val = write_val(w, phi->val, phi->type);
+    uint32_t blklbl = write_str(w, w->fn->block_names[phi->blklbl]);
+    uint64_t offset = bin_reserve(w, sizeof(BinPhiVal));
+    *bin_at(w, BinPhiVal, offset) = (BinPhiVal) {.val = val, .blklbl_name = blklbl, .type = phi->type};
+    return offset;
+}
+
+static uint64_t write_asm_io(BinWriter *w, InlineAsmIO **io_vec) {
+    size_t num = vec_size(io_vec);
+    uint64_t offset = bin_reserve(w, sizeof(BinAsmIO) * num);
+    for (size_t i = 0; i < num; i++) {
+        InlineAsmIO io = (*io_vec)[i];
+        uint64_t label = write_val(w, io.label, io.type);
+        uint32_t reg = write_str(w, io.reg);
+        bin_at(w, BinAsmIO, offset)[i] = (BinAsmIO) {.label = label, .reg = reg, .type = io.type};
+    }
+    return offset;
+}
+
+static uint64_t write_asm(BinWriter *w, InlineAsm *info) {
+    BinInlineAsm bin = {
+        .num_inputs = vec_size(info->inputs_vec),
+        .num_outputs = vec_size(info->outputs_vec),
+        .num_clobbers = vec_size(info->clobbers_vec),
+    };
+    bin.assembly = write_str(w, info->assembly);
+    bin.inputs = write_asm_io(w, info->inputs_vec);
+    bin.outputs = write_asm_io(w, info->outputs_vec);
+    bin.clobbers = bin_reserve(w, sizeof(uint32_t) * bin.num_clobbers);
+    for (size_t i = 0; i < bin.num_clobbers; i++) {
+        uint32_t clobber = write_str(w, (*info->clobbers_vec)[i]);
+        bin_at(w, uint32_t, bin.clobbers)[i] = clobber;
+    }
+    uint64_t offset = bin_reserve(w, sizeof(BinInlineAsm));
+    *bin_at(w, BinInlineAsm, offset) = bin;
+    return offset;
+}
+
+static uint64_t write_val(BinWriter *w, uint64_t val, ValType type) {
+    if      (type == Number)         return val;
+    else if (type == Label)          return write_str(w, w->fn->value_names[val]);
+    else if (type == BlkLbl)         return write_str(w, w->fn->block_names[val]);
+    else if (type == Str || type == StrLit)
+                                     return write_str(w, (char*) val);
+    else if (type == FunctionArgs)   return write_arglist(w, (FunctionArgList*) val);
+    else if (type == PhiArg)         return write_phival(w, (PhiVal*) val);
+    else if (type == InlineAssembly) return write_asm(w, (InlineAsm*) val);
+    else return 0;
+}
+
+static void write_function(BinWriter *w, uint64_t offset, Function *fn) {
+    w->fn = fn;
+    uint64_t args = bin_reserve(w, sizeof(BinFunctionArgument) * fn->num_args);
+    for (size_t a = 0; a < fn->num_args; a++) {
+        FunctionArgument arg = fn->args[a];
+        uint32_t label = write_str(w, fn->value_names[arg.label]);
+        uint32_t type_struct = write_str(w, (arg.type_is_struct) ? arg.type_struct : NULL);
+        bin_at(w, BinFunctionArgument, args)[a] = (BinFunctionArgument) {
+            .label = label,
+            .type_struct = type_struct,
+            .type_is_struct = arg.type_is_struct,
+            .type = (arg.type_is_struct) ? 0 : arg.type,
+        };
+    }
+    uint64_t statements = bin_reserve(w, sizeof(BinStatement) * fn->num_statements);
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement statement = fn->statements[s];
+        BinStatement bin = {
+            .label = write_str(w, fn->value_names[statement.label]),
+            .instruction = statement.instruction,
+            .type = statement.type,
+            .arg_type = statement.arg_type,
+            .is_signed = statement.is_signed,
+        };
+        for (size_t i = 0; i < 3; i++) {
+            bin.val_types[i] = statement.val_types[i];
+            bin.vals[i] = write_val(w, statement.vals[i], statement.val_types[i]);
+        }
+        bin_at(w, BinStatement, statements)[s] = bin;
+    }
+    uint32_t name = write_str(w, fn->name);
+    uint32_t return_struct = write_str(w, (fn->ret_is_struct) ? fn->return_struct : NULL);
+    *bin_at(w, BinFunction, offset) = (BinFunction) {
+        .name = name,
+        .return_struct = return_struct,
+        .is_global = fn->is_global,
+        .ret_is_struct = fn->ret_is_struct,
+        .return_type = (fn->ret_is_struct) ? 0 : fn->return_type,
+        .is_variadic = fn->is_variadic,
+        .num_args = fn->num_args,
+        .num_statements = fn->num_statements,
+        .args = args,
+        .statements = statements,
+    };
+}
+
+static void write_global(BinWriter *w, uint64_t offset, Global *global) {
+    uint64_t vals = bin_reserve(w, sizeof(BinGlobalVal) * global->num_vals);
+    for (size_t v = 0; v < global->num_vals; v++) {
+        uint64_t val = write_val(w, global->vals[v], global->types[v]);
+        bin_at(w, BinGlobalVal, vals)[v] = (BinGlobalVal) {.val = val, .type = global->types[v], .size = global->sizes[v]};
+    }
+    uint32_t name = write_str(w, global->name);
+    uint32_t section = write_str(w, global->section);
+    *bin_at(w, BinGlobal, offset) = (BinGlobal) {
+        .name = name,
+        .section = section,
+        .num_vals = global->num_vals,
+        .alignment = global->alignment,
+        .vals = vals,
+    };
+}
+
+void build_program_IR_bin(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf) {
+    BinWriter w = {
+        .data = malloc(64 * 1024),
+        .capacity = 64 * 1024,
+        .strings = vec_new(sizeof(char*)),
+    };
+    bin_reserve(&w, sizeof(BinHeader));
+    BinHeader header = {
+        .magic = UYBC_MAGIC,
+        .version = UYBC_VERSION,
+        .num_functions = num_functions,
+        .num_globals = num_global_vars,
+        .num_aggtypes = num_aggtypes,
+        .num_filesdbg = num_dbgfiles,
+        .functions = bin_reserve(&w, sizeof(BinFunction) * num_functions),
+        .globals = bin_reserve(&w, sizeof(BinGlobal) * num_global_vars),
+        .aggtypes = bin_reserve(&w, sizeof(BinAggregateType) * num_aggtypes),
+        .filesdbg = bin_reserve(&w, sizeof(BinFileDbg) * num_dbgfiles),
+    };
+    for (size_t f = 0; f < num_functions; f++)
+        write_function(&w, header.functions + f * sizeof(BinFunction), &IR[f]);
+    for (size_t g = 0; g < num_global_vars; g++)
+        write_global(&w, header.globals + g * sizeof(BinGlobal), &global_vars[g]);
+    for (size_t t = 0; t < num_aggtypes; t++) {
+        uint32_t name = write_str(&w, aggtypes[t].name);
+        bin_at(&w, BinAggregateType, header.aggtypes)[t] = (BinAggregateType) {
+            .name = name,
+            .alignment = aggtypes[t].alignment,
+            .size_bytes = aggtypes[t].size_bytes,
+        };
+    }
+    for (size_t f = 0; f < num_dbgfiles; f++) {
+        uint32_t fname = write_str(&w, dbgfiles[f].fname);
+        bin_at(&w, BinFileDbg, header.filesdbg)[f] = (BinFileDbg) {.id = dbgfiles[f].id, .fname = fname};
+    }
+    header.num_strings = vec_size(w.strings);
+    header.strings = bin_reserve(&w, sizeof(uint64_t) * header.num_strings);
+    for (size_t i = 0; i < header.num_strings; i++) {
+        char *str = (*w.strings)[i];
+        size_t len = strlen(str) + 1;
+        uint64_t offset = bin_reserve(&w, len);
+        memcpy(&w.data[offset], str, len);
+        bin_at(&w, uint64_t, header.strings)[i] = offset;
+    }
+    *bin_at(&w, BinHeader, 0) = header;
+    fwrite(w.data, 1, w.len, outf);
+    free(w.data);
+    free(w.str_index);
+    vec_free(w.strings);
+}
+
+typedef struct {
+    char *buf;
+    size_t len;
+    char **strings; // the interned version of each string in the string table
+    size_t num_strings;
+} BinReader;
+
+_Noreturn static void invalid_bin(char *reason) {
+    compile_error("Invalid binary IR file: %s.\n", reason);
+}
+
+// Checks that `count` records of `size` bytes at `offset` are inside the file and returns them
+static void *bin_get(BinReader *r, uint64_t offset, size_t size, size_t count) {
+    if (offset > r->len || (size && count > (r->len - offset) / size))
+        invalid_bin("record is outside of the file");
+    return &r->buf[offset];
+}
+
+static char *read_str(BinReader *r, uint32_t idx) {
+    if (idx == UYBC_NO_STR) return NULL;
+    if (idx >= r->num_strings) invalid_bin("string index is out of range");
+    return r->strings[idx];
+}
+
+static ValueId read_value_id(BinReader *r, uint32_t idx) {
+    char *name = read_str(r, idx);
+    if (!name) invalid_bin("value has no name");
+    return value_id(name);
+}
+
+static BlockId read_block_id(BinReader *r, uint32_t idx) {
+    char *name = read_str(r, idx);
+    if (!name) invalid_bin("block has no name");
+    return block_id(name);
+}
+
+static ValType read_valtype(uint8_t type) {
+    if (type > Empty) invalid_bin("unknown value type");
+    return type;
+}
+
+static Type read_type(uint8_t type) {
+    if (type > None) invalid_bin("unknown type");
+    return type;
+}
+
+static uint64_t read_val(BinReader *r, uint64_t val, ValType type);
+
+static FunctionArgList *read_arglist(BinReader *r, uint64_t offset) {
+    BinArgList *bin = bin_get(r, offset, sizeof(BinArgList), 1);
+    bin_get(r, offset + sizeof(BinArgList), sizeof(BinCallArg), bin->num_args);
+    size_t num_args = bin->num_args;
+    FunctionArgList *args = aalloc(sizeof(FunctionArgList));
+    *args = (FunctionArgList) {
+        .args = aalloc(sizeof(uint64_t) * num_args),
+        .arg_sizes = aalloc(sizeof(Type) * num_args),
+        .arg_struct_types = aalloc(sizeof(char*) * num_args),
+        .args_are_structs = aalloc(sizeof(bool) * num_args),
+        .arg_types = aalloc(sizeof(ValType) * num_args),
+        .num_args = num_args,
+    };
+    for (size_t a = 0; a < num_args; a++) {
+        BinCallArg arg = bin->args[a];
+        args->arg_types[a] = read_valtype(arg.val_type);
+        args->args[a] = read_val(r, arg.val, args->arg_types[a]);
+        args->arg_sizes[a] = read_type(arg.size);
+        args->args_are_structs[a] = arg.is_struct;
+        args->arg_struct_types[a] = read_str(r, arg.struct_type);
+    }
+    return args;
+}
+
+static PhiVal *read_phival(BinReader *r, uint64_t offset) {
+    BinPhiVal *bin = bin_get(r, offset, sizeof(BinPhiVal), 1);
+    PhiVal *phi = aalloc(sizeof(PhiVal));
+    phi->type = read_valtype(bin->type);
+    phi->val = read_val(r, bin->val, phi->type);
+    phi->blklbl = read_block_id(r, bin->blklbl_name);
+    return phi;
+}
+
+static InlineAsmIO **read_asm_io(BinReader *r, uint64_t offset, size_t num) {
+    BinAsmIO *bin = bin_get(r, offset, sizeof(BinAsmIO), num);
+    InlineAsmIO **io_vec = vec_new(sizeof(InlineAsmIO));
+    for (size_t i = 0; i < num; i++) {
+        ValType type = read_valtype(bin[i].type);
+        vec_push(io_vec, ((InlineAsmIO) {
+            .reg = read_str(r, bin[i].reg),
+            .label = read_val(r, bin[i].label, type),
+            .type = type,
+        }));
+    }
+    return io_vec;
+}
+
+static InlineAsm *read_asm(BinReader *r, uint64_t offset) {
+    BinInlineAsm *bin = bin_get(r, offset, sizeof(BinInlineAsm), 1);
+    InlineAsm *info = malloc(sizeof(InlineAsm));
+    info->assembly = read_str(r, bin->assembly);
+    info->inputs_vec = read_asm_io(r, bin->inputs, bin->num_inputs);
+    info->outputs_vec = read_asm_io(r, bin->outputs, bin->num_outputs);
+    info->clobbers_vec = vec_new(sizeof(char*));
+    uint32_t *clobbers = bin_get(r, bin->clobbers, sizeof(uint32_t), bin->num_clobbers);
+    for (size_t i = 0; i < bin->num_clobbers; i++)
+        vec_push(info->clobbers_vec, read_str(r, clobbers[i]));
+    return info;
+}
+
+static uint64_t read_val(BinReader *r, uint64_t val, ValType type) {
+    if      (type == Number)         return val;
+    else if (type == Label)          return read_value_id(r, val);
+    else if (type == BlkLbl)         return read_block_id(r, val);
+    else if (type == Str || type == StrLit)
+                                     return (uint64_t) read_str(r, val);
+    else if (type == FunctionArgs)   return (uint64_t) read_arglist(r, val);
+    else if (type == PhiArg)         return (uint64_t) read_phival(r, val);
+    else if (type == InlineAssembly) return (uint64_t) read_asm(r, val);
+    else return 0;
+}
+
+static Function read_function(BinReader *r, BinFunction *bin) {
+    Function fn = {
+        .is_global = bin->is_global,
+        .name = read_str(r, bin->name),
+        .args = aalloc(sizeof(FunctionArgument) * bin->num_args),
+        .num_args = bin->num_args,
+        .ret_is_struct = bin->ret_is_struct,
+        .statements = aalloc(sizeof(Statement) * bin->num_statements),
+        .num_statements = bin->num_statements,
+        .is_variadic = bin->is_variadic,
+    };
+    values_begin();
+    if (fn.ret_is_struct) fn.return_struct = read_str(r, bin->return_struct);
+    else fn.return_type = read_type(bin->return_type);
+    BinFunctionArgument *args = bin_get(r, bin->args, sizeof(BinFunctionArgument), bin->num_args);
+    for (size_t a = 0; a < fn.num_args; a++) {
+        fn.args[a] = (FunctionArgument) {.type_is_struct = args[a].type_is_struct, .label = read_value_id(r, args[a].label)};
+        if (fn.args[a].type_is_struct) fn.args[a].type_struct = read_str(r, args[a].type_struct);
+        else fn.args[a].type = read_type(args[a].type);
+    }
+    BinStatement *statements = bin_get(r, bin->statements, sizeof(BinStatement), bin->num_statements);
+    for (size_t s = 0; s < fn.num_statements; s++) {
+        BinStatement *statement = &statements[s];
+        if (statement->instruction >= NUM_INSTRUCTIONS) invalid_bin("unknown instruction");
+        fn.statements[s] = (Statement) {
+            .label = (statement->label == UYBC_NO_STR) ? 0 : read_value_id(r, statement->label),
+            .instruction = statement->instruction,
+            .type = read_type(statement->type),
+            .arg_type = read_type(statement->arg_type),
+            .is_signed = statement->is_signed,
+        };
+        for (size_t i = 0; i < 3; i++) {
+            fn.statements[s].val_types[i] = read_valtype(statement->val_types[i]);
+            fn.statements[s].vals[i] = read_val(r, statement->vals[i], fn.statements[s].val_types[i]);
+        }
+    }
+    values_end(&fn);
+    cfg_build(&fn);
+    return fn;
+}
+
+static Global read_global(BinReader *r, BinGlobal *bin) {
+    Global global = {
+        .section = read_str(r, bin->section),
+        .name = read_str(r, bin->name),
+        .types = aalloc(sizeof(ValType) * bin->num_vals),
+        .sizes = aalloc(sizeof(Type) * bin->num_vals),
+        .vals = aalloc(sizeof(size_t) * bin->num_vals),
+        .num_vals = bin->num_vals,
+        .alignment = bin->alignment,
+    };
+    BinGlobalVal *vals = bin_get(r, bin->vals, sizeof(BinGlobalVal), bin->num_vals);
+    for (size_t v = 0; v < global.num_vals; v++) {
+        global.types[v] = read_valtype(vals[v].type);
+        global.sizes[v] = read_type(vals[v].size);
+        global.vals[v] = read_val(r, vals[v].val, global.types[v]);
+    }
+    return global;
+}
+
+bool is_binary_IR(char *buf, size_t len) {
+    return len >= sizeof(uint32_t) && *((uint32_t*) buf) == UYBC_MAGIC;
+}
+
+/* `buf` can be a mapping of the file, and doesn't have to stay alive afterwards since the strings
+ * are interned. The results are the same as parse_program() gives for the IR that was written. */
+Function **load_program_bin(char *buf, size_t len, Global ***globals_buf, AggregateType ***aggtypes_buf, FileDbg ***filesdbg_buf) {
+    BinReader r = {.buf = buf, .len = len};
+    BinHeader *header = bin_get(&r, 0, sizeof(BinHeader), 1);
+    if (header->magic != UYBC_MAGIC) invalid_bin("wrong magic number");
+    if (header->version != UYBC_VERSION) invalid_bin("unsupported version");
+    uint64_t *string_offsets = bin_get(&r, header->strings, sizeof(uint64_t), header->num_strings);
+    r.num_strings = header->num_strings;
+    r.strings = malloc(sizeof(char*) * r.num_strings);
+    for (size_t i = 0; i < r.num_strings; i++) {
+        char *str = bin_get(&r, string_offsets[i], 1, 1);
+        char *end = memchr(str, 0, len - string_offsets[i]);
+        if (!end) invalid_bin("string isn't terminated");
+        r.strings[i] = intern(str, end - str);
+    }
+    Function **functions = vec_new(sizeof(Function));
+    *globals_buf = vec_new(sizeof(Global));
+    *aggtypes_buf = vec_new(sizeof(AggregateType));
+    *filesdbg_buf = vec_new(sizeof(FileDbg));
+    BinFunction *bin_functions = bin_get(&r, header->functions, sizeof(BinFunction), header->num_functions);
+    for (size_t f = 0; f < header->num_functions; f++)
+        vec_push(functions, read_function(&r, &bin_functions[f]));
+    BinGlobal *bin_globals = bin_get(&r, header->globals, sizeof(BinGlobal), header->num_globals);
+    for (size_t g = 0; g < header->num_globals; g++)
+        vec_push(*globals_buf, read_global(&r, &bin_globals[g]));
+    BinAggregateType *bin_aggtypes = bin_get(&r, header->aggtypes, sizeof(BinAggregateType), header->num_aggtypes);
+    for (size_t t = 0; t < header->num_aggtypes; t++) {
+        vec_push(*aggtypes_buf, ((AggregateType) {
+            .name = read_str(&r, bin_aggtypes[t].name),
+            .alignment = bin_aggtypes[t].alignment,
+            .size_bytes = bin_aggtypes[t].size_bytes,
+        }));
+    }
+    BinFileDbg *bin_filesdbg = bin_get(&r, header->filesdbg, sizeof(BinFileDbg), header->num_filesdbg);
+    for (size_t f = 0; f < header->num_filesdbg; f++)
+        vec_push(*filesdbg_buf, ((FileDbg) {.fname = read_str(&r, bin_filesdbg[f].fname), .id = bin_filesdbg[f].id}));
+    free(r.strings);
+    return functions;
+}
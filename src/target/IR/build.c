@@ -1,16 +1,20 @@
 #include <stdio.h>
+#include <error.h>
 #include <string.h>
 #include <utils.h>
 #include <arena.h>
 #include <api.h>
 #include <stdlib.h>
 
-void build_function(Function IR, FILE *outf) {
+extern _Thread_local Function *IR_current_fn; // defined in instructions.c
+
+void build_function_IR(Function IR, AggregateType *aggtypes, size_t num_aggtypes, FILE *outf) {
+    IR_current_fn = &IR;
     char *rettype = get_full_char_str(IR.ret_is_struct, IR.return_type, IR.return_struct);
     fprintf(outf, "%sfunction %s $%s(", (IR.is_global) ? "export " : "", rettype, IR.name);
     for (size_t arg = 0; arg < IR.num_args; arg++) {
         char *argtype = get_full_char_str(IR.args[arg].type_is_struct, IR.args[arg].type, IR.args[arg].type_struct);
-        fprintf(outf, "%s %%%s", argtype, IR.args[arg].label);
+        fprintf(outf, "%s %%%s", argtype, IR.value_names[IR.args[arg].label]);
         if (!(arg == IR.num_args - 1 || IR.is_variadic))
             fprintf(outf, ", ");
     }
@@ -18,7 +22,7 @@ void build_function(Function IR, FILE *outf) {
     fprintf(outf, ") {\n");
     for (size_t s = 0; s < IR.num_statements; s++) {
         if (IR.statements[s].label) {
-            fprintf(outf, "\t%%%s =%c ", IR.statements[s].label, size_as_char(IR.statements[s].type));
+            fprintf(outf, "\t%%%s =%c ", IR.value_names[IR.statements[s].label], size_as_char(IR.statements[s].type));
         } else {
             fprintf(outf, "\t");
         }
@@ -40,8 +44,7 @@ void build_globals(Global *global_vars, size_t num_global_vars, FILE *outf) {
             else if (global_vars[g].types[v] == StrLit)
                 fprintf(outf, "\"%s\"", (char*) global_vars[g].vals[v]);
             else {
-                printf("Type for global var must either be Number or StrLit.\n");
-                exit(1);
+                compile_error("Type for global var must either be Number or StrLit.\n");
             }
             if (v != global_vars[g].num_vals - 1)
                 fprintf(outf, ", ");
@@ -62,12 +65,16 @@ void build_filesdbg(FileDbg *filesdbg, size_t num_filesdbg, FILE *outf) {
     }
 }
 
-void build_program_IR(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf) {
+void build_header_IR(Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, char **exported, size_t num_exported, FILE *outf) {
     fprintf(outf, "# Generated by UYB for UYB IR\n\n");
     build_filesdbg(dbgfiles, num_dbgfiles, outf);
     build_globals(global_vars, num_global_vars, outf);
     build_aggtypes(aggtypes, num_aggtypes, outf);
+}
+
+void build_program_IR(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf) {
+    build_header_IR(global_vars, num_global_vars, aggtypes, num_aggtypes, dbgfiles, num_dbgfiles, NULL, 0, outf);
     for (size_t f = 0; f < num_functions; f++) {
-        build_function(IR[f], outf);
+        build_function_IR(IR[f], aggtypes, num_aggtypes, outf);
     }
 }
@@ -1,198 +1,35 @@
 #include <api.h>
+#include <error.h>
 #include <stdlib.h>
 
 char *get_full_char_str(bool is_struct, Type type, char *type_struct); // defined in build.c
 
+// The function being printed, for the names of its values and blocks. Set by build_function_IR().
+_Thread_local Function *IR_current_fn;
+
 static void build_value(uint64_t val, ValType type, FILE *outf) {
     if      (type == Number) fprintf(outf, "%zu",  val);
-    else if (type == BlkLbl) fprintf(outf, "@%s",  (char*) val);
-    else if (type == Label ) fprintf(outf, "%%%s", (char*) val);
+    else if (type == BlkLbl) fprintf(outf, "@%s",  IR_current_fn->block_names[val]);
+    else if (type == Label ) fprintf(outf, "%%%s", IR_current_fn->value_names[val]);
     else if (type == Str   ) fprintf(outf, "$%s",  (char*) val);
     else if (type == PhiArg) {
-        fprintf(outf, "@%s ", ((PhiVal*) val)->blklbl_name);
+        fprintf(outf, "@%s ", IR_current_fn->block_names[((PhiVal*) val)->blklbl]);
         build_value(((PhiVal*) val)->val, ((PhiVal*) val)->type, outf);
     }
 }
 
-static char size_as_char(Type type) {
-    if      (type == Bits8) return 'b';
-    else if (type == Bits16) return 'h';
-    else if (type == Bits32) return 'w';
-    else return 'l';
-}
-
-static void add_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "add ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void sub_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "sub ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void div_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "div ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void udiv_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "udiv ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void rem_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "rem ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void urem_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "urem ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void mul_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "mul ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void copy_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "copy ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
-}
-
-static void ret_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "ret ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
-}
-
-static void jmp_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "jmp ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
-}
-
-static void jz_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "jz ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void and_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "and ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void or_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "or ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void blit_build(uint64_t vals[3], ValType types[3], Statement statement, FILE* outf) {
-    fprintf(outf, "blit ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, ", ");
-    build_value(vals[2], types[2], outf);
-    fprintf(outf, "\n");
-}
-
-static void jnz_build(uint64_t vals[3], ValType types[3], Statement statement, FILE* outf) {
-    fprintf(outf, "jnz ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, ", ");
-    build_value(vals[2], types[2], outf);
-    fprintf(outf, "\n");
-}
-
-static void xor_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "xor ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void shl_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "shl ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void shr_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "shr ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void store_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "store%c ", size_as_char(statement.type));
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void load_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "load%c ", size_as_char(statement.type));
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void neg_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "neg ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
-}
-
-static void alloc_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "alloc ");
-    build_value(vals[0], types[0], outf);
+// Prints any instruction which is just its mnemonic followed by its operands
+static void operands_build(uint64_t vals[3], ValType types[3], Statement statement, FILE* outf) {
+    fprintf(outf, "%s", statement_mnemonic(statement));
+    for (size_t i = 0; i < 3 && types[i] != Empty; i++) {
+        fprintf(outf, (i) ? ", " : " ");
+        build_value(vals[i], types[i], outf);
+    }
     fprintf(outf, "\n");
 }
 
 static void call_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "call ");
+    fprintf(outf, "%s ", statement_mnemonic(statement));
     build_value(vals[0], types[0], outf);
     fprintf(outf, "(");
     FunctionArgList *args = (FunctionArgList*) vals[1];
@@ -200,144 +37,29 @@ static void call_build(uint64_t vals[2], ValType types[2], Statement statement,
     for (size_t arg = 0; arg < num_args; arg++) {
         char *arg_type = get_full_char_str(args->args_are_structs[arg], args->arg_sizes[arg], args->arg_struct_types[arg]);
         fprintf(outf, "%s ", arg_type);
-        build_value((uint64_t) args->args[arg], args->arg_types[arg], outf);
+        build_value(args->args[arg], args->arg_types[arg], outf);
         if (arg != num_args - 1)
             fprintf(outf, ", ");
     }
     fprintf(outf, ")\n");
 }
 
-static void eq_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "ceq ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void ne_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "cne ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void sle_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "csle ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void slt_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "cslt ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void sge_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "csge ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void sgt_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "csgt ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void ule_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "cule ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void ult_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "cult ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void uge_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "cuge ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void ugt_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "cugt ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void ext_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "ext ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
-}
-
-static void hlt_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "hlt\n");
-}
-
 static void blklbl_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "@%s\n", (char*) vals[0]);
-}
-
-static void phi_build(uint64_t vals[2], ValType types[2], Statement statement, FILE* outf) {
-    fprintf(outf, "phi ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, ", ");
-    build_value(vals[1], types[1], outf);
-    fprintf(outf, "\n");
-}
-
-static void vastart_build(uint64_t vals[2], ValType types[2], Statement statement, FILE *outf) {
-    fprintf(outf, "vastart ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
-}
-
-static void vaarg_build(uint64_t vals[2], ValType types[2], Statement statement, FILE *outf) {
-    fprintf(outf, "vaarg ");
-    build_value(vals[0], types[0], outf);
-    fprintf(outf, "\n");
+    fprintf(outf, "@%s\n", IR_current_fn->block_names[vals[0]]);
 }
 
 static void loc_build(uint64_t vals[3], ValType types[3], Statement statement, FILE *outf) {
     if (types[0] != Number || types[1] != Number || types[2] != Number) {
-        printf("All arguments of .loc instruction must be an integer literal.\n");
-        exit(1);
+        compile_error("All arguments of .loc instruction must be an integer literal.\n");
     }
     fprintf(outf, ".loc %zu %zu %zu\n", vals[0], vals[1], vals[2]);
 }
 
 static void asm_build(uint64_t vals[3], ValType types[3], Statement statement, FILE *outf) {
-    printf("IR target does not support inline assembly statement in UYB. Please use an architecture-specific target for this feature.\n");
-    exit(1);
+    compile_error("IR target does not support inline assembly statement in UYB. Please use an architecture-specific target for this feature.\n");
 }
 
 void (*instructions_IR[])(uint64_t[2], ValType[2], Statement, FILE*) = {
-    add_build, sub_build, div_build, mul_build, copy_build, ret_build, call_build, jz_build, 
-    neg_build, udiv_build, rem_build, urem_build, and_build, or_build, xor_build, shl_build, shr_build, 
-    store_build, load_build, blit_build, alloc_build, eq_build, ne_build, sle_build, slt_build, sge_build, sgt_build, ule_build, ult_build, 
-    uge_build, ugt_build, ext_build, hlt_build, blklbl_build, jmp_build, jnz_build, phi_build, vastart_build, vaarg_build, 
-    loc_build, asm_build, 
+    [ADD ... RET] = operands_build, [CALL] = call_build, [JZ ... EXT] = operands_build,
+    [HLT] = operands_build, [BLKLBL] = blklbl_build, [JMP ... VAARG] = operands_build, [LOC] = loc_build, [ASM] = asm_build,
 };
@@ -1,15 +1,49 @@
 /* Main code generation file for UYB x86_64 target.
  * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
 #include <api.h>
+#include <error.h>
 #include <vector.h>
 #include <strslice.h>
 #include <string.h>
 #include <arena.h>
 #include <target/x86_64/register.h>
 #include <utils.h>
+#include <cache.h>
+#include <version.h>
+#include <hashmap.h>
 
-AggregateType *aggregate_types; /* TODO: Move all global vars (including those in register.c) */
-size_t num_aggregate_types;     /* into a single structure. */
+/* TODO: Move all global vars (including those in register.c) into a single structure. They're thread
+ * local so that several files can be compiled at once. */
+_Thread_local AggregateType *aggregate_types;
+_Thread_local size_t num_aggregate_types;
+extern int is_position_independent;
+
+/* Which of aggregate_types each name is (plus one), kept in its own arena since the same types are
+ * used by every function, which each rewind the main arena after they're compiled. */
+static _Thread_local HashMap aggtype_names;
+static _Thread_local Arena aggtype_names_arena;
+
+/* Makes `aggtypes` the ones used by the functions compiled after this. When functions are compiled
+ * one at a time, it's given the same types again and again (with new ones added on the end), so the
+ * map of names is only made again when they change. */
+static void use_aggtypes(AggregateType *aggtypes, size_t num_aggtypes) {
+    if (aggregate_types == aggtypes && num_aggregate_types == num_aggtypes && aggtype_names.entries) return;
+    aggregate_types = aggtypes;
+    num_aggregate_types = num_aggtypes;
+    arena_reset(&aggtype_names_arena);
+    hashmap_init(&aggtype_names, &aggtype_names_arena, num_aggtypes);
+    for (size_t i = 0; i < num_aggtypes; i++)
+        hashmap_put(&aggtype_names, (uint64_t) aggtypes[i].name, i + 1);
+}
+
+// Returns the aggregate type called `name`, which must be interned
+AggregateType *find_aggtype(char *name) {
+    uint64_t index;
+    if (!hashmap_get(&aggtype_names, (uint64_t) name, &index)) {
+        compile_error("Tried to use undefined aggregate type.\n");
+    }
+    return &aggregate_types[index - 1];
+}
 
 size_t type_to_size(Type type) {
     if (type == Bits8) return 1;
@@ -44,7 +78,7 @@ static String *build_function(Function IR) {
     String *fnbuf0 = string_from("\n");
     string_push_fmt(fnbuf0, "// %s %s(", type_as_str(IR.return_type, IR.return_struct, IR.ret_is_struct), IR.name);
     for (size_t arg = 0; arg < IR.num_args; arg++) {
-        string_push_fmt(fnbuf0, "%s %%%s", type_as_str(IR.args[arg].type, IR.args[arg].type_struct, IR.args[arg].type_is_struct), IR.args[arg].label);
+        string_push_fmt(fnbuf0, "%s %%%s", type_as_str(IR.args[arg].type, IR.args[arg].type_struct, IR.args[arg].type_is_struct), IR.value_names[IR.args[arg].label]);
         if (arg != IR.num_args - 1) string_push(fnbuf0, ", ");
     }
     string_push_fmt(fnbuf0, ") {\n%s", IR.name);
@@ -54,10 +88,9 @@ static String *build_function(Function IR) {
     for (size_t arg = 0; arg < IR.num_args; arg++) {
         if (IR.args[arg].type_is_struct) {
             if (arg > 4) {
-                printf("Only the first 5 arguments accepted by a function can be structures. (TODO)\n");
-                exit(1);
+                compile_error("Only the first 5 arguments accepted by a function can be structures. (TODO)\n");
             }
-            AggregateType *aggtype = find_aggtype(IR.args[arg].type_struct, aggregate_types, num_aggregate_types);
+            AggregateType *aggtype = find_aggtype(IR.args[arg].type_struct);
             char *label_loc = reg_alloc(IR.args[arg].label, Bits64);
             if (aggtype->size_bytes <= 16) {
                 // allocate space on the stack for it
@@ -82,27 +115,34 @@ static String *build_function(Function IR) {
             }
         } else if (arg > 5) {
             // it's on the stack
-            size_t *new_vec_val = aalloc(sizeof(size_t) * 2);
-            new_vec_val[0] = (size_t) IR.args[arg].label;
             reg_arg_off += type_to_size(IR.args[arg].type);
-            new_vec_val[1] = reg_arg_off + 8;
-            vec_push(regalloc.labels_as_offsets, new_vec_val);
+            reg_stack_slot(IR.args[arg].label, reg_arg_off + 8, IR.args[arg].type);
         } else {
             reg_alloc(IR.args[arg].label, IR.args[arg].type);
             for (size_t i = 0; i < sizeof(label_reg_tab) / sizeof(label_reg_tab[0]); i++) {
-                if (label_reg_tab[i][1] && !strcmp(IR.args[arg].label, label_reg_tab[i][1])) reg_alloc_tab[i][1]++;
+                if (label_reg_tab[i][1] && IR.value_names[IR.args[arg].label] == label_reg_tab[i][1] && reg_alloc_tab[i][1] > 0)
+                    reg_alloc_tab[i][1]++;
             }
         }
     }
     for (size_t s = 0; s < IR.num_statements; s++) {
-        update_regalloc();
+        reg_next_statement();
         disasm_instr(fnbuf, IR.statements[s]);
         // expects result in rax
         instructions_x86_64[IR.statements[s].instruction](IR.statements[s].vals, IR.statements[s].val_types, IR.statements[s], fnbuf); 
     }
     size_t sz = vec_size(regalloc.used_regs_vec);
-    if (((regalloc.bytes_rip_pad & 0b11111) != 0b10000) && regalloc.bytes_rip_pad) regalloc.bytes_rip_pad += 8;
-    if (sz & 1) regalloc.bytes_rip_pad += 8;
+    // rsp has to be 16 byte aligned at calls, so the frame and the registers saved under it are padded to that
+    regalloc.bytes_rip_pad = (regalloc.bytes_rip_pad + sz * 8 + 15) / 16 * 16 - sz * 8;
+    // every ret jumps here, to restore the registers saved in the prologue
+    string_push(fnbuf, "9:\n");
+    if (sz) string_push_fmt(fnbuf, "\tlea -%zu(%%rbp), %%rsp\n", regalloc.bytes_rip_pad + sz * 8);
+    for (size_t i = sz; i > 0; i--)
+        string_push_fmt(fnbuf, "\tpop %s\n", (*regalloc.used_regs_vec)[i - 1]);
+    if (IR.is_variadic)
+        string_push_fmt(fnbuf, "\tmov %%rbp, %%rsp\n\tpop %%rbp\n\tadd $%zu, %%rsp\n\tret\n", sizeof(arg_regs) / sizeof(arg_regs[0]) * 8);
+    else
+        string_push(fnbuf, "\tmov %rbp, %rsp\n\tpop %rbp\n\tret\n");
     string_push(fnbuf, "// }\n");
     string_push(fnbuf0, ":\n");
     if (IR.is_variadic) {
@@ -110,7 +150,6 @@ static String *build_function(Function IR) {
         for (ssize_t arg = sizeof(arg_regs) / sizeof(arg_regs[0]) - 1; arg >= 0; arg--)
             string_push_fmt(fnbuf0, "\tpush %s\n", arg_regs[arg]);
         string_push(fnbuf0, "\t // End var args\n");
-        regalloc.bytes_rip_pad += 8;
     }
     string_push(fnbuf0, "\tpush %rbp\n\tmov %rsp, %rbp\n");
     if (regalloc.bytes_rip_pad)
@@ -120,7 +159,7 @@ static String *build_function(Function IR) {
     char **argregs_at = arg_regs;
     for (size_t arg = 0; arg < IR.num_args; arg++) {
         if (IR.args[arg].type_is_struct) {
-            AggregateType *aggtype = find_aggtype(IR.args[arg].type_struct, aggregate_types, num_aggregate_types);
+            AggregateType *aggtype = find_aggtype(IR.args[arg].type_struct);
             if (aggtype->size_bytes <= 8 || aggtype->size_bytes > 16) 
                 argregs_at++;
             else
@@ -134,18 +173,83 @@ static String *build_function(Function IR) {
     }
     string_push(fnbuf0, structarg_buf->data + 1);
     string_push(fnbuf0, fnbuf->data + 2);
+    string_free(structarg_buf);
+    string_free(fnbuf);
+    vec_free(regalloc.used_regs_vec);
     return fnbuf0;
 }
 
-void build_program_x86_64(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf) {
-    aggregate_types = aggtypes;
-    num_aggregate_types = num_aggtypes;
-    char* **globals = vec_new(sizeof(char*));
-    String* **function_statements = vec_new(sizeof(String**));
-    for (size_t f = 0; f < num_functions; f++) {
-        if (IR[f].is_global) vec_push(globals, IR[f].name);
-        vec_push(function_statements, build_function(IR[f]));
+static void write_aggtype_key(FILE *f, char *name) {
+    AggregateType *aggtype = find_aggtype(name);
+    fprintf(f, "type :%s %zu %zu\n", aggtype->name, aggtype->alignment, aggtype->size_bytes);
+}
+
+/* Writes everything that the output of build_function() depends on: the function itself (as the IR
+ * target prints it), the aggregate types it uses, the options that change code generation, and the
+ * register allocator's state left from the last function. */
+static void write_function_key(FILE *f, Function IR) {
+    fprintf(f, "x86_64 %s pie=%d\n", COMMIT, is_position_independent);
+    reg_state_write(f);
+    if (IR.ret_is_struct) write_aggtype_key(f, IR.return_struct);
+    for (size_t arg = 0; arg < IR.num_args; arg++) {
+        if (IR.args[arg].type_is_struct) write_aggtype_key(f, IR.args[arg].type_struct);
+    }
+    for (size_t s = 0; s < IR.num_statements; s++) {
+        if (IR.statements[s].val_types[1] != FunctionArgs) continue;
+        FunctionArgList *args = (FunctionArgList*) IR.statements[s].vals[1];
+        for (size_t arg = 0; arg < args->num_args; arg++) {
+            if (args->args_are_structs[arg]) write_aggtype_key(f, args->arg_struct_types[arg]);
+        }
     }
+    build_function_IR(IR, aggregate_types, num_aggregate_types, f);
+}
+
+/* Uses the function cache if it's enabled. A cached entry is the register allocator's state after
+ * the function followed by its output, so that using it leaves everything as compiling it would. */
+static String *build_function_cached(Function IR) {
+    if (!cache_enabled()) return build_function(IR);
+    // the IR target can't print inline assembly, so functions using it can't have a key
+    for (size_t s = 0; s < IR.num_statements; s++) {
+        if (IR.statements[s].instruction == ASM) return build_function(IR);
+    }
+    char *key_buf;
+    size_t key_len;
+    FILE *key_file = open_memstream(&key_buf, &key_len);
+    write_function_key(key_file, IR);
+    fclose(key_file);
+    CacheKey key = cache_key(key_buf, key_len);
+    free(key_buf);
+    size_t entry_len;
+    char *entry = cache_get(key, &entry_len);
+    if (entry) {
+        char *output = reg_state_read(entry);
+        if (output) {
+            String *fnbuf = string_from(output);
+            free(entry);
+            return fnbuf;
+        }
+        free(entry);
+    }
+    String *fnbuf = build_function(IR);
+    FILE *entry_file = open_memstream(&entry, &entry_len);
+    reg_state_write(entry_file);
+    fputs(fnbuf->data, entry_file);
+    fclose(entry_file);
+    cache_put(key, entry, entry_len);
+    free(entry);
+    return fnbuf;
+}
+
+// Compiles a single function, so that functions can be compiled one at a time as they're parsed.
+void build_function_x86_64(Function IR, AggregateType *aggtypes, size_t num_aggtypes, FILE *outf) {
+    use_aggtypes(aggtypes, num_aggtypes);
+    String *fnbuf = build_function_cached(IR);
+    fprintf(outf, "%s", fnbuf->data);
+    string_free(fnbuf);
+}
+
+// Everything that comes before the functions, which are expected to be written after this.
+void build_header_x86_64(Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, char **exported, size_t num_exported, FILE *outf) {
     fprintf(outf, "// Generated by UYB for x86_64\n");
     for (size_t f = 0; f < num_dbgfiles; f++)
         fprintf(outf, ".file %zu \"%s\"\n", dbgfiles[f].id, dbgfiles[f].fname);
@@ -162,16 +266,34 @@ void build_program_x86_64(Function *IR, size_t num_functions, Global *global_var
             else if (global_vars[g].types[i] == StrLit)
                 fprintf(outf, "\t.ascii \"%s\"\n", (char*) global_vars[g].vals[i]);
             else {
-                printf("Type for global var must either be Number or StrLit.\n");
-                exit(1);
+                compile_error("Type for global var must either be Number or StrLit.\n");
             }
         }
         if (global_vars[g].section)
             fprintf(outf, ".data\n");
     }
     fprintf(outf, "\n.text\n");
-    for (size_t i = 0; i < vec_size(globals); i++)
-        fprintf(outf, ".globl %s\n", (*globals)[i]);
+    for (size_t i = 0; i < num_exported; i++)
+        fprintf(outf, ".globl %s\n", exported[i]);
+}
+
+void reset_x86_64() {
+    reg_reset();
+    aggregate_types = NULL;
+    num_aggregate_types = 0;
+    aggtype_names.entries = NULL;
+    arena_reset(&aggtype_names_arena);
+}
+
+void build_program_x86_64(Function *IR, size_t num_functions, Global *global_vars, size_t num_global_vars, AggregateType *aggtypes, size_t num_aggtypes, FileDbg *dbgfiles, size_t num_dbgfiles, FILE *outf) {
+    use_aggtypes(aggtypes, num_aggtypes);
+    char* **globals = vec_new(sizeof(char*));
+    String* **function_statements = vec_new(sizeof(String**));
+    for (size_t f = 0; f < num_functions; f++) {
+        if (IR[f].is_global) vec_push(globals, IR[f].name);
+        vec_push(function_statements, build_function_cached(IR[f]));
+    }
+    build_header_x86_64(global_vars, num_global_vars, aggtypes, num_aggtypes, dbgfiles, num_dbgfiles, *globals, vec_size(globals), outf);
     for (size_t i = 0; i < vec_size(function_statements); i++)
         fprintf(outf, "%s", (*function_statements)[i]->data);
 }
@@ -1,6 +1,7 @@
 /* Individual instruction implementations for x86_64 target of UYB.
  * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
 #include <api.h>
+#include <error.h>
 #include <assert.h>
 #include <stdio.h>
 #include <vector.h>
@@ -9,10 +10,12 @@
 #include <string.h>
 #include <target/x86_64/register.h>
 #include <utils.h>
+#include <cfg.h>
+#include <arena.h>
 
 // defined in build.c
-extern AggregateType *aggregate_types;
-extern size_t num_aggregate_types;
+extern _Thread_local AggregateType *aggregate_types;
+extern _Thread_local size_t num_aggregate_types;
 
 // defined in main.c
 extern int is_position_independent;
@@ -26,61 +29,18 @@ char *rax_versions[] = {
     "al", "ax", "eax", "rax"
 };
 
-char *instruction_as_str(Instruction instr) {
-    if      (instr == ADD    ) return "ADD";
-    else if (instr == SUB    ) return "SUB";
-    else if (instr == DIV    ) return "DIV";
-    else if (instr == MUL    ) return "MUL";
-    else if (instr == COPY   ) return "COPY";
-    else if (instr == RET    ) return "RET";
-    else if (instr == CALL   ) return "CALL";
-    else if (instr == JZ     ) return "JZ";
-    else if (instr == NEG    ) return "NEG";
-    else if (instr == UDIV   ) return "UDIV";
-    else if (instr == STORE  ) return "STORE";
-    else if (instr == LOAD   ) return "LOAD";
-    else if (instr == BLIT   ) return "BLIT";
-    else if (instr == ALLOC  ) return "ALLOC";
-    else if (instr == EQ     ) return "EQ";
-    else if (instr == NE     ) return "NE";
-    else if (instr == SGE    ) return "SGE";
-    else if (instr == SGT    ) return "SGT";
-    else if (instr == SLE    ) return "SLE";
-    else if (instr == SLT    ) return "SLT";
-    else if (instr == UGE    ) return "UGE";
-    else if (instr == UGT    ) return "UGT";
-    else if (instr == ULE    ) return "ULE";
-    else if (instr == ULT    ) return "ULT";
-    else if (instr == EXT    ) return "EXT";
-    else if (instr == HLT    ) return "HLT";
-    else if (instr == BLKLBL ) return "BLKLBL";
-    else if (instr == JMP    ) return "JMP";
-    else if (instr == JNZ    ) return "JNZ";
-    else if (instr == SHR    ) return "SHR";
-    else if (instr == SHL    ) return "SHL";
-    else if (instr == AND    ) return "AND";
-    else if (instr == OR     ) return "OR";
-    else if (instr == PHI    ) return "PHI";
-    else if (instr == VASTART) return "VASTART";
-    else if (instr == VAARG  ) return "VAARG";
-    else if (instr == LOC    ) return "LOC";
-    else if (instr == ASM    ) return "ASM";
-    else return "Unknown instruction";
-}
-
 static void print_val(String *fnbuf, uint64_t val, ValType type) {
     if      (type == Number         ) string_push_fmt(fnbuf, "$%llu", val);
-    else if (type == Label          ) string_push_fmt(fnbuf, "%%%s", (char*) val);
+    else if (type == Label          ) string_push_fmt(fnbuf, "%%%s", regalloc.current_fn->value_names[val]);
     else if (type == Str            ) string_push_fmt(fnbuf, "$%s", (char*) val);
     else if (type == FunctionArgs   ) string_push_fmt(fnbuf, "(function arguments)");
-    else if (type == BlkLbl         ) string_push_fmt(fnbuf, "@%s", (char*) val);
+    else if (type == BlkLbl         ) string_push_fmt(fnbuf, "@%s", regalloc.current_fn->block_names[val]);
     else if (type == InlineAssembly ) string_push_fmt(fnbuf, "(inline assembly values)");
     else if (type == PhiArg) {
-        string_push_fmt(fnbuf, "@%s ", ((PhiVal*) val)->blklbl_name);
+        string_push_fmt(fnbuf, "@%s ", regalloc.current_fn->block_names[((PhiVal*) val)->blklbl]);
         print_val(fnbuf, ((PhiVal*) val)->val, ((PhiVal*) val)->type);
     } else {
-        printf("Invalid value type\n");
-        exit(1);
+        compile_error("Invalid value type\n");
     }
 }
 
@@ -88,9 +48,9 @@ void disasm_instr(String *fnbuf, Statement statement) {
     if (statement.instruction == BLKLBL) return;
     string_push(fnbuf, "\t// ");
     if (statement.label) {
-        string_push_fmt(fnbuf, "%%%s =%s ", statement.label, type_as_str(statement.type, 0, false));
+        string_push_fmt(fnbuf, "%%%s =%s ", regalloc.current_fn->value_names[statement.label], type_as_str(statement.type, 0, false));
     }
-    string_push_fmt(fnbuf, "%s ", instruction_as_str(statement.instruction));
+    string_push_fmt(fnbuf, "%s ", statement_mnemonic(statement));
     if (statement.val_types[0] != Empty) print_val(fnbuf, statement.vals[0], statement.val_types[0]);
     if (statement.val_types[1] != Empty) {
         string_push(fnbuf, ", ");
@@ -105,8 +65,8 @@ void disasm_instr(String *fnbuf, Statement statement) {
 
 static void build_value_noresize(ValType type, uint64_t val, bool can_prepend_dollar, String *fnbuf) {
     if (type == Number) string_push_fmt(fnbuf, "$%llu", val);
-    else if (type == BlkLbl) string_push_fmt(fnbuf, ".%s_%s", regalloc.current_fn->name, (char*) val);
-    else if (type == Label ) string_push_fmt(fnbuf, "%s", label_to_reg_noresize(0, (char*) val, false));
+    else if (type == BlkLbl) string_push_fmt(fnbuf, ".%s_%s", regalloc.current_fn->name, regalloc.current_fn->block_names[val]);
+    else if (type == Label ) string_push_fmt(fnbuf, "%s", label_to_reg_noresize(0, val, false));
     else if (type == Str   ) {
         if (is_position_independent)
             string_push_fmt(fnbuf, "%s(%%rip)", (char*) val);
@@ -117,8 +77,8 @@ static void build_value_noresize(ValType type, uint64_t val, bool can_prepend_do
 
 static void build_value(ValType type, uint64_t val, bool can_prepend_dollar, String *fnbuf) {
     if (type == Number) string_push_fmt(fnbuf, "$%llu", val);
-    else if (type == BlkLbl) string_push_fmt(fnbuf, ".%s_%s", regalloc.current_fn->name, (char*) val);
-    else if (type == Label ) string_push_fmt(fnbuf, "%s", label_to_reg(0, (char*) val, false));
+    else if (type == BlkLbl) string_push_fmt(fnbuf, ".%s_%s", regalloc.current_fn->name, regalloc.current_fn->block_names[val]);
+    else if (type == Label ) string_push_fmt(fnbuf, "%s", label_to_reg(0, val, false));
     else if (type == Str   ) {
         if (is_position_independent)
             string_push_fmt(fnbuf, "%s(%%rip)", (char*) val);
@@ -169,14 +129,21 @@ static void xor_build(uint64_t vals[2], ValType types[2], Statement statement, S
 
 static void div_both_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf, bool is_signed, bool get_remainder) {
     char *label_loc = reg_alloc(statement.label, statement.type);
+    // div can't take an immediate as the divisor either, so a number has to go in a register first
+    if (types[1] == Number) {
+        string_push_fmt(fnbuf, "\tmov%c $%llu, %s\n", sizes[statement.type], vals[1], reg_as_size("%rsi", statement.type));
+    }
     string_push_fmt(fnbuf, "\tmov%c ", sizes[statement.type]);
     build_value(types[0], vals[0], true, fnbuf);
-    string_push_fmt(fnbuf, ", %%%s\n"
-                       "\txor %rdx, %rdx\n", rax_versions[statement.type]);
+    string_push_fmt(fnbuf, ", %%%s\n", rax_versions[statement.type]);
+    // the upper half of the dividend is in rdx, which has to be the sign of rax for signed division
+    if (is_signed) string_push(fnbuf, (statement.type == Bits64) ? "\tcqto\n" : "\tcltd\n");
+    else string_push(fnbuf, "\txor %rdx, %rdx\n");
     string_push_fmt(fnbuf, "\t%s%c ", (is_signed) ? "idiv" : "div", sizes[statement.type]);
-    build_value(types[1], vals[1], true, fnbuf);
+    if (types[1] == Number) string_push(fnbuf, reg_as_size("%rsi", statement.type));
+    else build_value(types[1], vals[1], true, fnbuf);
     string_push(fnbuf, "\n");
-    string_push_fmt(fnbuf, "\tmov %%%s, %s\n", (get_remainder) ? reg_as_size("%rdx", statement.type) : rax_versions[statement.type], label_loc);
+    string_push_fmt(fnbuf, "\tmov %s, %s\n", reg_as_size((get_remainder) ? "%rdx" : "%rax", statement.type), label_loc);
 }
 
 static void div_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
@@ -233,18 +200,17 @@ static void ret_build(uint64_t vals[2], ValType types[2], Statement statement, S
     } else {
         if (regalloc.current_fn->ret_is_struct) {
             if (types[0] != Label) {
-                printf("Tried to return a non-struct value from a function meant to return a struct.\n");
-                exit(1);
+                compile_error("Tried to return a non-struct value from a function meant to return a struct.\n");
             }
-            AggregateType *aggtype = find_aggtype(regalloc.current_fn->return_struct, aggregate_types, num_aggregate_types);
+            AggregateType *aggtype = find_aggtype(regalloc.current_fn->return_struct);
             if (aggtype->size_bytes > 8 && aggtype->size_bytes <= 16) {
-                char *label = label_to_reg_noresize(0, (char*) vals[0], false);
+                char *label = label_to_reg_noresize(0, vals[0], false);
                 string_push_fmt(fnbuf, "\tmov %s, %%rdi\n", label);
                 string_push(fnbuf, "\tmov (%rdi), %rax\n"); // save lower 8 bytes
                 string_push(fnbuf, "\tmov 8(%rdi), %rdx\n"); // save higher 8 bytes
                 goto end_save;
             } else if (aggtype->size_bytes <= 8) {
-                char *label = label_to_reg_noresize(0, (char*) vals[0], false);
+                char *label = label_to_reg_noresize(0, vals[0], false);
                 string_push_fmt(fnbuf, "\tmov %s, %%rdi\n", label);
                 string_push(fnbuf, "\tmov (%rdi), %rax\n"); // save lower 8 bytes
                 goto end_save;
@@ -255,10 +221,10 @@ static void ret_build(uint64_t vals[2], ValType types[2], Statement statement, S
         string_push(fnbuf, ", %rax\n");
     }
 end_save:
-    if (regalloc.current_fn->is_variadic)
-        string_push_fmt(fnbuf, "\tmov %rbp, %rsp\n\tpop %rbp\n\tadd $%zu, %rsp\n\tret\n", sizeof(arg_regs) / sizeof(arg_regs[0]) * 8);
-    else
-        string_push_fmt(fnbuf, "\tmov %rbp, %rsp\n\tpop %rbp\n\tret\n");
+    /* The epilogue is at the end of the function, since which registers have to be restored isn't
+     * known until then. The last statement can just run on into it. */
+    if (regalloc.statement_idx != regalloc.current_fn->num_statements)
+        string_push(fnbuf, "\tjmp 9f\n");
 }
 
 static void call_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
@@ -271,7 +237,7 @@ static void call_build(uint64_t vals[2], ValType types[2], Statement statement,
         char *label_loc = NULL;
         if (((FunctionArgList*) vals[1])->arg_types[arg] == Label &&
                 ((FunctionArgList*) vals[1])->args_are_structs[arg]) {
-            AggregateType *aggtype = find_aggtype(((FunctionArgList*) vals[1])->arg_struct_types[arg], aggregate_types, num_aggregate_types);
+            AggregateType *aggtype = find_aggtype(((FunctionArgList*) vals[1])->arg_struct_types[arg]);
             if (aggtype->size_bytes > 16) {
                 // Make sure it's 64 bit then just continue and let it be passed as a pointer
                 ((FunctionArgList*) vals[1])->arg_sizes[arg] = Bits64;
@@ -292,7 +258,7 @@ static void call_build(uint64_t vals[2], ValType types[2], Statement statement,
                 continue;
             }
         }
-        if (((FunctionArgList*) vals[1])->arg_types[arg] != Number) {
+        if (((FunctionArgList*) vals[1])->arg_types[arg] == Label) {
             label_loc = label_to_reg_noresize(0, ((FunctionArgList*) vals[1])->args[arg], true);
             if (label_loc && arg < 6  && !strcmp(label_loc, reg_as_size(*argregs_at, get_reg_size(label_loc, ((FunctionArgList*) vals[1])->args[arg])))) {
                 argregs_at++;
@@ -301,20 +267,19 @@ static void call_build(uint64_t vals[2], ValType types[2], Statement statement,
         }
         if (arg < 6) {
             if (((FunctionArgList*) vals[1])->arg_types[arg] == Label && (label_loc && label_loc[0] == '%')) {
-                if (((FunctionArgList*) vals[1])->arg_types[arg] != Label)
-                    label_to_reg_noresize(0, ((FunctionArgList*) vals[1])->args[arg], true);
-                string_push_fmt(fnbuf, "\t%s%c ", (((FunctionArgList*) vals[1])->arg_types[arg] == Str && is_position_independent) ? "lea" : "mov", sizes[((FunctionArgList*) vals[1])->arg_sizes[arg]]);
-                build_value(((FunctionArgList*) vals[1])->arg_types[arg], (uint64_t) ((FunctionArgList*) vals[1])->args[arg], true, fnbuf);
-                string_push_fmt(fnbuf, ", %s // arg = %zu\n", reg_as_size(*argregs_at, ((FunctionArgList*) vals[1])->arg_sizes[arg]), arg);
+                // the value's register can be a different size to the argument, so use the part of it that's the right size
+                Type arg_size = ((FunctionArgList*) vals[1])->arg_sizes[arg];
+                label_to_reg_noresize(0, ((FunctionArgList*) vals[1])->args[arg], true);
+                string_push_fmt(fnbuf, "\tmov%c %s, %s // arg = %zu\n", sizes[arg_size], reg_as_size(label_loc, arg_size), reg_as_size(*argregs_at, arg_size), arg);
             } else {
                 string_push_fmt(fnbuf, "\t%s%c ", (((FunctionArgList*) vals[1])->arg_types[arg] == Str && is_position_independent) ? "lea" : "mov", sizes[((FunctionArgList*) vals[1])->arg_sizes[arg]]);
-                build_value(((FunctionArgList*) vals[1])->arg_types[arg], (uint64_t) ((FunctionArgList*) vals[1])->args[arg], true, fnbuf);
+                build_value(((FunctionArgList*) vals[1])->arg_types[arg], ((FunctionArgList*) vals[1])->args[arg], true, fnbuf);
                 string_push_fmt(fnbuf, ", %s // arg = %zu\n", reg_as_size(*argregs_at, ((FunctionArgList*) vals[1])->arg_sizes[arg]), arg);
             }
         } else {
             pop_bytes += 8;
             string_push_fmt(fnbuf, "\tpush ");
-            build_value(((FunctionArgList*) vals[1])->arg_types[arg], (uint64_t) ((FunctionArgList*) vals[1])->args[arg], true, fnbuf);
+            build_value(((FunctionArgList*) vals[1])->arg_types[arg], ((FunctionArgList*) vals[1])->args[arg], true, fnbuf);
             string_push_fmt(fnbuf, " // arg = %zu\n", arg);
         }
         argregs_at++;
@@ -337,16 +302,64 @@ static void call_build(uint64_t vals[2], ValType types[2], Statement statement,
 
 static void jz_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     if (types[0] != Label) {
-        printf("First value of JZ instruction must be a label.\n");
-        exit(1);
+        compile_error("First value of JZ instruction must be a label.\n");
     }
     string_push_fmt(fnbuf, "\tcmp $0, %s\n"
-                           "\tje ", label_to_reg(0, (char*) vals[0], false));
+                           "\tje ", label_to_reg(0, vals[0], false));
     build_value(types[1], vals[1], false, fnbuf);
     string_push_fmt(fnbuf, "\n");
 }
 
+// Moves a value into rax (or the part of it that's `type` wide)
+static void load_rax(uint64_t val, ValType type, Type size, String *fnbuf) {
+    string_push_fmt(fnbuf, "\t%s%c ", (type == Str && is_position_independent) ? "lea" : "mov", sizes[size]);
+    build_value(type, val, true, fnbuf);
+    string_push_fmt(fnbuf, ", %%%s\n", rax_versions[size]);
+}
+
+/* Finds the phis in block `succ` which take a value from block `pred`, storing them (as indexes into
+ * regalloc.phis) in moves_buf, which needs room for every phi taking a value from `pred`. Returns
+ * how many there are. */
+static size_t find_phi_moves(BlockId pred, BlockId succ, size_t *moves_buf) {
+    Function *fn = regalloc.current_fn;
+    size_t num_moves = 0;
+    if (!pred || pred >= fn->num_blocks || succ >= fn->num_blocks) return 0;
+    for (size_t p = regalloc.phis_start[pred]; p < regalloc.phis_start[pred + 1]; p++) {
+        size_t block = cfg_block_of_statement(fn, regalloc.phis[p]);
+        if (fn->bblocks[block].label == succ) moves_buf[num_moves++] = p;
+    }
+    return num_moves;
+}
+
+static size_t num_phis_from(BlockId pred) {
+    if (!pred || pred >= regalloc.current_fn->num_blocks) return 0;
+    return regalloc.phis_start[pred + 1] - regalloc.phis_start[pred];
+}
+
+/* Gives the phis in block `succ` the values they take from block `pred`, for when control goes from
+ * one to the other. Each phi gets a place the first time it's given a value. When there's more than
+ * one, every value is read before any are written (through the stack), in case a phi takes the value
+ * of another phi in the same block. */
+static void phi_moves_build(BlockId pred, BlockId succ, String *fnbuf) {
+    size_t *moves = (size_t*) aalloc(sizeof(size_t) * (num_phis_from(pred) + 1));
+    size_t num_moves = find_phi_moves(pred, succ, moves);
+    for (size_t m = 0; m < num_moves; m++) {
+        Statement phi = regalloc.current_fn->statements[regalloc.phis[moves[m]]];
+        PhiVal *from = (PhiVal*) phi.vals[((PhiVal*) phi.vals[0])->blklbl != pred];
+        load_rax(from->val, from->type, phi.type, fnbuf);
+        if (num_moves > 1) string_push(fnbuf, "\tpush %rax\n");
+    }
+    for (size_t m = num_moves; m > 0; m--) {
+        Statement phi = regalloc.current_fn->statements[regalloc.phis[moves[m - 1]]];
+        char *label_loc = label_to_reg(0, phi.label, true);
+        if (!label_loc) label_loc = reg_alloc(phi.label, phi.type);
+        if (num_moves > 1) string_push(fnbuf, "\tpop %rax\n");
+        string_push_fmt(fnbuf, "\tmov%c %%%s, %s\n", sizes[phi.type], rax_versions[phi.type], label_loc);
+    }
+}
+
 static void jmp_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
+    if (types[0] == BlkLbl) phi_moves_build(regalloc.current_block, vals[0], fnbuf);
     string_push_fmt(fnbuf, "\tjmp ");
     build_value(types[0], vals[0], false, fnbuf);
     string_push_fmt(fnbuf, "\n");
@@ -354,34 +367,54 @@ static void jmp_build(uint64_t vals[2], ValType types[2], Statement statement, S
 
 static void jnz_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     if (types[1] == Empty || types[2] == Empty) {
-        printf("Expected two labels in JNZ instruction.\n");
-        exit(1);
+        compile_error("Expected two labels in JNZ instruction.\n");
     }
     if (types[0] == Number) {
         string_push_fmt(fnbuf, "\tmov ");
         build_value(types[0], vals[0], false, fnbuf);
         string_push_fmt(fnbuf, ", %%rdi\n\tcmpq $0, %%rdi");
     } else if (types[0] == Label) {
-        char *loc = label_to_reg_noresize(0, (char*) vals[0], false);
-        Type sz = get_reg_size(loc, (char*) vals[0]);
+        char *loc = label_to_reg_noresize(0, vals[0], false);
+        Type sz = get_reg_size(loc, vals[0]);
         string_push_fmt(fnbuf, "\tcmp%c $0, %s\n", sizes[sz], reg_as_size(loc, sz));
     } else {
-        printf("First value of JNZ must be either a label or a number.\n");
-        exit(1);
+        compile_error("First value of JNZ must be either a label or a number.\n");
     }
-    string_push_fmt(fnbuf, "\n\tjne ");
-    build_value(types[1], vals[1], false, fnbuf);
-    string_push_fmt(fnbuf, "\n\tjmp ");
+    size_t *moves = (size_t*) aalloc(sizeof(size_t) * (num_phis_from(regalloc.current_block) + 1));
+    bool has_phi_moves = types[1] == BlkLbl && types[2] == BlkLbl &&
+                         (find_phi_moves(regalloc.current_block, vals[1], moves) ||
+                          find_phi_moves(regalloc.current_block, vals[2], moves));
+    if (!has_phi_moves) {
+        string_push_fmt(fnbuf, "\n\tjne ");
+        build_value(types[1], vals[1], false, fnbuf);
+        string_push_fmt(fnbuf, "\n\tjmp ");
+        build_value(types[2], vals[2], false, fnbuf);
+        string_push_fmt(fnbuf, "\n");
+        return;
+    }
+    /* each edge needs its own phi moves, so the taken edge gets a local label of its own to do them
+     * at, which can't clash with any block's label */
+    string_push(fnbuf, "\n\tjne 1f\n");
+    phi_moves_build(regalloc.current_block, vals[2], fnbuf);
+    string_push_fmt(fnbuf, "\tjmp ");
     build_value(types[2], vals[2], false, fnbuf);
+    string_push(fnbuf, "\n1:\n");
+    phi_moves_build(regalloc.current_block, vals[1], fnbuf);
+    string_push_fmt(fnbuf, "\tjmp ");
+    build_value(types[1], vals[1], false, fnbuf);
     string_push_fmt(fnbuf, "\n");
 }
 
 static void neg_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     char *label_loc = reg_alloc(statement.label, statement.type);
-    string_push(fnbuf, "\tmov ");
+    // mov can't take two memory operands, so a label stored on the stack is negated in rax
+    char *neg_loc = (label_loc[0] == '%') ? label_loc : reg_as_size("%rax", statement.type);
+    string_push_fmt(fnbuf, "\tmov%c ", sizes[statement.type]);
     build_value(types[0], vals[0], true, fnbuf);
     string_push_fmt(fnbuf, ", %s\n"
-                           "\tneg%c %s\n", sizes[statement.type], label_loc, label_loc);
+                           "\tneg%c %s\n", neg_loc, sizes[statement.type], neg_loc);
+    if (neg_loc != label_loc)
+        string_push_fmt(fnbuf, "\tmov%c %s, %s\n", sizes[statement.type], neg_loc, label_loc);
 }
 
 static void shift_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf, char direction) {
@@ -410,13 +443,16 @@ static void shr_build(uint64_t vals[2], ValType types[2], Statement statement, S
 }
 
 static void store_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
-    char *reg = label_to_reg(0, (char*) vals[1], false);
+    if (types[1] != Label) {
+        compile_error("Address to store to must be a label.\n");
+    }
+    char *reg = label_to_reg(0, vals[1], false);
     if (reg[0] == '%') {
         string_push_fmt(fnbuf, "\tmov%c ", sizes[statement.type]);
         build_value(types[0], vals[0], true, fnbuf);
         string_push_fmt(fnbuf, ", %s\n", reg_as_size("%rdi", statement.type));
         string_push_fmt(fnbuf, "\tmov%c %s", sizes[statement.type], reg_as_size("%rdi", statement.type));
-        string_push_fmt(fnbuf, ", (%s) // addr of %s\n", reg, (char*) vals[1]);
+        string_push_fmt(fnbuf, ", (%s) // addr of %s\n", reg, regalloc.current_fn->value_names[vals[1]]);
     } else {
         string_push_fmt(fnbuf, "\tmovq %s, %%rdi\n", reg);
         string_push_fmt(fnbuf, "\tmov%c ", sizes[statement.type]);
@@ -426,20 +462,34 @@ static void store_build(uint64_t vals[2], ValType types[2], Statement statement,
     }
 }
 
+/* Moves `src`, a register or memory operand holding a value of type `from`, into all of the 64 bit
+ * register `dst`, sign or zero extending it. */
+static void extend_into(String *fnbuf, char *src, Type from, bool is_signed, char *dst) {
+    if (from == Bits64)
+        string_push_fmt(fnbuf, "\tmovq %s, %s\n", src, dst);
+    else if (from == Bits32 && !is_signed) // writing the lower half of a register clears the upper half
+        string_push_fmt(fnbuf, "\tmovl %s, %s\n", src, reg_as_size(dst, Bits32));
+    else
+        string_push_fmt(fnbuf, "\tmov%c%cq %s, %s\n", (is_signed) ? 's' : 'z', sizes[from], src, dst);
+}
+
 static void load_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
+    if (types[0] != Label) {
+        compile_error("Address to load from must be a label.\n");
+    }
     char *label_loc = reg_alloc(statement.label, statement.type);
-    char *addr = label_to_reg(0, (char*) vals[0], false);
-    bool use_brackets = addr[0] == '%';
-    if (use_brackets) {
-        // is a register that stores the address
-        string_push_fmt(fnbuf, "\tmovq (%s), %%rdi\n", addr);
-        string_push_fmt(fnbuf, "\tmov%c %s, %s\n", sizes[statement.type], reg_as_size("%rdi", statement.type), label_loc);
-    } else {
+    char *addr = label_to_reg(0, vals[0], false);
+    // only arg_type's width is read from memory, and then it's extended to the statement's type
+    Type from = (statement.arg_type == None) ? statement.type : statement.arg_type;
+    if (addr[0] != '%') {
         // address is on the stack
         string_push_fmt(fnbuf, "\tmovq %s, %%rdi\n", addr);
-        string_push_fmt(fnbuf, "\tmovq (%rdi), %%rdi\n");
-        string_push_fmt(fnbuf, "\tmov%c %s, %s\n", sizes[statement.type], reg_as_size("%rdi", statement.type), label_loc);
+        addr = "%rdi";
     }
+    char mem[16];
+    snprintf(mem, sizeof(mem), "(%s)", addr);
+    extend_into(fnbuf, mem, from, statement.is_signed, "%rdi");
+    string_push_fmt(fnbuf, "\tmov%c %s, %s\n", sizes[statement.type], reg_as_size("%rdi", statement.type), label_loc);
 }
 
 static void blit_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
@@ -457,8 +507,7 @@ static void blit_build(uint64_t vals[2], ValType types[2], Statement statement,
 
 static void alloc_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     if (types[0] != Number) {
-        printf("ALLOC's argument must be a number literal.\n");
-        exit(1);
+        compile_error("ALLOC's argument must be a number literal.\n");
     }
     char *label_loc = reg_alloc(statement.label, statement.type);
     regalloc.bytes_rip_pad += vals[0];
@@ -469,11 +518,18 @@ static void alloc_build(uint64_t vals[2], ValType types[2], Statement statement,
 
 static void comparison_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf, char *instr) {
     char *label_loc = reg_alloc_noresize(statement.label, statement.type);
+    // the operands can be wider than the result (`=w ceql`), and are compared at their own width
+    Type width = (statement.arg_type == None) ? statement.type : statement.arg_type;
+    // cmp can't take an immediate as the value being compared, so a number has to go in a register first
+    if (types[0] == Number) {
+        string_push_fmt(fnbuf, "\tmov $%llu, %s\n", vals[0], reg_as_size("%rsi", width));
+    }
     string_push_fmt(fnbuf, "\tmov ");
     build_value(types[1], vals[1], true, fnbuf);
     string_push_fmt(fnbuf, ", %s\n"
-                           "\tcmp%c %s, ", reg_as_size("%rdi", statement.type), sizes[statement.type], reg_as_size("%rdi", statement.type));
-    build_value(types[0], vals[0], true, fnbuf);
+                           "\tcmp%c %s, ", reg_as_size("%rdi", width), sizes[width], reg_as_size("%rdi", width));
+    if (types[0] == Number) string_push(fnbuf, reg_as_size("%rsi", width));
+    else build_value(types[0], vals[0], true, fnbuf);
     string_push_fmt(fnbuf, "\n");
     if (label_loc[0] == '%') { // label in reg
         char *sized_label = reg_as_size(label_loc, Bits8);
@@ -527,43 +583,26 @@ static void ult_build(uint64_t vals[2], ValType types[2], Statement statement, S
 }
 
 static void blklbl_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
-    if (types[0] != Str) {
-        printf("Expected label to have value RawStr, got something else instead.\n");
-        exit(1);
-    }
-    string_push_fmt(fnbuf, ".%s_%s:\n", regalloc.current_fn->name, (char*) vals[0]);
-    /* Now it needs to do Phi stuff:
-     *  - Go through the rest of the statements in this function and find a Phi instruction with this label
-     *  - Once it finds one:
-     *      - If this block label is the first one specified in the phi instruction, allocate the register
-     *      - Set the label's value to the value it should be for this branch, as specified by phi
-     */
-    for (size_t s = 0; s < regalloc.current_fn->num_statements; s++) {
-        Statement phi = regalloc.current_fn->statements[s];
-        if (phi.instruction != PHI) continue; 
-        bool is_first = !strcmp(((PhiVal*) phi.vals[0])->blklbl_name, (char*) vals[0]);
-        bool is_second = !strcmp(((PhiVal*) phi.vals[1])->blklbl_name, (char*) vals[0]);
-        if (is_first || is_second) {
-            char *label_loc;
-            string_push_fmt(fnbuf, "\tmov%c ", sizes[phi.type]);
-            if (is_first) {
-                label_loc = reg_alloc(phi.label, phi.type);
-                build_value(((PhiVal*) phi.vals[0])->type, ((PhiVal*) phi.vals[0])->val, true, fnbuf);
-            } else {
-                label_loc = label_to_reg(0, phi.label, false);
-                build_value(((PhiVal*) phi.vals[1])->type, ((PhiVal*) phi.vals[1])->val, true, fnbuf);
-            }
-            string_push_fmt(fnbuf, ", %s\n", label_loc);
-        }
+    if (types[0] != BlkLbl) {
+        compile_error("Expected label to have value BlkLbl, got something else instead.\n");
     }
+    // if the block before this one runs off the end into it, that's where its phi moves go
+    size_t s = regalloc.statement_idx - 1;
+    if (s && !is_terminator(regalloc.current_fn->statements[s - 1].instruction))
+        phi_moves_build(regalloc.current_block, vals[0], fnbuf);
+    regalloc.current_block = vals[0];
+    string_push_fmt(fnbuf, ".%s_%s:\n", regalloc.current_fn->name, regalloc.current_fn->block_names[vals[0]]);
 }
 
 // second val dictates whether or not it's a signed operation (signed if true).
 static void ext_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
-    char *label_loc = reg_alloc_noresize(statement.label, statement.type);
-    string_push_fmt(fnbuf, "\t%s ", (types[0] == Label) ? "movsx" : "mov");
-    build_value(types[0], vals[0], true, fnbuf);
-    string_push_fmt(fnbuf, ", %s\n", reg_as_size("%rdx", statement.type));
+    char *label_loc = reg_alloc(statement.label, statement.type);
+    Type from = (statement.arg_type == None) ? statement.type : statement.arg_type;
+    // all 64 bits of the operand go in rdx first, so that it can be extended from any width of it
+    string_push(fnbuf, "\tmovq ");
+    build_value_noresize(types[0], vals[0], true, fnbuf);
+    string_push(fnbuf, ", %rdx\n");
+    extend_into(fnbuf, reg_as_size("%rdx", from), from, statement.is_signed, "%rdx");
     string_push_fmt(fnbuf, "\tmov%c %s, %s\n", sizes[statement.type], reg_as_size("%rdx", statement.type), label_loc);
 }
 
@@ -573,16 +612,15 @@ static void hlt_build(uint64_t vals[2], ValType types[2], Statement statement, S
 
 static void phi_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     /* Phi doesn't actually do anything in the instruction itself in generated assembly.
-     * All of the generated assembly to do with the phi instruction is done within block label
-     * compilation. */
+     * All of the generated assembly to do with the phi instruction is done at the end of each block
+     * it takes a value from, by jmp, jnz and block label compilation. */
 }
 
 static void vastart_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     if (types[0] != Label) {
-        printf("vastart expects argument to be a label, got something else instead.\n");
-        exit(1);
+        compile_error("vastart expects argument to be a label, got something else instead.\n");
     }
-    char *addr = label_to_reg(0, (char*) vals[0], false);
+    char *addr = label_to_reg(0, vals[0], false);
     string_push_fmt(fnbuf, "\tmovw $0, (%s)\n", addr); // Set current vararg index (off = 0)
     string_push_fmt(fnbuf, "\tmovq %%rbp, %%rax\n"
                            "\taddq $8, %%rax\n"
@@ -591,10 +629,9 @@ static void vastart_build(uint64_t vals[2], ValType types[2], Statement statemen
 
 static void vaarg_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     if (types[0] != Label) {
-        printf("vastart expects argument to be a label, got something else instead.\n");
-        exit(1);
+        compile_error("vastart expects argument to be a label, got something else instead.\n");
     }
-    char *addr = label_to_reg(0, (char*) vals[0], false);
+    char *addr = label_to_reg(0, vals[0], false);
     // get current index
     string_push_fmt(fnbuf, "\txor %%rax, %%rax\n");
     if (addr[0] == '%')
@@ -617,8 +654,7 @@ static void vaarg_build(uint64_t vals[2], ValType types[2], Statement statement,
 
 static void loc_build(uint64_t vals[2], ValType types[2], Statement statement, String *fnbuf) {
     if (types[0] != Number || types[1] != Number || types[2] != Number) {
-        printf("All arguments of .loc instruction must be an integer literal.\n");
-        exit(1);
+        compile_error("All arguments of .loc instruction must be an integer literal.\n");
     }
     string_push_fmt(fnbuf, "\t.loc %zu %zu %zu\n", vals[0], vals[1], vals[2]);
 }
@@ -662,7 +698,7 @@ static void asm_build(uint64_t vals[2], ValType types[2], Statement statement, S
             size_t stack_offset = vec_size(info->inputs_vec) + vec_size(info->clobbers_vec);
             string_push_fmt(fnbuf, "%s", label_to_reg(stack_offset, (*info->inputs_vec)[input].label, false));
         } else {
-            build_value_noresize((*info->inputs_vec)[input].type, (uint64_t) (*info->inputs_vec)[input].label, true, fnbuf);
+            build_value_noresize((*info->inputs_vec)[input].type, (*info->inputs_vec)[input].label, true, fnbuf);
         }
         string_push_fmt(fnbuf, ", %s\n", (*info->inputs_vec)[input].reg);
     }
@@ -1,18 +1,21 @@
 /* Register allocator for UYB project.
  * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
 #include <target/x86_64/register.h>
+#include <error.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <vector.h>
 #include <arena.h>
+#include <intern.h>
+#include <optimisation.h>
 
 /* all the scratch registers:
  *  {reg_name, num_refs, reg_size} 
  * num_refs is the number of references to the label corresponding to that register
  * *after* the current instruction. */
-intptr_t reg_alloc_tab[5][3] = {
+_Thread_local intptr_t reg_alloc_tab[5][3] = {
     {(uintptr_t) "%rbx", 0, 0},
     {(uintptr_t) "%r12", 0, 0},
     {(uintptr_t) "%r13", 0, 0},
@@ -21,7 +24,7 @@ intptr_t reg_alloc_tab[5][3] = {
 };
 
 // Left side is register, middle is assigned label, right is number of instances of that label
-char *label_reg_tab[5][3] = {
+_Thread_local char *label_reg_tab[5][3] = {
     {"%rbx", 0, 0},
     {"%r12", 0, 0},
     {"%r13", 0, 0},
@@ -29,23 +32,17 @@ char *label_reg_tab[5][3] = {
     {"%r15", 0, 0},
 };
 
-RegAlloc regalloc;
-
-bool check_label_in_args(char *label) {
-    for (size_t i = 0; i < regalloc.current_fn->num_args; i++) {
-        if (!strcmp(label, regalloc.current_fn->args[i].label)) return true;
-    }
-    return false;
-}
+_Thread_local RegAlloc regalloc;
 
 char *reg_as_size_inner(char *reg, Type size) {
     reg++;
     if (reg[0] == 'r' && /* is digit: */ (reg[1] >= '0' && reg[1] <= '9')) {
-        String *str = string_from(reg);
-             if (size == Bits8 ) string_push(str, "b");
-        else if (size == Bits16) string_push(str, "w");
-        else if (size == Bits32) string_push(str, "d");
-        return str->data;
+        char *buf = aalloc(strlen(reg) + 2);
+        strcpy(buf, reg);
+             if (size == Bits8 ) strcat(buf, "b");
+        else if (size == Bits16) strcat(buf, "w");
+        else if (size == Bits32) strcat(buf, "d");
+        return buf;
     }
     if (size == Bits8) {
              if (!strcmp(reg, "rsi")) return "sil";
@@ -87,66 +84,214 @@ char *reg_as_size(char *reg, Type size) {
     return buf;
 }
 
+/* Unlike reg_init_fn(), this also forgets which labels were left in registers by earlier functions,
+ * so that the next file compiled on this thread doesn't depend on the last one. */
+void reg_reset() {
+    for (size_t i = 0; i < sizeof(reg_alloc_tab) / sizeof(reg_alloc_tab[0]); i++) {
+        reg_alloc_tab[i][1] = 0;
+        reg_alloc_tab[i][2] = 0;
+        label_reg_tab[i][1] = 0;
+        label_reg_tab[i][2] = 0;
+    }
+    memset(&regalloc, 0, sizeof(regalloc));
+}
+
+/* reg_init_fn() leaves which label is in each register (and its size) as the last function left it,
+ * which can change how the next function is compiled. These write and read that state, so that it
+ * can be part of what a cached function's output depends on, and put back as it would have been
+ * left after using the cached output instead of compiling the function. */
+void reg_state_write(FILE *f) {
+    for (size_t i = 0; i < sizeof(label_reg_tab) / sizeof(label_reg_tab[0]); i++) {
+        fprintf(f, "%s %zu %zu\n", (label_reg_tab[i][1]) ? label_reg_tab[i][1] : "-",
+                (size_t) label_reg_tab[i][2], (size_t) reg_alloc_tab[i][2]);
+    }
+}
+
+// Returns the rest of `buf` after the state, or NULL if it doesn't start with a valid state.
+char *reg_state_read(char *buf) {
+    for (size_t i = 0; i < sizeof(label_reg_tab) / sizeof(label_reg_tab[0]); i++) {
+        char *end = strchr(buf, ' ');
+        if (!end) return NULL;
+        char *label = (end - buf == 1 && buf[0] == '-') ? NULL : intern(buf, end - buf);
+        size_t count, size;
+        int len;
+        // whitespace in the format would also skip the start of whatever comes after the state
+        if (sscanf(end, " %zu %zu%n", &count, &size, &len) != 2 || end[len] != '\n') return NULL;
+        label_reg_tab[i][1] = label;
+        label_reg_tab[i][2] = (char*) count;
+        reg_alloc_tab[i][2] = size;
+        buf = end + len + 1;
+    }
+    return buf;
+}
+
+/* Adds `delta` to the number of references there are to each value in `statement`, as many as the
+ * code generated for it looks the value up. Call arguments are looked up twice. */
+static void count_references(Statement *statement, int delta) {
+    if (statement->val_types[1] == FunctionArgs) {
+        FunctionArgList *args = (FunctionArgList*) statement->vals[1];
+        for (size_t arg = 0; arg < args->num_args; arg++) {
+            if (args->arg_types[arg] == Label) regalloc.refs_left[args->args[arg]] += 2 * delta;
+        }
+    }
+    if (statement->instruction == ASM) {
+        InlineAsm *info = (InlineAsm*) statement->vals[0];
+        for (size_t in = 0; in < vec_size(info->inputs_vec); in++) {
+            if ((*info->inputs_vec)[in].type == Label) regalloc.refs_left[(*info->inputs_vec)[in].label] += delta;
+        }
+    }
+    // each operand is looked up separately, even if they're the same value
+    for (size_t v = 0; v < 3; v++) {
+        if (statement->val_types[v] == Label) regalloc.refs_left[statement->vals[v]] += delta;
+    }
+}
+
+/* Counts the references to each value, and finds the values that can't be given up after their
+ * last reference: those still live at the end of a block that finishes after it (so they're needed
+ * again when a loop goes around), and anything to do with a phi, since phis are compiled at the
+ * ends of the blocks they come from rather than where they are. */
+static void find_references(Function *fn) {
+    regalloc.refs_left = (size_t*) aalloc(sizeof(size_t) * fn->num_values);
+    memset(regalloc.refs_left, 0, sizeof(size_t) * fn->num_values);
+    regalloc.keep_after_refs = (bool*) aalloc(sizeof(bool) * fn->num_values);
+    memset(regalloc.keep_after_refs, 0, sizeof(bool) * fn->num_values);
+    size_t *last_ref = (size_t*) calloc(fn->num_values, sizeof(size_t));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        Statement *statement = &fn->statements[s];
+        count_references(statement, 1);
+        if (statement->val_types[1] == FunctionArgs) {
+            FunctionArgList *args = (FunctionArgList*) statement->vals[1];
+            for (size_t arg = 0; arg < args->num_args; arg++) {
+                if (args->arg_types[arg] == Label) last_ref[args->args[arg]] = s;
+            }
+        }
+        if (statement->instruction == ASM) {
+            InlineAsm *info = (InlineAsm*) statement->vals[0];
+            for (size_t in = 0; in < vec_size(info->inputs_vec); in++) {
+                if ((*info->inputs_vec)[in].type == Label) last_ref[(*info->inputs_vec)[in].label] = s;
+            }
+        }
+        if (statement->instruction == PHI) {
+            regalloc.keep_after_refs[statement->label] = true;
+            for (size_t i = 0; i < 2; i++) {
+                PhiVal *phi_val = (PhiVal*) statement->vals[i];
+                if (phi_val->type == Label) regalloc.keep_after_refs[phi_val->val] = true;
+            }
+        }
+        for (size_t v = 0; v < 3; v++) {
+            if (statement->val_types[v] == Label) last_ref[statement->vals[v]] = s;
+        }
+    }
+    Liveness live = liveness(fn);
+    for (size_t slice = 0; slice < live.num_slices; slice++) {
+        for (size_t j = live.slice_start[slice]; j < live.slice_start[slice + 1]; j++) {
+            uint64_t *live_out = &live.live_out[j * LIVE_SLICE_WORDS];
+            for (size_t w = 0; w < LIVE_SLICE_WORDS; w++) {
+                for (uint64_t bits = live_out[w]; bits; bits &= bits - 1) {
+                    ValueId value = live.values[slice * LIVE_SLICE_BITS + w * 64 + __builtin_ctzll(bits)];
+                    if (fn->bblocks[live.blocks[j]].end > last_ref[value]) regalloc.keep_after_refs[value] = true;
+                }
+            }
+        }
+    }
+    free(last_ref);
+}
+
+// Adds `phi` to the phis of each block it takes a value from, or just counts it if phis is NULL
+static void add_phi(Function *fn, size_t phi, size_t *next, size_t *phis) {
+    Statement *statement = &fn->statements[phi];
+    BlockId blocks[2] = {((PhiVal*) statement->vals[0])->blklbl, ((PhiVal*) statement->vals[1])->blklbl};
+    for (size_t i = 0; i < 2; i++) {
+        if (blocks[i] >= fn->num_blocks || (i && blocks[1] == blocks[0])) continue;
+        if (phis) phis[next[blocks[i]]] = phi;
+        next[blocks[i]]++;
+    }
+}
+
+/* Groups the phis by the blocks they take values from, since that's where they're compiled. Each
+ * block's phis stay in the order they're in the function. */
+static void find_phis(Function *fn) {
+    size_t *next = (size_t*) calloc(fn->num_blocks + 1, sizeof(size_t));
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (fn->statements[s].instruction == PHI) add_phi(fn, s, &next[1], NULL);
+    }
+    for (size_t b = 0; b < fn->num_blocks; b++) next[b + 1] += next[b];
+    size_t num_phis = next[fn->num_blocks];
+    regalloc.phis_start = (size_t*) aalloc(sizeof(size_t) * (fn->num_blocks + 1));
+    memcpy(regalloc.phis_start, next, sizeof(size_t) * (fn->num_blocks + 1));
+    regalloc.phis = (size_t*) aalloc(sizeof(size_t) * num_phis);
+    for (size_t s = 0; s < fn->num_statements; s++) {
+        if (fn->statements[s].instruction == PHI) add_phi(fn, s, next, regalloc.phis);
+    }
+    free(next);
+}
+
+// Moves on to the next statement, so the references in the one just compiled aren't counted any more
+void reg_next_statement() {
+    if (regalloc.statement_idx) count_references(&regalloc.current_fn->statements[regalloc.statement_idx - 1], -1);
+    regalloc.statement_idx++;
+}
+
 void reg_init_fn(Function func) {
     regalloc.bytes_rip_pad = 0;
-    for (size_t i = 0; i < sizeof(reg_alloc_tab) / sizeof(reg_alloc_tab[0]); i++)
+    // nothing from the last function is in a register any more, even if it was still referred to at its end
+    for (size_t i = 0; i < sizeof(reg_alloc_tab) / sizeof(reg_alloc_tab[0]); i++) {
         reg_alloc_tab[i][1] = 0;
+        label_reg_tab[i][1] = 0;
+    }
     regalloc.current_fn = (Function*) aalloc(sizeof(Function));
     *regalloc.current_fn = func;
-    regalloc.labels_as_offsets = vec_new(sizeof(size_t) * 3);
+    regalloc.stack_slots = (StackSlot*) aalloc(sizeof(StackSlot) * func.num_values);
+    memset(regalloc.stack_slots, 0, sizeof(StackSlot) * func.num_values);
+    find_references(regalloc.current_fn);
+    find_phis(regalloc.current_fn);
+    regalloc.is_arg = (bool*) aalloc(sizeof(bool) * func.num_values);
+    memset(regalloc.is_arg, 0, sizeof(bool) * func.num_values);
+    for (size_t a = 0; a < func.num_args; a++) regalloc.is_arg[func.args[a].label] = true;
     regalloc.used_regs_vec = vec_new(sizeof(char*));
     regalloc.statement_idx = 0;
+    regalloc.current_block = 0;
+}
+
+/* Records that `value` is kept at `offset` bytes below %rbp. If it's given more than one place on the
+ * stack, the first one is where it's looked for. */
+void reg_stack_slot(ValueId value, size_t offset, Type size) {
+    if (regalloc.stack_slots[value].offset) return;
+    regalloc.stack_slots[value] = (StackSlot) {.offset = offset, .size = size};
 }
 
-char *reg_alloc_noresize(char *label, Type reg_size) {
+char *reg_alloc_noresize(ValueId value, Type reg_size) {
+    char *label = regalloc.current_fn->value_names[value];
     for (size_t l = 0; l < sizeof(label_reg_tab) / sizeof(label_reg_tab[0]); l++) {
-        if (!label_reg_tab[l][1] || strcmp(label_reg_tab[l][1], label)) continue;
+        if (!label_reg_tab[l][1] || label_reg_tab[l][1] != label) continue;
         size_t new_label_sz = strlen(label) + 5;
         char *new_label = (char*) aalloc(new_label_sz);
         label_reg_tab[l][2]++;
         snprintf(new_label, new_label_sz, "%s.%zu", label, (size_t) label_reg_tab[l][2]);
-        label = new_label;
+        label = intern_cstr(new_label);
+        // nothing in the function refers to the new name, so it isn't the value any more
+        value = 0;
     }
     for (size_t i = 0; i < sizeof(reg_alloc_tab) / sizeof(reg_alloc_tab[0]); i++) {
         if (reg_alloc_tab[i][1]) continue;
-        for (size_t s = regalloc.statement_idx; s < regalloc.current_fn->num_statements; s++) {
-            if (regalloc.current_fn->statements[s].instruction == JMP || regalloc.current_fn->statements[s].instruction == JNZ) {
-                reg_alloc_tab[i][1] = -1;
-                break;
-            }
-            if (regalloc.current_fn->statements[s].val_types[1] == FunctionArgs) {
-                for (size_t arg = 0; arg < ((FunctionArgList*) regalloc.current_fn->statements[s].vals[1])->num_args; arg++) {
-                    if (((FunctionArgList*) regalloc.current_fn->statements[s].vals[1])->arg_types[arg] != Number &&
-                            strcmp(label, ((FunctionArgList*) regalloc.current_fn->statements[s].vals[1])->args[arg])) continue;
-                    reg_alloc_tab[i][1] += 2;
-                }
-            }
-            if (regalloc.current_fn->statements[s].instruction == ASM) {
-                InlineAsm *info = (InlineAsm*) regalloc.current_fn->statements[s].vals[0];
-                for (size_t in = 0; in < vec_size(info->inputs_vec); in++) {
-                    if (strcmp((*info->inputs_vec)[in].label, label)) continue;
-                    reg_alloc_tab[i][1]++;
-                }
-            }
-            if ((regalloc.current_fn->statements[s].val_types[0] == Label && !strcmp((char*) regalloc.current_fn->statements[s].vals[0], label)) || 
-                    (regalloc.current_fn->statements[s].val_types[1] == Label && !strcmp((char*) regalloc.current_fn->statements[s].vals[1], label)) ||
-                    (regalloc.current_fn->statements[s].val_types[2] == Label && !strcmp((char*) regalloc.current_fn->statements[s].vals[2], label))) {
-                reg_alloc_tab[i][1]++;
-            }
-        }
-        if (check_label_in_args(label) && reg_alloc_tab[i][1]) reg_alloc_tab[i][1]++;
-        label_reg_tab[i][1] = aalloc(strlen(label) + 1);
-        strcpy(label_reg_tab[i][1], label);
+        // the register is given back once every reference after this statement has been compiled
+        if (value && regalloc.keep_after_refs[value]) reg_alloc_tab[i][1] = -1;
+        else if (value) reg_alloc_tab[i][1] = regalloc.refs_left[value];
+        // (a negative count means it's never given back, so that's left alone)
+        if (regalloc.is_arg[value] && reg_alloc_tab[i][1] > 0) reg_alloc_tab[i][1]++;
+        label_reg_tab[i][1] = label;
         size_t used_sz = vec_size(regalloc.used_regs_vec);
         bool do_push = true;
         for (size_t y = 0; y < used_sz; y++) {
             if (strcmp((*regalloc.used_regs_vec)[y], (char*) reg_alloc_tab[i][0])) continue;
+            do_push = false;
+            break;
         }
-        if (reg_alloc_tab[i][1]) {
-            if (do_push)
-                vec_push(regalloc.used_regs_vec, (char*) reg_alloc_tab[i][0]);
+        // it's written to even if nothing uses the value, so it has to be saved either way
+        if (do_push)
+            vec_push(regalloc.used_regs_vec, (char*) reg_alloc_tab[i][0]);
+        if (reg_alloc_tab[i][1])
             regalloc.bytes_rip_pad += 8;
-        }
         reg_alloc_tab[i][2] = reg_size;
         return (char*) reg_alloc_tab[i][0];
     }
@@ -155,61 +300,50 @@ char *reg_alloc_noresize(char *label, Type reg_size) {
     size_t buf_sz = strlen("-(%rbp)") + 5;
     char *buf = (char*) aalloc(buf_sz + 1);
     snprintf(buf, buf_sz, fmt, regalloc.bytes_rip_pad);
-    size_t *new_vec_val = aalloc(sizeof(size_t) * 3);
-    new_vec_val[0] = (size_t) label;
-    new_vec_val[1] = regalloc.bytes_rip_pad;
-    new_vec_val[2] = reg_size;
-    vec_push(regalloc.labels_as_offsets, new_vec_val);
+    if (value) reg_stack_slot(value, regalloc.bytes_rip_pad, reg_size);
     return buf;
 }
 
-char *reg_alloc(char *label, Type reg_size) {
-    char *reg = reg_alloc_noresize(label, reg_size);
+char *reg_alloc(ValueId value, Type reg_size) {
+    char *reg = reg_alloc_noresize(value, reg_size);
     if (reg[0] == '%')
         return reg_as_size((char*) reg, reg_size);
     else
         return reg;
 }
 
-char *label_to_reg_noresize(size_t offset, char *label, bool allow_noexist) {
+char *label_to_reg_noresize(size_t offset, ValueId value, bool allow_noexist) {
+    char *label = regalloc.current_fn->value_names[value];
     for (size_t i = 0; i < sizeof(label_reg_tab) / sizeof(label_reg_tab[1]); i++) {
-        if (!label_reg_tab[i][1] || strcmp(label_reg_tab[i][1], label)) continue;
+        if (!label_reg_tab[i][1] || label_reg_tab[i][1] != label) continue;
         if (reg_alloc_tab[i][1])
             reg_alloc_tab[i][1]--;
         if (!reg_alloc_tab[i][1])
             label_reg_tab[i][1] = 0;
         return label_reg_tab[i][0];
     }
-    size_t label_offset_list_len = vec_size(regalloc.labels_as_offsets);
-    for (size_t l = 0; l < label_offset_list_len; l++) {
-        if (strcmp((char*) (*regalloc.labels_as_offsets)[l][0], label)) continue;
+    if (regalloc.stack_slots[value].offset) {
         char *fmt = "-%llu(%%rbp)";
         size_t buf_sz = strlen("-(%rbp)") + 5;
         char *buf = (char*) aalloc(buf_sz + 1);
-        snprintf(buf, buf_sz, fmt, (*regalloc.labels_as_offsets)[l][1] + offset);
+        snprintf(buf, buf_sz, fmt, regalloc.stack_slots[value].offset + offset);
         return buf;
     }
     if (allow_noexist) return NULL;
-    printf("Tried to use non-defined label: %s\n", label);
-    exit(1);
+    compile_error("Tried to use non-defined label: %s\n", label);
 }
 
-Type get_reg_size(char *reg, char *expected_label) {
+Type get_reg_size(char *reg, ValueId expected_label) {
     for (size_t i = 0; i < sizeof(reg_alloc_tab) / sizeof(reg_alloc_tab[0]); i++) {
         if (strcmp(reg, (char*) reg_alloc_tab[i][0])) continue;
         return reg_alloc_tab[i][2];
     }
-    size_t len = vec_size(regalloc.labels_as_offsets);
-    for (size_t i = 0; i < len; i++) {
-        if (strcmp(expected_label, (char*) (*regalloc.labels_as_offsets)[i][0])) continue;
-        return (Type) (*regalloc.labels_as_offsets)[i][2];
-    }
-    printf("Invalid register in get_reg_size: %s\n", reg);
-    exit(1);
+    if (regalloc.stack_slots[expected_label].offset) return regalloc.stack_slots[expected_label].size;
+    compile_error("Invalid register in get_reg_size: %s\n", reg);
 }
 
 // I think this is kinda slow
-char *label_to_reg(size_t offset, char *label, bool allow_noexist) {
+char *label_to_reg(size_t offset, ValueId label, bool allow_noexist) {
     char *reg = label_to_reg_noresize(0, label, allow_noexist);
     if (!reg && allow_noexist) return NULL;
     for (size_t i = 0; i < sizeof(reg_alloc_tab) / sizeof(reg_alloc_tab[0]); i++) {
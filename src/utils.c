@@ -1,4 +1,5 @@
 #include <utils.h>
+#include <error.h>
 #include <vector.h>
 #include <arena.h>
 #include <string.h>
@@ -11,30 +12,6 @@ char size_as_char(Type type) {
     else return 'l';
 }
 
-/* returns 1 or 0 depending on if it was found. if it was found it stores the result in val_buf unless
- * val_buf is null */
-int find_sizet_in_copyvals(CopyVal **copyvals, char *label, size_t *val_buf) {
-    for (size_t i = 0; i < vec_size(copyvals); i++) {
-        if (!strcmp((*copyvals)[i].label, label)) {
-            if (val_buf)
-                *val_buf = (*copyvals)[i].val;
-            return 1;
-        }
-    }
-    return 0;
-}
-
-int find_copyval(CopyVal **copyvals, char *label, CopyVal *val_buf) {
-    for (size_t i = 0; i < vec_size(copyvals); i++) {
-        if (!strcmp((*copyvals)[i].label, label)) {
-            if (val_buf)
-                *val_buf = (*copyvals)[i];
-            return 1;
-        }
-    }
-    return 0;
-}
-
 char *get_full_char_str(bool is_struct, Type type, char *type_struct) {
     char *rettype;
     if (is_struct) {
@@ -48,28 +25,30 @@ char *get_full_char_str(bool is_struct, Type type, char *type_struct) {
     return rettype;
 }
 
-// Returns a pointer to an aggregate type from an array of aggregate types
-AggregateType *find_aggtype(char *name, AggregateType *aggtypes, size_t num_aggtypes) {
-    for (size_t i = 0; i < num_aggtypes; i++) {
-        if (!strcmp(name, aggtypes[i].name)) return &aggtypes[i];
-    }
-    printf("Tried to use undefined aggregate type.\n");
-    exit(1);
+/* Moves the elements of a vector into the arena and frees the vector, so that they're released
+ * along with everything else allocated for the function being compiled. */
+void *vec_into_arena(void *vec_data) {
+    size_t bytes = vec_size(vec_data) * ((Vec*) ((uintptr_t) vec_data - (sizeof(Vec) - sizeof(void*))))->data_size;
+    void *ret = aalloc(bytes);
+    memcpy(ret, *((void**) vec_data), bytes);
+    vec_free(vec_data);
+    return ret;
 }
 
 /* Caller is expected to free return value.
- * Reads a full line of stdin. */
-char *read_full_stdin() {
+ * Reads all of `f` (which may be a stream such as stdin) into a growable buffer, storing the number
+ * of bytes read in len_buf. */
+char *read_full_file(FILE *f, size_t *len_buf) {
     size_t pos = 0, size = 1025, nread;
     char *buf0 = malloc(size);
     char *buf = buf0;
     for (;;) {
         if (buf == NULL) {
-            fprintf(stderr, "Not enough memory for %zu bytes in read_full_stdin()\n", size);
+            fprintf(stderr, "Not enough memory for %zu bytes in read_full_file()\n", size);
             free(buf0);
             return NULL;
         }
-        nread = fread(buf + pos, 1, size - pos - 1, stdin);
+        nread = fread(buf + pos, 1, size - pos - 1, f);
         if (nread == 0) break;
         pos += nread;
         if (size - pos < size / 2)
@@ -77,5 +56,6 @@ char *read_full_stdin() {
         buf = realloc(buf0 = buf, size);
     }
     buf[pos] = '\0';
+    *len_buf = pos;
     return buf;
 }
@@ -0,0 +1,74 @@
+/* Gives each temporary and block label in a function a dense ID, in the order they're first seen,
+ * so that the optimiser and targets can use them to index arrays instead of searching for names.
+ * Whoever builds a Function (the parser or the binary IR loader) calls values_begin() before it,
+ * value_id() and block_id() for every name in it, and values_end() once it's done, which stores
+ * the names for each ID in the Function.
+ * Finding the ID for a name uses the name's intern ID to index a table of slots, which is only
+ * cleared lazily: each slot remembers which function it was last set for, so starting a new
+ * function doesn't cost anything no matter how many names were interned before it.
+ * Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details. */
+#include <values.h>
+#include <intern.h>
+#include <vector.h>
+#include <utils.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t generation; // the function that `value` and `block` were given out for
+    ValueId value;
+    BlockId block;
+} NameSlot;
+
+static _Thread_local NameSlot *slots;
+static _Thread_local size_t num_slots;
+static _Thread_local uint32_t generation;
+static _Thread_local char* **value_names;
+static _Thread_local char* **block_names;
+
+void values_begin() {
+    generation++;
+    value_names = vec_new(sizeof(char*));
+    block_names = vec_new(sizeof(char*));
+    // ID 0 is never used
+    vec_push(value_names, (char*) NULL);
+    vec_push(block_names, (char*) NULL);
+}
+
+static NameSlot *name_slot(char *name) {
+    size_t id = intern_id(name);
+    if (id >= num_slots) {
+        size_t new_num = (id + 1) * 2;
+        slots = realloc(slots, sizeof(NameSlot) * new_num);
+        memset(&slots[num_slots], 0, sizeof(NameSlot) * (new_num - num_slots));
+        num_slots = new_num;
+    }
+    NameSlot *slot = &slots[id];
+    if (slot->generation != generation) *slot = (NameSlot) {.generation = generation};
+    return slot;
+}
+
+// `name` must be interned
+ValueId value_id(char *name) {
+    NameSlot *slot = name_slot(name);
+    if (!slot->value) {
+        slot->value = vec_size(value_names);
+        vec_push(value_names, name);
+    }
+    return slot->value;
+}
+
+BlockId block_id(char *name) {
+    NameSlot *slot = name_slot(name);
+    if (!slot->block) {
+        slot->block = vec_size(block_names);
+        vec_push(block_names, name);
+    }
+    return slot->block;
+}
+
+void values_end(Function *fn) {
+    fn->num_values = vec_size(value_names);
+    fn->value_names = vec_into_arena(value_names);
+    fn->num_blocks = vec_size(block_names);
+    fn->block_names = vec_into_arena(block_names);
+}
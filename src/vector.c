@@ -28,3 +28,9 @@ int vec_contains(void *vec_data, size_t val) {
     }
     return 0;
 }
+
+void vec_free(void *vec_data) {
+    Vec *vec = (Vec*) ((uint64_t) vec_data - (sizeof(Vec) - sizeof(void*)));
+    free(vec->data);
+    free(vec);
+}
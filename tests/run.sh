@@ -0,0 +1,15 @@
+#!/bin/sh
+# Compiles one of the test programs in /tests with UYB, builds and runs it, and checks that it prints
+# exactly what's in the .out file with the same name.
+# Usage: run.sh <uyb> <cc> <program.ssa> [uyb options...]
+# Copyright (C) 2025 Jake Steinburger (UnmappedStack) under MPL2.0, see /LICENSE for details.
+uyb=$1
+cc=$2
+program=$3
+shift 3
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+"$uyb" "$@" "$program" -o "$tmp/out.S" || exit 1
+"$cc" "$tmp/out.S" -o "$tmp/out" 2>/dev/null || { echo "Failed to assemble the output:"; cat "$tmp/out.S"; exit 1; }
+"$tmp/out" > "$tmp/out.txt"
+diff -u "${program%.ssa}.out" "$tmp/out.txt"